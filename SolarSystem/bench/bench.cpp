@@ -0,0 +1,1331 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../src/Simulation.h"
+#include "../src/BarnesHut.h"
+#include "../src/Bvh.h"
+#include "../src/Catalog.h"
+#include "../src/FMM.h"
+#include "../src/Kepler.h"
+#include "../src/Ephemeris.h"
+#include "../src/Collisions.h"
+#include "../src/Conjunction.h"
+#include "../src/Eclipses.h"
+#include "../src/Ensemble.h"
+#include "../src/Sgp4.h"
+#include "../src/Snapshot.h"
+#include "../src/Trajectory.h"
+using namespace std;
+
+// Simulation benchmarks. Usage: solarsim-bench <mode> [body counts...]
+
+typedef chrono::steady_clock BenchClock;
+
+double SecondsSince(BenchClock::time_point start) {
+    return chrono::duration<double>(BenchClock::now() - start).count();
+}
+
+// Uniform random sphere of equal-mass bodies, total mass 1
+void MakeCluster(BodySystem& bodies, size_t n, unsigned seed) {
+    mt19937_64 rng(seed);
+    uniform_real_distribution<double> unit(-1.0, 1.0);
+    bodies.Resize(0);
+    while (bodies.Size() < n) {
+        glm::dvec3 p(unit(rng), unit(rng), unit(rng));
+        if (glm::dot(p, p) <= 1.0) {
+            bodies.Add(p, glm::dvec3(0.0), 1.0 / n);
+        }
+    }
+}
+
+vector<size_t> ParseCounts(int argc, char** argv, vector<size_t> defaults) {
+    if (argc <= 2) {
+        return defaults;
+    }
+    vector<size_t> counts;
+    for (int a = 2; a < argc; ++a) {
+        counts.push_back(static_cast<size_t>(strtoull(argv[a], nullptr, 10)));
+    }
+    return counts;
+}
+
+// Runs the solver until at least a second has passed and returns seconds per evaluation
+double TimeSolver(GravitySolver& solver, BodySystem& bodies) {
+    solver.ComputeAccelerations(bodies);
+    int evaluations = 0;
+    BenchClock::time_point start = BenchClock::now();
+    do {
+        solver.ComputeAccelerations(bodies);
+        ++evaluations;
+    } while (SecondsSince(start) < 1.0);
+    return SecondsSince(start) / evaluations;
+}
+
+void BenchDirect(const vector<size_t>& counts) {
+    unsigned cores = WorkerCount();
+    cout << "direct summation, " << DirectSummationSolver::InstructionSet() << ", " << cores << " threads" << endl;
+    for (size_t c = 0; c < counts.size(); ++c) {
+        BodySystem bodies;
+        MakeCluster(bodies, counts[c], 1);
+        KernelPrecision precisions[2] = { KernelPrecision::Double, KernelPrecision::Mixed };
+        for (int p = 0; p < 2; ++p) {
+            DirectSummationSolver solver(1.0, 1e-3, precisions[p]);
+            double seconds = TimeSolver(solver, bodies);
+            double rate = static_cast<double>(counts[c]) * counts[c] / seconds;
+            cout << "  N=" << counts[c] << " " << solver.Name() << ": " << seconds * 1e3 << " ms/step, "
+                << rate / 1e9 << " G interactions/s, " << rate / cores / 1e9 << " G/s per core" << endl;
+        }
+    }
+}
+
+// Relative acceleration error against direct summation for a sample of bodies
+void SampledError(const BodySystem& bodies, double softening, size_t samples, double& maxError, double& rmsError) {
+    const size_t n = bodies.Size();
+    const double eps2 = softening * softening;
+    maxError = 0.0;
+    rmsError = 0.0;
+    for (size_t s = 0; s < samples; ++s) {
+        size_t i = (s * 2654435761u) % n;
+        glm::dvec3 exact(0.0);
+        for (size_t j = 0; j < n; ++j) {
+            glm::dvec3 d = bodies.Position(j) - bodies.Position(i);
+            double r2 = glm::dot(d, d) + eps2;
+            if (r2 > 0.0) {
+                exact += d * (bodies.mass[j] / (r2 * sqrt(r2)));
+            }
+        }
+        double error = glm::length(bodies.Acceleration(i) - exact) / glm::length(exact);
+        maxError = max(maxError, error);
+        rmsError += error * error;
+    }
+    rmsError = sqrt(rmsError / samples);
+}
+
+void BenchBarnesHut(const vector<size_t>& counts) {
+    const double softening = 1e-3;
+    cout << "barnes-hut, " << WorkerCount() << " threads" << endl;
+    for (size_t c = 0; c < counts.size(); ++c) {
+        BodySystem bodies;
+        MakeCluster(bodies, counts[c], 1);
+        double thetas[3] = { 0.3, 0.5, 0.8 };
+        for (int t = 0; t < 3; ++t) {
+            BarnesHutSolver solver(1.0, softening, thetas[t]);
+            BenchClock::time_point start = BenchClock::now();
+            solver.tree.Build(bodies);
+            double build = SecondsSince(start);
+
+            start = BenchClock::now();
+            solver.ComputeAccelerations(bodies);
+            double total = SecondsSince(start);
+            double perBody = static_cast<double>(solver.interactions) / counts[c];
+
+            double maxError, rmsError;
+            SampledError(bodies, softening, 64, maxError, rmsError);
+            cout << "  N=" << counts[c] << " theta=" << thetas[t] << ": build " << build * 1e3 << " ms, refit+walk "
+                << total * 1e3 << " ms, " << perBody << " interactions/body, error rms " << rmsError << " max "
+                << maxError << endl;
+        }
+    }
+}
+
+// Expansion order sweep; error should drop roughly geometrically with p at fixed theta
+void BenchFmm(const vector<size_t>& counts) {
+    const double softening = 1e-3;
+    cout << "fmm, " << JobSystem::Instance().Threads() << " threads" << endl;
+    for (size_t c = 0; c < counts.size(); ++c) {
+        BodySystem bodies;
+        MakeCluster(bodies, counts[c], 1);
+        int orders[4] = { 2, 4, 6, 8 };
+        for (int o = 0; o < 4; ++o) {
+            FmmSolver solver(1.0, softening, orders[o]);
+            BenchClock::time_point start = BenchClock::now();
+            solver.ComputeAccelerations(bodies);
+            double total = SecondsSince(start);
+
+            double maxError, rmsError;
+            SampledError(bodies, softening, 64, maxError, rmsError);
+            cout << "  N=" << counts[c] << " p=" << orders[o] << ": " << total * 1e3 << " ms, "
+                << static_cast<double>(solver.interactions) / counts[c] << " interactions/body, error rms "
+                << rmsError << " max " << maxError << endl;
+        }
+    }
+}
+
+// Random belt-like orbits (10% highly eccentric); reports batch throughput and the Kepler residual
+void BenchKepler(const vector<size_t>& counts) {
+    cout << "kepler, " << KeplerOrbits::InstructionSet() << ", " << WorkerCount() << " threads" << endl;
+    mt19937_64 rng(11);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    for (size_t c = 0; c < counts.size(); ++c) {
+        KeplerOrbits orbits(1.0);
+        orbits.Reserve(counts[c]);
+        for (size_t i = 0; i < counts[c]; ++i) {
+            OrbitalElements elements;
+            elements.semiMajorAxis = 2.1 + 1.2 * unit(rng);
+            elements.eccentricity = i % 10 == 0 ? 0.99 * unit(rng) : 0.3 * unit(rng);
+            elements.inclination = 0.5 * unit(rng);
+            elements.ascendingNode = 6.283185307179586 * unit(rng);
+            elements.argumentOfPeriapsis = 6.283185307179586 * unit(rng);
+            elements.meanAnomaly = 6.283185307179586 * unit(rng);
+            orbits.Add(elements);
+        }
+
+        vector<double> x, y, z;
+        orbits.Propagate(0.0, x, y, z);
+        int runs = 0;
+        BenchClock::time_point start = BenchClock::now();
+        do {
+            orbits.Propagate(1e4 * (runs + 1), x, y, z);
+            ++runs;
+        } while (SecondsSince(start) < 1.0);
+        double seconds = SecondsSince(start) / runs;
+
+        // Batch result against the scalar solver on a sample
+        double t = 1e4 * runs, maxError = 0.0;
+        for (size_t i = 0; i < counts[c]; i += 97) {
+            glm::dvec3 exact = orbits.Position(i, t);
+            maxError = max(maxError, glm::length(exact - glm::dvec3(x[i], y[i], z[i])));
+        }
+        // Interleaved float positions, the layout the asteroid belt writes into its instance buffer
+        vector<float> instances(3 * counts[c]);
+        runs = 0;
+        start = BenchClock::now();
+        do {
+            orbits.Propagate(1e4 * (runs + 1), &instances[0], 3, glm::dvec3(0.0));
+            ++runs;
+        } while (SecondsSince(start) < 1.0);
+        double floatSeconds = SecondsSince(start) / runs;
+
+        cout << "  N=" << counts[c] << ": " << seconds * 1e3 << " ms per seek, " << counts[c] / (seconds * 1e3)
+            << " bodies/ms, max deviation from scalar " << maxError << "; float instance layout "
+            << floatSeconds * 1e3 << " ms" << endl;
+    }
+}
+
+// Pick tree over a belt of asteroids moving along their orbits: build, refit and rebuild cost as the
+// orbits shear, then ray picks and k-nearest queries timed and checked against a linear scan
+void BenchBvh(size_t count) {
+    const double twoPi = 6.283185307179586;
+    mt19937_64 rng(5);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    KeplerOrbits orbits(1.0);
+    orbits.Reserve(count);
+    SphereBvh tree;
+    tree.Resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        OrbitalElements elements;
+        elements.semiMajorAxis = 2.1 + 1.2 * unit(rng);
+        elements.eccentricity = 0.3 * unit(rng);
+        elements.inclination = 0.3 * unit(rng);
+        elements.ascendingNode = twoPi * unit(rng);
+        elements.argumentOfPeriapsis = twoPi * unit(rng);
+        elements.meanAnomaly = twoPi * unit(rng);
+        orbits.Add(elements);
+        tree.Radii()[i] = static_cast<float>(0.0005 + 0.002 * pow(unit(rng), 4.0));
+    }
+    const glm::dvec3 observer(0.5, 0.3, 4.0);
+    orbits.Propagate(0.0, tree.Positions(), 3, -observer);
+    BenchClock::time_point start = BenchClock::now();
+    tree.Build();
+    double build = SecondsSince(start);
+    cout << "bvh, " << count << " spheres on " << WorkerCount() << " threads: build " << build * 1e3 << " ms, "
+        << tree.Nodes() << " nodes" << endl;
+
+    // A frame is a fiftieth of a time unit, about 1/1400 of an orbit (a fast-forwarded viewer)
+    const int frames = 300;
+    double refitSeconds = 0.0, rebuildSeconds = 0.0;
+    int rebuilds = 0;
+    float worstQuality = 1.0f;
+    for (int f = 1; f <= frames; ++f) {
+        orbits.Propagate(0.02 * f, tree.Positions(), 3, -observer);
+        start = BenchClock::now();
+        bool rebuilt = tree.Update();
+        (rebuilt ? rebuildSeconds : refitSeconds) += SecondsSince(start);
+        rebuilds += rebuilt ? 1 : 0;
+        worstQuality = max(worstQuality, rebuilt ? 1.0f : tree.Quality());
+    }
+    cout << "  " << frames << " frames: refit " << refitSeconds * 1e3 / max(1, frames - rebuilds) << " ms, "
+        << rebuilds << " SAH rebuilds (" << (rebuilds > 0 ? rebuildSeconds * 1e3 / rebuilds : 0.0)
+        << " ms each), worst refit cost x" << worstQuality << " of the built tree" << endl;
+
+    // Rays from the observer (the origin of the tree's frame) toward random asteroids, slightly off target
+    const size_t queries = 20000, checked = 200;
+    const float slope = 0.001f;
+    vector<glm::vec3> directions(queries), points(queries);
+    for (size_t q = 0; q < queries; ++q) {
+        glm::vec3 target = tree.Position(static_cast<size_t>(unit(rng) * count) % count);
+        glm::vec3 jitter(unit(rng) - 0.5, unit(rng) - 0.5, unit(rng) - 0.5);
+        directions[q] = glm::normalize(target + 0.01f * jitter);
+        points[q] = target + 0.05f * jitter;
+    }
+    vector<BvhHit> hits(queries);
+    size_t hitCount = 0;
+    start = BenchClock::now();
+    for (size_t q = 0; q < queries; ++q) {
+        hitCount += tree.Raycast(glm::vec3(0.0f), directions[q], slope, hits[q]) ? 1 : 0;
+    }
+    double ray = SecondsSince(start) / queries;
+    size_t rayMismatches = 0;
+    for (size_t q = 0; q < checked; ++q) {
+        // Linear scan with the same hit rule
+        BvhHit best = { static_cast<size_t>(-1), numeric_limits<float>::max() };
+        for (size_t i = 0; i < count; ++i) {
+            glm::vec3 offset = tree.Position(i);
+            float along = glm::dot(offset, directions[q]);
+            float reach = tree.Radii()[i] + slope * along;
+            float miss2 = max(0.0f, glm::dot(offset, offset) - along * along);
+            if (along <= 0.0f || miss2 > reach * reach) {
+                continue;
+            }
+            float enter = along - sqrt(max(0.0f, tree.Radii()[i] * tree.Radii()[i] - miss2));
+            if (enter < best.distance) {
+                best.index = i;
+                best.distance = enter;
+            }
+        }
+        rayMismatches += best.index != hits[q].index ? 1 : 0;
+    }
+
+    const size_t k = 8;
+    vector<BvhHit> nearest;
+    start = BenchClock::now();
+    for (size_t q = 0; q < queries; ++q) {
+        tree.Nearest(points[q], k, nearest);
+    }
+    double knn = SecondsSince(start) / queries;
+    size_t knnMismatches = 0;
+    vector<float> distances(count);
+    for (size_t q = 0; q < checked; ++q) {
+        tree.Nearest(points[q], k, nearest);
+        for (size_t i = 0; i < count; ++i) {
+            distances[i] = glm::length(tree.Position(i) - points[q]);
+        }
+        nth_element(distances.begin(), distances.begin() + (k - 1), distances.end());
+        knnMismatches += nearest.size() != k || nearest.back().distance != distances[k - 1] ? 1 : 0;
+    }
+    cout << "  ray pick " << ray * 1e6 << " us (" << hitCount << " of " << queries << " hit), " << rayMismatches
+        << " of " << checked << " differing from a linear scan; " << k << " nearest " << knn * 1e6 << " us, "
+        << knnMismatches << " of " << checked << " differing" << endl;
+}
+
+// Close-approach screening: events over two orbits of a crowded narrow ring checked against an all-pairs
+// scan of the sampled range rate, then filter counts and time for a belt-sized population
+void BenchConjunctions(size_t count) {
+    const double twoPi = 6.283185307179586;
+    mt19937_64 rng(23);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    auto makeBelt = [&](KeplerOrbits& orbits, size_t n, double innerAxis, double width, double maxE, double maxI) {
+        orbits.Reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            OrbitalElements elements;
+            elements.semiMajorAxis = innerAxis + width * unit(rng);
+            elements.eccentricity = maxE * unit(rng);
+            elements.inclination = maxI * unit(rng);
+            elements.ascendingNode = twoPi * unit(rng);
+            elements.argumentOfPeriapsis = twoPi * unit(rng);
+            elements.meanAnomaly = twoPi * unit(rng);
+            orbits.Add(elements);
+        }
+    };
+
+    const size_t small = 200;
+    KeplerOrbits ring(1.0);
+    makeBelt(ring, small, 2.5, 0.1, 0.05, 0.05);
+    ConjunctionSettings settings;
+    settings.threshold = 0.02;
+    settings.start = 0.0;
+    settings.end = 50.0;
+    ConjunctionStats stats;
+    vector<Conjunction> events = ConjunctionScreen::Screen(ring, settings, &stats);
+
+    const size_t samples = 5000;
+    const double dt = (settings.end - settings.start) / samples;
+    vector<glm::dvec3> position(small * (samples + 1)), velocity(small * (samples + 1));
+    for (size_t s = 0; s <= samples; ++s) {
+        for (size_t i = 0; i < small; ++i) {
+            ring.State(i, settings.start + s * dt, position[s * small + i], velocity[s * small + i]);
+        }
+    }
+    vector<Conjunction> scanned;
+    BenchClock::time_point start = BenchClock::now();
+    for (uint32_t i = 0; i < small; ++i) {
+        for (uint32_t j = i + 1; j < small; ++j) {
+            double previous = 0.0;
+            for (size_t s = 0; s <= samples; ++s) {
+                double g = glm::dot(position[s * small + j] - position[s * small + i],
+                    velocity[s * small + j] - velocity[s * small + i]);
+                if (s > 0 && previous < 0.0 && g >= 0.0) {
+                    ConjunctionScreen::Refine(ring, i, j, settings.start + (s - 1) * dt, settings.start + s * dt, 1,
+                        settings.threshold, scanned);
+                }
+                previous = g;
+            }
+        }
+    }
+    double scanSeconds = SecondsSince(start);
+    size_t missed = 0, matched = 0;
+    for (size_t e = 0; e < scanned.size(); ++e) {
+        bool found = false;
+        for (size_t f = 0; f < events.size() && !found; ++f) {
+            found = events[f].first == scanned[e].first && events[f].second == scanned[e].second &&
+                fabs(events[f].time - scanned[e].time) < 1e-6;
+        }
+        (found ? matched : missed) += 1;
+    }
+    cout << "conjunctions, " << WorkerCount() << " threads" << endl;
+    cout << "  ring of " << small << " over " << settings.end << " time units within " << settings.threshold << ": "
+        << events.size() << " events in " << stats.seconds * 1e3 << " ms (" << stats.buckets << " buckets), "
+        << scanned.size() << " from an all-pairs scan in " << scanSeconds * 1e3 << " ms; " << missed
+        << " missed, " << events.size() - matched << " extra" << endl;
+
+    // A tenth of an orbit of a belt, screened at a distance a few times the mean spacing is small against
+    KeplerOrbits belt(1.0);
+    makeBelt(belt, count, 2.1, 1.2, 0.3, 0.3);
+    settings.threshold = 0.001;
+    settings.end = 3.0;
+    events = ConjunctionScreen::Screen(belt, settings, &stats);
+    cout << "  belt of " << count << " over " << settings.end << " time units within " << settings.threshold << ": "
+        << stats.seconds * 1e3 << " ms, " << stats.buckets << " buckets of " << stats.bucket << "; "
+        << stats.sweepPairs << " swept pairs, " << stats.apsisRejected << " rejected by apsides, "
+        << stats.pathRejected << " by orbit paths, " << stats.refined << " refined, " << stats.events << " events"
+        << endl;
+}
+
+// Eclipses and transits of the viewer's two suns and eight planets (their drawn radii, with small random
+// tilts and eccentricities): a short window checked against a dense scan of the event state, then
+// centuries of scene time
+void BenchEclipses(double years) {
+    const double twoPi = 6.283185307179586;
+    const double starMass = 171.0, year = 75.0;
+    mt19937_64 rng(25);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    KeplerOrbits orbits(starMass);
+    const double separation = 6.0, masses[2] = { starMass * 0.75, starMass * 0.25 };
+    for (int k = 0; k < 2; ++k) {
+        double other = masses[1 - k];
+        OrbitalElements elements = { separation * other / starMass, 0.0, 0.0, 0.0, 0.0, k * 0.5 * twoPi };
+        orbits.Add(elements, other * other * other / (starMass * starMass));
+    }
+    const double planetRadii[8] = { 25.0, 27.0, 29.0, 31.0, 36.0, 43.0, 48.0, 53.0 };
+    for (int k = 0; k < 8; ++k) {
+        OrbitalElements elements = { planetRadii[k], 0.02 * unit(rng), 0.02 * unit(rng), twoPi * unit(rng),
+            twoPi * unit(rng), twoPi * unit(rng) };
+        orbits.Add(elements);
+    }
+    const vector<double> radii = { 4.98, 1.74, 0.075, 0.125, 0.125, 0.075, 1.0, 1.55, 1.48, 1.47 };
+    const vector<uint32_t> sources = { 0, 1 };
+    const vector<EclipseBody> bodies = EclipseSearch::Bodies(orbits, radii);
+    auto state = [&](size_t i, double t, glm::dvec3& position, glm::dvec3& velocity) {
+        orbits.State(i, t, position, velocity);
+    };
+
+    EclipseSettings settings;
+    settings.end = 150.0;
+    EclipseStats stats;
+    vector<EclipseEvent> events = EclipseSearch::Search(state, bodies, sources, settings, &stats);
+
+    // Dense scan: state changes between samples, matched to an event starting within a sample
+    const double dt = 0.002;
+    const size_t samples = static_cast<size_t>(settings.end / dt);
+    const size_t n = radii.size();
+    vector<glm::dvec3> sampled(n * (samples + 1));
+    for (size_t s = 0; s <= samples; ++s) {
+        for (size_t i = 0; i < n; ++i) {
+            sampled[s * n + i] = orbits.Position(i, s * dt);
+        }
+    }
+    BenchClock::time_point start = BenchClock::now();
+    size_t scanned = 0, missed = 0;
+    for (uint32_t source : sources) {
+        for (uint32_t occulter = 0; occulter < n; ++occulter) {
+            for (uint32_t observer = 2; observer < n; ++observer) {
+                if (occulter == source || observer == occulter) {
+                    continue;
+                }
+                bool previous = false;
+                for (size_t s = 0; s <= samples; ++s) {
+                    const glm::dvec3* p = &sampled[s * n];
+                    glm::dvec3 toSource = p[source] - p[observer], toOcculter = p[occulter] - p[observer];
+                    double dS = glm::length(toSource), dO = glm::length(toOcculter);
+                    double angle = atan2(glm::length(glm::cross(toSource, toOcculter)), glm::dot(toSource, toOcculter));
+                    bool inside = angle < asin(radii[source] / dS) + asin(radii[occulter] / dO) && dO < dS;
+                    if (inside && !previous) {
+                        ++scanned;
+                        bool found = false;
+                        for (size_t e = 0; e < events.size() && !found; ++e) {
+                            found = events[e].source == source && events[e].occulter == occulter &&
+                                events[e].observer == observer && fabs(events[e].start - s * dt) <= dt;
+                        }
+                        missed += found ? 0 : 1;
+                    }
+                    previous = inside;
+                }
+            }
+        }
+    }
+    double scanSeconds = SecondsSince(start);
+    cout << "eclipses, " << WorkerCount() << " threads, " << stats.triples << " triples" << endl;
+    cout << "  " << settings.end << " time units: " << events.size() << " events in " << stats.seconds * 1e3 << " ms ("
+        << stats.steps << " steps), " << scanned << " from a scan every " << dt << " in " << scanSeconds * 1e3
+        << " ms; " << missed << " missed, " << static_cast<long long>(events.size()) - static_cast<long long>(scanned - missed)
+        << " extra" << endl;
+
+    settings.end = years * year;
+    events = EclipseSearch::Search(state, bodies, sources, settings, &stats);
+    size_t eclipses = 0, transits = 0, central = 0;
+    for (size_t e = 0; e < events.size(); ++e) {
+        (events[e].kind == EclipseKind::Eclipse ? eclipses : transits) += 1;
+        central += events[e].central ? 1 : 0;
+    }
+    cout << "  " << years << " years (" << settings.end << " time units): " << stats.seconds << " s, " << stats.chunks
+        << " chunks, " << stats.steps << " steps (" << stats.steps / max<size_t>(stats.contacts, 1) << " per contact), "
+        << events.size() << " events: " << eclipses << " eclipses, " << transits << " transits, " << central
+        << " central" << endl;
+}
+
+// SGP4: the published check case (Vallado et al. 2006, satellite 00005) to the reference digits, then
+// batch propagation of a generated constellation per frame, SIMD lanes checked against the scalar path
+void BenchSgp4(size_t count) {
+    cout << "sgp4, " << Sgp4Orbits::InstructionSet() << ", " << WorkerCount() << " threads" << endl;
+    TwoLineElements reference;
+    TleReader::Parse("1 00005U 58002B   00179.78495062  .00000023  00000-0  28098-4 0  4753",
+        "2 00005  34.2682 348.7242 1859667 331.7664  19.3264 10.82419157413667", reference);
+    Sgp4Orbits check;
+    check.Add(reference);
+    const double minutes[2] = { 0.0, 360.0 };
+    const glm::dvec3 expectedPosition[2] = { glm::dvec3(7022.46529266, -1400.08296755, 0.03995155),
+        glm::dvec3(-7154.03120202, -3783.17682504, -3536.19412294) };
+    const glm::dvec3 expectedVelocity[2] = { glm::dvec3(1.893841015, 6.405893759, 4.534807250),
+        glm::dvec3(4.741887409, -4.151817765, -2.093935425) };
+    double positionError = 0.0, velocityError = 0.0;
+    for (int k = 0; k < 2; ++k) {
+        glm::dvec3 position, velocity;
+        check.State(0, reference.epoch + minutes[k] / 1440.0, position, velocity);
+        positionError = max(positionError, glm::length(position - expectedPosition[k]));
+        velocityError = max(velocityError, glm::length(velocity - expectedVelocity[k]));
+    }
+    cout << "  satellite 00005 against the reference: " << positionError * 1e3 << " m, " << velocityError * 1e6
+        << " mm/s" << endl;
+
+    const double epoch = 2460600.5;
+    Sgp4Orbits orbits;
+    vector<TwoLineElements> elements = GenerateConstellation(count, epoch);
+    BenchClock::time_point start = BenchClock::now();
+    orbits.Reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        orbits.Add(elements[i]);
+    }
+    double init = SecondsSince(start);
+
+    // A frame every 30 s of satellite time for a day after the epoch
+    vector<double> x, y, z;
+    orbits.Propagate(epoch, x, y, z);
+    int frames = 0;
+    start = BenchClock::now();
+    do {
+        orbits.Propagate(epoch + (frames % 2880) / 2880.0, x, y, z);
+        ++frames;
+    } while (SecondsSince(start) < 1.0);
+    double seconds = SecondsSince(start) / frames;
+    vector<float> instances(3 * count);
+    frames = 0;
+    start = BenchClock::now();
+    do {
+        orbits.Propagate(epoch + (frames % 2880) / 2880.0, &instances[0], 3, glm::dmat3(1e-4), glm::dvec3(0.0));
+        ++frames;
+    } while (SecondsSince(start) < 1.0);
+    double floatSeconds = SecondsSince(start) / frames;
+
+    // Batch against the scalar path a week out, and the velocity against differenced positions
+    const double date = epoch + 7.0;
+    orbits.Propagate(date, x, y, z);
+    double maxDeviation = 0.0, maxVelocityError = 0.0;
+    size_t decayed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        glm::dvec3 position, velocity, before, after, unused;
+        if (!orbits.State(i, date, position, velocity)) {
+            ++decayed;
+        }
+        maxDeviation = max(maxDeviation, glm::length(position - glm::dvec3(x[i], y[i], z[i])));
+        if (i % 97 == 0) {
+            const double h = 0.5 / 86400.0;
+            orbits.State(i, date - h, before, unused);
+            orbits.State(i, date + h, after, unused);
+            maxVelocityError = max(maxVelocityError, glm::length((after - before) - velocity));
+        }
+    }
+    cout << "  N=" << count << " (" << orbits.DeepSpaceCount() << " deep-space): init " << init * 1e3 << " ms, "
+        << seconds * 1e3 << " ms per frame (" << count / (seconds * 1e3) << " satellites/ms), float instance layout "
+        << floatSeconds * 1e3 << " ms; batch against scalar " << maxDeviation * 1e3 << " m, velocity against "
+        << "differenced positions " << maxVelocityError * 1e3 << " m/s, " << decayed << " decayed" << endl;
+}
+
+double TotalEnergy(const BodySystem& b, double G) {
+    double energy = 0.0;
+    for (size_t i = 0; i < b.Size(); ++i) {
+        energy += 0.5 * b.mass[i] * glm::dot(b.Velocity(i), b.Velocity(i));
+        for (size_t j = i + 1; j < b.Size(); ++j) {
+            energy -= G * b.mass[i] * b.mass[j] / glm::length(b.Position(i) - b.Position(j));
+        }
+    }
+    return energy;
+}
+
+// Sun plus four planets on slightly eccentric orbits (G = 1, sun mass 1, inner orbit period 2 pi)
+void MakePlanetarySystem(NBodySimulation& simulation) {
+    double radii[4] = { 1.0, 1.5, 5.2, 9.5 };
+    double masses[4] = { 3e-6, 3e-7, 1e-3, 3e-4 };
+    simulation.AddBody(glm::dvec3(0.0), glm::dvec3(0.0), 1.0);
+    for (int p = 0; p < 4; ++p) {
+        double speed = 1.02 * sqrt(1.0 / radii[p]);
+        simulation.AddBody(glm::dvec3(radii[p], 0.0, 0.0), glm::dvec3(0.0, speed, 0.0), masses[p]);
+    }
+}
+
+// Wall-clock time and maximum relative energy error over 1000 time units for each scheme and step.
+// IAS15 and block-leapfrog pick their own substeps, so for them dt is only the output interval.
+void BenchIntegrators() {
+    cout << "integrators, planetary system over 1000 time units" << endl;
+    double steps[3] = { 0.5, 0.1, 0.02 };
+    for (int k = 0; k < IntegratorKindCount; ++k) {
+        for (int s = 0; s < 3; ++s) {
+            NBodySimulation simulation;
+            simulation.SetIntegrator(static_cast<IntegratorKind>(k));
+            MakePlanetarySystem(simulation);
+            double initial = TotalEnergy(simulation.bodies, 1.0);
+            double maxError = 0.0;
+            long count = static_cast<long>(1000.0 / steps[s]);
+            double seconds = 0.0;
+            for (long step = 0; step < count; ++step) {
+                BenchClock::time_point start = BenchClock::now();
+                simulation.Step(steps[s]);
+                seconds += SecondsSince(start);
+                if (step % 16 == 0) {
+                    maxError = max(maxError, fabs(TotalEnergy(simulation.bodies, 1.0) / initial - 1.0));
+                }
+            }
+            const Integrator& integrator = simulation.CurrentIntegrator();
+            cout << "  " << integrator.Name() << " dt=" << steps[s] << ": " << seconds * 1e3 << " ms, "
+                << integrator.ForceEvaluations() << " force evaluations, " << integrator.StepsTaken() << " steps, "
+                << integrator.RejectedSteps() << " rejected, max |dE/E| " << maxError << endl;
+        }
+    }
+}
+
+// Maximum relative energy error and wall-clock time of one run over `duration`, stepping by dt
+double RunToEnergyError(NBodySimulation& simulation, double dt, double duration, double& seconds) {
+    double initial = TotalEnergy(simulation.bodies, 1.0);
+    double maxError = 0.0;
+    long count = static_cast<long>(duration / dt + 0.5);
+    seconds = 0.0;
+    for (long step = 0; step < count; ++step) {
+        BenchClock::time_point start = BenchClock::now();
+        simulation.Step(dt);
+        seconds += SecondsSince(start);
+        if (step % 4 == 0) {
+            maxError = max(maxError, fabs(TotalEnergy(simulation.bodies, 1.0) / initial - 1.0));
+        }
+    }
+    return maxError;
+}
+
+// Sun, eight planets on their real orbits (AU, years / 2 pi, solar masses), the Moon, the Galilean
+// moons and `asteroids` massless belt bodies: orbital periods from 2 days to 165 years
+void MakeHierarchicalSystem(NBodySimulation& simulation, size_t asteroids) {
+    const double radii[8] = { 0.387, 0.723, 1.0, 1.524, 5.203, 9.537, 19.19, 30.07 };
+    const double masses[8] = { 1.66e-7, 2.45e-6, 3.0e-6, 3.23e-7, 9.55e-4, 2.86e-4, 4.37e-5, 5.15e-5 };
+    simulation.AddBody(glm::dvec3(0.0), glm::dvec3(0.0), 1.0);
+    glm::dvec3 earth(0.0), earthVelocity(0.0), jupiter(0.0), jupiterVelocity(0.0);
+    for (int p = 0; p < 8; ++p) {
+        double angle = 2.4 * p;
+        glm::dvec3 position = radii[p] * glm::dvec3(cos(angle), sin(angle), 0.0);
+        glm::dvec3 velocity = sqrt(1.0 / radii[p]) * glm::dvec3(-sin(angle), cos(angle), 0.0);
+        simulation.AddBody(position, velocity, masses[p]);
+        if (p == 2) {
+            earth = position; earthVelocity = velocity;
+        }
+        if (p == 4) {
+            jupiter = position; jupiterVelocity = velocity;
+        }
+    }
+    // Moons on circular orbits around their planet
+    const double moonRadii[5] = { 0.00257, 0.00282, 0.00449, 0.00716, 0.01259 };
+    const double moonMasses[5] = { 3.7e-8, 4.5e-8, 2.4e-8, 7.4e-8, 5.4e-8 };
+    for (int m = 0; m < 5; ++m) {
+        bool lunar = m == 0;
+        glm::dvec3 center = lunar ? earth : jupiter, centerVelocity = lunar ? earthVelocity : jupiterVelocity;
+        double mu = lunar ? masses[2] : masses[4];
+        double angle = 1.3 * m;
+        glm::dvec3 offset = moonRadii[m] * glm::dvec3(cos(angle), sin(angle), 0.0);
+        glm::dvec3 velocity = sqrt(mu / moonRadii[m]) * glm::dvec3(-sin(angle), cos(angle), 0.0);
+        simulation.AddBody(center + offset, centerVelocity + velocity, moonMasses[m]);
+    }
+    mt19937_64 rng(5);
+    uniform_real_distribution<double> radius(2.2, 3.3), phase(0.0, 2.0 * 3.14159265358979);
+    for (size_t a = 0; a < asteroids; ++a) {
+        double r = radius(rng), angle = phase(rng);
+        simulation.AddBody(r * glm::dvec3(cos(angle), sin(angle), 0.0),
+            sqrt(1.0 / r) * glm::dvec3(-sin(angle), cos(angle), 0.0), 0.0);
+    }
+}
+
+// Global leapfrog at the step the fastest moon needs against per-body block steps on the same system:
+// pairwise interactions (the force cost), wall time and energy error over 10 time units (~330 orbits of Io)
+void BenchBlockSteps(size_t asteroids) {
+    const double duration = 10.0, outputStep = 0.1;
+    cout << "block timesteps, sun, planets, 5 moons and " << asteroids << " asteroids over " << duration
+        << " time units" << endl;
+    for (int run = 0; run < 4; ++run) {
+        NBodySimulation simulation;
+        double dt = outputStep;
+        ostringstream label;
+        if (run < 2) {
+            dt = run == 0 ? 2e-3 : 1e-3;
+            simulation.SetIntegrator(IntegratorKind::Leapfrog);
+            label << "leapfrog dt=" << dt;
+        }
+        else {
+            double eta = run == 2 ? 0.03 : 0.01;
+            simulation.SetIntegrator(unique_ptr<Integrator>(new BlockLeapfrogIntegrator(eta)));
+            label << "block-leapfrog eta=" << eta;
+        }
+        MakeHierarchicalSystem(simulation, asteroids);
+        double seconds;
+        double error = RunToEnergyError(simulation, dt, duration, seconds);
+        cout << "  " << label.str() << ": " << seconds * 1e3 << " ms, " << simulation.Solver().interactions
+            << " interactions, " << simulation.CurrentIntegrator().StepsTaken() << " substeps, max |dE/E| " << error;
+        const BlockLeapfrogIntegrator* block = dynamic_cast<const BlockLeapfrogIntegrator*>(&simulation.CurrentIntegrator());
+        if (block != nullptr) {
+            vector<size_t> histogram = block->LevelHistogram();
+            cout << ", bodies per level";
+            for (size_t l = 0; l < histogram.size(); ++l) {
+                if (histogram[l] > 0) {
+                    cout << " " << l << ":" << histogram[l];
+                }
+            }
+        }
+        cout << endl;
+    }
+}
+
+// Planetary system plus a 1e-4 mass comet on an e = 0.98 orbit that dives to 0.05 from the star every
+// ~25 time units and reaches out to Jupiter: for each scheme, the cheapest run (over a dt sweep, or an
+// epsilon sweep for IAS15) whose energy error stays below each target
+void BenchAdaptive() {
+    const double duration = 200.0, outputStep = 0.05;
+    const double targets[3] = { 1e-4, 1e-6, 1e-9 };
+    cout << "adaptive, planetary system plus an e=0.98 comet over " << duration << " time units" << endl;
+    for (int k = 0; k < IntegratorKindCount; ++k) {
+        IntegratorKind kind = static_cast<IntegratorKind>(k);
+        bool adaptive = kind == IntegratorKind::IAS15;
+        double best[3] = { -1.0, -1.0, -1.0 };
+        string setting[3];
+        for (int sweep = 0; sweep < 8; ++sweep) {
+            NBodySimulation simulation;
+            double dt = outputStep;
+            ostringstream label;
+            if (adaptive) {
+                double epsilon = pow(10.0, -1.0 - sweep);
+                simulation.SetIntegrator(unique_ptr<Integrator>(new IAS15Integrator(epsilon)));
+                label << "epsilon=" << epsilon;
+            }
+            else {
+                simulation.SetIntegrator(kind);
+                dt = outputStep * pow(0.25, sweep);
+                label << "dt=" << dt;
+            }
+            MakePlanetarySystem(simulation);
+            const double perihelion = 0.05, eccentricity = 0.98;
+            simulation.AddBody(glm::dvec3(perihelion, 0.0, 0.0),
+                glm::dvec3(0.0, sqrt((1.0 + eccentricity) / perihelion), 0.0), 1e-4);
+            double seconds;
+            double error = RunToEnergyError(simulation, dt, duration, seconds);
+            const Integrator& integrator = simulation.CurrentIntegrator();
+            cout << "  " << integrator.Name() << " " << label.str() << ": " << seconds * 1e3 << " ms, "
+                << integrator.StepsTaken() << " steps, " << integrator.RejectedSteps() << " rejected, max |dE/E| "
+                << error << endl;
+            for (int t = 0; t < 3; ++t) {
+                if (error < targets[t] && (best[t] < 0.0 || seconds < best[t])) {
+                    best[t] = seconds;
+                    setting[t] = label.str();
+                }
+            }
+            if (error < targets[2] || seconds > 10.0) {
+                break;
+            }
+        }
+        for (int t = 0; t < 3; ++t) {
+            cout << "  " << MakeIntegrator(kind)->Name() << " to |dE/E| < " << targets[t] << ": ";
+            if (best[t] < 0.0) {
+                cout << "not reached" << endl;
+            }
+            else {
+                cout << best[t] * 1e3 << " ms (" << setting[t] << ")" << endl;
+            }
+        }
+    }
+}
+
+// Broad plus narrow phase on a cluster with random velocities and log-normal radii (mean spacing ~10
+// radii), checked against an all-pairs scan where that is affordable; then merges the overlaps
+void BenchCollisions(const vector<size_t>& counts) {
+    cout << "collisions, " << WorkerCount() << " threads" << endl;
+    for (size_t c = 0; c < counts.size(); ++c) {
+        const size_t n = counts[c];
+        BodySystem bodies;
+        MakeCluster(bodies, n, 1);
+        mt19937_64 rng(2);
+        normal_distribution<double> velocity(0.0, 0.1);
+        lognormal_distribution<double> size(0.0, 0.75);
+        double spacing = pow(4.19 / n, 1.0 / 3.0);
+        for (size_t i = 0; i < n; ++i) {
+            bodies.SetVelocity(i, glm::dvec3(velocity(rng), velocity(rng), velocity(rng)));
+            bodies.radius[i] = 0.05 * spacing * size(rng);
+        }
+        const double dt = 0.01;
+        CollisionDetector detector(0.2 * spacing);
+        detector.Detect(bodies, dt);
+        int runs = 0;
+        BenchClock::time_point start = BenchClock::now();
+        do {
+            detector.Detect(bodies, dt);
+            ++runs;
+        } while (SecondsSince(start) < 1.0);
+        double seconds = SecondsSince(start) / runs;
+
+        const vector<Encounter>& found = detector.Encounters();
+        size_t overlaps = 0;
+        for (size_t e = 0; e < found.size(); ++e) {
+            overlaps += found[e].overlap ? 1 : 0;
+        }
+        cout << "  N=" << n << ": " << seconds * 1e3 << " ms, " << static_cast<double>(detector.candidates) / n
+            << " candidates/body, " << found.size() << " encounters, " << overlaps << " overlaps";
+        if (n <= 20000) {
+            size_t expected = 0;
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = i + 1; j < n; ++j) {
+                    double distance, time;
+                    CollisionDetector::ClosestApproach(bodies.Position(j) - bodies.Position(i),
+                        bodies.Velocity(j) - bodies.Velocity(i), dt, distance, time);
+                    if (distance < bodies.radius[i] + bodies.radius[j] || distance < detector.encounterDistance) {
+                        ++expected;
+                    }
+                }
+            }
+            cout << " (all-pairs scan: " << expected << ")";
+        }
+        vector<size_t> remap;
+        size_t removed = MergeOverlaps(bodies, found, remap);
+        cout << ", " << removed << " bodies merged away" << endl;
+    }
+}
+
+// Checkpoint round trip: every integrator and force backend must continue bit for bit from a snapshot
+// restored into a default simulation; then the stall of capturing, the background write and the mapped
+// restore for large clusters
+void BenchSnapshot(const vector<size_t>& counts) {
+    const string path = "bench.snap";
+    cout << "snapshot, resume check on the planetary system (100 steps before and after)" << endl;
+    for (int k = 0; k < IntegratorKindCount + 2; ++k) {
+        NBodySimulation original;
+        SimulationClock clock(0.05);
+        if (k < IntegratorKindCount) {
+            original.SetIntegrator(static_cast<IntegratorKind>(k));
+        }
+        else if (k == IntegratorKindCount) {
+            original.SetSolver(unique_ptr<GravitySolver>(new BarnesHutSolver()));
+        }
+        else {
+            original.SetSolver(unique_ptr<GravitySolver>(new FmmSolver()));
+        }
+        MakePlanetarySystem(original);
+        for (int step = 0; step < 100; ++step) {
+            original.Step(clock.fixedStep);
+        }
+        SnapshotWriter writer;
+        writer.Capture(original, clock, path);
+        if (!writer.Wait()) {
+            return;
+        }
+        NBodySimulation restored;
+        SimulationClock restoredClock;
+        SnapshotReader reader;
+        if (!reader.Open(path) || !reader.Restore(restored, restoredClock)) {
+            return;
+        }
+        double difference = 0.0;
+        for (int step = 0; step < 100; ++step) {
+            original.Step(clock.fixedStep);
+            restored.Step(restoredClock.fixedStep);
+        }
+        for (size_t i = 0; i < original.bodies.Size(); ++i) {
+            difference = max(difference, glm::length(original.bodies.Position(i) - restored.bodies.Position(i)));
+        }
+        cout << "  " << restored.CurrentIntegrator().Name() << ", " << restored.Solver().Name()
+            << ": largest position difference " << difference << endl;
+    }
+
+    cout << "snapshot, capture / write / restore" << endl;
+    for (size_t c = 0; c < counts.size(); ++c) {
+        NBodySimulation simulation;
+        MakeCluster(simulation.bodies, counts[c], 1);
+        simulation.Invalidate();
+        SimulationClock clock;
+        // Reserve faults in the image buffer up front, so neither capture pays for it
+        SnapshotWriter writer;
+        BenchClock::time_point reserveStart = BenchClock::now();
+        writer.Reserve(simulation, clock);
+        double reserve = SecondsSince(reserveStart);
+        double capture[2], write = 0.0;
+        for (int pass = 0; pass < 2; ++pass) {
+            BenchClock::time_point start = BenchClock::now();
+            writer.Capture(simulation, clock, path);
+            capture[pass] = SecondsSince(start);
+            bool written = writer.Wait();
+            write = SecondsSince(start) - capture[pass];
+            if (!written) {
+                return;
+            }
+        }
+
+        NBodySimulation restored;
+        SimulationClock restoredClock;
+        SnapshotReader reader;
+        BenchClock::time_point start = BenchClock::now();
+        bool opened = reader.Open(path);
+        double open = SecondsSince(start);
+        if (!opened || !reader.Restore(restored, restoredClock)) {
+            return;
+        }
+        double restore = SecondsSince(start) - open;
+        double megabytes = writer.Bytes() / 1048576.0;
+        cout << "  N=" << counts[c] << ": " << megabytes << " MB, reserve " << reserve * 1e3 << " ms, capture "
+            << capture[0] * 1e3 << " ms (then " << capture[1] * 1e3 << " ms), background write "
+            << write * 1e3 << " ms, open " << open * 1e3 << " ms, restore " << restore * 1e3 << " ms ("
+            << megabytes / restore << " MB/s)" << endl;
+    }
+    remove(path.c_str());
+}
+
+// Builds ephemerides of the planetary system at several tolerances; reports size, fit error and the
+// cost of a lookup at random times across the span
+void BenchEphemeris() {
+    const string path = "solarsim-bench.eph";
+    const double step = 0.01;
+    cout << "ephemeris, planetary system over 1000 time units, step " << step << endl;
+    double tolerances[3] = { 1e-6, 1e-7, 1e-8 };
+    for (int t = 0; t < 3; ++t) {
+        NBodySimulation simulation;
+        MakePlanetarySystem(simulation);
+        EphemerisSettings settings;
+        settings.span = 1000.0;
+        settings.recordLength = 4.0;
+        settings.tolerance = tolerances[t];
+        EphemerisStats stats;
+        BenchClock::time_point start = BenchClock::now();
+        if (!EphemerisBuilder::Build(simulation, step, settings, path, &stats)) {
+            return;
+        }
+        double build = SecondsSince(start);
+
+        Ephemeris ephemeris;
+        if (!ephemeris.Open(path)) {
+            return;
+        }
+        const size_t lookups = 2000000;
+        mt19937_64 rng(3);
+        uniform_real_distribution<double> when(ephemeris.StartTime(), ephemeris.EndTime());
+        vector<double> times(lookups);
+        for (size_t i = 0; i < lookups; ++i) {
+            times[i] = when(rng);
+        }
+        double checksum = 0.0;
+        start = BenchClock::now();
+        for (size_t i = 0; i < lookups; ++i) {
+            checksum += ephemeris.Position(i % ephemeris.BodyCount(), times[i]).x;
+        }
+        double lookup = SecondsSince(start) / lookups;
+
+        cout << "  tolerance " << tolerances[t] << ": build " << build * 1e3 << " ms, " << stats.bytes / 1024
+            << " KB, pieces per record";
+        for (size_t b = 0; b < stats.subintervals.size(); ++b) {
+            cout << " " << stats.subintervals[b];
+        }
+        cout << ", max error " << stats.maxError << (stats.toleranceMet ? "" : " (tolerance missed)") << ", lookup " << lookup * 1e9 << " ns (checksum " << checksum << ")" << endl;
+    }
+    remove(path.c_str());
+}
+
+// Records the planets, moons and asteroids every step at several tolerances: bytes per body and frame
+// against 24 for raw doubles, encode rate, the largest error, and the cost of random seeks and of
+// playing the whole recording backward
+void BenchTrajectory(size_t asteroids) {
+    const string path = "solarsim-bench.traj";
+    const double dt = 1e-3;
+    const size_t frames = 2000;
+    NBodySimulation simulation;
+    MakeHierarchicalSystem(simulation, asteroids);
+    const size_t n = simulation.bodies.Size();
+    cout << "trajectory, " << n << " bodies, " << frames << " frames every " << dt << endl;
+    vector<double> recorded(frames * n * 3);
+    for (size_t f = 0; f < frames; ++f) {
+        if (f > 0) {
+            simulation.Step(dt);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            recorded[(f * n + i) * 3 + 0] = simulation.bodies.x[i];
+            recorded[(f * n + i) * 3 + 1] = simulation.bodies.y[i];
+            recorded[(f * n + i) * 3 + 2] = simulation.bodies.z[i];
+        }
+    }
+
+    double tolerances[3] = { 1e-4, 1e-6, 1e-8 };
+    for (int t = 0; t < 3; ++t) {
+        TrajectoryRecorder recorder;
+        if (!recorder.Open(path, n, 0.0, dt, tolerances[t])) {
+            return;
+        }
+        BodySystem frame;
+        frame.Resize(n);
+        BenchClock::time_point start = BenchClock::now();
+        for (size_t f = 0; f < frames; ++f) {
+            for (size_t i = 0; i < n; ++i) {
+                frame.x[i] = recorded[(f * n + i) * 3 + 0];
+                frame.y[i] = recorded[(f * n + i) * 3 + 1];
+                frame.z[i] = recorded[(f * n + i) * 3 + 2];
+            }
+            recorder.Record(frame);
+        }
+        recorder.Close();
+        double encode = SecondsSince(start);
+
+        TrajectoryPlayer player;
+        if (!player.Open(path)) {
+            return;
+        }
+        double maxError = 0.0;
+        for (size_t f = 0; f < frames; ++f) {
+            for (size_t i = 0; i < n; ++i) {
+                glm::dvec3 error = player.FramePosition(i, f) - glm::dvec3(recorded[(f * n + i) * 3 + 0],
+                    recorded[(f * n + i) * 3 + 1], recorded[(f * n + i) * 3 + 2]);
+                maxError = max(maxError, max(fabs(error.x), max(fabs(error.y), fabs(error.z))));
+            }
+        }
+
+        const size_t seeks = 20000;
+        mt19937_64 rng(7);
+        uniform_real_distribution<double> when(player.StartTime(), player.EndTime());
+        double checksum = 0.0;
+        unsigned long long decodedBefore = player.BlocksDecoded();
+        start = BenchClock::now();
+        for (size_t s = 0; s < seeks; ++s) {
+            checksum += player.Position(s % n, when(rng)).x;
+        }
+        double seek = SecondsSince(start) / seeks;
+        double blocksPerSeek = static_cast<double>(player.BlocksDecoded() - decodedBefore) / seeks;
+
+        // Every body at every half frame, last to first
+        decodedBefore = player.BlocksDecoded();
+        start = BenchClock::now();
+        for (double time = player.EndTime(); time >= player.StartTime(); time -= 0.5 * dt) {
+            for (size_t i = 0; i < n; ++i) {
+                checksum += player.Position(i, time).y;
+            }
+        }
+        double reverse = SecondsSince(start);
+        unsigned long long reverseBlocks = player.BlocksDecoded() - decodedBefore;
+
+        cout << "  tolerance " << tolerances[t] << ": " << static_cast<double>(recorder.Bytes()) / (frames * n)
+            << " bytes per body-frame (raw 24), encode " << frames * n / encode / 1e6 << " M positions/s, max error "
+            << maxError << ", random seek " << seek * 1e6 << " us (" << blocksPerSeek << " blocks), reverse pass "
+            << reverse * 1e3 << " ms decoding " << reverseBlocks << " blocks (checksum " << checksum << ")" << endl;
+    }
+    remove(path.c_str());
+}
+
+// Synthetic MPCORB.DAT-format catalog: cold parse rate, sidecar reload time, the sidecar and a CSV
+// copy of the same records reproducing the parsed columns exactly, and the decimal parser against strtod
+void BenchCatalog(size_t records) {
+    const string path = "solarsim-bench-mpcorb.dat", csvPath = "solarsim-bench-catalog.csv";
+    const char* epochs[4] = { "K24AH", "K2422", "K239B", "J9961" };
+    const double epochDates[4] = { 2460600.5, 2460342.5, 2460198.5, 2451330.5 };
+    mt19937_64 rng(11);
+    uniform_real_distribution<double> unit(0.0, 1.0);
+    {
+        ofstream mpc(path.c_str(), ios::binary), csv(csvPath.c_str(), ios::binary);
+        mpc << "MINOR PLANET CENTER ORBIT DATABASE (MPCORB)\n\nDes'n     H     G   Epoch     M        Peri.      Node"
+            "       Incl.       e            n           a        Reference #Obs #Opp    Arc    rms  Perts   Computer\n"
+            << string(160, '-') << "\n";
+        csv << "full_name,epoch,e,a,i,om,w,ma,H\n";
+        char line[256];
+        for (size_t r = 0; r < records; ++r) {
+            int epoch = unit(rng) < 0.9 ? 0 : static_cast<int>(1 + 3 * unit(rng)) % 4;
+            double h = 10.0 + 10.0 * unit(rng), m = 360.0 * unit(rng), peri = 360.0 * unit(rng);
+            double node = 360.0 * unit(rng), incl = 30.0 * unit(rng), e = 0.3 * unit(rng), a = 2.1 + 1.2 * unit(rng);
+            char name[8];
+            snprintf(name, sizeof(name), "%c%04u", static_cast<char>('A' + (r / 10000) % 26), static_cast<unsigned>(r % 10000));
+            snprintf(line, sizeof(line), "%-7s %5.2f  0.15 %s %9.5f  %9.5f  %9.5f  %9.5f  %9.7f %11.8f %11.7f  0 E2024-V47"
+                "  7330 124 1801-2024 0.80 M-v 30k MPCLINUX   4000      (%zu) %s\n", name, h, epochs[epoch], m, peri, node,
+                incl, e, 0.9856076686 / pow(a, 1.5), a, r + 1, name);
+            mpc << line;
+            if (r == records / 2) {
+                mpc << "\n";
+            }
+            snprintf(line, sizeof(line), "\"%s\",%.1f,%.7f,%.7f,%.5f,%.5f,%.5f,%.5f,%.2f\n", name, epochDates[epoch], e, a,
+                incl, node, peri, m, h);
+            csv << line;
+        }
+    }
+    OrbitCatalog parsed, cached, csv;
+    CatalogStats cold, warm, csvStats;
+    remove(CatalogLoader::SidecarPath(path).c_str());
+    if (!CatalogLoader::Load(path, parsed, &cold) || !CatalogLoader::Load(path, cached, &warm) ||
+        !CatalogLoader::Load(csvPath, csv, &csvStats, false)) {
+        return;
+    }
+    bool same = cached.Size() == parsed.Size() && cached.names == parsed.names && cached.nameStart == parsed.nameStart;
+    bool csvSame = csv.Size() == parsed.Size() && csv.names == parsed.names;
+    for (int c = 0; c < OrbitCatalog::Columns; ++c) {
+        same = same && memcmp(cached.Column(c), parsed.Column(c), parsed.Size() * sizeof(double)) == 0;
+        csvSame = csvSame && memcmp(csv.Column(c), parsed.Column(c), parsed.Size() * sizeof(double)) == 0;
+    }
+    cout << "catalog, " << parsed.Size() << " records (" << cold.rejected << " rejected), " << cold.bytes / 1e6 << " MB on "
+        << WorkerCount() << " threads" << endl;
+    cout << "  parse " << cold.seconds * 1e3 << " ms (" << cold.bytes / 1e6 / cold.seconds << " MB/s, "
+        << parsed.Size() / cold.seconds / 1e6 << " M records/s), sidecar reload " << warm.seconds * 1e3 << " ms"
+        << (warm.fromSidecar ? "" : " (NOT FROM SIDECAR)") << ", " << (same ? "identical" : "MISMATCH") << endl;
+    cout << "  csv " << csvStats.bytes / 1e6 / csvStats.seconds << " MB/s, " << (csvSame ? "identical" : "MISMATCH")
+        << " to the fixed-width records" << endl;
+
+    // Random decimals of 1 to 17 significant digits with and without exponents
+    const size_t samples = 1000000;
+    vector<string> texts(samples);
+    for (size_t s = 0; s < samples; ++s) {
+        char text[64];
+        int digits = 1 + static_cast<int>(17 * unit(rng));
+        double value = (unit(rng) - 0.5) * pow(10.0, static_cast<int>(12 * unit(rng)) - 6);
+        snprintf(text, sizeof(text), unit(rng) < 0.5 ? "%.*g" : "%.*e", digits, value);
+        texts[s] = text;
+    }
+    vector<double> fastValues(samples), referenceValues(samples);
+    BenchClock::time_point start = BenchClock::now();
+    for (size_t s = 0; s < samples; ++s) {
+        const char* p = texts[s].c_str();
+        CatalogLoader::ParseDecimal(p, p + texts[s].size(), fastValues[s]);
+    }
+    double fast = SecondsSince(start);
+    start = BenchClock::now();
+    for (size_t s = 0; s < samples; ++s) {
+        referenceValues[s] = strtod(texts[s].c_str(), nullptr);
+    }
+    double reference = SecondsSince(start);
+    size_t mismatches = 0;
+    for (size_t s = 0; s < samples; ++s) {
+        mismatches += fastValues[s] != referenceValues[s] ? 1 : 0;
+    }
+    cout << "  decimal parser " << samples / fast / 1e6 << " M/s against strtod " << samples / reference / 1e6
+        << " M/s, " << mismatches << " results differing from strtod" << endl;
+    remove(path.c_str());
+    remove(csvPath.c_str());
+    remove(CatalogLoader::SidecarPath(path).c_str());
+}
+
+// Monte Carlo ensemble of the planetary system with perturbed planet velocities: members per second
+// with one simulation per member and with 4 and 8 members per SIMD lane batch, and how far the lane
+// batches' statistics drift from the per-member run (they should agree to rounding)
+void BenchEnsemble(size_t members) {
+    NBodySimulation base;
+    MakePlanetarySystem(base);
+    Scenario scenario;
+    scenario.integrator = "leapfrog";
+    scenario.step = 0.01;
+    scenario.endTime = 100.0;
+    const char* names[5] = { "sun", "p1", "p2", "p3", "p4" };
+    for (size_t i = 0; i < base.bodies.Size(); ++i) {
+        ScenarioBody body = { names[i], base.bodies.Position(i), base.bodies.Velocity(i), base.bodies.mass[i], 0.0 };
+        scenario.bodies.push_back(body);
+    }
+    ScenarioPerturbation perturbation = { ScenarioPerturbation::AllBodies, PerturbedQuantity::Velocity, true, 1e-3 };
+    scenario.perturbations.push_back(perturbation);
+    ScenarioApproach approach = { 1, 2, 0.4 };
+    scenario.approaches.push_back(approach);
+    ScenarioElements tracked = { 3, 0 };
+    scenario.elements.push_back(tracked);
+    cout << "ensemble, " << members << " members of the planetary system over " << scenario.endTime << " time units" << endl;
+
+    double reference[2] = { 0.0, 0.0 };
+    unsigned lanes[3] = { 1, 4, 8 };
+    for (int run = 0; run < 3; ++run) {
+        EnsembleSettings settings;
+        settings.members = members;
+        settings.lanes = lanes[run];
+        EnsembleRunner runner;
+        BenchClock::time_point start = BenchClock::now();
+        runner.Run(scenario, settings);
+        double seconds = SecondsSince(start);
+        double closest = runner.approaches[0].distance.mean, axis = runner.elements[0].semiMajorAxis.mean;
+        if (run == 0) {
+            reference[0] = closest;
+            reference[1] = axis;
+        }
+        cout << "  lanes " << lanes[run] << ": " << members / seconds << " members/s, mean closest approach " << closest
+            << " (diff " << fabs(closest - reference[0]) << "), mean a " << axis << " (diff " << fabs(axis - reference[1])
+            << ")" << endl;
+    }
+}
+
+// Speed against accuracy: the same collapsing cluster (softening 0.05, 0.5 time units) with bigger
+// steps, mixed precision, Barnes-Hut opening angles and the fast multipole method, each judged by the
+// conservation monitor's worst energy, momentum and angular momentum drift
+void BenchAccuracy(size_t n) {
+    const double duration = 0.5, softening = 0.05, baseStep = 1e-3;
+    cout << "accuracy, " << n << "-body cluster over " << duration << " time units, drift sampled every 10 steps" << endl;
+    for (int run = 0; run < 8; ++run) {
+        double dt = baseStep;
+        unique_ptr<GravitySolver> solver;
+        ostringstream label;
+        if (run < 3) {
+            dt = baseStep * (1 << run);
+            solver.reset(new DirectSummationSolver(1.0, softening));
+            label << "direct dt=" << dt;
+        }
+        else if (run == 3) {
+            solver.reset(new DirectSummationSolver(1.0, softening, KernelPrecision::Mixed));
+            label << "direct-mixed dt=" << dt;
+        }
+        else if (run < 7) {
+            double theta = run == 4 ? 0.3 : run == 5 ? 0.5 : 0.8;
+            solver.reset(new BarnesHutSolver(1.0, softening, theta));
+            label << "barnes-hut theta=" << theta;
+        }
+        else {
+            solver.reset(new FmmSolver(1.0, softening));
+            label << "fmm order 4";
+        }
+        NBodySimulation simulation(move(solver), MakeIntegrator(IntegratorKind::Leapfrog));
+        MakeCluster(simulation.bodies, n, 11);
+        simulation.Invalidate();
+        simulation.conservation.cadence = 10;
+        simulation.conservation.Sample(simulation.bodies, 1.0, softening, 0.0);
+        const int steps = static_cast<int>(round(duration / dt));
+        BenchClock::time_point start = BenchClock::now();
+        for (int s = 0; s < steps; ++s) {
+            simulation.Step(dt);
+        }
+        double seconds = SecondsSince(start);
+        ConservationDrift worst = simulation.conservation.WorstDrift();
+        cout << "  " << label.str() << ": " << 1e3 * (seconds - simulation.conservation.Seconds()) / steps
+            << " ms/step, " << 1e3 * seconds << " ms total, worst |dE/E| " << worst.energy << ", |dP|/P "
+            << worst.momentum << ", |dL|/L " << worst.angularMomentum << " (diagnostics "
+            << 1e3 * simulation.conservation.Seconds() << " ms)" << endl;
+    }
+}
+
+// Strong scaling of the three force backends on the job system, 1..maxThreads workers
+void BenchScaling(unsigned maxThreads) {
+    const double softening = 1e-3;
+    BodySystem small, large;
+    MakeCluster(small, 10000, 1);
+    MakeCluster(large, 100000, 1);
+    DirectSummationSolver direct(1.0, softening);
+    BarnesHutSolver barnesHut(1.0, softening);
+    FmmSolver fmm(1.0, softening);
+    GravitySolver* solvers[3] = { &direct, &barnesHut, &fmm };
+    BodySystem* systems[3] = { &small, &large, &large };
+    double baseline[3] = { 0.0, 0.0, 0.0 };
+
+    cout << "scaling, direct N=" << small.Size() << ", barnes-hut and fmm N=" << large.Size() << endl;
+    for (unsigned threads = 1; threads <= maxThreads; ++threads) {
+        SetWorkerCount(threads);
+        cout << "  " << JobSystem::Instance().Threads() << " threads:";
+        for (int s = 0; s < 3; ++s) {
+            double seconds = TimeSolver(*solvers[s], *systems[s]);
+            if (threads == 1) {
+                baseline[s] = seconds;
+            }
+            double speedup = baseline[s] / seconds;
+            cout << " " << solvers[s]->Name() << " " << seconds * 1e3 << " ms (x" << speedup << ", "
+                << 100.0 * speedup / threads << "%)";
+        }
+        cout << endl;
+    }
+    SetWorkerCount(0);
+}
+
+int main(int argc, char** argv) {
+    string mode = argc > 1 ? argv[1] : "direct";
+    if (mode == "direct") {
+        BenchDirect(ParseCounts(argc, argv, { 1000, 4000, 10000, 20000 }));
+    }
+    else if (mode == "barneshut") {
+        BenchBarnesHut(ParseCounts(argc, argv, { 10000, 100000, 1000000 }));
+    }
+    else if (mode == "fmm") {
+        BenchFmm(ParseCounts(argc, argv, { 10000, 100000, 1000000 }));
+    }
+    else if (mode == "kepler") {
+        BenchKepler(ParseCounts(argc, argv, { 100000, 1000000 }));
+    }
+    else if (mode == "integrators") {
+        BenchIntegrators();
+    }
+    else if (mode == "adaptive") {
+        BenchAdaptive();
+    }
+    else if (mode == "block") {
+        BenchBlockSteps(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 1000);
+    }
+    else if (mode == "snapshot") {
+        BenchSnapshot(ParseCounts(argc, argv, { 1000000, 10000000 }));
+    }
+    else if (mode == "collisions") {
+        BenchCollisions(ParseCounts(argc, argv, { 20000, 100000, 1000000 }));
+    }
+    else if (mode == "ephemeris") {
+        BenchEphemeris();
+    }
+    else if (mode == "accuracy") {
+        BenchAccuracy(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 1000);
+    }
+    else if (mode == "ensemble") {
+        BenchEnsemble(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 256);
+    }
+    else if (mode == "trajectory") {
+        BenchTrajectory(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 1000);
+    }
+    else if (mode == "bvh") {
+        BenchBvh(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 1000000);
+    }
+    else if (mode == "catalog") {
+        BenchCatalog(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 1300000);
+    }
+    else if (mode == "conjunctions") {
+        BenchConjunctions(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 100000);
+    }
+    else if (mode == "eclipses") {
+        BenchEclipses(argc > 2 ? strtod(argv[2], nullptr) : 300.0);
+    }
+    else if (mode == "sgp4") {
+        BenchSgp4(argc > 2 ? static_cast<size_t>(strtoul(argv[2], nullptr, 10)) : 50000);
+    }
+    else if (mode == "scaling") {
+        unsigned maxThreads = argc > 2 ? static_cast<unsigned>(strtoul(argv[2], nullptr, 10)) : thread::hardware_concurrency();
+        BenchScaling(max(maxThreads, 1u));
+    }
+    else {
+        cout << "ERROR::BENCH::UNKNOWN_MODE " << mode << endl;
+        cout << "modes: direct, barneshut, fmm, kepler, integrators, adaptive, block, collisions, ephemeris, snapshot, trajectory, ensemble, accuracy, catalog, bvh, conjunctions, eclipses, sgp4, scaling" << endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,373 @@
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "../src/Catalog.h"
+#include "../src/Conjunction.h"
+#include "../src/Ensemble.h"
+#include "../src/Scenario.h"
+#include "../src/SimulationClock.h"
+#include "../src/Snapshot.h"
+#include "../src/Trajectory.h"
+using namespace std;
+
+// Headless batch runner: loads a scenario, integrates it to the end time on every core and writes the
+// results, or screens an orbit catalog for close approaches. Links only the simulation core, so it runs
+// on servers without a display or GPU.
+
+typedef chrono::steady_clock CliClock;
+
+struct CliOptions {
+    string scenarioPath;
+    double endTime = NAN;           // overrides the scenario's
+    string integrator;              // overrides the scenario's
+    unsigned threads = 0;
+    string trajectoryPath;
+    double tolerance = 1e-9;
+    string finalPath;
+    string snapshotPath;
+    bool quiet = false;
+    size_t ensembleMembers = 0;     // 0: a single run
+    EnsembleSettings ensemble;
+    string reportPath;
+    string conservationPath;
+    unsigned cadence = 0;           // steps between conservation samples, 0: only at the start and end
+    string screenPath;              // orbit catalog to screen instead of running a scenario
+    double threshold = 0.001;       // AU
+    double span = 30.0;             // days
+    double startDate = NAN;         // JD, default the catalog's first epoch
+    size_t limit = 0;               // 0: every record
+    string eventsPath;
+};
+
+void PrintUsage() {
+    cout << "usage: solarsim-cli <scenario> [options]" << endl
+        << "       solarsim-cli --screen <catalog> [--threshold <au>] [--span <days>] [--start <jd>] [--limit <n>] [--events <path>]" << endl
+        << "  --end <time>            run to this time instead of the scenario's end" << endl
+        << "  --integrator <name>     leapfrog, yoshida4, wisdom-holman, ias15 or block-leapfrog" << endl
+        << "  --threads <n>           worker threads (default: every hardware thread)" << endl
+        << "  --trajectory <path>     record positions every output interval (see --tolerance)" << endl
+        << "  --tolerance <value>     largest position error of the trajectory (default 1e-9)" << endl
+        << "  --final <path>          write the final state as CSV" << endl
+        << "  --snapshot <path>       write a snapshot at the end, which the viewer restores with F9" << endl
+        << "  --conservation <path>   write energy and momentum drift as a CSV time series" << endl
+        << "  --cadence <steps>       steps between conservation samples (default: start and end only)" << endl
+        << "  --quiet                 no progress output" << endl
+        << "  --ensemble <n>          run n perturbed copies (the scenario's perturb, approach and elements lines)" << endl
+        << "  --seed <value>          ensemble random seed (default 1)" << endl
+        << "  --lanes <1|4|8>         ensemble members per SIMD batch for small leapfrog systems (default 1)" << endl
+        << "  --report <path>         write the ensemble report to a file instead of the console" << endl
+        << "  --screen <catalog>      find close approaches in an MPCORB.DAT or CSV orbit catalog" << endl
+        << "  --threshold <au>        closest approach distance to report (default 0.001)" << endl
+        << "  --span <days>           length of the screening window (default 30)" << endl
+        << "  --start <jd>            start of the window (default: the first record's epoch)" << endl
+        << "  --limit <n>             screen only the first n records" << endl
+        << "  --events <path>         write the events as CSV instead of listing them" << endl;
+}
+
+bool ParseOptions(int argc, char** argv, CliOptions& options) {
+    for (int a = 1; a < argc; ++a) {
+        string arg = argv[a];
+        bool hasValue = a + 1 < argc;
+        if (arg == "--quiet") {
+            options.quiet = true;
+        }
+        else if (arg.compare(0, 2, "--") == 0 && !hasValue) {
+            cout << "ERROR::CLI::MISSING_VALUE " << arg << endl;
+            return false;
+        }
+        else if (arg == "--end") {
+            options.endTime = strtod(argv[++a], nullptr);
+        }
+        else if (arg == "--integrator") {
+            options.integrator = argv[++a];
+        }
+        else if (arg == "--threads") {
+            options.threads = static_cast<unsigned>(strtoul(argv[++a], nullptr, 10));
+        }
+        else if (arg == "--trajectory") {
+            options.trajectoryPath = argv[++a];
+        }
+        else if (arg == "--tolerance") {
+            options.tolerance = strtod(argv[++a], nullptr);
+        }
+        else if (arg == "--final") {
+            options.finalPath = argv[++a];
+        }
+        else if (arg == "--snapshot") {
+            options.snapshotPath = argv[++a];
+        }
+        else if (arg == "--conservation") {
+            options.conservationPath = argv[++a];
+        }
+        else if (arg == "--cadence") {
+            options.cadence = static_cast<unsigned>(strtoul(argv[++a], nullptr, 10));
+        }
+        else if (arg == "--ensemble") {
+            options.ensembleMembers = static_cast<size_t>(strtoull(argv[++a], nullptr, 10));
+        }
+        else if (arg == "--seed") {
+            options.ensemble.seed = strtoull(argv[++a], nullptr, 10);
+        }
+        else if (arg == "--lanes") {
+            options.ensemble.lanes = static_cast<unsigned>(strtoul(argv[++a], nullptr, 10));
+        }
+        else if (arg == "--report") {
+            options.reportPath = argv[++a];
+        }
+        else if (arg == "--screen") {
+            options.screenPath = argv[++a];
+        }
+        else if (arg == "--threshold") {
+            options.threshold = strtod(argv[++a], nullptr);
+        }
+        else if (arg == "--span") {
+            options.span = strtod(argv[++a], nullptr);
+        }
+        else if (arg == "--start") {
+            options.startDate = strtod(argv[++a], nullptr);
+        }
+        else if (arg == "--limit") {
+            options.limit = static_cast<size_t>(strtoull(argv[++a], nullptr, 10));
+        }
+        else if (arg == "--events") {
+            options.eventsPath = argv[++a];
+        }
+        else if (arg.compare(0, 2, "--") == 0 || !options.scenarioPath.empty()) {
+            cout << "ERROR::CLI::UNKNOWN_ARGUMENT " << arg << endl;
+            return false;
+        }
+        else {
+            options.scenarioPath = arg;
+        }
+    }
+    if (!options.screenPath.empty()) {
+        if (!options.scenarioPath.empty() || !(options.threshold > 0.0) || !(options.span > 0.0)) {
+            cout << "ERROR::CLI::SCREEN_NEEDS_A_CATALOG_THRESHOLD_AND_SPAN_ONLY" << endl;
+            return false;
+        }
+        return true;
+    }
+    if (options.scenarioPath.empty()) {
+        PrintUsage();
+        return false;
+    }
+    if (options.ensembleMembers > 0 &&
+        (!options.trajectoryPath.empty() || !options.finalPath.empty() || !options.snapshotPath.empty() ||
+        !options.conservationPath.empty())) {
+        cout << "ERROR::CLI::ENSEMBLE_WRITES_A_REPORT_ONLY" << endl;
+        return false;
+    }
+    return true;
+}
+
+// Runs the perturbed copies and prints the aggregated statistics
+int RunEnsemble(const CliOptions& options, const Scenario& scenario) {
+    EnsembleSettings settings = options.ensemble;
+    settings.members = options.ensembleMembers;
+    if (!options.quiet) {
+        cout << options.scenarioPath << ": ensemble of " << settings.members << " members, " << scenario.bodies.size()
+            << " bodies, " << scenario.perturbations.size() << " perturbations, seed " << settings.seed << " on "
+            << WorkerCount() << " threads" << endl;
+    }
+    EnsembleRunner runner;
+    CliClock::time_point start = CliClock::now();
+    if (!runner.Run(scenario, settings)) {
+        return EXIT_FAILURE;
+    }
+    double seconds = chrono::duration<double>(CliClock::now() - start).count();
+    if (!options.quiet) {
+        cout << "done in " << seconds << " s (" << settings.members / seconds << " members/s, "
+            << (runner.LaneBatches() > 0 ? "SIMD lane batches" : "one simulation per member") << ")" << endl;
+    }
+    if (options.reportPath.empty()) {
+        runner.Print(cout, scenario);
+        return 0;
+    }
+    ofstream report(options.reportPath.c_str());
+    runner.Print(report, scenario);
+    if (!report) {
+        cout << "ERROR::CLI::FILE_NOT_WRITTEN " << options.reportPath << endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+// Close approaches among the catalog's orbits around the Sun over the window, in AU and days
+int RunScreen(const CliOptions& options) {
+    OrbitCatalog catalog;
+    CatalogStats loaded;
+    if (!CatalogLoader::Load(options.screenPath, catalog, &loaded)) {
+        return EXIT_FAILURE;
+    }
+    const size_t count = options.limit > 0 ? min(options.limit, catalog.Size()) : catalog.Size();
+    const double start = !std::isnan(options.startDate) ? options.startDate : (count > 0 ? catalog.epoch[0] : 0.0);
+    const double gauss = 0.01720209895;
+    // Times run from the window's start, which keeps the root finding well inside double precision
+    KeplerOrbits orbits(gauss * gauss);
+    orbits.Reserve(count);
+    vector<uint32_t> record;
+    record.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        OrbitalElements elements = catalog.Elements(i);
+        elements.epoch -= start;
+        if (elements.eccentricity < 1.0 && orbits.Add(elements) != KeplerOrbits::Invalid) {
+            record.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    ConjunctionSettings settings;
+    settings.threshold = options.threshold;
+    settings.start = 0.0;
+    settings.end = options.span;
+    if (!options.quiet) {
+        cout << options.screenPath << ": " << orbits.Size() << " orbits (" << count - orbits.Size()
+            << " unbound skipped) from JD " << setprecision(10) << start << setprecision(6) << " over "
+            << options.span << " days within " << options.threshold << " AU on " << WorkerCount() << " threads" << endl;
+    }
+    ConjunctionStats stats;
+    vector<Conjunction> events = ConjunctionScreen::Screen(orbits, settings, &stats);
+    if (!options.quiet) {
+        cout << "done in " << stats.seconds << " s: " << stats.buckets << " buckets of " << stats.bucket << " days, "
+            << stats.sweepPairs << " swept pairs, " << stats.apsisRejected << " rejected by apsides, "
+            << stats.pathRejected << " by orbit paths, " << stats.refined << " refined, " << stats.events
+            << " events" << endl;
+    }
+
+    const double kmPerAu = 149597870.7;
+    ofstream file;
+    if (!options.eventsPath.empty()) {
+        file.open(options.eventsPath.c_str());
+        if (!file) {
+            cout << "ERROR::CLI::FILE_NOT_WRITTEN " << options.eventsPath << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    ostream& out = options.eventsPath.empty() ? cout : file;
+    out << setprecision(12) << "jd,first,second,distance_km,relative_speed_km_s" << endl;
+    for (size_t e = 0; e < events.size(); ++e) {
+        const Conjunction& event = events[e];
+        out << start + event.time << "," << catalog.Name(record[event.first]) << "," << catalog.Name(record[event.second])
+            << "," << event.distance * kmPerAu << "," << event.relativeSpeed * kmPerAu / 86400.0 << "\n";
+    }
+    out.flush();
+    if (!out) {
+        cout << "ERROR::CLI::FILE_NOT_WRITTEN " << options.eventsPath << endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
+
+// One line per body: name, position, velocity, mass, in full double precision
+bool WriteFinalState(const string& path, const Scenario& scenario, const NBodySimulation& simulation) {
+    ofstream out(path.c_str());
+    if (!out) {
+        cout << "ERROR::CLI::FILE_NOT_WRITTEN " << path << endl;
+        return false;
+    }
+    const BodySystem& b = simulation.bodies;
+    out << setprecision(17) << "# t " << simulation.time << endl << "name,x,y,z,vx,vy,vz,mass" << endl;
+    for (size_t i = 0; i < b.Size(); ++i) {
+        out << scenario.bodies[i].name << "," << b.x[i] << "," << b.y[i] << "," << b.z[i] << "," << b.vx[i] << ","
+            << b.vy[i] << "," << b.vz[i] << "," << b.mass[i] << endl;
+    }
+    return static_cast<bool>(out);
+}
+
+int main(int argc, char** argv) {
+    CliOptions options;
+    if (!ParseOptions(argc, argv, options)) {
+        return EXIT_FAILURE;
+    }
+    if (options.threads > 0) {
+        SetWorkerCount(options.threads);
+    }
+    if (!options.screenPath.empty()) {
+        return RunScreen(options);
+    }
+    Scenario scenario;
+    if (!scenario.Load(options.scenarioPath)) {
+        return EXIT_FAILURE;
+    }
+    if (!options.integrator.empty()) {
+        if (!Scenario::KnownIntegrator(options.integrator)) {
+            cout << "ERROR::CLI::UNKNOWN_INTEGRATOR " << options.integrator << endl;
+            return EXIT_FAILURE;
+        }
+        scenario.integrator = options.integrator;
+    }
+    if (!std::isnan(options.endTime)) {
+        scenario.endTime = options.endTime;
+    }
+    if (options.ensembleMembers > 0) {
+        return RunEnsemble(options, scenario);
+    }
+
+    NBodySimulation simulation;
+    scenario.Build(simulation);
+
+    const unsigned long long steps = static_cast<unsigned long long>(max(0.0, round(scenario.endTime / scenario.step)));
+    const unsigned long long outputEvery = scenario.outputInterval > 0.0 ?
+        max(1ULL, static_cast<unsigned long long>(round(scenario.outputInterval / scenario.step))) : 1ULL;
+    TrajectoryRecorder recorder;
+    if (!options.trajectoryPath.empty()) {
+        if (!recorder.Open(options.trajectoryPath, simulation.bodies.Size(), simulation.time,
+            scenario.step * outputEvery, options.tolerance)) {
+            return EXIT_FAILURE;
+        }
+        recorder.Record(simulation.bodies);
+    }
+    // Energy and momentum are always compared between the start and the end; the cadence adds samples between
+    ConservationMonitor& conservation = simulation.conservation;
+    if (!options.conservationPath.empty() && !conservation.OpenSeries(options.conservationPath)) {
+        return EXIT_FAILURE;
+    }
+    conservation.cadence = options.cadence;
+    conservation.Sample(simulation.bodies, simulation.Solver().G, simulation.Solver().softening, simulation.time);
+    if (!options.quiet) {
+        cout << options.scenarioPath << ": " << simulation.bodies.Size() << " bodies, " << simulation.Solver().Name()
+            << " forces, " << simulation.CurrentIntegrator().Name() << ", " << steps << " steps of " << scenario.step
+            << " on " << WorkerCount() << " threads" << endl;
+    }
+
+    CliClock::time_point start = CliClock::now(), lastReport = start;
+    for (unsigned long long s = 1; s <= steps; ++s) {
+        simulation.Step(scenario.step);
+        if (s % outputEvery == 0 && recorder.IsOpen() && !recorder.Record(simulation.bodies)) {
+            cout << "ERROR::CLI::TRAJECTORY_NOT_WRITTEN" << endl;
+            return EXIT_FAILURE;
+        }
+        if (!options.quiet && chrono::duration<double>(CliClock::now() - lastReport).count() > 10.0) {
+            lastReport = CliClock::now();
+            cout << "  t " << simulation.time << " (" << 100.0 * s / steps << "%)" << endl;
+        }
+    }
+    double seconds = chrono::duration<double>(CliClock::now() - start).count();
+    if (conservation.Latest().time != simulation.time) {
+        conservation.Sample(simulation.bodies, simulation.Solver().G, simulation.Solver().softening, simulation.time);
+    }
+    conservation.CloseSeries();
+
+    bool ok = recorder.Close();
+    if (!options.finalPath.empty()) {
+        ok = WriteFinalState(options.finalPath, scenario, simulation) && ok;
+    }
+    if (!options.snapshotPath.empty()) {
+        SimulationClock clock(scenario.step);
+        clock.Restore(simulation.time, steps);
+        SnapshotWriter writer;
+        ok = writer.Capture(simulation, clock, options.snapshotPath) && writer.Wait() && ok;
+    }
+    if (!options.quiet) {
+        cout << "done: t " << simulation.time << " in " << seconds << " s, " << simulation.Solver().interactions
+            << " interactions, " << simulation.CurrentIntegrator().StepsTaken() << " integrator steps" << endl;
+        ConservationDrift drift = conservation.Drift(), worst = conservation.WorstDrift();
+        cout << "conservation: |dE/E| " << drift.energy << " (worst " << worst.energy << "), |dP|/P " << drift.momentum
+            << ", |dL|/L " << drift.angularMomentum << " over " << conservation.Samples() << " samples in "
+            << 1e3 * conservation.Seconds() << " ms" << endl;
+    }
+    return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+#define NUMBER_OF_POINT_LIGHTS 2
+
+in vec3 FragPos;
+in vec3 Normal;
+
+out vec4 color;
+
+uniform vec3 lightPositions[NUMBER_OF_POINT_LIGHTS];
+uniform vec3 lightColors[NUMBER_OF_POINT_LIGHTS];
+uniform vec3 albedo;
+
+void main() {
+    vec3 norm = normalize(Normal);
+    vec3 result = 0.1 * albedo;
+    for (int i = 0; i < NUMBER_OF_POINT_LIGHTS; i++) {
+        vec3 lightDir = normalize(lightPositions[i] - FragPos);
+        result += lightColors[i] * max(dot(norm, lightDir), 0.0) * albedo;
+    }
+    color = vec4(result, 1.0);
+}
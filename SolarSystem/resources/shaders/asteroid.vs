@@ -0,0 +1,26 @@
+#version 330 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec3 instancePosition;
+layout (location = 3) in vec2 instanceShape;    // size, spin phase
+
+out vec3 Normal;
+out vec3 FragPos;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float time;
+
+// Rotation about a per-instance axis (Rodrigues)
+vec3 spin(vec3 v, vec3 axis, float angle) {
+    return v * cos(angle) + cross(axis, v) * sin(angle) + axis * dot(axis, v) * (1.0 - cos(angle));
+}
+
+void main() {
+    float phase = instanceShape.y;
+    vec3 axis = normalize(vec3(sin(phase * 7.0), 1.0, cos(phase * 3.0)));
+    float angle = phase + time * (0.2 + 0.1 * sin(phase * 5.0));
+    FragPos = instancePosition + spin(position, axis, angle) * instanceShape.x;
+    Normal = spin(normal, axis, angle);
+    gl_Position = projection * view * vec4(FragPos, 1.0f);
+}
@@ -0,0 +1,272 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "Kepler.h"
+#include "Catalog.h"
+#include "Bvh.h"
+
+// Main-belt asteroids on Keplerian orbits. Every frame the batch propagator writes float positions
+// straight into a mapped per-instance buffer; a few procedurally generated low-poly rocks are then
+// drawn with one instanced call each, the instances being grouped by rock shape.
+class AsteroidBelt {
+public:
+    static const int RockVariants = 3;
+
+    KeplerOrbits orbits;
+    bool visible;
+
+    AsteroidBelt() : visible(false), meshVBO(0), positionVBO(0), shapeVBO(0), pickTime(0.0), pickCenter(0.0), pickStale(true) {
+        for (int v = 0; v < RockVariants; ++v) {
+            VAOs[v] = 0;
+        }
+    }
+
+    ~AsteroidBelt() {
+        Release();
+    }
+
+    AsteroidBelt(const AsteroidBelt&) = delete;
+    AsteroidBelt& operator=(const AsteroidBelt&) = delete;
+
+    // Frees the GL objects; call it while the context is current, the destructor then finds nothing left to free
+    void Release() {
+        for (int v = 0; v < RockVariants; ++v) {
+            if (VAOs[v] != 0) {
+                glDeleteVertexArrays(1, &VAOs[v]);
+                VAOs[v] = 0;
+            }
+        }
+        GLuint buffers[3] = { meshVBO, positionVBO, shapeVBO };
+        for (int b = 0; b < 3; ++b) {
+            if (buffers[b] != 0) {
+                glDeleteBuffers(1, &buffers[b]);
+            }
+        }
+        meshVBO = positionVBO = shapeVBO = 0;
+    }
+
+    size_t Size() const {
+        return orbits.Size();
+    }
+
+    // Generates `count` asteroids with semi-major axes in [innerRadius, outerRadius] around a body with
+    // parameter mu. `frame` maps the elements' reference plane into the scene (see KeplerOrbits::Add).
+    void Generate(size_t count, double mu, double innerRadius, double outerRadius, const glm::dmat3& frame,
+        unsigned seed = 7) {
+        std::mt19937_64 rng(seed);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        std::normal_distribution<double> spread(0.0, 1.0);
+        const double twoPi = 6.283185307179586;
+
+        orbits.Clear();
+        orbits.Reserve(count);
+        std::vector<glm::vec2> shapes;
+        shapes.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            OrbitalElements elements;
+            elements.semiMajorAxis = innerRadius + (outerRadius - innerRadius) * unit(rng);
+            elements.eccentricity = std::min(std::fabs(0.07 * spread(rng)), 0.3);
+            elements.inclination = std::min(std::fabs(0.1 * spread(rng)), 0.5);
+            elements.ascendingNode = twoPi * unit(rng);
+            elements.argumentOfPeriapsis = twoPi * unit(rng);
+            elements.meanAnomaly = twoPi * unit(rng);
+            orbits.Add(elements, mu, frame);
+
+            // Mostly small rocks with a few large ones, and a random spin phase
+            float size = 0.01f + 0.03f * static_cast<float>(std::pow(unit(rng), 4.0));
+            shapes.push_back(glm::vec2(size, static_cast<float>(twoPi * unit(rng))));
+        }
+        upload(shapes);
+    }
+
+    // Shows up to `maxCount` bodies of a real catalog. `axisToScene` maps a semi-major axis in AU to scene
+    // units; mean anomalies are first carried to the catalog's first epoch with the real mean motions, so
+    // the bodies keep their true relative phases. Orbits that are not closed ellipses are left out.
+    template <typename AxisMap>
+    void Load(const OrbitCatalog& catalog, double mu, const AxisMap& axisToScene, const glm::dmat3& frame,
+        size_t maxCount = static_cast<size_t>(-1)) {
+        const double gauss = 0.01720209895;     // rad/day for a = 1 AU around the Sun
+        const double twoPi = 6.283185307179586;
+        std::mt19937_64 rng(7);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+        const size_t count = std::min(catalog.Size(), maxCount);
+        const double epoch = count > 0 ? catalog.epoch[0] : 0.0;
+
+        orbits.Clear();
+        orbits.Reserve(count);
+        std::vector<glm::vec2> shapes;
+        shapes.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            OrbitalElements elements = catalog.Elements(i);
+            if (!(elements.semiMajorAxis > 0.0) || !(elements.eccentricity >= 0.0 && elements.eccentricity < 1.0)) {
+                continue;
+            }
+            double motion = gauss / std::pow(elements.semiMajorAxis, 1.5);
+            elements.meanAnomaly = std::fmod(elements.meanAnomaly + motion * (epoch - catalog.epoch[i]), twoPi);
+            elements.semiMajorAxis = axisToScene(elements.semiMajorAxis);
+            elements.epoch = 0.0;
+            orbits.Add(elements, mu, frame);
+
+            // Brighter (lower H) bodies are drawn larger
+            double h = catalog.absoluteMagnitude[i];
+            double bright = std::isnan(h) ? 0.0 : std::max(0.0, std::min(1.0, (18.0 - h) / 15.0));
+            float size = 0.01f + 0.03f * static_cast<float>(bright * bright);
+            shapes.push_back(glm::vec2(size, static_cast<float>(twoPi * unit(rng))));
+        }
+        upload(shapes);
+    }
+
+    // Propagates every asteroid to time t and refreshes the instance positions (offset by `center`)
+    void Update(double t, const glm::dvec3& center) {
+        if (!visible || Size() == 0) {
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        GLsizeiptr bytes = static_cast<GLsizeiptr>(Size() * 3 * sizeof(float));
+        void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped == nullptr) {
+            std::cout << "ERROR::ASTEROIDS::MAP_FAILED" << std::endl;
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return;
+        }
+        orbits.Propagate(t, static_cast<float*>(mapped), 3, center);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Pick tree over the rocks at time t, offset by `center` like Update. It is brought up to date only
+    // when asked: the belt's orbits shear apart within a few hundred frames, so a tree kept every frame
+    // would need a full rebuild every few frames, while a query pays at most one rebuild.
+    const SphereBvh& PickTree(double t, const glm::dvec3& center) {
+        if (pickStale || t != pickTime || center != pickCenter) {
+            orbits.Propagate(t, pickTree.Positions(), 3, center);
+            pickTree.Update();
+            pickTime = t;
+            pickCenter = center;
+            pickStale = false;
+        }
+        return pickTree;
+    }
+
+    // One instanced draw per rock shape; the shader expects view, projection, time and the lights
+    void Draw(Shader& shader, float time) {
+        if (!visible || Size() == 0) {
+            return;
+        }
+        glUniform1f(glGetUniformLocation(shader.Program, "time"), time);
+        glUniform3f(glGetUniformLocation(shader.Program, "albedo"), 0.45f, 0.4f, 0.35f);
+        for (int v = 0; v < RockVariants; ++v) {
+            GLsizei instances = static_cast<GLsizei>(instanceFirst[v + 1] - instanceFirst[v]);
+            if (instances == 0) {
+                continue;
+            }
+            glBindVertexArray(VAOs[v]);
+            glDrawArraysInstanced(GL_TRIANGLES, vertexFirst[v], vertexFirst[v + 1] - vertexFirst[v], instances);
+        }
+        glBindVertexArray(0);
+    }
+
+private:
+    struct RockVertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    GLuint meshVBO, positionVBO, shapeVBO;
+    SphereBvh pickTree;
+    double pickTime;
+    glm::dvec3 pickCenter;
+    bool pickStale;
+    GLuint VAOs[RockVariants];
+    GLint vertexFirst[RockVariants + 1];
+    size_t instanceFirst[RockVariants + 1];
+
+    // Icosahedron with jittered vertex radii and flat normals: 20 faces, 60 vertices per rock
+    static void appendRock(std::vector<RockVertex>& out, unsigned seed) {
+        const float t = 1.618034f;
+        glm::vec3 corners[12] = {
+            glm::vec3(-1, t, 0), glm::vec3(1, t, 0), glm::vec3(-1, -t, 0), glm::vec3(1, -t, 0),
+            glm::vec3(0, -1, t), glm::vec3(0, 1, t), glm::vec3(0, -1, -t), glm::vec3(0, 1, -t),
+            glm::vec3(t, 0, -1), glm::vec3(t, 0, 1), glm::vec3(-t, 0, -1), glm::vec3(-t, 0, 1)
+        };
+        const int faces[20][3] = {
+            { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+            { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+            { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+            { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+        };
+        std::mt19937 rng(seed);
+        std::uniform_real_distribution<float> jitter(0.7f, 1.2f);
+        for (int c = 0; c < 12; ++c) {
+            corners[c] = glm::normalize(corners[c]) * jitter(rng);
+        }
+        for (int f = 0; f < 20; ++f) {
+            glm::vec3 a = corners[faces[f][0]], b = corners[faces[f][1]], c = corners[faces[f][2]];
+            glm::vec3 normal = glm::normalize(glm::cross(b - a, c - a));
+            RockVertex va = { a, normal }, vb = { b, normal }, vc = { c, normal };
+            out.push_back(va); out.push_back(vb); out.push_back(vc);
+        }
+    }
+
+    void upload(const std::vector<glm::vec2>& shapes) {
+        Release();
+        const size_t count = shapes.size();
+        pickTree.Resize(0);
+        pickTree.Resize(count);
+        pickStale = true;
+        for (size_t i = 0; i < count; ++i) {
+            pickTree.Radii()[i] = 1.2f * shapes[i].x;       // the rocks' jittered corners reach 1.2
+        }
+        std::vector<RockVertex> rocks;
+        for (int v = 0; v < RockVariants; ++v) {
+            vertexFirst[v] = static_cast<GLint>(rocks.size());
+            appendRock(rocks, 17u + 31u * static_cast<unsigned>(v));
+            instanceFirst[v] = count * v / RockVariants;
+        }
+        vertexFirst[RockVariants] = static_cast<GLint>(rocks.size());
+        instanceFirst[RockVariants] = count;
+
+        glGenBuffers(1, &meshVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glBufferData(GL_ARRAY_BUFFER, rocks.size() * sizeof(RockVertex), &rocks[0], GL_STATIC_DRAW);
+        glGenBuffers(1, &positionVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, count * 3 * sizeof(float), nullptr, GL_STREAM_DRAW);
+        glGenBuffers(1, &shapeVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, shapeVBO);
+        glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec2), count > 0 ? &shapes[0] : nullptr, GL_STATIC_DRAW);
+
+        // One VAO per rock shape whose instance attributes start at that shape's first instance
+        glGenVertexArrays(RockVariants, VAOs);
+        for (int v = 0; v < RockVariants; ++v) {
+            glBindVertexArray(VAOs[v]);
+            glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(RockVertex), (void*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(RockVertex), (void*)offsetof(RockVertex, normal));
+
+            glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+            glEnableVertexAttribArray(2);
+            glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)(instanceFirst[v] * 3 * sizeof(float)));
+            glVertexAttribDivisor(2, 1);
+
+            glBindBuffer(GL_ARRAY_BUFFER, shapeVBO);
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)(instanceFirst[v] * sizeof(glm::vec2)));
+            glVertexAttribDivisor(3, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+#include "NBody.h"
+#include "Octree.h"
+#include "Parallel.h"
+
+// Barnes-Hut tree code on the linearized Morton octree. A cell is replaced by its monopole when
+// size / distance < theta and the target lies outside it. Targets are walked in Morton order so
+// neighbouring threads touch neighbouring cells. Between substeps the tree is only refit while the
+// bodies have moved less than `reuseTolerance` mean leaf sizes; cell sizes are inflated by the
+// drift so the opening test stays conservative.
+class BarnesHutSolver : public GravitySolver {
+public:
+    double theta;
+    double reuseTolerance;
+    int maxRefits;
+    Octree tree;
+    unsigned long long rebuilds, refits;
+
+    BarnesHutSolver(double G = 1.0, double softening = 0.0, double theta = 0.5, size_t leafSize = 16)
+        : GravitySolver(G, softening), theta(theta), reuseTolerance(0.25), maxRefits(16), tree(leafSize),
+          rebuilds(0), refits(0), refitsSinceBuild(0) {}
+
+    const char* Name() const override {
+        return "barnes-hut";
+    }
+
+    void ComputeAccelerations(BodySystem& bodies) override {
+        const size_t n = bodies.Size();
+        if (n == 0) {
+            return;
+        }
+        updateTree(bodies);
+
+        std::atomic<unsigned long long> counted(0);
+        ParallelFor(0, n, 256, [&](size_t begin, size_t end) {
+            unsigned long long local = 0;
+            for (size_t k = begin; k < end; ++k) {
+                glm::dvec3 a = walk(k, local);
+                uint32_t i = tree.order[k];
+                bodies.ax[i] = G * a.x; bodies.ay[i] = G * a.y; bodies.az[i] = G * a.z;
+            }
+            counted += local;
+        });
+        interactions += counted;
+    }
+
+    // Forces the next evaluation to rebuild instead of refitting (e.g. after bodies were added)
+    void Invalidate() {
+        tree.nodes.clear();
+    }
+
+private:
+    int refitsSinceBuild;
+
+    void updateTree(const BodySystem& bodies) {
+        bool rebuild = tree.nodes.empty() || tree.BodyCount() != bodies.Size() || refitsSinceBuild >= maxRefits;
+        if (!rebuild) {
+            double drift = tree.Refit(bodies);
+            rebuild = drift > reuseTolerance * tree.meanLeafHalfSize;
+            ++refits;
+            ++refitsSinceBuild;
+        }
+        if (rebuild) {
+            tree.Build(bodies);
+            ++rebuilds;
+            refitsSinceBuild = 0;
+        }
+    }
+
+    // Stackless depth-first walk for the body at Morton index k
+    glm::dvec3 walk(size_t k, unsigned long long& count) const {
+        const std::vector<OctreeNode>& nodes = tree.nodes;
+        const double px = tree.sx[k], py = tree.sy[k], pz = tree.sz[k];
+        const double eps2 = softening * softening;
+        const double theta2 = theta * theta;
+        const double margin = tree.drift;
+        double ax = 0.0, ay = 0.0, az = 0.0;
+
+        size_t i = 0;
+        while (i < nodes.size()) {
+            const OctreeNode& node = nodes[i];
+            double dx = node.comX - px, dy = node.comY - py, dz = node.comZ - pz;
+            double d2 = dx * dx + dy * dy + dz * dz;
+            double reach = node.halfSize + margin;
+            bool outside = std::fabs(px - node.centerX) > reach || std::fabs(py - node.centerY) > reach ||
+                std::fabs(pz - node.centerZ) > reach;
+            double size = 2.0 * reach;
+
+            if (outside && size * size < theta2 * d2) {
+                double r2 = d2 + eps2;
+                double inv = 1.0 / std::sqrt(r2);
+                double s = node.mass * inv * inv * inv;
+                ax += dx * s; ay += dy * s; az += dz * s;
+                ++count;
+                i = node.skip;
+            }
+            else if (node.leaf) {
+                for (uint32_t j = node.first; j < node.first + node.count; ++j) {
+                    double ex = tree.sx[j] - px, ey = tree.sy[j] - py, ez = tree.sz[j] - pz;
+                    double r2 = ex * ex + ey * ey + ez * ez + eps2;
+                    if (r2 > 0.0) {
+                        double inv = 1.0 / std::sqrt(r2);
+                        double s = tree.sm[j] * inv * inv * inv;
+                        ax += ex * s; ay += ey * s; az += ez * s;
+                    }
+                }
+                count += node.count;
+                i = node.skip;
+            }
+            else {
+                ++i;
+            }
+        }
+        return glm::dvec3(ax, ay, az);
+    }
+};
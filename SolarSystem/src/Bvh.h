@@ -0,0 +1,515 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Parallel.h"
+
+// A sphere found by a query: its index, and the distance along the ray (Raycast) or from the point (Nearest)
+struct BvhHit {
+    size_t index;
+    float distance;
+};
+
+// Bounding-volume hierarchy over spheres (a body's position and pick radius) for ray picking and
+// k-nearest queries. The owner writes Positions() and Radii() and calls Update: the tree is refit
+// bottom up when it exists, and rebuilt with a binned surface-area heuristic when the bodies changed
+// count or the refit tree's SAH cost has grown past `rebuildRatio` times its cost when built (orbits
+// shear, so boxes of one node drift apart). The top levels are split serially until there are enough
+// subtrees for every worker; each subtree is then built, and later refit, on its own job and owns a
+// contiguous node range. Nodes hold float boxes, so positions should be camera or scene relative.
+class SphereBvh {
+public:
+    float rebuildRatio;
+    unsigned leafSize;
+
+    SphereBvh() : rebuildRatio(1.5f), leafSize(4), builtCost(0.0f), cost(0.0f), topNodes(0), rebuilds(0), refits(0) {}
+
+    void Resize(size_t n) {
+        positions.resize(3 * n);
+        radii.resize(n, 0.0f);
+    }
+
+    size_t Size() const {
+        return radii.size();
+    }
+
+    // x, y, z of every sphere, interleaved
+    float* Positions() {
+        return positions.data();
+    }
+
+    float* Radii() {
+        return radii.data();
+    }
+
+    glm::vec3 Position(size_t i) const {
+        return glm::vec3(positions[3 * i], positions[3 * i + 1], positions[3 * i + 2]);
+    }
+
+    // Refits, or rebuilds when needed; returns true when it rebuilt
+    bool Update() {
+        if (order.size() != Size() || nodes.empty()) {
+            Build();
+            return true;
+        }
+        Refit();
+        if (cost > rebuildRatio * builtCost) {
+            Build();
+            return true;
+        }
+        return false;
+    }
+
+    void Build() {
+        const size_t n = Size();
+        nodes.clear();
+        subtrees.clear();
+        order.resize(n);
+        prims.resize(n);
+        ParallelFor(0, n, 16384, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                BuildPrim prim = { Position(i), radii[i], static_cast<uint32_t>(i) };
+                prims[i] = prim;
+            }
+        });
+        if (n == 0) {
+            builtCost = cost = 0.0f;
+            return;
+        }
+
+        // Split breadth first until the open ranges are small enough to share out
+        const size_t target = std::max<size_t>(1, 4 * WorkerCount());
+        const size_t parallelSize = std::max<size_t>(4096, n / target);
+        std::vector<Range> open(1, Range{ 0, 0, static_cast<uint32_t>(n), 0 });
+        nodes.push_back(BvhNode());
+        std::vector<Range> pending;
+        for (size_t r = 0; r < open.size(); ++r) {
+            Range range = open[r];
+            if (range.end - range.begin > parallelSize) {
+                uint32_t left = static_cast<uint32_t>(nodes.size());
+                if (split(range, nodes[range.node], left)) {
+                    nodes.push_back(BvhNode());
+                    nodes.push_back(BvhNode());
+                    uint32_t middle = nodes[range.node].count;
+                    nodes[range.node].count = 0;
+                    open.push_back(Range{ left, range.begin, middle, range.depth + 1 });
+                    open.push_back(Range{ left + 1, middle, range.end, range.depth + 1 });
+                }
+                continue;
+            }
+            pending.push_back(range);
+        }
+        topNodes = nodes.size();
+
+        // Subtrees are built into their own arrays, then appended; a local child index c becomes base + c
+        std::vector<std::vector<BvhNode>> local(pending.size());
+        ParallelFor(0, pending.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; ++t) {
+                buildSubtree(pending[t], local[t]);
+            }
+        });
+        ParallelFor(0, n, 16384, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                order[i] = prims[i].index;
+            }
+        });
+        for (size_t t = 0; t < pending.size(); ++t) {
+            const uint32_t base = static_cast<uint32_t>(nodes.size()) - 1;
+            std::vector<BvhNode>& built = local[t];
+            for (size_t i = 0; i < built.size(); ++i) {
+                if (built[i].count == 0) {
+                    built[i].first += base;
+                }
+            }
+            nodes[pending[t].node] = built[0];
+            nodes.insert(nodes.end(), built.begin() + 1, built.end());
+            Subtree subtree = { pending[t].node, base + 1, static_cast<uint32_t>(nodes.size()) };
+            subtrees.push_back(subtree);
+        }
+        Refit();
+        builtCost = cost;
+        ++rebuilds;
+    }
+
+    // New boxes for the same topology: each subtree bottom up on its own job, then the top levels
+    void Refit() {
+        std::vector<float> subtreeCost(subtrees.size(), 0.0f);
+        ParallelFor(0, subtrees.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; ++t) {
+                float sum = 0.0f;
+                for (uint32_t i = subtrees[t].end; i-- > subtrees[t].begin;) {
+                    sum += refitNode(i);
+                }
+                subtreeCost[t] = sum;
+            }
+        });
+        float top = 0.0f;
+        for (size_t i = topNodes; i-- > 0;) {
+            top += refitNode(static_cast<uint32_t>(i));
+        }
+        for (size_t t = 0; t < subtrees.size(); ++t) {
+            top += subtreeCost[t];
+        }
+        float rootArea = nodes.empty() ? 0.0f : area(nodes[0]);
+        cost = rootArea > 0.0f ? top / rootArea : 0.0f;
+        ++refits;
+    }
+
+    // Closest sphere along the ray (direction normalized). A sphere also counts when the ray passes
+    // within `slope` times its distance of it, so small far-away bodies stay pickable at a fixed angle.
+    bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float slope, BvhHit& hit) const {
+        hit.index = static_cast<size_t>(-1);
+        hit.distance = std::numeric_limits<float>::max();
+        if (nodes.empty()) {
+            return false;
+        }
+        const glm::vec3 inverse(1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z);
+        uint32_t stack[StackSize];
+        int top = 0;
+        stack[top++] = 0;
+        while (top > 0) {
+            const BvhNode& node = nodes[stack[--top]];
+            if (node.count > 0) {
+                for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                    size_t i = order[k];
+                    glm::vec3 offset = Position(i) - origin;
+                    float along = glm::dot(offset, direction);
+                    if (along <= 0.0f) {
+                        continue;
+                    }
+                    float reach = radii[i] + slope * along;
+                    float miss2 = std::max(0.0f, glm::dot(offset, offset) - along * along);
+                    if (miss2 > reach * reach) {
+                        continue;
+                    }
+                    float enter = along - std::sqrt(std::max(0.0f, radii[i] * radii[i] - miss2));
+                    if (enter < hit.distance) {
+                        hit.index = i;
+                        hit.distance = enter;
+                    }
+                }
+                continue;
+            }
+            // Nearer child last, so it is popped first
+            float enter[2];
+            for (int c = 0; c < 2; ++c) {
+                enter[c] = entry(nodes[node.first + c], origin, inverse, slope);
+            }
+            int nearer = enter[1] < enter[0] ? 1 : 0;
+            for (int c = 0; c < 2; ++c) {
+                int child = c == 0 ? 1 - nearer : nearer;
+                if (enter[child] < hit.distance) {
+                    stack[top++] = node.first + child;
+                }
+            }
+        }
+        return hit.index != static_cast<size_t>(-1);
+    }
+
+    // The k sphere centers nearest to `point`, nearest first; returns how many were found
+    size_t Nearest(const glm::vec3& point, size_t k, std::vector<BvhHit>& out) const {
+        out.clear();
+        if (nodes.empty() || k == 0) {
+            return 0;
+        }
+        // `out` is a max-heap on distance while searching; nodes are visited nearest box first
+        auto farther = [](const BvhHit& a, const BvhHit& b) { return a.distance < b.distance; };
+        float bound = std::numeric_limits<float>::max();
+        uint32_t stack[StackSize];
+        float stackDistance[StackSize];
+        int top = 0;
+        stack[top] = 0;
+        stackDistance[top++] = 0.0f;
+        while (top > 0) {
+            --top;
+            if (stackDistance[top] > bound) {
+                continue;
+            }
+            const BvhNode& node = nodes[stack[top]];
+            if (node.count > 0) {
+                for (uint32_t j = node.first; j < node.first + node.count; ++j) {
+                    size_t i = order[j];
+                    float distance = glm::length(Position(i) - point);
+                    if (out.size() < k) {
+                        BvhHit hit = { i, distance };
+                        out.push_back(hit);
+                        std::push_heap(out.begin(), out.end(), farther);
+                    }
+                    else if (distance < out.front().distance) {
+                        std::pop_heap(out.begin(), out.end(), farther);
+                        out.back().index = i;
+                        out.back().distance = distance;
+                        std::push_heap(out.begin(), out.end(), farther);
+                    }
+                    if (out.size() == k) {
+                        bound = out.front().distance;
+                    }
+                }
+                continue;
+            }
+            float distance[2];
+            for (int c = 0; c < 2; ++c) {
+                distance[c] = boxDistance(nodes[node.first + c], point);
+            }
+            int nearer = distance[1] < distance[0] ? 1 : 0;
+            for (int c = 0; c < 2; ++c) {
+                int child = c == 0 ? 1 - nearer : nearer;
+                if (distance[child] <= bound) {
+                    stack[top] = node.first + child;
+                    stackDistance[top++] = distance[child];
+                }
+            }
+        }
+        std::sort_heap(out.begin(), out.end(), farther);
+        return out.size();
+    }
+
+    // SAH cost of the current boxes relative to the tree's cost when it was built
+    float Quality() const {
+        return builtCost > 0.0f ? cost / builtCost : 1.0f;
+    }
+
+    size_t Nodes() const {
+        return nodes.size();
+    }
+
+    unsigned long long Rebuilds() const {
+        return rebuilds;
+    }
+
+    unsigned long long Refits() const {
+        return refits;
+    }
+
+private:
+    static const int Bins = 16;
+    static const unsigned MaxDepth = 96;     // deeper ranges are split at the median to bound the stack
+    // Median splits halve a range of fewer than 2^32 spheres, so inner nodes are at most MaxDepth + 31 deep,
+    // and a traversal holds at most one pending sibling per level plus the two children just pushed
+    static const int StackSize = MaxDepth + 33;
+
+    // count > 0: a leaf over order[first, first + count); otherwise the children are first and first + 1
+    struct BvhNode {
+        glm::vec3 lo;
+        uint32_t first;
+        glm::vec3 hi;
+        uint32_t count;
+    };
+
+    struct Range {
+        uint32_t node, begin, end;
+        unsigned depth;
+    };
+
+    // Node range [begin, end) built as one job, whose root is `root` among the top nodes
+    struct Subtree {
+        uint32_t root, begin, end;
+    };
+
+    struct Bin {
+        glm::vec3 lo, hi;
+        uint32_t count;
+    };
+
+    // The build partitions these compact copies rather than indices into the positions
+    struct BuildPrim {
+        glm::vec3 center;
+        float radius;
+        uint32_t index;
+    };
+
+    std::vector<float> positions, radii;
+    std::vector<uint32_t> order;
+    std::vector<BuildPrim> prims;
+    std::vector<BvhNode> nodes;
+    std::vector<Subtree> subtrees;
+    float builtCost, cost;
+    size_t topNodes;
+    unsigned long long rebuilds, refits;
+
+    static float area(const BvhNode& node) {
+        glm::vec3 d = node.hi - node.lo;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    static float area(const glm::vec3& lo, const glm::vec3& hi) {
+        glm::vec3 d = hi - lo;
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+
+    // Component-wise min and max; glm's go through a function pointer that is not always inlined
+    static glm::vec3 minimum(const glm::vec3& a, const glm::vec3& b) {
+        return glm::vec3(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z);
+    }
+
+    static glm::vec3 maximum(const glm::vec3& a, const glm::vec3& b) {
+        return glm::vec3(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z);
+    }
+
+    // Box of node i from its children or spheres; returns its area weighted as in the SAH cost
+    float refitNode(uint32_t i) {
+        BvhNode& node = nodes[i];
+        if (node.count == 0) {
+            const BvhNode& a = nodes[node.first];
+            const BvhNode& b = nodes[node.first + 1];
+            node.lo = minimum(a.lo, b.lo);
+            node.hi = maximum(a.hi, b.hi);
+            return area(node);
+        }
+        glm::vec3 lo(std::numeric_limits<float>::max()), hi(-std::numeric_limits<float>::max());
+        for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+            size_t s = order[k];
+            glm::vec3 p = Position(s);
+            lo = minimum(lo, p - radii[s]);
+            hi = maximum(hi, p + radii[s]);
+        }
+        node.lo = lo;
+        node.hi = hi;
+        return area(node) * static_cast<float>(node.count);
+    }
+
+    // Bounds `node` over its range of prims and picks a split; on success node.count holds the split
+    // position and the range is partitioned, otherwise the node is made a leaf
+    bool split(const Range& range, BvhNode& node, uint32_t left) {
+        const float big = std::numeric_limits<float>::max();
+        glm::vec3 lo(big), hi(-big), centerLo(big), centerHi(-big);
+        for (uint32_t k = range.begin; k < range.end; ++k) {
+            const BuildPrim& prim = prims[k];
+            lo = minimum(lo, prim.center - prim.radius);
+            hi = maximum(hi, prim.center + prim.radius);
+            centerLo = minimum(centerLo, prim.center);
+            centerHi = maximum(centerHi, prim.center);
+        }
+        node.lo = lo;
+        node.hi = hi;
+        const uint32_t count = range.end - range.begin;
+        if (count <= leafSize) {
+            node.first = range.begin;
+            node.count = count;
+            return false;
+        }
+        node.first = left;
+
+        glm::vec3 extent = centerHi - centerLo;
+        if (std::max(extent.x, std::max(extent.y, extent.z)) <= 0.0f || range.depth >= MaxDepth) {
+            // Coincident centers (or a runaway depth): split the range in half
+            node.count = range.begin + count / 2;
+            return true;
+        }
+
+        // Binned SAH on all three axes in one pass over the range
+        Bin bins[3][Bins];
+        for (int a = 0; a < 3; ++a) {
+            for (int b = 0; b < Bins; ++b) {
+                bins[a][b].lo = glm::vec3(big);
+                bins[a][b].hi = glm::vec3(-big);
+                bins[a][b].count = 0;
+            }
+        }
+        glm::vec3 scale(0.0f);
+        for (int a = 0; a < 3; ++a) {
+            scale[a] = extent[a] > 0.0f ? Bins / extent[a] : 0.0f;
+        }
+        int widest = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+        int firstAxis = count > 1024 ? widest : 0, lastAxis = count > 1024 ? widest + 1 : 3;
+        for (uint32_t k = range.begin; k < range.end; ++k) {
+            const BuildPrim& prim = prims[k];
+            glm::vec3 primLo = prim.center - prim.radius, primHi = prim.center + prim.radius;
+            glm::vec3 position = (prim.center - centerLo) * scale;
+            for (int a = firstAxis; a < lastAxis; ++a) {
+                Bin& bin = bins[a][std::min(Bins - 1, static_cast<int>(position[a]))];
+                bin.lo = minimum(bin.lo, primLo);
+                bin.hi = maximum(bin.hi, primHi);
+                ++bin.count;
+            }
+        }
+        float bestCost = big;
+        int bestAxis = -1, bestBin = 0;
+        for (int a = firstAxis; a < lastAxis; ++a) {
+            if (extent[a] <= 0.0f) {
+                continue;
+            }
+            // Cost of every left/right division: a sweep from the right, then from the left
+            float rightCost[Bins];
+            glm::vec3 rlo(big), rhi(-big);
+            uint32_t rightCount = 0;
+            for (int b = Bins - 1; b > 0; --b) {
+                rlo = minimum(rlo, bins[a][b].lo);
+                rhi = maximum(rhi, bins[a][b].hi);
+                rightCount += bins[a][b].count;
+                rightCost[b] = rightCount > 0 ? area(rlo, rhi) * rightCount : 0.0f;
+            }
+            glm::vec3 llo(big), lhi(-big);
+            uint32_t leftCount = 0;
+            for (int b = 0; b < Bins - 1; ++b) {
+                llo = minimum(llo, bins[a][b].lo);
+                lhi = maximum(lhi, bins[a][b].hi);
+                leftCount += bins[a][b].count;
+                if (leftCount == 0 || leftCount == count) {
+                    continue;
+                }
+                float c = area(llo, lhi) * leftCount + rightCost[b + 1];
+                if (c < bestCost) {
+                    bestCost = c;
+                    bestAxis = a;
+                    bestBin = b;
+                }
+            }
+        }
+        if (bestAxis < 0) {
+            node.count = range.begin + count / 2;
+            return true;
+        }
+        const float axisScale = scale[bestAxis], base = centerLo[bestAxis];
+        BuildPrim* middle = std::partition(prims.data() + range.begin, prims.data() + range.end, [&](const BuildPrim& prim) {
+            return std::min(Bins - 1, static_cast<int>((prim.center[bestAxis] - base) * axisScale)) <= bestBin;
+        });
+        node.count = static_cast<uint32_t>(middle - prims.data());
+        return true;
+    }
+
+    // Depth-first build of one range into `out`, whose element 0 is the range's root
+    void buildSubtree(const Range& root, std::vector<BvhNode>& out) {
+        out.clear();
+        out.push_back(BvhNode());
+        std::vector<Range> stack(1, Range{ 0, root.begin, root.end, root.depth });
+        while (!stack.empty()) {
+            Range range = stack.back();
+            stack.pop_back();
+            uint32_t left = static_cast<uint32_t>(out.size());
+            BvhNode node;
+            if (split(range, node, left)) {
+                uint32_t middle = node.count;
+                node.count = 0;
+                out.push_back(BvhNode());
+                out.push_back(BvhNode());
+                stack.push_back(Range{ left + 1, middle, range.end, range.depth + 1 });
+                stack.push_back(Range{ left, range.begin, middle, range.depth + 1 });
+            }
+            out[range.node] = node;
+        }
+    }
+
+    // Distance along the ray to the box grown by the pick slope, or infinity when missed
+    static float entry(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float slope) {
+        glm::vec3 corner = maximum(glm::abs(node.lo - origin), glm::abs(node.hi - origin));
+        glm::vec3 grow(slope * glm::length(corner));
+        glm::vec3 t0 = (node.lo - grow - origin) * inverse;
+        glm::vec3 t1 = (node.hi + grow - origin) * inverse;
+        glm::vec3 tEnter = minimum(t0, t1), tExit = maximum(t0, t1);
+        float enter = std::max(std::max(tEnter.x, tEnter.y), std::max(tEnter.z, 0.0f));
+        float exit = std::min(std::min(tExit.x, tExit.y), tExit.z);
+        return enter <= exit ? enter : std::numeric_limits<float>::max();
+    }
+
+    static float boxDistance(const BvhNode& node, const glm::vec3& point) {
+        glm::vec3 d = maximum(maximum(node.lo - point, point - node.hi), glm::vec3(0.0f));
+        return glm::length(d);
+    }
+};
@@ -29,7 +29,7 @@ class Camera {
 public:
     // Vectors
     Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), GLfloat yaw = YAW, GLfloat pitch = PITCH) : front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVTY), zoom(ZOOM) {
-        this->position = position;
+        this->position = glm::dvec3(position);
         this->worldUp = up;
         this->yaw = yaw;
         this->pitch = pitch;
@@ -38,7 +38,7 @@ public:
 
     // Scalar
     Camera(GLfloat posX, GLfloat posY, GLfloat posZ, GLfloat upX, GLfloat upY, GLfloat upZ, GLfloat yaw, GLfloat pitch) : front(glm::vec3(0.0f, 0.0f, -1.0f)), movementSpeed(SPEED), mouseSensitivity(SENSITIVTY), zoom(ZOOM) {
-        this->position = glm::vec3(posX, posY, posZ);
+        this->position = glm::dvec3(posX, posY, posZ);
         this->worldUp = glm::vec3(upX, upY, upZ);
         this->yaw = yaw;
         this->pitch = pitch;
@@ -46,29 +46,35 @@ public:
     }
 
     glm::mat4 GetViewMatrix() {
-        return glm::lookAt(this->position, this->position + this->front, this->up);
+        glm::vec3 position(this->position);
+        return glm::lookAt(position, position + this->front, this->up);
+    }
+
+    // View for camera-relative rendering: the camera sits at the origin, so only the rotation remains
+    glm::mat4 GetRotationMatrix() {
+        return glm::lookAt(glm::vec3(0.0f), this->front, this->up);
     }
 
     void ProcessKeyboard(Camera_Movement direction, GLfloat deltaTime) {
-        GLfloat velocity = this->movementSpeed * deltaTime;
+        double velocity = this->movementSpeed * deltaTime;
 
         if (direction == FORWARD) {
-            this->position += this->front * velocity;
+            this->position += glm::dvec3(this->front) * velocity;
         }
         else if (direction == BACKWARD) {
-            this->position -= this->front * velocity;
+            this->position -= glm::dvec3(this->front) * velocity;
         }
         else if (direction == LEFT) {
-            this->position -= this->right * velocity;
+            this->position -= glm::dvec3(this->right) * velocity;
         }
         else if (direction == RIGHT) {
-            this->position += this->right * velocity;
+            this->position += glm::dvec3(this->right) * velocity;
         }
         else if (direction == UP) {
-            this->position += this->up * velocity;
+            this->position += glm::dvec3(this->up) * velocity;
         }
         else if (direction == DOWN) {
-            this->position -= this->up * velocity;
+            this->position -= glm::dvec3(this->up) * velocity;
         }
     }
 
@@ -91,7 +97,7 @@ public:
         this->updateCameraVectors();
     }
 
-    void SetPosition(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f)) {
+    void SetPosition(glm::dvec3 position = glm::dvec3(0.0)) {
         this->position = position;
     }
 
@@ -115,6 +121,11 @@ public:
     }
 
     glm::vec3 GetPosition() {
+        return glm::vec3(this->position);
+    }
+
+    // Kept in double so the camera can sit anywhere in a large scene without jitter
+    glm::dvec3 GetWorldPosition() {
         return this->position;
     }
 
@@ -123,7 +134,7 @@ public:
     }
 
 private:
-    glm::vec3 position;
+    glm::dvec3 position;
     glm::vec3 front;
     glm::vec3 up;
     glm::vec3 right;
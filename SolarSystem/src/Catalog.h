@@ -0,0 +1,588 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "Kepler.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+
+// Orbital elements of a small-body catalog in structure-of-arrays form. Angles are in radians and
+// ecliptic, semi-major axes in AU and epochs Julian dates (TT), as in MPC and JPL catalogs.
+struct OrbitCatalog {
+    std::vector<double> absoluteMagnitude;     // H, NaN when the catalog has none
+    std::vector<double> epoch;
+    std::vector<double> semiMajorAxis;
+    std::vector<double> eccentricity;
+    std::vector<double> inclination;
+    std::vector<double> ascendingNode;
+    std::vector<double> argumentOfPeriapsis;
+    std::vector<double> meanAnomaly;
+    std::vector<uint64_t> nameStart;           // Size() + 1 offsets into names
+    std::vector<char> names;
+
+    size_t Size() const {
+        return semiMajorAxis.size();
+    }
+
+    void Resize(size_t n) {
+        absoluteMagnitude.resize(n); epoch.resize(n); semiMajorAxis.resize(n); eccentricity.resize(n);
+        inclination.resize(n); ascendingNode.resize(n); argumentOfPeriapsis.resize(n); meanAnomaly.resize(n);
+        nameStart.resize(n + 1);
+    }
+
+    void Clear() {
+        Resize(0);
+        nameStart[0] = 0;
+        names.clear();
+    }
+
+    std::string Name(size_t i) const {
+        return std::string(names.data() + nameStart[i], names.data() + nameStart[i + 1]);
+    }
+
+    OrbitalElements Elements(size_t i) const {
+        OrbitalElements elements;
+        elements.semiMajorAxis = semiMajorAxis[i];
+        elements.eccentricity = eccentricity[i];
+        elements.inclination = inclination[i];
+        elements.ascendingNode = ascendingNode[i];
+        elements.argumentOfPeriapsis = argumentOfPeriapsis[i];
+        elements.meanAnomaly = meanAnomaly[i];
+        elements.epoch = epoch[i];
+        return elements;
+    }
+
+    double* Column(int c) {
+        double* columns[8] = { absoluteMagnitude.data(), epoch.data(), semiMajorAxis.data(), eccentricity.data(),
+            inclination.data(), ascendingNode.data(), argumentOfPeriapsis.data(), meanAnomaly.data() };
+        return columns[c];
+    }
+
+    static const int Columns = 8;
+};
+
+struct CatalogStats {
+    bool fromSidecar = false;
+    size_t records = 0;
+    size_t rejected = 0;        // lines that looked like records but did not parse
+    size_t bytes = 0;           // of the source
+    double seconds = 0.0;
+};
+
+// Sidecar cache: header, the eight element columns, the name offsets, then the names
+struct CatalogSidecarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t sourceSize;
+    int64_t sourceModified;
+    uint64_t count;
+    uint64_t nameBytes;
+};
+
+const uint32_t CatalogSidecarVersion = 2;
+const char CatalogSidecarMagic[8] = { 'S', 'S', 'C', 'A', 'T', 'L', 'G', 0 };
+
+// Reads MPCORB-style fixed-width files and CSV files with a header row (JPL small-body database
+// exports: full_name, a, e, i, om, w, ma, epoch, H). The file is mapped, split into chunks at line
+// boundaries and the chunks are parsed in parallel with a decimal parser that takes the exact fast
+// path for up to 15 significant digits. The result is cached next to the source as `<source>.sscat`,
+// tagged with the source's size and modification time; later loads just copy the columns out of it.
+class CatalogLoader {
+public:
+    static std::string SidecarPath(const std::string& path) {
+        return path + ".sscat";
+    }
+
+    static bool Load(const std::string& path, OrbitCatalog& catalog, CatalogStats* stats = nullptr,
+        bool useSidecar = true) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        CatalogStats local;
+        CatalogStats& result = stats != nullptr ? *stats : local;
+        result = CatalogStats();
+        uint64_t size = 0;
+        int64_t modified = 0;
+        if (!sourceInfo(path, size, modified)) {
+            std::cout << "ERROR::CATALOG::FILE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        result.bytes = static_cast<size_t>(size);
+        if (useSidecar && ReadSidecar(SidecarPath(path), size, modified, catalog)) {
+            result.fromSidecar = true;
+        }
+        else {
+            if (!Parse(path, catalog, result)) {
+                return false;
+            }
+            if (useSidecar) {
+                WriteSidecar(SidecarPath(path), size, modified, catalog);
+            }
+        }
+        result.records = catalog.Size();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    static bool Parse(const std::string& path, OrbitCatalog& catalog, CatalogStats& stats) {
+        MappedFile file;
+        if (!file.Open(path)) {
+            std::cout << "ERROR::CATALOG::FILE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        const char* begin = file.Data();
+        const char* end = begin + file.Size();
+        Format format;
+        const char* data = detectFormat(begin, end, format);
+        if (data == nullptr) {
+            std::cout << "ERROR::CATALOG::UNKNOWN_FORMAT " << path << std::endl;
+            return false;
+        }
+
+        // Chunks of about a megabyte that end at a line break
+        std::vector<const char*> cuts(1, data);
+        const size_t chunkBytes = 1 << 20;
+        while (cuts.back() < end) {
+            const char* cut = cuts.back() + std::min<size_t>(chunkBytes, end - cuts.back());
+            while (cut < end && *(cut - 1) != '\n') {
+                ++cut;
+            }
+            cuts.push_back(cut);
+        }
+        const size_t chunks = cuts.size() - 1;
+        std::vector<OrbitCatalog> parts(chunks);
+        std::vector<size_t> rejected(chunks, 0);
+        ParallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c) {
+                rejected[c] = parseChunk(cuts[c], cuts[c + 1], format, parts[c]);
+            }
+        });
+
+        // Concatenate in file order, each chunk copied into its slice in parallel
+        std::vector<size_t> offset(chunks + 1, 0), nameOffset(chunks + 1, 0);
+        for (size_t c = 0; c < chunks; ++c) {
+            offset[c + 1] = offset[c] + parts[c].Size();
+            nameOffset[c + 1] = nameOffset[c] + parts[c].names.size();
+            stats.rejected += rejected[c];
+        }
+        catalog.Resize(offset[chunks]);
+        catalog.names.resize(nameOffset[chunks]);
+        catalog.nameStart[offset[chunks]] = nameOffset[chunks];
+        ParallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c) {
+                OrbitCatalog& part = parts[c];
+                size_t n = part.Size();
+                for (int column = 0; column < OrbitCatalog::Columns && n > 0; ++column) {
+                    std::memcpy(catalog.Column(column) + offset[c], part.Column(column), n * sizeof(double));
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    catalog.nameStart[offset[c] + i] = nameOffset[c] + part.nameStart[i];
+                }
+                if (!part.names.empty()) {
+                    std::memcpy(&catalog.names[nameOffset[c]], part.names.data(), part.names.size());
+                }
+            }
+        });
+        return true;
+    }
+
+    static bool ReadSidecar(const std::string& path, uint64_t sourceSize, int64_t sourceModified, OrbitCatalog& catalog) {
+        MappedFile file;
+        if (!file.Open(path) || file.Size() < sizeof(CatalogSidecarHeader)) {
+            return false;
+        }
+        CatalogSidecarHeader header;
+        std::memcpy(&header, file.Data(), sizeof(header));
+        if (std::memcmp(header.magic, CatalogSidecarMagic, sizeof(header.magic)) != 0 ||
+            header.version != CatalogSidecarVersion || header.sourceSize != sourceSize ||
+            header.sourceModified != sourceModified) {
+            return false;
+        }
+        const uint64_t n = header.count;
+        const uint64_t expected = sizeof(header) + n * (OrbitCatalog::Columns * sizeof(double) + sizeof(uint64_t)) +
+            sizeof(uint64_t) + header.nameBytes;
+        if (file.Size() != expected) {
+            return false;
+        }
+        catalog.Resize(static_cast<size_t>(n));
+        catalog.names.resize(static_cast<size_t>(header.nameBytes));
+        const char* in = file.Data() + sizeof(header);
+        for (int column = 0; column < OrbitCatalog::Columns; ++column) {
+            std::memcpy(catalog.Column(column), in, n * sizeof(double));
+            in += n * sizeof(double);
+        }
+        std::memcpy(catalog.nameStart.data(), in, (n + 1) * sizeof(uint64_t));
+        in += (n + 1) * sizeof(uint64_t);
+        if (header.nameBytes > 0) {
+            std::memcpy(catalog.names.data(), in, static_cast<size_t>(header.nameBytes));
+        }
+        return true;
+    }
+
+    // Written to a temporary file and renamed, so a crash never leaves a torn cache that looks valid
+    static bool WriteSidecar(const std::string& path, uint64_t sourceSize, int64_t sourceModified,
+        OrbitCatalog& catalog) {
+        CatalogSidecarHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, CatalogSidecarMagic, sizeof(header.magic));
+        header.version = CatalogSidecarVersion;
+        header.sourceSize = sourceSize;
+        header.sourceModified = sourceModified;
+        header.count = catalog.Size();
+        header.nameBytes = catalog.names.size();
+        const std::string temporary = path + ".tmp";
+        {
+            std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (int column = 0; column < OrbitCatalog::Columns; ++column) {
+                out.write(reinterpret_cast<const char*>(catalog.Column(column)),
+                    static_cast<std::streamsize>(catalog.Size() * sizeof(double)));
+            }
+            out.write(reinterpret_cast<const char*>(catalog.nameStart.data()),
+                static_cast<std::streamsize>(catalog.nameStart.size() * sizeof(uint64_t)));
+            out.write(catalog.names.data(), static_cast<std::streamsize>(catalog.names.size()));
+            if (!out) {
+                std::cout << "ERROR::CATALOG::SIDECAR_NOT_WRITTEN " << path << std::endl;
+                std::remove(temporary.c_str());
+                return false;
+            }
+        }
+        std::remove(path.c_str());
+        if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+            std::cout << "ERROR::CATALOG::SIDECAR_NOT_WRITTEN " << path << std::endl;
+            std::remove(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Decimal number in [p, end) with optional sign, fraction and exponent; leading blanks are skipped
+    // and p is left after the number. Up to 15 significant digits and exponents within +-22 are
+    // converted exactly with one multiplication or division by a power of ten; the rest use strtod.
+    static bool ParseDecimal(const char*& p, const char* end, double& value) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        const char* start = p;
+        bool negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            ++p;
+        }
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool any = false;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                digits += mantissa > 0 ? 1 : 0;
+            }
+            else {
+                ++exponent;
+            }
+        }
+        if (p < end && *p == '.') {
+            ++p;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+                any = true;
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + static_cast<uint64_t>(*p - '0');
+                    digits += mantissa > 0 ? 1 : 0;
+                    --exponent;
+                }
+            }
+        }
+        if (!any) {
+            p = start;
+            return false;
+        }
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            const char* mark = p++;
+            bool negativeExponent = false;
+            if (p < end && (*p == '-' || *p == '+')) {
+                negativeExponent = *p == '-';
+                ++p;
+            }
+            if (p == end || *p < '0' || *p > '9') {
+                p = mark;
+            }
+            else {
+                int e = 0;
+                for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+                    e = std::min(e * 10 + (*p - '0'), 10000);
+                }
+                exponent += negativeExponent ? -e : e;
+            }
+        }
+        static const double powers[23] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        if (digits <= 15 && exponent >= -22 && exponent <= 22) {
+            double m = static_cast<double>(mantissa);
+            value = exponent < 0 ? m / powers[-exponent] : m * powers[exponent];
+        }
+        else {
+            char buffer[64];
+            size_t length = std::min<size_t>(static_cast<size_t>(p - start), sizeof(buffer) - 1);
+            std::memcpy(buffer, start, length);
+            buffer[length] = 0;
+            value = std::strtod(buffer, nullptr);
+            return true;
+        }
+        value = negative ? -value : value;
+        return true;
+    }
+
+    // MPC packed date such as K24AH (2024 October 17) as the Julian date at 0h
+    static bool PackedEpoch(const char* packed, double& julianDate) {
+        int century = packed[0] == 'I' ? 18 : packed[0] == 'J' ? 19 : packed[0] == 'K' ? 20 : -1;
+        if (century < 0 || packed[1] < '0' || packed[1] > '9' || packed[2] < '0' || packed[2] > '9') {
+            return false;
+        }
+        int year = century * 100 + (packed[1] - '0') * 10 + (packed[2] - '0');
+        int month = packedDigit(packed[3]), day = packedDigit(packed[4]);
+        if (month < 1 || month > 12 || day < 1 || day > 31) {
+            return false;
+        }
+        // Fliegel and Van Flandern's Gregorian day number, which is the Julian date at noon
+        int a = (14 - month) / 12, y = year + 4800 - a, m = month + 12 * a - 3;
+        long dayNumber = day + (153 * m + 2) / 5 + 365L * y + y / 4 - y / 100 + y / 400 - 32045;
+        julianDate = static_cast<double>(dayNumber) - 0.5;
+        return true;
+    }
+
+private:
+    enum class FormatKind { Mpc, Csv };
+
+    struct Format {
+        FormatKind kind;
+        // CSV column of each catalog column (H, epoch, a, e, i, node, peri, M), -1 when absent, and the name
+        int column[OrbitCatalog::Columns];
+        int nameColumn;
+        int columnCount;
+        double epochOffset;     // added to the epoch column: 2400000.5 when it holds MJD
+    };
+
+    static int packedDigit(char c) {
+        if (c >= '1' && c <= '9') {
+            return c - '0';
+        }
+        if (c >= 'A' && c <= 'V') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    static bool sourceInfo(const std::string& path, uint64_t& size, int64_t& modified) {
+        struct stat info;
+        if (stat(path.c_str(), &info) != 0) {
+            return false;
+        }
+        size = static_cast<uint64_t>(info.st_size);
+        modified = static_cast<int64_t>(info.st_mtime);
+        return true;
+    }
+
+    static const char* lineEnd(const char* p, const char* end) {
+        const char* newline = static_cast<const char*>(std::memchr(p, '\n', static_cast<size_t>(end - p)));
+        return newline != nullptr ? newline : end;
+    }
+
+    // Finds where the records start. MPCORB.DAT has a free-text header closed by a line of dashes
+    // (files without one start straight away); CSV files name their columns in the first line.
+    static const char* detectFormat(const char* begin, const char* end, Format& format) {
+        const char* first = lineEnd(begin, end);
+        std::string header(begin, first);
+        if (!header.empty() && header[header.size() - 1] == '\r') {
+            header.erase(header.size() - 1);
+        }
+        if (header.find(',') != std::string::npos) {
+            format.kind = FormatKind::Csv;
+            std::fill(format.column, format.column + OrbitCatalog::Columns, -1);
+            format.nameColumn = -1;
+            format.epochOffset = 0.0;
+            std::vector<std::string> fields = splitCsv(header.data(), header.data() + header.size());
+            format.columnCount = static_cast<int>(fields.size());
+            const char* names[OrbitCatalog::Columns][3] = { { "h", "H", "" }, { "epoch", "epoch_mjd", "" },
+                { "a", "", "" }, { "e", "", "" }, { "i", "incl", "" }, { "om", "node", "" }, { "w", "peri", "" },
+                { "ma", "m", "M" } };
+            for (int f = 0; f < format.columnCount; ++f) {
+                std::string name = fields[f];
+                for (int c = 0; c < OrbitCatalog::Columns; ++c) {
+                    for (int alias = 0; alias < 3; ++alias) {
+                        if (names[c][alias][0] != 0 && name == names[c][alias] && format.column[c] < 0) {
+                            format.column[c] = f;
+                            format.epochOffset = c == 1 && alias == 1 ? 2400000.5 : format.epochOffset;
+                        }
+                    }
+                }
+                if ((name == "full_name" || name == "name" || name == "pdes" || name == "designation") &&
+                    format.nameColumn < 0) {
+                    format.nameColumn = f;
+                }
+            }
+            for (int c = 2; c < OrbitCatalog::Columns; ++c) {
+                if (format.column[c] < 0) {
+                    return nullptr;
+                }
+            }
+            return first < end ? first + 1 : end;
+        }
+        format.kind = FormatKind::Mpc;
+        format.epochOffset = 0.0;
+        const char* scanEnd = begin + std::min<size_t>(static_cast<size_t>(end - begin), 1 << 16);
+        for (const char* line = begin; line < scanEnd;) {
+            const char* next = lineEnd(line, end);
+            if (next - line >= 5 && std::strncmp(line, "-----", 5) == 0) {
+                return next < end ? next + 1 : end;
+            }
+            line = next + 1;
+        }
+        return begin;
+    }
+
+    static std::vector<std::string> splitCsv(const char* p, const char* end) {
+        std::vector<std::string> fields(1);
+        bool quoted = false;
+        for (; p < end; ++p) {
+            if (*p == '"') {
+                quoted = !quoted;
+            }
+            else if (*p == ',' && !quoted) {
+                fields.push_back(std::string());
+            }
+            else if (*p != '\r') {
+                fields.back() += *p;
+            }
+        }
+        for (size_t f = 0; f < fields.size(); ++f) {
+            std::string& field = fields[f];
+            size_t first = field.find_first_not_of(' '), last = field.find_last_not_of(' ');
+            field = first == std::string::npos ? std::string() : field.substr(first, last - first + 1);
+        }
+        return fields;
+    }
+
+    // A whole fixed-width field, blanks around the number allowed
+    static bool parseField(const char* line, size_t from, size_t to, double& value) {
+        const char* p = line + from;
+        const char* end = line + to;
+        if (!ParseDecimal(p, end, value)) {
+            return false;
+        }
+        while (p < end && *p == ' ') {
+            ++p;
+        }
+        return p == end;
+    }
+
+    static size_t parseChunk(const char* p, const char* end, const Format& format, OrbitCatalog& part) {
+        const double degrees = 3.14159265358979323846 / 180.0;
+        part.Clear();
+        size_t rejected = 0;
+        double values[OrbitCatalog::Columns];
+        while (p < end) {
+            const char* line = p;
+            const char* next = lineEnd(p, end);
+            p = next < end ? next + 1 : end;
+            const char* stop = next > line && *(next - 1) == '\r' ? next - 1 : next;
+            const char* nameBegin = line;
+            const char* nameEnd = line;
+            bool ok;
+            if (format.kind == FormatKind::Mpc) {
+                // MPCORB columns (0-based, end exclusive): designation 0-7, H 8-13, epoch 20-25, M 26-35,
+                // peri 37-46, node 48-57, i 59-68, e 70-79, a 92-103
+                if (stop - line < 103) {
+                    continue;
+                }
+                ok = PackedEpoch(line + 20, values[1]) && parseField(line, 26, 35, values[7]) &&
+                    parseField(line, 37, 46, values[6]) && parseField(line, 48, 57, values[5]) &&
+                    parseField(line, 59, 68, values[4]) && parseField(line, 70, 79, values[3]) &&
+                    parseField(line, 92, 103, values[2]);
+                if (!parseField(line, 8, 13, values[0])) {
+                    values[0] = std::numeric_limits<double>::quiet_NaN();
+                }
+                nameEnd = line + 7;
+                while (nameEnd > nameBegin && *(nameEnd - 1) == ' ') {
+                    --nameEnd;
+                }
+            }
+            else {
+                if (stop == line) {
+                    continue;
+                }
+                ok = parseCsvRecord(line, stop, format, values, nameBegin, nameEnd);
+            }
+            if (!ok || !(values[2] != 0.0)) {
+                ++rejected;
+                continue;
+            }
+            for (int c = 4; c < OrbitCatalog::Columns; ++c) {
+                values[c] *= degrees;
+            }
+            size_t i = part.Size();
+            part.Resize(i + 1);
+            for (int c = 0; c < OrbitCatalog::Columns; ++c) {
+                part.Column(c)[i] = values[c];
+            }
+            part.names.insert(part.names.end(), nameBegin, nameEnd);
+            part.nameStart[i + 1] = part.names.size();
+        }
+        return rejected;
+    }
+
+    // Fields are found by walking the commas; quotes only protect commas inside names
+    static bool parseCsvRecord(const char* line, const char* stop, const Format& format, double* values,
+        const char*& nameBegin, const char*& nameEnd) {
+        values[0] = std::numeric_limits<double>::quiet_NaN();
+        values[1] = 0.0;
+        // H and the epoch may be missing; the six elements may not
+        const int needed = OrbitCatalog::Columns - 2;
+        int found = 0;
+        const char* p = line;
+        for (int field = 0; field < format.columnCount && p <= stop; ++field) {
+            const char* fieldBegin = p;
+            bool quoted = false;
+            while (p < stop && (quoted || *p != ',')) {
+                quoted = *p == '"' ? !quoted : quoted;
+                ++p;
+            }
+            const char* fieldEnd = p;
+            ++p;
+            if (field == format.nameColumn) {
+                nameBegin = fieldBegin;
+                nameEnd = fieldEnd;
+                while (nameBegin < nameEnd && (*nameBegin == ' ' || *nameBegin == '"')) {
+                    ++nameBegin;
+                }
+                while (nameEnd > nameBegin && (*(nameEnd - 1) == ' ' || *(nameEnd - 1) == '"')) {
+                    --nameEnd;
+                }
+                continue;
+            }
+            for (int c = 0; c < OrbitCatalog::Columns; ++c) {
+                if (format.column[c] != field) {
+                    continue;
+                }
+                const char* q = fieldBegin;
+                double value;
+                if (ParseDecimal(q, fieldEnd, value)) {
+                    values[c] = c == 1 ? value + format.epochOffset : value;
+                    found += c >= 2 ? 1 : 0;
+                }
+            }
+        }
+        return found == needed;
+    }
+};
@@ -0,0 +1,394 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NBody.h"
+#include "Octree.h"
+#include "Parallel.h"
+#include "RadixSort.h"
+
+// A pair whose closest approach during the last step came within the encounter distance, or whose
+// spheres touched. `time` is when that happened, relative to the end of the step (in [-dt, 0]).
+struct Encounter {
+    uint32_t first, second;     // first < second
+    double distance;            // center distance at closest approach
+    double time;
+    bool overlap;               // distance < radius[first] + radius[second]
+};
+
+// Hierarchical spatial hash over the spheres swept by each body during a step. Level L has cells of
+// size baseCell * 2^L and holds the bodies whose swept sphere is at most a quarter of a cell across
+// (reach <= size / 4), so a single huge body does not force coarse cells on a million small ones.
+// Cell keys (level plus Morton-ordered, wrapped cell coordinates) are radix-sorted; an open-addressing
+// table then maps a key to its run of bodies. Any partner of a body at its own or a coarser level lies
+// within half a cell of it, so each body probes only the 2x2x2 cells nearest to it at its own level and
+// at every coarser occupied level, finding every pair once in near-linear time. Wrapped coordinates
+// may alias far-away cells; that only adds candidates, which the narrow phase rejects.
+class SpatialHash {
+public:
+    static const int Levels = 16;
+    static const int CoordinateBits = 19;   // per axis, 57 bits of Morton code below 4 level bits
+
+    struct Cell {
+        uint64_t key;
+        uint32_t first, count;
+    };
+
+    std::vector<uint64_t> keys;         // sorted cell key of every body
+    std::vector<uint32_t> order;        // body index in key order
+    std::vector<Cell> cells;
+    double baseCell;
+    unsigned usedLevels;                // bit L set when level L holds bodies
+
+    SpatialHash() : baseCell(1.0), usedLevels(0), tableMask(0) {}
+
+    // centers/reach are the swept spheres; reach must be positive
+    void Build(const std::vector<glm::dvec3>& centers, const std::vector<double>& reach) {
+        const size_t n = centers.size();
+        keys.resize(n);
+        order.resize(n);
+        cells.clear();
+        usedLevels = 0;
+        if (n == 0) {
+            return;
+        }
+
+        double smallest = reach[0], largest = reach[0];
+        for (size_t i = 1; i < n; ++i) {
+            smallest = std::min(smallest, reach[i]);
+            largest = std::max(largest, reach[i]);
+        }
+        baseCell = std::max(4.0 * smallest, 4.0 * largest / static_cast<double>(1u << (Levels - 1)));
+
+        levels.resize(n);
+        ParallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                int level = LevelFor(reach[i]);
+                levels[i] = static_cast<uint8_t>(level);
+                keys[i] = KeyOf(centers[i], level);
+                order[i] = static_cast<uint32_t>(i);
+            }
+        });
+        for (size_t i = 0; i < n; ++i) {
+            usedLevels |= 1u << levels[i];
+        }
+        RadixSortPairs(keys, order, 64);
+
+        for (size_t i = 0; i < n; ++i) {
+            if (i == 0 || keys[i] != keys[i - 1]) {
+                Cell cell = { keys[i], static_cast<uint32_t>(i), 0 };
+                cells.push_back(cell);
+            }
+            ++cells.back().count;
+        }
+        buildTable();
+    }
+
+    int LevelFor(double reach) const {
+        int level = 0;
+        double size = baseCell;
+        while (level < Levels - 1 && 4.0 * reach > size) {
+            size *= 2.0;
+            ++level;
+        }
+        return level;
+    }
+
+    double CellSize(int level) const {
+        return baseCell * static_cast<double>(1u << level);
+    }
+
+    uint64_t KeyOf(const glm::dvec3& p, int level) const {
+        double size = CellSize(level);
+        return KeyOf(static_cast<int64_t>(std::floor(p.x / size)), static_cast<int64_t>(std::floor(p.y / size)),
+            static_cast<int64_t>(std::floor(p.z / size)), level);
+    }
+
+    static uint64_t KeyOf(int64_t cx, int64_t cy, int64_t cz, int level) {
+        const uint64_t mask = (1u << CoordinateBits) - 1;
+        return (static_cast<uint64_t>(level) << (3 * CoordinateBits)) |
+            Octree::MortonCode(static_cast<uint32_t>(cx & mask), static_cast<uint32_t>(cy & mask),
+                static_cast<uint32_t>(cz & mask));
+    }
+
+    // Cell holding `key`, or nullptr when that cell is empty
+    const Cell* Find(uint64_t key) const {
+        if (cells.empty()) {
+            return nullptr;
+        }
+        size_t slot = hash(key) & tableMask;
+        while (table[slot].cell != Empty) {
+            if (table[slot].key == key) {
+                return &cells[table[slot].cell];
+            }
+            slot = (slot + 1) & tableMask;
+        }
+        return nullptr;
+    }
+
+    uint8_t LevelOf(size_t body) const {
+        return levels[body];
+    }
+
+private:
+    static const uint32_t Empty = 0xFFFFFFFFu;
+
+    // Keys are stored in the table so a probe touches one cache line
+    struct Slot {
+        uint64_t key;
+        uint32_t cell;
+    };
+
+    std::vector<uint8_t> levels;
+    std::vector<Slot> table;
+    size_t tableMask;
+
+    static size_t hash(uint64_t key) {
+        return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 17);
+    }
+
+    void buildTable() {
+        size_t capacity = 16;
+        while (capacity < 2 * cells.size()) {
+            capacity *= 2;
+        }
+        Slot empty = { 0, Empty };
+        table.assign(capacity, empty);
+        tableMask = capacity - 1;
+        for (size_t c = 0; c < cells.size(); ++c) {
+            size_t slot = hash(cells[c].key) & tableMask;
+            while (table[slot].cell != Empty) {
+                slot = (slot + 1) & tableMask;
+            }
+            table[slot].key = cells[c].key;
+            table[slot].cell = static_cast<uint32_t>(c);
+        }
+    }
+};
+
+// Broad phase (SpatialHash) plus narrow phase for a step that just finished. Bodies are assumed to have
+// moved in straight lines with their current velocities, so the closest approach of every candidate
+// pair is found analytically even when they passed through each other within the step.
+class CollisionDetector {
+public:
+    double encounterDistance;           // report pairs passing closer than this (0: only overlaps)
+    SpatialHash grid;
+    unsigned long long candidates;      // pairs tested by the narrow phase in the last Detect
+
+    CollisionDetector(double encounterDistance = 0.0) : encounterDistance(encounterDistance), candidates(0) {}
+
+    const std::vector<Encounter>& Detect(const BodySystem& bodies, double dt) {
+        const size_t n = bodies.Size();
+        encounters.clear();
+        candidates = 0;
+        if (n < 2) {
+            return encounters;
+        }
+
+        // Swept sphere over [-dt, 0]: centered mid-segment, grown by half the travel and half the
+        // encounter distance so any qualifying pair's spheres overlap
+        centers.resize(n);
+        reach.resize(n);
+        ParallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                glm::dvec3 v = bodies.Velocity(i);
+                centers[i] = bodies.Position(i) - 0.5 * dt * v;
+                reach[i] = bodies.radius[i] + 0.5 * dt * glm::length(v) + 0.5 * encounterDistance;
+                reach[i] = std::max(reach[i], 1e-12);
+            }
+        });
+        grid.Build(centers, reach);
+
+        // Fixed blocks of sorted bodies, each collecting into its own list
+        const size_t blockSize = 2048;
+        const size_t blocks = (n + blockSize - 1) / blockSize;
+        std::vector<std::vector<Encounter> > found(blocks);
+        std::vector<unsigned long long> tested(blocks, 0);
+        ParallelFor(0, blocks, 1, [&](size_t first, size_t last) {
+            for (size_t block = first; block < last; ++block) {
+                size_t end = std::min(n, (block + 1) * blockSize);
+                NeighborCache cache;
+                for (size_t s = block * blockSize; s < end; ++s) {
+                    tested[block] += queryBody(bodies, grid.order[s], dt, cache, found[block]);
+                }
+            }
+        });
+        for (size_t block = 0; block < blocks; ++block) {
+            encounters.insert(encounters.end(), found[block].begin(), found[block].end());
+            candidates += tested[block];
+        }
+        std::sort(encounters.begin(), encounters.end(), [](const Encounter& a, const Encounter& b) {
+            return a.first != b.first ? a.first < b.first : a.second < b.second;
+        });
+        // A pair can be seen twice only when wrapped cell coordinates alias a neighbor
+        encounters.erase(std::unique(encounters.begin(), encounters.end(), [](const Encounter& a, const Encounter& b) {
+            return a.first == b.first && a.second == b.second;
+        }), encounters.end());
+        return encounters;
+    }
+
+    const std::vector<Encounter>& Encounters() const {
+        return encounters;
+    }
+
+    // Closest approach of two bodies moving in straight lines over [-dt, 0]
+    static void ClosestApproach(const glm::dvec3& dp, const glm::dvec3& dv, double dt, double& distance, double& time) {
+        double speed2 = glm::dot(dv, dv);
+        time = speed2 > 0.0 ? std::min(std::max(-glm::dot(dp, dv) / speed2, -dt), 0.0) : 0.0;
+        distance = glm::length(dp + dv * time);
+    }
+
+private:
+    std::vector<Encounter> encounters;
+    std::vector<glm::dvec3> centers;
+    std::vector<double> reach;
+
+    // The 8 cells nearest to the last body probed at each level. Bodies are visited in key order, so
+    // neighbors usually share their cell at coarser levels and skip the hash lookups entirely.
+    struct NeighborCache {
+        bool valid[SpatialHash::Levels];
+        int64_t cx[SpatialHash::Levels], cy[SpatialHash::Levels], cz[SpatialHash::Levels];
+        const SpatialHash::Cell* cells[SpatialHash::Levels][8];
+
+        NeighborCache() {
+            std::fill(valid, valid + SpatialHash::Levels, false);
+        }
+    };
+
+    // Tests body i against the same level (higher indices only) and every coarser occupied level
+    unsigned long long queryBody(const BodySystem& bodies, uint32_t i, double dt, NeighborCache& cache,
+        std::vector<Encounter>& out) const {
+        unsigned long long tested = 0;
+        const int own = grid.LevelOf(i);
+        for (int level = own; level < SpatialHash::Levels; ++level) {
+            if (!(grid.usedLevels & (1u << level))) {
+                continue;
+            }
+            // Lower corner of the 2x2x2 block spanning half a cell around the center
+            double size = grid.CellSize(level);
+            int64_t cx = static_cast<int64_t>(std::floor(centers[i].x / size - 0.5));
+            int64_t cy = static_cast<int64_t>(std::floor(centers[i].y / size - 0.5));
+            int64_t cz = static_cast<int64_t>(std::floor(centers[i].z / size - 0.5));
+            const SpatialHash::Cell** neighbors = cache.cells[level];
+            if (!cache.valid[level] || cache.cx[level] != cx || cache.cy[level] != cy || cache.cz[level] != cz) {
+                int slot = 0;
+                for (int dz = 0; dz <= 1; ++dz) {
+                    for (int dy = 0; dy <= 1; ++dy) {
+                        for (int dx = 0; dx <= 1; ++dx) {
+                            neighbors[slot++] = grid.Find(SpatialHash::KeyOf(cx + dx, cy + dy, cz + dz, level));
+                        }
+                    }
+                }
+                cache.valid[level] = true;
+                cache.cx[level] = cx; cache.cy[level] = cy; cache.cz[level] = cz;
+            }
+            for (int slot = 0; slot < 8; ++slot) {
+                const SpatialHash::Cell* cell = neighbors[slot];
+                if (cell == nullptr) {
+                    continue;
+                }
+                for (uint32_t k = cell->first; k < cell->first + cell->count; ++k) {
+                    uint32_t j = grid.order[k];
+                    if (level == own && j <= i) {
+                        continue;
+                    }
+                    ++tested;
+                    narrowPhase(bodies, i, j, dt, out);
+                }
+            }
+        }
+        return tested;
+    }
+
+    void narrowPhase(const BodySystem& bodies, uint32_t i, uint32_t j, double dt, std::vector<Encounter>& out) const {
+        glm::dvec3 d = centers[j] - centers[i];
+        double limit = reach[i] + reach[j];
+        if (glm::dot(d, d) > limit * limit) {
+            return;
+        }
+        double distance, time;
+        ClosestApproach(bodies.Position(j) - bodies.Position(i), bodies.Velocity(j) - bodies.Velocity(i), dt, distance, time);
+        bool overlap = distance < bodies.radius[i] + bodies.radius[j];
+        if (overlap || distance < encounterDistance) {
+            Encounter e = { std::min(i, j), std::max(i, j), distance, time, overlap };
+            out.push_back(e);
+        }
+    }
+};
+
+// Merges every group of overlapping bodies into one, conserving mass, momentum and volume; the survivor
+// sits at the group's center of mass. Returns the number of bodies removed; remap gives the new index
+// of every old body (absorbed bodies map to their survivor's new index).
+inline size_t MergeOverlaps(BodySystem& bodies, const std::vector<Encounter>& encounters, std::vector<size_t>& remap) {
+    const size_t n = bodies.Size();
+    std::vector<uint32_t> parent(n);
+    for (size_t i = 0; i < n; ++i) {
+        parent[i] = static_cast<uint32_t>(i);
+    }
+    auto root = [&](uint32_t i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+
+    bool merged = false;
+    for (size_t e = 0; e < encounters.size(); ++e) {
+        if (!encounters[e].overlap) {
+            continue;
+        }
+        uint32_t a = root(encounters[e].first), b = root(encounters[e].second);
+        if (a != b) {
+            parent[std::max(a, b)] = std::min(a, b);     // the lowest index survives
+            merged = true;
+        }
+    }
+    if (!merged) {
+        remap.resize(n);
+        for (size_t i = 0; i < n; ++i) {
+            remap[i] = i;
+        }
+        return 0;
+    }
+
+    // Accumulate each group into its root
+    std::vector<double> momentumX(n, 0.0), momentumY(n, 0.0), momentumZ(n, 0.0), weightedX(n, 0.0), weightedY(n, 0.0),
+        weightedZ(n, 0.0), volume(n, 0.0), mass(n, 0.0);
+    std::vector<char> keep(n, 0);
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t r = root(static_cast<uint32_t>(i));
+        double m = bodies.mass[i];
+        mass[r] += m;
+        momentumX[r] += m * bodies.vx[i]; momentumY[r] += m * bodies.vy[i]; momentumZ[r] += m * bodies.vz[i];
+        weightedX[r] += m * bodies.x[i]; weightedY[r] += m * bodies.y[i]; weightedZ[r] += m * bodies.z[i];
+        volume[r] += bodies.radius[i] * bodies.radius[i] * bodies.radius[i];
+        keep[i] = r == i;
+    }
+    size_t removed = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!keep[i]) {
+            ++removed;
+            continue;
+        }
+        if (mass[i] > 0.0) {
+            bodies.SetPosition(i, glm::dvec3(weightedX[i], weightedY[i], weightedZ[i]) / mass[i]);
+            bodies.SetVelocity(i, glm::dvec3(momentumX[i], momentumY[i], momentumZ[i]) / mass[i]);
+        }
+        bodies.mass[i] = mass[i];
+        bodies.radius[i] = std::cbrt(volume[i]);
+    }
+
+    std::vector<size_t> survivors;
+    bodies.Compact(keep, survivors);
+    remap.resize(n);
+    for (size_t i = 0; i < n; ++i) {
+        remap[i] = survivors[root(static_cast<uint32_t>(i))];
+    }
+    return removed;
+}
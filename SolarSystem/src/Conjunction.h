@@ -0,0 +1,300 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Kepler.h"
+#include "Parallel.h"
+#include "RadixSort.h"
+#include "RootFinding.h"
+
+// A closest approach of two orbits within the screening threshold
+struct Conjunction {
+    uint32_t first, second;     // first < second
+    double time;
+    double distance;
+    double relativeSpeed;
+};
+
+struct ConjunctionSettings {
+    double threshold = 0.0;
+    double start = 0.0;
+    double end = 0.0;
+    double bucket = 0.0;        // time bucket length; 0 sizes buckets from the population's density and speeds
+    int samples = 4;            // range-rate samples per bucket, each interval bracketing at most one minimum
+};
+
+struct ConjunctionStats {
+    size_t buckets = 0;
+    double bucket = 0.0;
+    unsigned long long sweepPairs = 0;      // swept spheres overlapping in a bucket
+    unsigned long long apsisRejected = 0;
+    unsigned long long pathRejected = 0;
+    unsigned long long refined = 0;         // pair-buckets whose distance function was searched
+    size_t events = 0;
+    double seconds = 0.0;
+};
+
+// All-pairs close-approach screening of Keplerian orbits around one focus, using the propagator the
+// viewer's belt runs on. The window is cut into time buckets; at each bucket's middle every object is
+// propagated and given a swept sphere that holds it for the whole bucket (its fastest speed times half
+// the bucket, plus half the threshold). Spheres are swept and pruned along x within slabs of y as wide
+// as the largest sphere, so only neighboring slabs meet. Overlapping pairs then pass two orbit filters:
+// the perigee/apogee shells must come within the threshold, and near the line where the two orbital
+// planes cross (the only place their paths can meet) the radii must too. Survivors are refined by
+// sampling the range rate over the bucket and finding each minus-to-plus root with Brent's method; a
+// minimum belongs to the bucket it falls in, so no event is found twice. Buckets are processed one
+// after another, each one in parallel; events come back sorted by time.
+class ConjunctionScreen {
+public:
+    static std::vector<Conjunction> Screen(const KeplerOrbits& orbits, const ConjunctionSettings& settings,
+        ConjunctionStats* stats = nullptr) {
+        std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+        ConjunctionStats local;
+        ConjunctionStats& result = stats != nullptr ? *stats : local;
+        result = ConjunctionStats();
+        std::vector<Conjunction> events;
+        const size_t n = orbits.Size();
+        const double threshold = settings.threshold;
+        if (n < 2 || !(settings.end > settings.start)) {
+            return events;
+        }
+
+        std::vector<OrbitShape> shapes(n);
+        std::vector<double> speed(n);
+        ParallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                shapes[i] = orbits.Shape(i);
+                speed[i] = shapes[i].MaxSpeed();
+            }
+        });
+        std::vector<double> x, y, z;
+        const double bucket = settings.bucket > 0.0 ? settings.bucket : AutoBucket(orbits, shapes, speed, settings);
+        const size_t buckets = static_cast<size_t>(std::ceil((settings.end - settings.start) / bucket));
+        result.bucket = bucket;
+        result.buckets = buckets;
+
+        std::vector<uint64_t> keys(n);
+        std::vector<uint32_t> order(n);
+        std::vector<double> lo(n), hi(n), reach(n);
+        std::vector<uint32_t> slab(n), runEnd(n);
+        const size_t blockSize = 2048;
+        const size_t blocks = (n + blockSize - 1) / blockSize;
+        for (size_t b = 0; b < buckets; ++b) {
+            const double t0 = settings.start + b * bucket;
+            const double t1 = std::min(settings.end, t0 + bucket);
+            orbits.Propagate(0.5 * (t0 + t1), x, y, z);
+            const double half = 0.5 * (t1 - t0);
+            double widest = 0.0, yMin = y[0];
+            for (size_t i = 0; i < n; ++i) {
+                reach[i] = speed[i] * half + 0.5 * threshold;
+                widest = std::max(widest, reach[i]);
+                yMin = std::min(yMin, y[i]);
+            }
+            // Slabs of y at least two spheres wide, each sorted by the low end of the x intervals
+            const double slabWidth = 2.0 * widest * (1.0 + 1e-9);
+            ParallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    double s = std::min(std::floor((y[i] - yMin) / slabWidth), 4294967295.0);
+                    keys[i] = (static_cast<uint64_t>(s) << 32) | sortableFloat(static_cast<float>(x[i] - reach[i]));
+                    order[i] = static_cast<uint32_t>(i);
+                }
+            });
+            RadixSortPairs(keys, order, 64);
+            ParallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; ++k) {
+                    uint32_t i = order[k];
+                    lo[k] = x[i] - reach[i];
+                    hi[k] = x[i] + reach[i];
+                    slab[k] = static_cast<uint32_t>(keys[k] >> 32);
+                }
+            });
+            for (size_t k = n; k-- > 0;) {
+                runEnd[k] = k + 1 < n && slab[k + 1] == slab[k] ? runEnd[k + 1] : static_cast<uint32_t>(k + 1);
+            }
+
+            std::vector<std::vector<Conjunction>> found(blocks);
+            std::vector<ConjunctionStats> counts(blocks);
+            ParallelFor(0, blocks, 1, [&](size_t first, size_t last) {
+                for (size_t block = first; block < last; ++block) {
+                    ConjunctionStats& count = counts[block];
+                    auto candidate = [&](uint32_t i, uint32_t j) {
+                        glm::dvec3 d(x[j] - x[i], y[j] - y[i], z[j] - z[i]);
+                        double limit = reach[i] + reach[j];
+                        if (glm::dot(d, d) > limit * limit) {
+                            return;
+                        }
+                        ++count.sweepPairs;
+                        if (!ApsisFilter(shapes[i], shapes[j], threshold)) {
+                            ++count.apsisRejected;
+                            return;
+                        }
+                        if (!PathFilter(shapes[i], shapes[j], threshold)) {
+                            ++count.pathRejected;
+                            return;
+                        }
+                        ++count.refined;
+                        Refine(orbits, std::min(i, j), std::max(i, j), t0, t1, settings.samples, threshold, found[block]);
+                    };
+                    for (size_t k = block * blockSize; k < std::min(n, (block + 1) * blockSize); ++k) {
+                        // Later entries of the same slab, then the overlapping stretch of the next slab
+                        for (size_t m = k + 1; m < runEnd[k] && lo[m] <= hi[k]; ++m) {
+                            candidate(order[k], order[m]);
+                        }
+                        size_t next = runEnd[k];
+                        if (next < n && slab[next] == slab[k] + 1) {
+                            size_t m = std::lower_bound(lo.begin() + next, lo.begin() + runEnd[next],
+                                lo[k] - 2.0 * widest) - lo.begin();
+                            for (; m < runEnd[next] && lo[m] <= hi[k]; ++m) {
+                                if (hi[m] >= lo[k]) {
+                                    candidate(order[k], order[m]);
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+            for (size_t block = 0; block < blocks; ++block) {
+                events.insert(events.end(), found[block].begin(), found[block].end());
+                result.sweepPairs += counts[block].sweepPairs;
+                result.apsisRejected += counts[block].apsisRejected;
+                result.pathRejected += counts[block].pathRejected;
+                result.refined += counts[block].refined;
+            }
+        }
+        std::sort(events.begin(), events.end(), [](const Conjunction& a, const Conjunction& b) {
+            if (a.time != b.time) {
+                return a.time < b.time;
+            }
+            return a.first != b.first ? a.first < b.first : a.second < b.second;
+        });
+        result.events = events.size();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clockStart).count();
+        return events;
+    }
+
+    // The radial shells [perigee, apogee] of the two orbits come within the threshold
+    static bool ApsisFilter(const OrbitShape& a, const OrbitShape& b, double threshold) {
+        return std::max(a.Periapsis(), b.Periapsis()) - std::min(a.Apoapsis(), b.Apoapsis()) <= threshold;
+    }
+
+    // A point of orbit a at angle theta from the planes' crossing line lies r sin(theta) sin(I) from the
+    // plane of b, so points within the threshold of each other are within asin(threshold / (q sin I)) of
+    // the same node on both orbits, and their radii, whose ranges over those windows are exact, differ
+    // by no more than the threshold. Near-coplanar pairs have windows of every angle and always pass.
+    static bool PathFilter(const OrbitShape& a, const OrbitShape& b, double threshold) {
+        glm::dvec3 line = glm::cross(a.normal, b.normal);
+        double sinI = glm::length(line);
+        double qa = a.Periapsis(), qb = b.Periapsis();
+        if (sinI * std::min(qa, qb) <= threshold) {
+            return true;
+        }
+        line /= sinI;
+        double windowA = std::asin(std::min(1.0, threshold / (qa * sinI)));
+        double windowB = std::asin(std::min(1.0, threshold / (qb * sinI)));
+        for (int node = 0; node < 2; ++node) {
+            glm::dvec3 u = node == 0 ? line : -line;
+            double loA, hiA, loB, hiB;
+            radiusRange(a, trueAnomaly(a, u), windowA, loA, hiA);
+            radiusRange(b, trueAnomaly(b, u), windowB, loB, hiB);
+            if (std::max(loA, loB) - std::min(hiA, hiB) <= threshold * (1.0 + 1e-9)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Closest approaches of orbits i and j within [t0, t1) that come within the threshold
+    static void Refine(const KeplerOrbits& orbits, uint32_t i, uint32_t j, double t0, double t1, int samples,
+        double threshold, std::vector<Conjunction>& out) {
+        auto rangeRate = [&](double t) {
+            glm::dvec3 pi, vi, pj, vj;
+            orbits.State(i, t, pi, vi);
+            orbits.State(j, t, pj, vj);
+            return glm::dot(pj - pi, vj - vi);
+        };
+        double ta = t0, ga = rangeRate(t0);
+        for (int s = 1; s <= samples; ++s) {
+            double tb = t0 + (t1 - t0) * s / samples;
+            double gb = rangeRate(tb);
+            if (ga < 0.0 && gb >= 0.0) {
+                double tca = BrentRoot(rangeRate, ta, tb, ga, gb, 1e-12 * std::max(1.0, std::fabs(tb)));
+                glm::dvec3 pi, vi, pj, vj;
+                orbits.State(i, tca, pi, vi);
+                orbits.State(j, tca, pj, vj);
+                double distance = glm::length(pj - pi);
+                if (distance <= threshold && tca < t1) {
+                    Conjunction event = { i, j, tca, distance, glm::length(vj - vi) };
+                    out.push_back(event);
+                }
+            }
+            ta = tb;
+            ga = gb;
+        }
+    }
+
+    // Buckets in which a typical swept sphere reaches a fifth of the mean spacing: propagating and sorting
+    // the population once costs about as much as testing a few candidate pairs per object, and the pair
+    // count grows with the cube of the bucket. At most a sixteenth of the shortest period, so each
+    // range-rate sample interval brackets one minimum.
+    static double AutoBucket(const KeplerOrbits& orbits, const std::vector<OrbitShape>& shapes,
+        const std::vector<double>& speed, const ConjunctionSettings& settings) {
+        const size_t n = orbits.Size();
+        std::vector<double> x, y, z;
+        orbits.Propagate(settings.start, x, y, z);
+        glm::dvec3 lo(x[0], y[0], z[0]), hi(lo);
+        double shortest = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            lo = glm::min(lo, glm::dvec3(x[i], y[i], z[i]));
+            hi = glm::max(hi, glm::dvec3(x[i], y[i], z[i]));
+            double period = 6.283185307179586 / shapes[i].meanMotion;
+            shortest = i == 0 ? period : std::min(shortest, period);
+        }
+        glm::dvec3 extent = glm::max(hi - lo, glm::dvec3(settings.threshold));
+        double density = n / (extent.x * extent.y * extent.z);
+        double spacing = 0.2 * std::cbrt(3.0 / (4.0 * 3.14159265358979323846 * density));
+        std::vector<double> speeds(speed);
+        std::nth_element(speeds.begin(), speeds.begin() + n / 2, speeds.end());
+        double bucket = 2.0 * std::max(spacing, settings.threshold) / speeds[n / 2];
+        return std::min(bucket, shortest / 16.0);
+    }
+
+private:
+    // Order-preserving unsigned image of a float
+    static uint32_t sortableFloat(float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+    }
+
+    static double trueAnomaly(const OrbitShape& shape, const glm::dvec3& direction) {
+        glm::dvec3 along = glm::cross(shape.normal, shape.periapsis);
+        return std::atan2(glm::dot(direction, along), glm::dot(direction, shape.periapsis));
+    }
+
+    // Smallest and largest radius for true anomalies in [nu - window, nu + window]
+    static void radiusRange(const OrbitShape& shape, double nu, double window, double& lo, double& hi) {
+        const double pi = 3.14159265358979323846;
+        if (window >= pi) {
+            lo = shape.Periapsis();
+            hi = shape.Apoapsis();
+            return;
+        }
+        double a = shape.Radius(nu - window), b = shape.Radius(nu + window);
+        lo = std::min(a, b);
+        hi = std::max(a, b);
+        // Periapsis (nu = 0) or apoapsis (nu = pi) inside the window
+        double fromPeriapsis = std::fabs(std::remainder(nu, 2.0 * pi));
+        if (fromPeriapsis <= window) {
+            lo = shape.Periapsis();
+        }
+        if (pi - fromPeriapsis <= window) {
+            hi = shape.Apoapsis();
+        }
+    }
+};
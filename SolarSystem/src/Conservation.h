@@ -0,0 +1,233 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NBody.h"
+#include "Parallel.h"
+
+// Conserved quantities of the whole system at one time
+struct ConservationSample {
+    double time = 0.0;
+    double kinetic = 0.0;
+    double potential = 0.0;
+    glm::dvec3 momentum = glm::dvec3(0.0);
+    glm::dvec3 angularMomentum = glm::dvec3(0.0);   // about the origin
+    double momentumScale = 0.0;                     // sum of m |v|, what momentum drift is measured against
+    double angularMomentumScale = 0.0;              // sum of m |r x v|, the same for angular momentum
+
+    double Energy() const {
+        return kinetic + potential;
+    }
+};
+
+// Relative change since the reference sample
+struct ConservationDrift {
+    double energy = 0.0;
+    double momentum = 0.0;
+    double angularMomentum = 0.0;
+};
+
+// Tracks energy, linear and angular momentum of a simulation every `cadence` steps (0 is off) and their
+// drift from the first sample, optionally appending every sample to a CSV time series. The sums are
+// parallel reductions over fixed chunks added in chunk order, so a sample does not depend on the
+// thread count. The potential is an exact pair sum over the bodies with mass, O(M^2), which is what
+// the cadence is for on large systems; massless test particles only add to the O(N) terms.
+class ConservationMonitor {
+public:
+    unsigned cadence;
+
+    ConservationMonitor() : cadence(0), stepsSinceSample(0), samples(0), hasReference(false), seconds(0.0) {}
+
+    // Starts a CSV time series; every later sample appends a row
+    bool OpenSeries(const std::string& path) {
+        series.close();
+        series.clear();
+        series.open(path.c_str(), std::ios::trunc);
+        if (!series) {
+            std::cout << "ERROR::CONSERVATION::FILE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        series << "time,kinetic,potential,energy,px,py,pz,lx,ly,lz,energy_drift,momentum_drift,angular_momentum_drift"
+            << std::endl << std::setprecision(17);
+        return true;
+    }
+
+    void CloseSeries() {
+        series.close();
+    }
+
+    // Call after every step; samples when the cadence is due
+    void AfterStep(const BodySystem& bodies, const GravitySolver& solver, double time) {
+        if (cadence == 0 || ++stepsSinceSample < cadence) {
+            return;
+        }
+        Sample(bodies, solver.G, solver.softening, time);
+    }
+
+    // Measures now, whatever the cadence; the first sample after a rebase becomes the reference
+    const ConservationSample& Sample(const BodySystem& bodies, double G, double softening, double time) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        stepsSinceSample = 0;
+        latest = Measure(bodies, G, softening, time);
+        if (!hasReference) {
+            reference = latest;
+            hasReference = true;
+            worst = ConservationDrift();
+        }
+        ConservationDrift drift = Drift();
+        worst.energy = std::max(worst.energy, drift.energy);
+        worst.momentum = std::max(worst.momentum, drift.momentum);
+        worst.angularMomentum = std::max(worst.angularMomentum, drift.angularMomentum);
+        ++samples;
+        if (series.is_open()) {
+            series << latest.time << "," << latest.kinetic << "," << latest.potential << "," << latest.Energy() << ","
+                << latest.momentum.x << "," << latest.momentum.y << "," << latest.momentum.z << ","
+                << latest.angularMomentum.x << "," << latest.angularMomentum.y << "," << latest.angularMomentum.z << ","
+                << drift.energy << "," << drift.momentum << "," << drift.angularMomentum << "\n";
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return latest;
+    }
+
+    // Makes the next sample the new reference; for deliberate changes such as merges or restored states
+    void Rebase() {
+        hasReference = false;
+        stepsSinceSample = 0;
+    }
+
+    size_t Samples() const {
+        return samples;
+    }
+
+    const ConservationSample& Latest() const {
+        return latest;
+    }
+
+    const ConservationSample& Reference() const {
+        return reference;
+    }
+
+    // Drift of the latest sample
+    ConservationDrift Drift() const {
+        ConservationDrift drift;
+        if (!hasReference) {
+            return drift;
+        }
+        double energy = std::fabs(reference.Energy());
+        drift.energy = std::fabs(latest.Energy() - reference.Energy()) / (energy > 0.0 ? energy : 1.0);
+        // A system that starts at rest has no momentum to compare with, so the scales of both samples count
+        double momentumScale = std::max(reference.momentumScale, latest.momentumScale);
+        double angularScale = std::max(reference.angularMomentumScale, latest.angularMomentumScale);
+        drift.momentum = glm::length(latest.momentum - reference.momentum) / std::max(momentumScale, 1e-300);
+        drift.angularMomentum = glm::length(latest.angularMomentum - reference.angularMomentum) /
+            std::max(angularScale, 1e-300);
+        return drift;
+    }
+
+    // Largest drift of any sample since the reference
+    ConservationDrift WorstDrift() const {
+        return worst;
+    }
+
+    // Wall time spent sampling, to keep the overhead in view
+    double Seconds() const {
+        return seconds;
+    }
+
+    static ConservationSample Measure(const BodySystem& b, double G, double softening, double time) {
+        const size_t n = b.Size();
+        const size_t chunk = 4096;
+        const size_t chunks = (n + chunk - 1) / chunk;
+        std::vector<ConservationSample> partial(chunks);
+        ParallelFor(0, chunks, 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                ConservationSample& sum = partial[c];
+                for (size_t i = c * chunk; i < std::min(n, (c + 1) * chunk); ++i) {
+                    glm::dvec3 r = b.Position(i), v = b.Velocity(i);
+                    glm::dvec3 p = b.mass[i] * v;
+                    glm::dvec3 l = glm::cross(r, p);
+                    sum.kinetic += 0.5 * glm::dot(p, v);
+                    sum.momentum += p;
+                    sum.angularMomentum += l;
+                    sum.momentumScale += glm::length(p);
+                    sum.angularMomentumScale += glm::length(l);
+                }
+            }
+        });
+
+        // Pairs among the bodies with mass, split into row blocks of roughly equal pair counts
+        std::vector<size_t> massive;
+        for (size_t i = 0; i < n; ++i) {
+            if (b.mass[i] > 0.0) {
+                massive.push_back(i);
+            }
+        }
+        const size_t m = massive.size();
+        const double eps2 = softening * softening;
+        std::vector<size_t> rowStart(1, 0);
+        const double pairsPerBlock = std::max(65536.0, 0.5 * static_cast<double>(m) * static_cast<double>(m) / 256.0);
+        double pairs = 0.0;
+        for (size_t row = 0; row < m; ++row) {
+            pairs += static_cast<double>(m - row - 1);
+            if (pairs >= pairsPerBlock) {
+                rowStart.push_back(row + 1);
+                pairs = 0.0;
+            }
+        }
+        if (rowStart.back() != m) {
+            rowStart.push_back(m);
+        }
+        std::vector<double> potential(rowStart.size() - 1, 0.0);
+        ParallelFor(0, potential.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t block = begin; block < end; ++block) {
+                double sum = 0.0;
+                for (size_t row = rowStart[block]; row < rowStart[block + 1]; ++row) {
+                    const size_t i = massive[row];
+                    const double xi = b.x[i], yi = b.y[i], zi = b.z[i];
+                    double rowSum = 0.0;
+                    for (size_t k = row + 1; k < m; ++k) {
+                        const size_t j = massive[k];
+                        double dx = b.x[j] - xi, dy = b.y[j] - yi, dz = b.z[j] - zi;
+                        double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                        if (r2 > 0.0) {
+                            rowSum += b.mass[j] / std::sqrt(r2);
+                        }
+                    }
+                    sum += b.mass[i] * rowSum;
+                }
+                potential[block] = sum;
+            }
+        });
+
+        ConservationSample sample;
+        sample.time = time;
+        for (size_t c = 0; c < chunks; ++c) {
+            sample.kinetic += partial[c].kinetic;
+            sample.momentum += partial[c].momentum;
+            sample.angularMomentum += partial[c].angularMomentum;
+            sample.momentumScale += partial[c].momentumScale;
+            sample.angularMomentumScale += partial[c].angularMomentumScale;
+        }
+        for (size_t block = 0; block < potential.size(); ++block) {
+            sample.potential -= G * potential[block];
+        }
+        return sample;
+    }
+
+private:
+    unsigned stepsSinceSample;
+    size_t samples;
+    bool hasReference;
+    ConservationSample reference, latest;
+    ConservationDrift worst;
+    std::ofstream series;
+    double seconds;
+};
@@ -0,0 +1,371 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Kepler.h"
+#include "Parallel.h"
+#include "RootFinding.h"
+
+// Eclipse: the occulter's disk is at least as large as the source's, so the source can be hidden;
+// transit: a smaller disk crossing the source
+enum class EclipseKind { Eclipse, Transit };
+
+// One passage of an occulter's disk over a source's disk, as seen from an observer body
+struct EclipseEvent {
+    uint32_t occulter, source, observer;
+    EclipseKind kind;
+    bool central;           // one disk wholly inside the other at maximum (total, annular or full transit)
+    double start, maximum, end;     // first contact, least separation, last contact; clipped to the window
+    double magnitude;       // fraction of the source's diameter covered at maximum
+};
+
+// A spherical body and bounds on its motion over the search window, in the frame the positions are given in
+struct EclipseBody {
+    double radius;
+    double maxSpeed;
+    double maxAcceleration;
+};
+
+struct EclipseSettings {
+    double start = 0.0;
+    double end = 0.0;
+    double chunk = 0.0;         // length of the parallel scan chunks; 0 splits the window into 64
+    double resolution = 1e-3;   // smallest scan step: contacts closer together than this may be missed
+};
+
+struct EclipseStats {
+    size_t triples = 0;
+    size_t chunks = 0;
+    unsigned long long steps = 0;       // shadow function evaluations while scanning
+    size_t contacts = 0;
+    size_t events = 0;
+    double seconds = 0.0;
+};
+
+// Eclipse and transit search over every (occulter, source, observer) triple of a set of spherical
+// bodies. The shadow function of a triple is the angle between the source and the occulter seen from
+// the observer less the sum of their apparent radii; it is negative while the disks overlap, so first
+// and last contacts are its roots. An event also needs the occulter to be nearer than the source, which
+// separates the passages of two disks large enough to overlap from every side. Each triple is scanned
+// with steps as long as the relative velocities and bounds on the accelerations allow without the event
+// state changing, so far from an alignment a step covers a large part of an orbit and the work grows
+// with the number of events rather than the length of the window. Sign changes are refined with Brent's
+// method, contacts are paired into events across the parallel chunks and the maximum is found by
+// golden-section search.
+//
+// `state(i, t, position, velocity)` gives body i at time t in any frame shared by all bodies, like
+// KeplerOrbits::State or Ephemeris::State, and the speed and acceleration bounds of the bodies hold in
+// that frame over the window.
+class EclipseSearch {
+public:
+    template <typename StateFn>
+    static std::vector<EclipseEvent> Search(const StateFn& state, const std::vector<EclipseBody>& bodies,
+        const std::vector<uint32_t>& sources, const EclipseSettings& settings, EclipseStats* stats = nullptr) {
+        std::chrono::steady_clock::time_point clockStart = std::chrono::steady_clock::now();
+        EclipseStats local;
+        EclipseStats& result = stats != nullptr ? *stats : local;
+        result = EclipseStats();
+        std::vector<EclipseEvent> events;
+        if (!(settings.end > settings.start)) {
+            return events;
+        }
+
+        // Triples: every source, any other body in front of it and every body that is neither as observer
+        std::vector<Triple> triples;
+        const uint32_t n = static_cast<uint32_t>(bodies.size());
+        for (size_t s = 0; s < sources.size(); ++s) {
+            for (uint32_t occulter = 0; occulter < n; ++occulter) {
+                for (uint32_t observer = 0; observer < n; ++observer) {
+                    bool observerIsSource = std::find(sources.begin(), sources.end(), observer) != sources.end();
+                    if (occulter != sources[s] && observer != occulter && !observerIsSource) {
+                        Triple triple = { occulter, sources[s], observer };
+                        triples.push_back(triple);
+                    }
+                }
+            }
+        }
+        const double span = settings.end - settings.start;
+        const double chunk = settings.chunk > 0.0 ? settings.chunk : span / 64.0;
+        const size_t chunks = static_cast<size_t>(std::ceil(span / chunk));
+        result.triples = triples.size();
+        result.chunks = chunks;
+
+        // Scan every triple over every chunk; contacts are kept per task in task order
+        std::vector<std::vector<Contact>> found(triples.size() * chunks);
+        std::vector<unsigned long long> steps(found.size(), 0);
+        ParallelFor(0, found.size(), 1, [&](size_t first, size_t last) {
+            for (size_t task = first; task < last; ++task) {
+                const Triple& triple = triples[task / chunks];
+                size_t c = task % chunks;
+                double t0 = settings.start + c * chunk;
+                double t1 = c + 1 == chunks ? settings.end : settings.start + (c + 1) * chunk;
+                scan(state, bodies, triple, t0, t1, settings.resolution, found[task], steps[task]);
+            }
+        });
+
+        // Pair the contacts of each triple into events, in time order across the chunks
+        for (size_t k = 0; k < triples.size(); ++k) {
+            const Triple& triple = triples[k];
+            bool inside = Shadow(state, bodies, triple.occulter, triple.source, triple.observer, settings.start) < 0.0 &&
+                Margin(state, triple.occulter, triple.source, triple.observer, settings.start) > 0.0;
+            double begin = settings.start;
+            EclipseEvent event;
+            for (size_t c = 0; c < chunks; ++c) {
+                const std::vector<Contact>& contacts = found[k * chunks + c];
+                result.contacts += contacts.size();
+                for (size_t m = 0; m < contacts.size(); ++m) {
+                    if (contacts[m].entering) {
+                        inside = true;
+                        begin = contacts[m].time;
+                    }
+                    else if (inside) {
+                        inside = false;
+                        describe(state, bodies, triple, begin, contacts[m].time, event);
+                        events.push_back(event);
+                    }
+                }
+            }
+            // Still in progress at the end of the window
+            if (inside) {
+                describe(state, bodies, triple, begin, settings.end, event);
+                events.push_back(event);
+            }
+        }
+        for (size_t task = 0; task < steps.size(); ++task) {
+            result.steps += steps[task];
+        }
+        std::sort(events.begin(), events.end(), [](const EclipseEvent& a, const EclipseEvent& b) {
+            if (a.start != b.start) {
+                return a.start < b.start;
+            }
+            if (a.observer != b.observer) {
+                return a.observer < b.observer;
+            }
+            return a.occulter != b.occulter ? a.occulter < b.occulter : a.source < b.source;
+        });
+        result.events = events.size();
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - clockStart).count();
+        return events;
+    }
+
+    // Shadow function of one triple at time t: negative while the disks overlap
+    template <typename StateFn>
+    static double Shadow(const StateFn& state, const std::vector<EclipseBody>& bodies, uint32_t occulter,
+        uint32_t source, uint32_t observer, double t) {
+        glm::dvec3 p = positionAt(state, observer, t);
+        glm::dvec3 toSource = positionAt(state, source, t) - p, toOcculter = positionAt(state, occulter, t) - p;
+        double dS = glm::length(toSource), dO = glm::length(toOcculter);
+        double separation = std::atan2(glm::length(glm::cross(toSource, toOcculter)), glm::dot(toSource, toOcculter));
+        return separation - apparentRadius(bodies[source].radius, dS) - apparentRadius(bodies[occulter].radius, dO);
+    }
+
+    // Distance margin of one triple at time t: positive while the occulter is nearer than the source
+    template <typename StateFn>
+    static double Margin(const StateFn& state, uint32_t occulter, uint32_t source, uint32_t observer, double t) {
+        glm::dvec3 p = positionAt(state, observer, t);
+        return glm::length(positionAt(state, source, t) - p) - glm::length(positionAt(state, occulter, t) - p);
+    }
+
+    // Bodies moving on Kepler orbits, bounded in the frame of their common focus: the speed and the
+    // acceleration (mu / q^2 with mu = n^2 a^3) peak at periapsis
+    static std::vector<EclipseBody> Bodies(const KeplerOrbits& orbits, const std::vector<double>& radii) {
+        std::vector<EclipseBody> bodies(orbits.Size());
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            OrbitShape shape = orbits.Shape(i);
+            double a = shape.semiMajorAxis, q = shape.Periapsis();
+            bodies[i].radius = i < radii.size() ? radii[i] : 0.0;
+            bodies[i].maxSpeed = shape.MaxSpeed();
+            bodies[i].maxAcceleration = shape.meanMotion * shape.meanMotion * a * a * a / (q * q);
+        }
+        return bodies;
+    }
+
+private:
+    struct Triple {
+        uint32_t occulter, source, observer;
+    };
+
+    struct Contact {
+        double time;
+        bool entering;
+    };
+
+    template <typename StateFn>
+    static glm::dvec3 positionAt(const StateFn& state, uint32_t body, double t) {
+        glm::dvec3 position, velocity;
+        state(body, t, position, velocity);
+        return position;
+    }
+
+    static double apparentRadius(double radius, double distance) {
+        return distance > radius ? std::asin(radius / distance) : 1.5707963267948966;
+    }
+
+    // Steps through [t0, t1) and records every change of the event state in it: the disks overlap (shadow
+    // function negative) and the occulter is the nearer body (distance margin positive)
+    template <typename StateFn>
+    static void scan(const StateFn& state, const std::vector<EclipseBody>& bodies, const Triple& triple, double t0,
+        double t1, double resolution, std::vector<Contact>& out, unsigned long long& steps) {
+        const EclipseBody &source = bodies[triple.source], &occulter = bodies[triple.occulter];
+        const EclipseBody& observer = bodies[triple.observer];
+        const double rS = source.radius, rO = occulter.radius;
+        const double uS = source.maxSpeed + observer.maxSpeed, uO = occulter.maxSpeed + observer.maxSpeed;
+        const double aS = source.maxAcceleration + observer.maxAcceleration;
+        const double aO = occulter.maxAcceleration + observer.maxAcceleration;
+        auto shadow = [&](double t) { return Shadow(state, bodies, triple.occulter, triple.source, triple.observer, t); };
+        auto margin = [&](double t) { return Margin(state, triple.occulter, triple.source, triple.observer, t); };
+
+        // Distances and relative speeds of the source and the occulter, and the rate of the distance
+        // margin, at the last evaluation
+        double dS = 0.0, dO = 0.0, wS = 0.0, wO = 0.0, gRate = 0.0;
+        auto evaluate = [&](double at, double& f, double& g) {
+            glm::dvec3 p, v, pS, vS, pO, vO;
+            state(triple.observer, at, p, v);
+            state(triple.source, at, pS, vS);
+            state(triple.occulter, at, pO, vO);
+            glm::dvec3 toSource = pS - p, toOcculter = pO - p;
+            dS = glm::length(toSource);
+            dO = glm::length(toOcculter);
+            wS = glm::length(vS - v);
+            wO = glm::length(vO - v);
+            gRate = glm::dot(toSource, vS - v) / dS - glm::dot(toOcculter, vO - v) / dO;
+            double separation = std::atan2(glm::length(glm::cross(toSource, toOcculter)), glm::dot(toSource, toOcculter));
+            f = separation - apparentRadius(rS, dS) - apparentRadius(rO, dO);
+            g = dS - dO;
+            ++steps;
+        };
+        // How far a body can move relative to the observer within h: from the current relative speed and
+        // the accelerations, or from the speed bounds alone
+        auto reach = [](double w, double u, double a, double h) { return std::min((w + 0.5 * a * h) * h, u * h); };
+        double t = t0, f, g;
+        evaluate(t, f, g);
+        while (t < t1) {
+            // Longest step over which the bounds keep the sign of f: a direction turns at most
+            // asin(reach / d), and the apparent radii follow the distances
+            const double rhoS = apparentRadius(rS, dS), rhoO = apparentRadius(rO, dO);
+            double hf = std::min(std::max(resolution, std::fabs(f) / (wS / dS + wO / dO + 1e-300)), t1 - t);
+            while (hf > resolution) {
+                double reachS = reach(wS, uS, aS, hf), reachO = reach(wO, uO, aO, hf);
+                bool keeps = reachS < dS && reachO < dO;
+                if (keeps) {
+                    double turn = std::asin(reachS / dS) + std::asin(reachO / dO);
+                    if (f >= 0.0) {
+                        keeps = f + rhoS + rhoO - turn - apparentRadius(rS, dS - reachS) -
+                            apparentRadius(rO, dO - reachO) > 0.0;
+                    }
+                    else {
+                        keeps = f + rhoS + rhoO + turn - apparentRadius(rS, dS + reachS) -
+                            apparentRadius(rO, dO + reachO) < 0.0;
+                    }
+                }
+                if (keeps) {
+                    break;
+                }
+                hf *= 0.5;
+            }
+            // The same for the distance margin from its rate and a bound on its second derivative: a distance
+            // d with relative speed W and acceleration a curves at most W^2 / d + a
+            const double sign = g > 0.0 ? 1.0 : -1.0;
+            double hg = t1 - t;
+            while (hg > resolution) {
+                double reachS = reach(wS, uS, aS, hg), reachO = reach(wO, uO, aO, hg);
+                double speedS = std::min(wS + aS * hg, uS), speedO = std::min(wO + aO * hg, uO);
+                bool keeps = reachS < dS && reachO < dO;
+                if (keeps) {
+                    double curve = speedS * speedS / (dS - reachS) + aS + speedO * speedO / (dO - reachO) + aO;
+                    keeps = sign * g + std::min(0.0, sign * gRate * hg) - 0.5 * curve * hg * hg > 0.0;
+                }
+                if (keeps) {
+                    break;
+                }
+                hg *= 0.5;
+            }
+            // During an event both signs must hold; outside one, whichever keeps it from starting is enough
+            bool inside = f < 0.0 && g > 0.0;
+            double h = inside ? std::min(hf, hg) : std::max(f >= 0.0 ? hf : 0.0, g <= 0.0 ? hg : 0.0);
+            h = std::min(std::max(h, resolution), t1 - t);
+            double next = t + h, fn, gn;
+            evaluate(next, fn, gn);
+
+            // Refine the sign changes and replay them in time order. A single change that leaves the event
+            // state as it was happened where the other sign held the state, so it needs no root.
+            bool flipsF = (f < 0.0) != (fn < 0.0), flipsG = (g > 0.0) != (gn > 0.0);
+            if ((flipsF && flipsG) || inside != (fn < 0.0 && gn > 0.0)) {
+                double roots[2];
+                int which[2];
+                int count = 0;
+                const double tolerance = 1e-10 * std::max(1.0, std::fabs(next));
+                if (flipsF) {
+                    roots[count] = BrentRoot(shadow, t, next, f, fn, tolerance);
+                    which[count++] = 0;
+                }
+                if (flipsG) {
+                    roots[count] = BrentRoot(margin, t, next, g, gn, tolerance);
+                    which[count++] = 1;
+                }
+                if (count == 2 && roots[1] < roots[0]) {
+                    std::swap(roots[0], roots[1]);
+                    std::swap(which[0], which[1]);
+                }
+                bool overlap = f < 0.0, front = g > 0.0;
+                for (int k = 0; k < count; ++k) {
+                    bool before = overlap && front;
+                    (which[k] == 0 ? overlap : front) = !(which[k] == 0 ? overlap : front);
+                    if (before != (overlap && front)) {
+                        Contact contact = { roots[k], !before };
+                        out.push_back(contact);
+                    }
+                }
+            }
+            t = next;
+            f = fn;
+            g = gn;
+        }
+    }
+
+    // Fills in an event between two contacts
+    template <typename StateFn>
+    static void describe(const StateFn& state, const std::vector<EclipseBody>& bodies, const Triple& triple,
+        double start, double end, EclipseEvent& event) {
+        auto shadow = [&](double t) { return Shadow(state, bodies, triple.occulter, triple.source, triple.observer, t); };
+        // Golden-section search for the least separation
+        const double ratio = 0.6180339887498949;
+        double a = start, b = end;
+        double c = b - ratio * (b - a), d = a + ratio * (b - a);
+        double fc = shadow(c), fd = shadow(d);
+        for (int iteration = 0; iteration < 60 && b - a > 1e-10 * std::max(1.0, std::fabs(b)); ++iteration) {
+            if (fc < fd) {
+                b = d; d = c; fd = fc;
+                c = b - ratio * (b - a);
+                fc = shadow(c);
+            }
+            else {
+                a = c; c = d; fc = fd;
+                d = a + ratio * (b - a);
+                fd = shadow(d);
+            }
+        }
+        double maximum = 0.5 * (a + b);
+        glm::dvec3 p = positionAt(state, triple.observer, maximum);
+        glm::dvec3 toSource = positionAt(state, triple.source, maximum) - p;
+        glm::dvec3 toOcculter = positionAt(state, triple.occulter, maximum) - p;
+        double dS = glm::length(toSource), dO = glm::length(toOcculter);
+        double separation = std::atan2(glm::length(glm::cross(toSource, toOcculter)), glm::dot(toSource, toOcculter));
+        double rhoS = apparentRadius(bodies[triple.source].radius, dS);
+        double rhoO = apparentRadius(bodies[triple.occulter].radius, dO);
+        event.occulter = triple.occulter;
+        event.source = triple.source;
+        event.observer = triple.observer;
+        event.kind = rhoO >= rhoS ? EclipseKind::Eclipse : EclipseKind::Transit;
+        event.central = separation <= std::fabs(rhoS - rhoO);
+        event.start = start;
+        event.maximum = maximum;
+        event.end = end;
+        event.magnitude = (rhoS + rhoO - separation) / (2.0 * rhoS);
+    }
+};
@@ -0,0 +1,514 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Parallel.h"
+#include "Scenario.h"
+
+// Running count, mean, variance, minimum and maximum (Welford's update)
+struct RunningStats {
+    size_t count = 0;
+    double mean = 0.0;
+    double m2 = 0.0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+
+    void Add(double value) {
+        ++count;
+        double delta = value - mean;
+        mean += delta / static_cast<double>(count);
+        m2 += delta * (value - mean);
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+
+    double StandardDeviation() const {
+        return count > 1 ? std::sqrt(m2 / static_cast<double>(count - 1)) : 0.0;
+    }
+};
+
+// Fixed-size histogram for values whose range is not known up front: the first `calibration` samples
+// are held back and set the range (their spread plus a margin on each side), every later sample is
+// counted straight away, outliers in the under- and overflow counts. Logarithmic histograms bin log10.
+class StreamingHistogram {
+public:
+    explicit StreamingHistogram(size_t bins = 40, bool logarithmic = false, size_t calibration = 32)
+        : logarithmic(logarithmic), calibration(std::max<size_t>(calibration, 1)), counts(bins, 0), lower(0.0),
+          upper(0.0), underflow(0), overflow(0), rejected(0) {}
+
+    void Add(double value) {
+        if (logarithmic) {
+            if (!(value > 0.0)) {
+                ++rejected;
+                return;
+            }
+            value = std::log10(value);
+        }
+        if (!std::isfinite(value)) {
+            ++rejected;
+            return;
+        }
+        if (!Calibrated()) {
+            pending.push_back(value);
+            if (pending.size() == calibration) {
+                calibrate();
+            }
+            return;
+        }
+        count(value);
+    }
+
+    // Fixes the range from however many samples there are; call before reading the bins
+    void Finish() {
+        if (!Calibrated() && !pending.empty()) {
+            calibrate();
+        }
+    }
+
+    bool Calibrated() const {
+        return upper > lower;
+    }
+
+    // Prints the non-empty bins as "[from, to) count" lines with a bar, in the unbinned unit
+    void Print(std::ostream& out, const std::string& indent) const {
+        if (!Calibrated()) {
+            return;
+        }
+        size_t largest = std::max<size_t>(1, *std::max_element(counts.begin(), counts.end()));
+        for (size_t b = 0; b < counts.size(); ++b) {
+            if (counts[b] == 0) {
+                continue;
+            }
+            out << indent << "[" << std::setw(12) << edge(b) << ", " << std::setw(12) << edge(b + 1) << ") "
+                << std::setw(7) << counts[b] << " " << std::string(1 + 40 * counts[b] / largest, '#') << std::endl;
+        }
+        if (underflow + overflow + rejected > 0) {
+            out << indent << underflow << " below, " << overflow << " above the range, " << rejected << " not finite"
+                << (logarithmic ? " or not positive" : "") << std::endl;
+        }
+    }
+
+private:
+    bool logarithmic;
+    size_t calibration;
+    std::vector<size_t> counts;
+    std::vector<double> pending;
+    double lower, upper;
+    size_t underflow, overflow, rejected;
+
+    void calibrate() {
+        double low = *std::min_element(pending.begin(), pending.end());
+        double high = *std::max_element(pending.begin(), pending.end());
+        double margin = 0.5 * (high - low);
+        if (margin == 0.0) {
+            margin = std::max(std::fabs(low) * 1e-6, 1e-12);
+        }
+        lower = low - margin;
+        upper = high + margin;
+        for (size_t v = 0; v < pending.size(); ++v) {
+            count(pending[v]);
+        }
+        pending.clear();
+        pending.shrink_to_fit();
+    }
+
+    void count(double value) {
+        if (value < lower) {
+            ++underflow;
+        }
+        else if (value >= upper) {
+            ++overflow;
+        }
+        else {
+            size_t bin = static_cast<size_t>((value - lower) / (upper - lower) * static_cast<double>(counts.size()));
+            ++counts[std::min(bin, counts.size() - 1)];
+        }
+    }
+
+    double edge(size_t b) const {
+        double value = lower + (upper - lower) * static_cast<double>(b) / static_cast<double>(counts.size());
+        return logarithmic ? std::pow(10.0, value) : value;
+    }
+};
+
+struct EnsembleSettings {
+    size_t members = 100;
+    uint64_t seed = 1;
+    // Members integrated side by side in one SIMD-friendly batch. Only used for leapfrog with direct
+    // forces on small systems (up to maxLaneBodies). Off by default: the batches measure no faster than
+    // single members, and their separate kernel only agrees with the direct solver to about 1e-15.
+    unsigned lanes = 1;
+    size_t maxLaneBodies = 64;
+    size_t histogramBins = 40;
+};
+
+struct EnsembleApproachReport {
+    ScenarioApproach pair;
+    RunningStats distance;      // closest approach of each member
+    RunningStats time;          // when it happened
+    StreamingHistogram histogram;
+    size_t below = 0;           // members that came closer than the pair's threshold
+};
+
+struct EnsembleElementsReport {
+    ScenarioElements tracked;
+    RunningStats semiMajorAxis, eccentricity, inclination;
+    StreamingHistogram semiMajorAxisHistogram, eccentricityHistogram, inclinationHistogram;
+    size_t unbound = 0;
+};
+
+// Monte Carlo ensembles: the base scenario cloned `members` times with the scenario's perturbations
+// applied, every member run to the end time, and the results folded into running statistics and
+// histograms, so memory does not grow with the member count or the run length. Members are scheduled
+// on the job system in waves and folded in member order, and each member draws its perturbations from
+// its own seeded generator, so a report does not depend on the thread count. The lane kernel is a
+// separate scalar loop from the direct solver and only agrees with it to about 1e-15, so reports run
+// with different lane counts can differ in the last digits.
+class EnsembleRunner {
+public:
+    std::vector<EnsembleApproachReport> approaches;
+    std::vector<EnsembleElementsReport> elements;
+
+    EnsembleRunner() : members(0), laneBatches(0) {}
+
+    bool Run(const Scenario& scenario, const EnsembleSettings& settings) {
+        if (settings.members == 0 || scenario.endTime <= 0.0) {
+            std::cout << "ERROR::ENSEMBLE::NOTHING_TO_RUN" << std::endl;
+            return false;
+        }
+        if (settings.lanes != 1 && settings.lanes != 4 && settings.lanes != 8) {
+            std::cout << "ERROR::ENSEMBLE::UNSUPPORTED_LANES " << settings.lanes << std::endl;
+            return false;
+        }
+        const unsigned long long steps = static_cast<unsigned long long>(std::round(scenario.endTime / scenario.step));
+        const std::string integrator = scenario.integrator.empty() ?
+            MakeIntegrator(DefaultIntegratorKind())->Name() : scenario.integrator;
+        const bool useLanes = settings.lanes > 1 && integrator == "leapfrog" && scenario.solver == "direct" &&
+            scenario.bodies.size() <= settings.maxLaneBodies;
+        const size_t batch = useLanes ? settings.lanes : 1;
+
+        approaches.clear();
+        for (size_t p = 0; p < scenario.approaches.size(); ++p) {
+            EnsembleApproachReport report;
+            report.pair = scenario.approaches[p];
+            report.histogram = StreamingHistogram(settings.histogramBins, true);
+            approaches.push_back(report);
+        }
+        elements.clear();
+        referencePoles.clear();
+        for (size_t e = 0; e < scenario.elements.size(); ++e) {
+            EnsembleElementsReport report;
+            report.tracked = scenario.elements[e];
+            report.semiMajorAxisHistogram = StreamingHistogram(settings.histogramBins);
+            report.eccentricityHistogram = StreamingHistogram(settings.histogramBins);
+            report.inclinationHistogram = StreamingHistogram(settings.histogramBins);
+            elements.push_back(report);
+            // Inclinations are measured from the unperturbed orbit's plane, whatever the scenario's axes
+            const ScenarioBody& body = scenario.bodies[report.tracked.body];
+            const ScenarioBody& central = scenario.bodies[report.tracked.central];
+            referencePoles.push_back(glm::normalize(glm::cross(body.position - central.position,
+                body.velocity - central.velocity)));
+        }
+
+        // A wave keeps every worker busy with a few batches; its results are folded before the next one
+        const size_t batchesPerWave = 4 * static_cast<size_t>(WorkerCount());
+        members = settings.members;
+        laneBatches = 0;
+        for (size_t waveStart = 0; waveStart < settings.members; waveStart += batchesPerWave * batch) {
+            size_t waveEnd = std::min(settings.members, waveStart + batchesPerWave * batch);
+            std::vector<MemberResult> results(waveEnd - waveStart);
+            size_t batches = (waveEnd - waveStart + batch - 1) / batch;
+            ParallelFor(0, batches, 1, [&](size_t begin, size_t end) {
+                for (size_t b = begin; b < end; ++b) {
+                    size_t first = waveStart + b * batch, last = std::min(waveEnd, first + batch);
+                    if (!useLanes) {
+                        runMember(scenario, settings.seed, first, steps, results[first - waveStart]);
+                    }
+                    else if (settings.lanes == 4) {
+                        runLanes<4>(scenario, settings.seed, first, last, steps, &results[first - waveStart]);
+                    }
+                    else {
+                        runLanes<8>(scenario, settings.seed, first, last, steps, &results[first - waveStart]);
+                    }
+                }
+            });
+            laneBatches += useLanes ? batches : 0;
+            for (size_t r = 0; r < results.size(); ++r) {
+                fold(results[r]);
+            }
+        }
+        for (size_t p = 0; p < approaches.size(); ++p) {
+            approaches[p].histogram.Finish();
+        }
+        for (size_t e = 0; e < elements.size(); ++e) {
+            elements[e].semiMajorAxisHistogram.Finish();
+            elements[e].eccentricityHistogram.Finish();
+            elements[e].inclinationHistogram.Finish();
+        }
+        return true;
+    }
+
+    size_t Members() const {
+        return members;
+    }
+
+    // Batches run on the SIMD lane path; 0 when every member ran as its own simulation
+    size_t LaneBatches() const {
+        return laneBatches;
+    }
+
+    void Print(std::ostream& out, const Scenario& scenario) const {
+        out << "ensemble of " << members << " members" << std::endl;
+        for (size_t p = 0; p < approaches.size(); ++p) {
+            const EnsembleApproachReport& report = approaches[p];
+            out << "approach " << scenario.bodies[report.pair.first].name << " - "
+                << scenario.bodies[report.pair.second].name << ": closest " << report.distance.mean << " +- "
+                << report.distance.StandardDeviation() << " [" << report.distance.min << ", " << report.distance.max
+                << "] at t " << report.time.mean << " +- " << report.time.StandardDeviation();
+            if (report.pair.threshold > 0.0) {
+                out << ", closer than " << report.pair.threshold << ": " << report.below << " ("
+                    << 100.0 * report.below / std::max<size_t>(members, 1) << "%)";
+            }
+            out << std::endl;
+            report.histogram.Print(out, "    ");
+        }
+        for (size_t e = 0; e < elements.size(); ++e) {
+            const EnsembleElementsReport& report = elements[e];
+            out << "elements of " << scenario.bodies[report.tracked.body].name << " around "
+                << scenario.bodies[report.tracked.central].name << ": " << report.unbound << " unbound" << std::endl;
+            printElement(out, "  a ", report.semiMajorAxis, report.semiMajorAxisHistogram);
+            printElement(out, "  e ", report.eccentricity, report.eccentricityHistogram);
+            printElement(out, "  i ", report.inclination, report.inclinationHistogram);
+        }
+    }
+
+    // Initial conditions of one member: the base bodies with the perturbations drawn in scenario order
+    static std::vector<ScenarioBody> PerturbedBodies(const Scenario& scenario, uint64_t seed, size_t member) {
+        std::vector<ScenarioBody> bodies = scenario.bodies;
+        std::seed_seq sequence = { static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32),
+            static_cast<uint32_t>(member), static_cast<uint32_t>(static_cast<uint64_t>(member) >> 32) };
+        std::mt19937_64 rng(sequence);
+        std::normal_distribution<double> gaussian(0.0, 1.0);
+        std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+        for (size_t p = 0; p < scenario.perturbations.size(); ++p) {
+            const ScenarioPerturbation& perturbation = scenario.perturbations[p];
+            bool all = perturbation.body == ScenarioPerturbation::AllBodies;
+            size_t first = all ? 0 : perturbation.body, last = all ? bodies.size() : perturbation.body + 1;
+            for (size_t i = first; i < last; ++i) {
+                auto draw = [&]() {
+                    return perturbation.scale * (perturbation.gaussian ? gaussian(rng) : uniform(rng));
+                };
+                if (perturbation.quantity == PerturbedQuantity::Position) {
+                    bodies[i].position += glm::dvec3(draw(), draw(), draw());
+                }
+                else if (perturbation.quantity == PerturbedQuantity::Velocity) {
+                    bodies[i].velocity += glm::dvec3(draw(), draw(), draw());
+                }
+                else {
+                    bodies[i].mass = std::max(0.0, bodies[i].mass * (1.0 + draw()));
+                }
+            }
+        }
+        return bodies;
+    }
+
+private:
+    // What one member contributes to the report
+    struct MemberResult {
+        std::vector<double> closest, closestTime;
+        std::vector<glm::dvec3> relativePosition, relativeVelocity;
+        std::vector<double> mu;
+    };
+
+    size_t members;
+    size_t laneBatches;
+    std::vector<glm::dvec3> referencePoles;
+
+    void startMember(const Scenario& scenario, MemberResult& result) const {
+        result.closest.assign(scenario.approaches.size(), std::numeric_limits<double>::infinity());
+        result.closestTime.assign(scenario.approaches.size(), 0.0);
+    }
+
+    static void trackApproaches(const Scenario& scenario, const BodySystem& b, double time, MemberResult& result) {
+        for (size_t p = 0; p < scenario.approaches.size(); ++p) {
+            double distance = glm::length(b.Position(scenario.approaches[p].first) - b.Position(scenario.approaches[p].second));
+            if (distance < result.closest[p]) {
+                result.closest[p] = distance;
+                result.closestTime[p] = time;
+            }
+        }
+    }
+
+    static void finishMember(const Scenario& scenario, const BodySystem& b, MemberResult& result) {
+        for (size_t e = 0; e < scenario.elements.size(); ++e) {
+            size_t body = scenario.elements[e].body, central = scenario.elements[e].central;
+            result.relativePosition.push_back(b.Position(body) - b.Position(central));
+            result.relativeVelocity.push_back(b.Velocity(body) - b.Velocity(central));
+            result.mu.push_back(scenario.G * (b.mass[body] + b.mass[central]));
+        }
+    }
+
+    void runMember(const Scenario& scenario, uint64_t seed, size_t member, unsigned long long steps,
+        MemberResult& result) const {
+        Scenario perturbed = scenario;
+        perturbed.bodies = PerturbedBodies(scenario, seed, member);
+        NBodySimulation simulation;
+        perturbed.Build(simulation);
+        startMember(scenario, result);
+        trackApproaches(scenario, simulation.bodies, simulation.time, result);
+        for (unsigned long long s = 0; s < steps; ++s) {
+            simulation.Step(scenario.step);
+            trackApproaches(scenario, simulation.bodies, simulation.time, result);
+        }
+        finishMember(scenario, simulation.bodies, result);
+    }
+
+    // Kick-drift-kick leapfrog with direct forces for Lanes members at once. Arrays are body-major with
+    // the members innermost, so every inner loop runs over the lanes with no dependencies between them
+    // and the compiler maps it onto the vector units. Missing members at the end repeat the last one.
+    template <int Lanes>
+    void runLanes(const Scenario& scenario, uint64_t seed, size_t first, size_t last, unsigned long long steps,
+        MemberResult* results) const {
+        const size_t n = scenario.bodies.size();
+        std::vector<double> x(n * Lanes), y(n * Lanes), z(n * Lanes), vx(n * Lanes), vy(n * Lanes), vz(n * Lanes);
+        std::vector<double> ax(n * Lanes), ay(n * Lanes), az(n * Lanes), mass(n * Lanes);
+        for (int l = 0; l < Lanes; ++l) {
+            std::vector<ScenarioBody> bodies = PerturbedBodies(scenario, seed, std::min(first + l, last - 1));
+            for (size_t i = 0; i < n; ++i) {
+                x[i * Lanes + l] = bodies[i].position.x;
+                y[i * Lanes + l] = bodies[i].position.y;
+                z[i * Lanes + l] = bodies[i].position.z;
+                vx[i * Lanes + l] = bodies[i].velocity.x;
+                vy[i * Lanes + l] = bodies[i].velocity.y;
+                vz[i * Lanes + l] = bodies[i].velocity.z;
+                mass[i * Lanes + l] = bodies[i].mass;
+            }
+        }
+        const double G = scenario.G, eps2 = scenario.softening * scenario.softening, h = scenario.step;
+        auto accelerations = [&]() {
+            for (size_t i = 0; i < n; ++i) {
+                double sx[Lanes] = {}, sy[Lanes] = {}, sz[Lanes] = {};
+                for (size_t j = 0; j < n; ++j) {
+                    if (j == i) {
+                        continue;
+                    }
+                    for (int l = 0; l < Lanes; ++l) {
+                        double dx = x[j * Lanes + l] - x[i * Lanes + l];
+                        double dy = y[j * Lanes + l] - y[i * Lanes + l];
+                        double dz = z[j * Lanes + l] - z[i * Lanes + l];
+                        double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                        // Coincident bodies with no softening pull on each other with nothing, as in the direct solver
+                        double inv = r2 > 0.0 ? 1.0 / std::sqrt(r2) : 0.0;
+                        double s = mass[j * Lanes + l] * inv * inv * inv;
+                        sx[l] += dx * s; sy[l] += dy * s; sz[l] += dz * s;
+                    }
+                }
+                for (int l = 0; l < Lanes; ++l) {
+                    ax[i * Lanes + l] = G * sx[l];
+                    ay[i * Lanes + l] = G * sy[l];
+                    az[i * Lanes + l] = G * sz[l];
+                }
+            }
+        };
+        auto kick = [&](double dt) {
+            for (size_t k = 0; k < n * Lanes; ++k) {
+                vx[k] += dt * ax[k]; vy[k] += dt * ay[k]; vz[k] += dt * az[k];
+            }
+        };
+        auto drift = [&](double dt) {
+            for (size_t k = 0; k < n * Lanes; ++k) {
+                x[k] += dt * vx[k]; y[k] += dt * vy[k]; z[k] += dt * vz[k];
+            }
+        };
+        auto track = [&](double time) {
+            for (size_t m = first; m < last; ++m) {
+                int l = static_cast<int>(m - first);
+                MemberResult& result = results[m - first];
+                for (size_t p = 0; p < scenario.approaches.size(); ++p) {
+                    size_t a = scenario.approaches[p].first * Lanes + l, b = scenario.approaches[p].second * Lanes + l;
+                    double distance = glm::length(glm::dvec3(x[a] - x[b], y[a] - y[b], z[a] - z[b]));
+                    if (distance < result.closest[p]) {
+                        result.closest[p] = distance;
+                        result.closestTime[p] = time;
+                    }
+                }
+            }
+        };
+
+        for (size_t m = first; m < last; ++m) {
+            startMember(scenario, results[m - first]);
+        }
+        track(0.0);
+        accelerations();
+        double time = 0.0;
+        for (unsigned long long s = 0; s < steps; ++s) {
+            kick(0.5 * h);
+            drift(h);
+            accelerations();
+            kick(0.5 * h);
+            time += h;
+            track(time);
+        }
+        for (size_t m = first; m < last; ++m) {
+            int l = static_cast<int>(m - first);
+            MemberResult& result = results[m - first];
+            for (size_t e = 0; e < scenario.elements.size(); ++e) {
+                size_t a = scenario.elements[e].body * Lanes + l, c = scenario.elements[e].central * Lanes + l;
+                result.relativePosition.push_back(glm::dvec3(x[a] - x[c], y[a] - y[c], z[a] - z[c]));
+                result.relativeVelocity.push_back(glm::dvec3(vx[a] - vx[c], vy[a] - vy[c], vz[a] - vz[c]));
+                result.mu.push_back(G * (mass[a] + mass[c]));
+            }
+        }
+    }
+
+    void fold(const MemberResult& result) {
+        for (size_t p = 0; p < approaches.size(); ++p) {
+            EnsembleApproachReport& report = approaches[p];
+            report.distance.Add(result.closest[p]);
+            report.time.Add(result.closestTime[p]);
+            report.histogram.Add(result.closest[p]);
+            report.below += result.closest[p] < report.pair.threshold ? 1 : 0;
+        }
+        for (size_t e = 0; e < elements.size(); ++e) {
+            EnsembleElementsReport& report = elements[e];
+            const glm::dvec3& r = result.relativePosition[e];
+            const glm::dvec3& v = result.relativeVelocity[e];
+            double mu = result.mu[e];
+            double inverseA = 2.0 / glm::length(r) - glm::dot(v, v) / mu;
+            glm::dvec3 h = glm::cross(r, v);
+            glm::dvec3 eVector = glm::cross(v, h) / mu - glm::normalize(r);
+            double eccentricity = glm::length(eVector);
+            if (inverseA <= 0.0 || eccentricity >= 1.0) {
+                ++report.unbound;
+                continue;
+            }
+            double inclination = std::acos(glm::clamp(glm::dot(glm::normalize(h), referencePoles[e]), -1.0, 1.0));
+            report.semiMajorAxis.Add(1.0 / inverseA);
+            report.eccentricity.Add(eccentricity);
+            report.inclination.Add(inclination);
+            report.semiMajorAxisHistogram.Add(1.0 / inverseA);
+            report.eccentricityHistogram.Add(eccentricity);
+            report.inclinationHistogram.Add(inclination);
+        }
+    }
+
+    static void printElement(std::ostream& out, const char* label, const RunningStats& stats,
+        const StreamingHistogram& histogram) {
+        if (stats.count == 0) {
+            out << label << "no bound members" << std::endl;
+            return;
+        }
+        out << label << stats.mean << " +- " << stats.StandardDeviation() << " [" << stats.min << ", " << stats.max
+            << "]" << std::endl;
+        histogram.Print(out, "    ");
+    }
+};
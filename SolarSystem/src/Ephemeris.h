@@ -0,0 +1,390 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MappedFile.h"
+#include "Simulation.h"
+
+// On-disk layout (little endian, all doubles 8-byte aligned):
+//     EphemerisHeader | EphemerisBodyLayout[bodyCount] | double records[recordCount][recordDoubles]
+// The span is cut into records of equal length. Within a record, body b owns `subintervals` equal
+// pieces, each holding `coefficients` Chebyshev coefficients for x, then y, then z, starting at
+// `offset` doubles into the record. Bodies on fast orbits simply get more pieces per record.
+struct EphemerisHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t coefficients;
+    uint32_t recordCount;
+    uint32_t recordDoubles;
+    uint32_t reserved;
+    double startTime;
+    double recordLength;
+    double tolerance;           // error bound the fit reached: the requested tolerance or the larger achieved error
+};
+
+struct EphemerisBodyLayout {
+    uint32_t subintervals;
+    uint32_t offset;
+};
+
+struct EphemerisSettings {
+    double span = 600.0;            // simulated time covered, starting at the simulation's current time
+    double recordLength = 8.0;
+    int coefficients = 12;          // per component and piece, at most Ephemeris::MaxCoefficients
+    double tolerance = 1e-6;        // largest allowed position error against the integrated samples
+    unsigned maxSubintervals = 64;  // power of two; bodies that still miss the tolerance stop here,
+                                    // as do bodies whose error stops improving
+};
+
+struct EphemerisStats {
+    double maxError = 0.0;
+    bool toleranceMet = true;       // false when some body stopped short of the tolerance
+    size_t bytes = 0;
+    std::vector<unsigned> subintervals;
+};
+
+// Piecewise Chebyshev ephemeris read from a memory-mapped file. A lookup is a division to find the
+// record and piece, then a Clenshaw recurrence per component, so its cost is the same at any time.
+class Ephemeris {
+public:
+    static const uint32_t Version = 1;
+    static const int MaxCoefficients = 32;
+
+    Ephemeris() : header(nullptr), layout(nullptr), records(nullptr) {}
+
+    bool Open(const std::string& path) {
+        Close();
+        if (!file.Open(path)) {
+            std::cout << "ERROR::EPHEMERIS::FILE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        if (!validate()) {
+            std::cout << "ERROR::EPHEMERIS::INVALID_FILE " << path << std::endl;
+            Close();
+            return false;
+        }
+        header = reinterpret_cast<const EphemerisHeader*>(file.Data());
+        layout = reinterpret_cast<const EphemerisBodyLayout*>(file.Data() + sizeof(EphemerisHeader));
+        records = reinterpret_cast<const double*>(file.Data() + dataOffset(header->bodyCount));
+        return true;
+    }
+
+    void Close() {
+        file.Close();
+        header = nullptr;
+        layout = nullptr;
+        records = nullptr;
+    }
+
+    bool IsOpen() const {
+        return header != nullptr;
+    }
+
+    size_t BodyCount() const {
+        return header->bodyCount;
+    }
+
+    double StartTime() const {
+        return header->startTime;
+    }
+
+    double EndTime() const {
+        return header->startTime + header->recordLength * header->recordCount;
+    }
+
+    size_t Bytes() const {
+        return file.Size();
+    }
+
+    // Times outside the covered span are clamped to its ends
+    glm::dvec3 Position(size_t body, double t) const {
+        double x;
+        const double* c = piece(body, t, x);
+        const int n = static_cast<int>(header->coefficients);
+        return glm::dvec3(Clenshaw(c, n, x), Clenshaw(c + n, n, x), Clenshaw(c + 2 * n, n, x));
+    }
+
+    void State(size_t body, double t, glm::dvec3& position, glm::dvec3& velocity) const {
+        double x;
+        const double* c = piece(body, t, x);
+        const int n = static_cast<int>(header->coefficients);
+        double scale = 2.0 * layout[body].subintervals / header->recordLength;
+        for (int k = 0; k < 3; ++k) {
+            position[k] = Clenshaw(c + k * n, n, x);
+            velocity[k] = ClenshawDerivative(c + k * n, n, x) * scale;
+        }
+    }
+
+    // Sum of c[j] T_j(x) for x in [-1, 1]
+    static double Clenshaw(const double* c, int n, double x) {
+        double b1 = 0.0, b2 = 0.0;
+        double twoX = 2.0 * x;
+        for (int j = n - 1; j >= 1; --j) {
+            double b0 = twoX * b1 - b2 + c[j];
+            b2 = b1;
+            b1 = b0;
+        }
+        return x * b1 - b2 + c[0];
+    }
+
+    // d/dx of the same series, through the derivative's Chebyshev coefficients
+    static double ClenshawDerivative(const double* c, int n, double x) {
+        if (n < 2) {
+            return 0.0;
+        }
+        double d[MaxCoefficients];
+        d[n - 1] = 0.0;
+        d[n - 2] = 2.0 * (n - 1) * c[n - 1];
+        for (int j = n - 2; j >= 1; --j) {
+            d[j - 1] = d[j + 1] + 2.0 * j * c[j];
+        }
+        d[0] *= 0.5;
+        return Clenshaw(d, n - 1, x);
+    }
+
+    // Chebyshev coefficients of f on [-1, 1] from its values at the n Chebyshev nodes
+    // x_k = cos(pi (k + 1/2) / n), k = 0..n-1
+    static void Fit(const double* values, int n, double* c) {
+        const double pi = 3.141592653589793;
+        for (int j = 0; j < n; ++j) {
+            double sum = 0.0;
+            for (int k = 0; k < n; ++k) {
+                sum += values[k] * std::cos(pi * j * (k + 0.5) / n);
+            }
+            c[j] = 2.0 * sum / n;
+        }
+        c[0] *= 0.5;
+    }
+
+    static size_t dataOffset(size_t bodyCount) {
+        return sizeof(EphemerisHeader) + bodyCount * sizeof(EphemerisBodyLayout);
+    }
+
+private:
+    MappedFile file;
+    const EphemerisHeader* header;
+    const EphemerisBodyLayout* layout;
+    const double* records;
+
+    // Coefficients of the piece covering t, and t mapped to that piece's [-1, 1]
+    const double* piece(size_t body, double t, double& x) const {
+        double u = (t - header->startTime) / header->recordLength;
+        u = std::min(std::max(u, 0.0), static_cast<double>(header->recordCount));
+        size_t record = std::min(static_cast<size_t>(u), static_cast<size_t>(header->recordCount) - 1);
+        const EphemerisBodyLayout& pieces = layout[body];
+        double local = (u - record) * pieces.subintervals;
+        size_t sub = std::min(static_cast<size_t>(local), static_cast<size_t>(pieces.subintervals) - 1);
+        x = 2.0 * (local - sub) - 1.0;
+        return records + record * header->recordDoubles + pieces.offset + sub * 3 * header->coefficients;
+    }
+
+    bool validate() const {
+        if (file.Size() < sizeof(EphemerisHeader)) {
+            return false;
+        }
+        const EphemerisHeader* h = reinterpret_cast<const EphemerisHeader*>(file.Data());
+        if (std::memcmp(h->magic, "SSEPHEM", 8) != 0 || h->version != Version || h->bodyCount == 0 ||
+            h->coefficients == 0 || h->coefficients > MaxCoefficients || h->recordCount == 0 || !(h->recordLength > 0.0)) {
+            return false;
+        }
+        size_t tableEnd = dataOffset(h->bodyCount);
+        if (file.Size() < tableEnd) {
+            return false;
+        }
+        const EphemerisBodyLayout* table = reinterpret_cast<const EphemerisBodyLayout*>(file.Data() + sizeof(EphemerisHeader));
+        for (uint32_t b = 0; b < h->bodyCount; ++b) {
+            size_t end = table[b].offset + static_cast<size_t>(table[b].subintervals) * 3 * h->coefficients;
+            if (table[b].subintervals == 0 || end > h->recordDoubles) {
+                return false;
+            }
+        }
+        return file.Size() == tableEnd + static_cast<size_t>(h->recordCount) * h->recordDoubles * sizeof(double);
+    }
+};
+
+// Integrates a simulation forward once over the requested span, fits every body and writes the file.
+// Encounter detection and conservation sampling are suspended meanwhile, so the encounter log and the
+// drift series get no rows for the rolled-back span and no merge changes the body count. The simulation
+// is restored to its starting state afterwards. A body that misses the tolerance is reported and the
+// header records the error actually reached.
+class EphemerisBuilder {
+public:
+    static bool Build(NBodySimulation& simulation, double step, const EphemerisSettings& settings,
+        const std::string& path, EphemerisStats* stats = nullptr) {
+        const size_t bodies = simulation.bodies.Size();
+        const int n = settings.coefficients;
+        if (bodies == 0 || n < 1 || n > Ephemeris::MaxCoefficients || !(step > 0.0) || !(settings.span > 0.0) ||
+            !(settings.recordLength > 0.0)) {
+            std::cout << "ERROR::EPHEMERIS::INVALID_SETTINGS" << std::endl;
+            return false;
+        }
+        const size_t recordCount = static_cast<size_t>(std::ceil(settings.span / settings.recordLength));
+        const double startTime = simulation.time;
+
+        // Integrated states at every step, per body, for Hermite interpolation between steps
+        Samples samples;
+        samples.start = startTime;
+        samples.step = step;
+        samples.count = static_cast<size_t>(std::ceil(recordCount * settings.recordLength / step)) + 1;
+        samples.bodies = bodies;
+        samples.position.resize(samples.count * bodies);
+        samples.velocity.resize(samples.count * bodies);
+        BodySystem saved = simulation.bodies;
+        const bool detectEncounters = simulation.detectEncounters;
+        const unsigned cadence = simulation.conservation.cadence;
+        simulation.detectEncounters = false;
+        simulation.conservation.cadence = 0;
+        for (size_t k = 0; k < samples.count; ++k) {
+            if (k > 0) {
+                simulation.Step(step);
+            }
+            for (size_t b = 0; b < bodies; ++b) {
+                samples.position[b * samples.count + k] = simulation.bodies.Position(b);
+                samples.velocity[b * samples.count + k] = simulation.bodies.Velocity(b);
+            }
+        }
+        simulation.bodies = saved;
+        simulation.time = startTime;
+        simulation.detectEncounters = detectEncounters;
+        simulation.conservation.cadence = cadence;
+        simulation.Invalidate();
+
+        // Per body, halve the pieces until every sample is within the tolerance
+        std::vector<std::vector<double> > coefficients(bodies);
+        std::vector<EphemerisBodyLayout> layout(bodies);
+        double worst = 0.0;
+        uint32_t recordDoubles = 0;
+        for (size_t b = 0; b < bodies; ++b) {
+            unsigned subintervals = 1;
+            double error = fitBody(samples, b, recordCount, settings.recordLength, subintervals, n, coefficients[b]);
+            std::vector<double> finer;
+            while (error > settings.tolerance && subintervals < settings.maxSubintervals) {
+                double finerError = fitBody(samples, b, recordCount, settings.recordLength, 2 * subintervals, n, finer);
+                // Stop once halving no longer helps: the samples' own interpolation error has been reached
+                if (finerError > 0.5 * error) {
+                    break;
+                }
+                coefficients[b].swap(finer);
+                error = finerError;
+                subintervals *= 2;
+            }
+            worst = std::max(worst, error);
+            layout[b].subintervals = subintervals;
+            layout[b].offset = recordDoubles;
+            recordDoubles += static_cast<uint32_t>(subintervals * 3 * n);
+        }
+        if (worst > settings.tolerance) {
+            std::cout << "ERROR::EPHEMERIS::TOLERANCE_NOT_MET requested " << settings.tolerance << ", reached " << worst
+                << std::endl;
+        }
+
+        EphemerisHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, "SSEPHEM", 8);
+        header.version = Ephemeris::Version;
+        header.bodyCount = static_cast<uint32_t>(bodies);
+        header.coefficients = static_cast<uint32_t>(n);
+        header.recordCount = static_cast<uint32_t>(recordCount);
+        header.recordDoubles = recordDoubles;
+        header.startTime = startTime;
+        header.recordLength = settings.recordLength;
+        header.tolerance = std::max(settings.tolerance, worst);
+
+        std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::EPHEMERIS::FILE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(&layout[0]), bodies * sizeof(EphemerisBodyLayout));
+        for (size_t r = 0; r < recordCount; ++r) {
+            for (size_t b = 0; b < bodies; ++b) {
+                size_t perRecord = static_cast<size_t>(layout[b].subintervals) * 3 * n;
+                out.write(reinterpret_cast<const char*>(&coefficients[b][r * perRecord]), perRecord * sizeof(double));
+            }
+        }
+        if (!out) {
+            std::cout << "ERROR::EPHEMERIS::FILE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+
+        if (stats != nullptr) {
+            stats->maxError = worst;
+            stats->toleranceMet = worst <= settings.tolerance;
+            stats->bytes = Ephemeris::dataOffset(bodies) + recordCount * recordDoubles * sizeof(double);
+            stats->subintervals.clear();
+            for (size_t b = 0; b < bodies; ++b) {
+                stats->subintervals.push_back(layout[b].subintervals);
+            }
+        }
+        return true;
+    }
+
+private:
+    struct Samples {
+        double start, step;
+        size_t count, bodies;
+        std::vector<glm::dvec3> position, velocity;
+
+        // Cubic Hermite interpolation between the two samples around t
+        glm::dvec3 At(size_t body, double t) const {
+            double u = (t - start) / step;
+            size_t k = std::min(static_cast<size_t>(std::max(u, 0.0)), count - 2);
+            double s = u - k;
+            const glm::dvec3& p0 = position[body * count + k];
+            const glm::dvec3& p1 = position[body * count + k + 1];
+            glm::dvec3 m0 = velocity[body * count + k] * step;
+            glm::dvec3 m1 = velocity[body * count + k + 1] * step;
+            double s2 = s * s, s3 = s2 * s;
+            return p0 * (2.0 * s3 - 3.0 * s2 + 1.0) + m0 * (s3 - 2.0 * s2 + s) + p1 * (3.0 * s2 - 2.0 * s3) + m1 * (s3 - s2);
+        }
+    };
+
+    // Fits every record of one body with the given number of pieces; returns the largest deviation
+    // from the integrated samples
+    static double fitBody(const Samples& samples, size_t body, size_t recordCount, double recordLength,
+        unsigned subintervals, int n, std::vector<double>& out) {
+        const double pi = 3.141592653589793;
+        const size_t pieces = recordCount * subintervals;
+        const double length = recordLength / subintervals;
+        out.assign(pieces * 3 * n, 0.0);
+        double values[3][Ephemeris::MaxCoefficients];
+        double worst = 0.0;
+        for (size_t p = 0; p < pieces; ++p) {
+            double begin = samples.start + p * length;
+            double mid = begin + 0.5 * length;
+            for (int k = 0; k < n; ++k) {
+                glm::dvec3 value = samples.At(body, mid + 0.5 * length * std::cos(pi * (k + 0.5) / n));
+                values[0][k] = value.x;
+                values[1][k] = value.y;
+                values[2][k] = value.z;
+            }
+            double* c = &out[p * 3 * n];
+            for (int axis = 0; axis < 3; ++axis) {
+                Ephemeris::Fit(values[axis], n, c + axis * n);
+            }
+
+            // Compare against every integrated sample inside the piece
+            size_t first = static_cast<size_t>(std::ceil((begin - samples.start) / samples.step));
+            size_t last = std::min(static_cast<size_t>((begin + length - samples.start) / samples.step), samples.count - 1);
+            for (size_t k = first; k <= last; ++k) {
+                double x = 2.0 * (samples.start + k * samples.step - mid) / length;
+                x = std::min(std::max(x, -1.0), 1.0);
+                glm::dvec3 fitted(Ephemeris::Clenshaw(c, n, x), Ephemeris::Clenshaw(c + n, n, x),
+                    Ephemeris::Clenshaw(c + 2 * n, n, x));
+                worst = std::max(worst, glm::length(fitted - samples.position[body * samples.count + k]));
+            }
+        }
+        return worst;
+    }
+};
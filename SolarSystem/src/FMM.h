@@ -0,0 +1,383 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NBody.h"
+#include "Octree.h"
+#include "JobSystem.h"
+
+// Fast multipole method with Cartesian Taylor expansions of order p over the Morton octree.
+// Multipoles M_k = sum m (y - c)^k sit at cell centers. Far cells interact through
+// L_n += sum_k (-1)^|k| M_k C(k+n, n) a_{k+n}(z - c), where a_k = D^k(1/r) / k! comes from a
+// three-term recurrence. Interaction lists come from a dual-tree walk with the opening test
+// (rT + rS) < theta * |zT - zS|. Everything runs as one task graph on the work-stealing pool:
+// P2M/M2M upward per subtree, the dual-tree walk per subtree in parallel with it, then M2L/L2L/L2P/P2P
+// downward.
+class FmmSolver : public GravitySolver {
+public:
+    int order;
+    double theta;
+    Octree tree;
+
+    FmmSolver(double G = 1.0, double softening = 0.0, int order = 4, double theta = 0.5, size_t leafSize = 64)
+        : GravitySolver(G, softening), order(order), theta(theta), tree(leafSize), preparedOrder(-1) {}
+
+    const char* Name() const override {
+        return "fmm";
+    }
+
+    void ComputeAccelerations(BodySystem& bodies) override {
+        const size_t n = bodies.Size();
+        if (n == 0) {
+            return;
+        }
+        prepareTerms();
+        tree.Build(bodies);
+        const size_t nodeCount = tree.nodes.size();
+        multipoles.assign(nodeCount * terms.size(), 0.0);
+        locals.assign(nodeCount * terms.size(), 0.0);
+        sortedAx.assign(n, 0.0); sortedAy.assign(n, 0.0); sortedAz.assign(n, 0.0);
+        farList.assign(nodeCount, std::vector<uint32_t>());
+        nearList.assign(nodeCount, std::vector<uint32_t>());
+        walkSources.assign(nodeCount, std::vector<uint32_t>());
+        walkRoots.assign(nodeCount, 0);
+        parents.assign(nodeCount, 0);
+        for (size_t i = 0; i < nodeCount; ++i) {
+            for (size_t c = i + 1; c < tree.nodes[i].skip && !tree.nodes[i].leaf; c = tree.nodes[c].skip) {
+                parents[c] = static_cast<uint32_t>(i);
+            }
+        }
+
+        TaskGraph graph;
+        buildGraph(graph);
+        graph.Run(JobSystem::Instance());
+
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t i = tree.order[k];
+            bodies.ax[i] = G * sortedAx[k]; bodies.ay[i] = G * sortedAy[k]; bodies.az[i] = G * sortedAz[k];
+        }
+        for (size_t i = 0; i < nodeCount; ++i) {
+            interactions += farList[i].size();
+            if (tree.nodes[i].leaf) {
+                for (size_t s = 0; s < nearList[i].size(); ++s) {
+                    interactions += static_cast<unsigned long long>(tree.nodes[i].count) * tree.nodes[nearList[i][s]].count;
+                }
+            }
+        }
+    }
+
+private:
+    struct Term {
+        int x, y, z, n;
+        int lower;      // index of this term with one power removed along `axis` (-1 for the constant)
+        int axis;
+    };
+
+    // One multiply-add of a translation operator: out[out] += coefficient * in[in] * factor[other]
+    struct Product {
+        uint16_t out, in, other;
+        double coefficient;
+    };
+
+    // Per-task buffers so workers never share scratch space
+    struct Scratch {
+        std::vector<double> a, mono;
+    };
+
+    std::vector<Term> terms;        // multi-indices with |k| <= order, sorted by total degree
+    std::vector<int> termIndex;     // (x, y, z) -> position in terms
+    std::vector<Product> m2mTable, m2lTable, l2lTable;
+    int preparedOrder;
+
+    std::vector<double> multipoles, locals;
+    std::vector<double> sortedAx, sortedAy, sortedAz;
+    std::vector<std::vector<uint32_t> > farList, nearList;
+    std::vector<std::vector<uint32_t> > walkSources;    // sources a subtree's walk starts from, in walk order
+    std::vector<uint8_t> walkRoots;                     // cells whose subtree is walked by a task of its own
+    std::vector<uint32_t> parents;
+
+    int indexOf(int x, int y, int z) const {
+        if (x < 0 || y < 0 || z < 0 || x + y + z > order) {
+            return -1;
+        }
+        return termIndex[(x * (order + 1) + y) * (order + 1) + z];
+    }
+
+    // Builds the term list and flattens M2M, M2L and L2L into lists of products for this order
+    void prepareTerms() {
+        if (preparedOrder == order) {
+            return;
+        }
+        preparedOrder = order;
+        terms.clear();
+        termIndex.assign((order + 1) * (order + 1) * (order + 1), -1);
+        for (int n = 0; n <= order; ++n) {
+            for (int x = n; x >= 0; --x) {
+                for (int y = n - x; y >= 0; --y) {
+                    Term t = { x, y, n - x - y, n, -1, 0 };
+                    t.axis = x > 0 ? 0 : (y > 0 ? 1 : 2);
+                    if (n > 0) {
+                        t.lower = indexOf(x - (t.axis == 0), y - (t.axis == 1), t.z - (t.axis == 2));
+                    }
+                    termIndex[(x * (order + 1) + y) * (order + 1) + t.z] = static_cast<int>(terms.size());
+                    terms.push_back(t);
+                }
+            }
+        }
+
+        std::vector<double> binomials((2 * order + 1) * (2 * order + 1), 0.0);
+        const int rows = 2 * order + 1;
+        for (int n = 0; n < rows; ++n) {
+            binomials[n * rows] = 1.0;
+            for (int k = 1; k <= n; ++k) {
+                binomials[n * rows + k] = binomials[(n - 1) * rows + k - 1] + (k < n ? binomials[(n - 1) * rows + k] : 0.0);
+            }
+        }
+        auto choose = [&](const Term& n, const Term& k) {
+            return binomials[n.x * rows + k.x] * binomials[n.y * rows + k.y] * binomials[n.z * rows + k.z];
+        };
+
+        m2mTable.clear();
+        m2lTable.clear();
+        l2lTable.clear();
+        for (size_t tk = 0; tk < terms.size(); ++tk) {
+            const Term& k = terms[tk];
+            for (size_t tj = 0; tj < terms.size(); ++tj) {
+                const Term& j = terms[tj];
+                int difference = indexOf(k.x - j.x, k.y - j.y, k.z - j.z);
+                if (difference >= 0) {
+                    // M2M: M_k += C(k, j) d^{k-j} M'_j;  L2L: L'_j += C(k, j) d^{k-j} L_k
+                    Product up = { static_cast<uint16_t>(tk), static_cast<uint16_t>(tj), static_cast<uint16_t>(difference),
+                        choose(k, j) };
+                    m2mTable.push_back(up);
+                    Product down = { static_cast<uint16_t>(tj), static_cast<uint16_t>(tk), static_cast<uint16_t>(difference),
+                        choose(k, j) };
+                    l2lTable.push_back(down);
+                }
+                int sum = indexOf(k.x + j.x, k.y + j.y, k.z + j.z);
+                if (sum >= 0) {
+                    // M2L: L_n += (-1)^|k| C(k + n, n) M_k a_{k+n}, here with n = terms[tk], k = terms[tj]
+                    const Term& kn = terms[sum];
+                    Product far = { static_cast<uint16_t>(tk), static_cast<uint16_t>(tj), static_cast<uint16_t>(sum),
+                        ((j.n & 1) ? -1.0 : 1.0) * choose(kn, k) };
+                    m2lTable.push_back(far);
+                }
+            }
+        }
+    }
+
+    // mono[t] = d^terms[t]
+    void monomials(const glm::dvec3& d, std::vector<double>& mono) const {
+        mono.resize(terms.size());
+        mono[0] = 1.0;
+        for (size_t t = 1; t < terms.size(); ++t) {
+            mono[t] = mono[terms[t].lower] * d[terms[t].axis];
+        }
+    }
+
+    // Taylor coefficients a_k(R) = D^k(1/|R|) / k! for |k| <= order:
+    // |k| r^2 a_k = -(2|k| - 1) sum_i R_i a_{k-e_i} - (|k| - 1) sum_i a_{k-2e_i}
+    void derivatives(const glm::dvec3& R, std::vector<double>& a) const {
+        a.resize(terms.size());
+        double r2 = glm::dot(R, R);
+        a[0] = 1.0 / std::sqrt(r2);
+        for (size_t t = 1; t < terms.size(); ++t) {
+            const Term& k = terms[t];
+            double first = 0.0, second = 0.0;
+            if (k.x > 0) first += R.x * a[indexOf(k.x - 1, k.y, k.z)];
+            if (k.y > 0) first += R.y * a[indexOf(k.x, k.y - 1, k.z)];
+            if (k.z > 0) first += R.z * a[indexOf(k.x, k.y, k.z - 1)];
+            if (k.x > 1) second += a[indexOf(k.x - 2, k.y, k.z)];
+            if (k.y > 1) second += a[indexOf(k.x, k.y - 2, k.z)];
+            if (k.z > 1) second += a[indexOf(k.x, k.y, k.z - 2)];
+            a[t] = -((2 * k.n - 1) * first + (k.n - 1) * second) / (k.n * r2);
+        }
+    }
+
+    static void apply(const std::vector<Product>& table, double* out, const double* in, const std::vector<double>& factor) {
+        for (size_t e = 0; e < table.size(); ++e) {
+            const Product& p = table[e];
+            out[p.out] += p.coefficient * in[p.in] * factor[p.other];
+        }
+    }
+
+    glm::dvec3 center(uint32_t node) const {
+        const OctreeNode& c = tree.nodes[node];
+        return glm::dvec3(c.centerX, c.centerY, c.centerZ);
+    }
+
+    // P2M for a leaf or M2M from its children for an internal node
+    void upwardNode(uint32_t i, Scratch& scratch) {
+        const OctreeNode& node = tree.nodes[i];
+        const size_t count = terms.size();
+        double* M = &multipoles[i * count];
+        if (node.leaf) {
+            glm::dvec3 c = center(i);
+            for (uint32_t b = node.first; b < node.first + node.count; ++b) {
+                monomials(glm::dvec3(tree.sx[b], tree.sy[b], tree.sz[b]) - c, scratch.mono);
+                for (size_t t = 0; t < count; ++t) {
+                    M[t] += tree.sm[b] * scratch.mono[t];
+                }
+            }
+            return;
+        }
+        for (uint32_t child = i + 1; child < node.skip; child = tree.nodes[child].skip) {
+            monomials(center(child) - center(i), scratch.mono);
+            apply(m2mTable, M, &multipoles[child * count], scratch.mono);
+        }
+    }
+
+    // Children follow their parent in depth-first order, so a reverse sweep finishes them first
+    void upwardSubtree(uint32_t root) {
+        Scratch scratch;
+        for (uint32_t i = tree.nodes[root].skip; i-- > root;) {
+            upwardNode(i, scratch);
+        }
+    }
+
+    bool wellSeparated(uint32_t a, uint32_t b) const {
+        const double sqrt3 = 1.7320508075688772;
+        double radii = sqrt3 * (tree.nodes[a].halfSize + tree.nodes[b].halfSize);
+        return radii < theta * glm::length(center(a) - center(b));
+    }
+
+    // Dual-tree walk filling far (M2L) and near (P2P) lists of every target cell. The top walk stops at
+    // walk roots and leaves their pairs to the subtree tasks; a target only descends one level at a time,
+    // so each subtree sees its pairs in the serial walk's order and gets the same lists.
+    void dualWalk(uint32_t target, uint32_t source, bool top) {
+        if (top && walkRoots[target]) {
+            walkSources[target].push_back(source);
+            return;
+        }
+        const OctreeNode& t = tree.nodes[target];
+        const OctreeNode& s = tree.nodes[source];
+        if (target != source && wellSeparated(target, source)) {
+            farList[target].push_back(source);
+        }
+        else if (t.leaf && s.leaf) {
+            nearList[target].push_back(source);
+        }
+        else if (s.leaf || (!t.leaf && t.halfSize >= s.halfSize)) {
+            for (uint32_t c = target + 1; c < t.skip; c = tree.nodes[c].skip) {
+                dualWalk(c, source, top);
+            }
+        }
+        else {
+            for (uint32_t c = source + 1; c < s.skip; c = tree.nodes[c].skip) {
+                dualWalk(target, c, top);
+            }
+        }
+    }
+
+    // M2L from every far source, L2L from the parent, and for leaves the final evaluation
+    void downwardNode(uint32_t i, Scratch& scratch) {
+        const size_t count = terms.size();
+        double* L = &locals[i * count];
+        glm::dvec3 z = center(i);
+        for (size_t f = 0; f < farList[i].size(); ++f) {
+            uint32_t source = farList[i][f];
+            derivatives(z - center(source), scratch.a);
+            apply(m2lTable, L, &multipoles[source * count], scratch.a);
+        }
+        if (i != 0) {
+            monomials(z - center(parents[i]), scratch.mono);
+            apply(l2lTable, L, &locals[parents[i] * count], scratch.mono);
+        }
+        if (tree.nodes[i].leaf) {
+            evaluateLeaf(i, scratch);
+        }
+    }
+
+    // L2P gradient of the local expansion plus direct P2P with the near list
+    void evaluateLeaf(uint32_t i, Scratch& scratch) {
+        const OctreeNode& node = tree.nodes[i];
+        const double* L = &locals[i * terms.size()];
+        const double eps2 = softening * softening;
+        glm::dvec3 z = center(i);
+        for (uint32_t b = node.first; b < node.first + node.count; ++b) {
+            double px = tree.sx[b], py = tree.sy[b], pz = tree.sz[b];
+            monomials(glm::dvec3(px, py, pz) - z, scratch.mono);
+            double gx = 0.0, gy = 0.0, gz = 0.0;
+            for (size_t t = 1; t < terms.size(); ++t) {
+                const Term& n = terms[t];
+                if (n.x > 0) gx += L[t] * n.x * scratch.mono[indexOf(n.x - 1, n.y, n.z)];
+                if (n.y > 0) gy += L[t] * n.y * scratch.mono[indexOf(n.x, n.y - 1, n.z)];
+                if (n.z > 0) gz += L[t] * n.z * scratch.mono[indexOf(n.x, n.y, n.z - 1)];
+            }
+            for (size_t s = 0; s < nearList[i].size(); ++s) {
+                const OctreeNode& source = tree.nodes[nearList[i][s]];
+                for (uint32_t j = source.first; j < source.first + source.count; ++j) {
+                    double dx = tree.sx[j] - px, dy = tree.sy[j] - py, dz = tree.sz[j] - pz;
+                    double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                    double inv = r2 > 0.0 ? 1.0 / std::sqrt(r2) : 0.0;
+                    double w = tree.sm[j] * inv * inv * inv;
+                    gx += dx * w; gy += dy * w; gz += dz * w;
+                }
+            }
+            sortedAx[b] = gx; sortedAy[b] = gy; sortedAz[b] = gz;
+        }
+    }
+
+    void downwardSubtree(uint32_t root) {
+        Scratch scratch;
+        for (uint32_t i = root; i < tree.nodes[root].skip; ++i) {
+            downwardNode(i, scratch);
+        }
+    }
+
+    void walkSubtree(uint32_t root) {
+        for (size_t s = 0; s < walkSources[root].size(); ++s) {
+            dualWalk(root, walkSources[root][s], false);
+        }
+    }
+
+    // Cells above `taskLevel` get an upward and a downward task each; deeper subtrees are handled
+    // whole by one task per pass and walked by a task of their own once the top walk has handed
+    // them their sources. Upward tasks wait for their children, downward tasks for their parent,
+    // the root's downward task for the root multipole and the top walk, and a subtree's downward
+    // task for its walk.
+    void buildGraph(TaskGraph& graph) {
+        const uint32_t taskLevel = 3;
+        std::vector<TaskGraph::TaskId> up(tree.nodes.size()), down(tree.nodes.size());
+        std::vector<uint32_t> splitNodes;
+
+        TaskGraph::TaskId topWalk = graph.Add([this] { dualWalk(0, 0, true); });
+        for (uint32_t i = 0; i < tree.nodes.size();) {
+            const OctreeNode& node = tree.nodes[i];
+            if (node.level >= taskLevel || node.leaf) {
+                walkRoots[i] = 1;
+                TaskGraph::TaskId walk = graph.Add([this, i] { walkSubtree(i); });
+                up[i] = graph.Add([this, i] { upwardSubtree(i); });
+                down[i] = graph.Add([this, i] { downwardSubtree(i); });
+                graph.Precede(topWalk, walk);
+                graph.Precede(walk, down[i]);
+                i = node.skip;
+            }
+            else {
+                splitNodes.push_back(i);
+                up[i] = graph.Add([this, i] {
+                    Scratch scratch;
+                    upwardNode(i, scratch);
+                });
+                down[i] = graph.Add([this, i] {
+                    Scratch scratch;
+                    downwardNode(i, scratch);
+                });
+                ++i;
+            }
+        }
+        for (size_t s = 0; s < splitNodes.size(); ++s) {
+            uint32_t i = splitNodes[s];
+            for (uint32_t c = i + 1; c < tree.nodes[i].skip; c = tree.nodes[c].skip) {
+                graph.Precede(up[c], up[i]);
+                graph.Precede(down[i], down[c]);
+            }
+        }
+        graph.Precede(up[0], down[0]);
+        graph.Precede(topWalk, down[0]);
+    }
+};
@@ -0,0 +1,103 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Per-phase CPU cost of a frame. Begin(name) closes the running phase and opens the next, so a frame
+// is just a sequence of Begin calls followed by EndFrame. Averages (and the worst frame) are printed
+// every `reportInterval` seconds while enabled.
+class FrameProfiler {
+public:
+    typedef std::chrono::steady_clock ProfileClock;
+
+    bool enabled;
+    double reportInterval;
+
+    FrameProfiler(double reportInterval = 2.0)
+        : enabled(false), reportInterval(reportInterval), current(-1), frames(0), frameTotal(0.0), frameWorst(0.0),
+          elapsed(0.0) {}
+
+    void Begin(const std::string& phase) {
+        ProfileClock::time_point now = ProfileClock::now();
+        closeCurrent(now);
+        current = indexOf(phase);
+        phaseStart = now;
+    }
+
+    // Closes the running phase and counts the frame; prints and resets once the interval is over
+    void EndFrame() {
+        ProfileClock::time_point now = ProfileClock::now();
+        closeCurrent(now);
+        current = -1;
+        double frame = 0.0;
+        for (size_t p = 0; p < phases.size(); ++p) {
+            frame += phases[p].frame;
+            phases[p].total += phases[p].frame;
+            phases[p].frame = 0.0;
+        }
+        ++frames;
+        frameTotal += frame;
+        frameWorst = std::max(frameWorst, frame);
+        elapsed += frame;
+        if (elapsed >= reportInterval) {
+            if (enabled) {
+                Report(std::cout);
+            }
+            Reset();
+        }
+    }
+
+    // Average milliseconds per frame for every phase since the last reset
+    void Report(std::ostream& out) const {
+        if (frames == 0) {
+            return;
+        }
+        out << "FRAME : " << 1e3 * frameTotal / frames << " ms avg, " << 1e3 * frameWorst << " ms worst |";
+        for (size_t p = 0; p < phases.size(); ++p) {
+            out << " " << phases[p].name << " " << 1e3 * phases[p].total / frames;
+        }
+        out << std::endl;
+    }
+
+    void Reset() {
+        for (size_t p = 0; p < phases.size(); ++p) {
+            phases[p].total = 0.0;
+        }
+        frames = 0;
+        frameTotal = 0.0;
+        frameWorst = 0.0;
+        elapsed = 0.0;
+    }
+
+private:
+    struct Phase {
+        std::string name;
+        double frame;   // seconds in the frame being recorded
+        double total;   // seconds summed over the reporting interval
+    };
+
+    std::vector<Phase> phases;
+    int current;
+    ProfileClock::time_point phaseStart;
+    unsigned long long frames;
+    double frameTotal, frameWorst, elapsed;
+
+    int indexOf(const std::string& name) {
+        for (size_t p = 0; p < phases.size(); ++p) {
+            if (phases[p].name == name) {
+                return static_cast<int>(p);
+            }
+        }
+        Phase phase = { name, 0.0, 0.0 };
+        phases.push_back(phase);
+        return static_cast<int>(phases.size()) - 1;
+    }
+
+    void closeCurrent(ProfileClock::time_point now) {
+        if (current >= 0) {
+            phases[current].frame += std::chrono::duration<double>(now - phaseStart).count();
+        }
+    }
+};
@@ -0,0 +1,902 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NBody.h"
+
+// Compile-time default, overridable with -DSOLARSYSTEM_DEFAULT_INTEGRATOR=<0..4> (see IntegratorKind)
+#ifndef SOLARSYSTEM_DEFAULT_INTEGRATOR
+#define SOLARSYSTEM_DEFAULT_INTEGRATOR 0
+#endif
+
+enum class IntegratorKind {
+    Leapfrog = 0,
+    Yoshida4 = 1,
+    WisdomHolman = 2,
+    IAS15 = 3,
+    BlockLeapfrog = 4
+};
+
+const int IntegratorKindCount = 5;
+
+// Integrator interface. Implementations keep the accelerations from the end of the last
+// step (first-same-as-last) and reuse them, so Reset() must be called whenever body state is edited.
+class Integrator {
+public:
+    virtual ~Integrator() {}
+
+    virtual const char* Name() const = 0;
+    virtual IntegratorKind Kind() const = 0;
+    virtual void Step(BodySystem& bodies, GravitySolver& solver, double dt) = 0;
+
+    virtual void Reset() {
+        accelerationsValid = false;
+    }
+
+    // Force evaluations performed so far, the dominant cost of every scheme here
+    unsigned long long ForceEvaluations() const {
+        return forceEvaluations;
+    }
+
+    // Accepted (sub)steps; equals the number of Step calls for the fixed-step schemes
+    unsigned long long StepsTaken() const {
+        return stepsTaken;
+    }
+
+    // Steps thrown away by adaptive step control
+    unsigned long long RejectedSteps() const {
+        return rejectedSteps;
+    }
+
+    // Whether the accelerations in BodySystem belong to the current state (see Reset)
+    bool AccelerationsValid() const {
+        return accelerationsValid;
+    }
+
+    // Extra state a checkpoint needs to continue bit for bit, such as step size history; the
+    // accelerations themselves are saved with the bodies
+    virtual void SaveState(std::vector<double>& state) const {
+        state.clear();
+    }
+
+    // Counterpart of SaveState, called after the bodies and their accelerations are restored;
+    // accelerationsRestored is what AccelerationsValid returned when saving. Returns false if the
+    // state does not fit, in which case the caller should Reset.
+    virtual bool LoadState(const double* state, size_t count, bool accelerationsRestored) {
+        (void)state;
+        accelerationsValid = accelerationsRestored;
+        return count == 0;
+    }
+
+    void RestoreCounters(unsigned long long evaluations, unsigned long long steps, unsigned long long rejected) {
+        forceEvaluations = evaluations;
+        stepsTaken = steps;
+        rejectedSteps = rejected;
+    }
+
+protected:
+    bool accelerationsValid = false;
+    unsigned long long forceEvaluations = 0;
+    unsigned long long stepsTaken = 0;
+    unsigned long long rejectedSteps = 0;
+
+    void computeForces(BodySystem& bodies, GravitySolver& solver) {
+        solver.ComputeAccelerations(bodies);
+        ++forceEvaluations;
+        accelerationsValid = true;
+    }
+
+    static void kick(BodySystem& b, double h) {
+        for (size_t i = 0; i < b.Size(); ++i) {
+            b.vx[i] += h * b.ax[i];
+            b.vy[i] += h * b.ay[i];
+            b.vz[i] += h * b.az[i];
+        }
+    }
+
+    static void drift(BodySystem& b, double h) {
+        for (size_t i = 0; i < b.Size(); ++i) {
+            b.x[i] += h * b.vx[i];
+            b.y[i] += h * b.vy[i];
+            b.z[i] += h * b.vz[i];
+        }
+    }
+
+    // One kick-drift-kick leapfrog substep; expects valid accelerations and leaves them valid
+    void leapfrogSubstep(BodySystem& bodies, GravitySolver& solver, double h) {
+        if (!accelerationsValid) {
+            computeForces(bodies, solver);
+        }
+        kick(bodies, 0.5 * h);
+        drift(bodies, h);
+        computeForces(bodies, solver);
+        kick(bodies, 0.5 * h);
+    }
+};
+
+// Second order, one force evaluation per step
+class LeapfrogIntegrator final : public Integrator {
+public:
+    const char* Name() const override {
+        return "leapfrog";
+    }
+
+    IntegratorKind Kind() const override {
+        return IntegratorKind::Leapfrog;
+    }
+
+    void Step(BodySystem& bodies, GravitySolver& solver, double dt) override {
+        leapfrogSubstep(bodies, solver, dt);
+        ++stepsTaken;
+    }
+};
+
+// Fourth order Yoshida composition of three leapfrog substeps, three force evaluations per step
+class Yoshida4Integrator final : public Integrator {
+public:
+    const char* Name() const override {
+        return "yoshida4";
+    }
+
+    IntegratorKind Kind() const override {
+        return IntegratorKind::Yoshida4;
+    }
+
+    void Step(BodySystem& bodies, GravitySolver& solver, double dt) override {
+        const double cbrt2 = std::cbrt(2.0);
+        const double w1 = 1.0 / (2.0 - cbrt2);
+        const double w0 = -cbrt2 / (2.0 - cbrt2);
+        leapfrogSubstep(bodies, solver, w1 * dt);
+        leapfrogSubstep(bodies, solver, w0 * dt);
+        leapfrogSubstep(bodies, solver, w1 * dt);
+        ++stepsTaken;
+    }
+};
+
+// Wisdom-Holman mapping in democratic heliocentric coordinates. Motion around the dominant body is
+// solved exactly by a Kepler drift, so only the small mutual perturbations are split, which allows
+// far larger steps than leapfrog for the same energy error. The interaction kick reuses the force
+// backend with the central mass temporarily zeroed.
+class WisdomHolmanIntegrator final : public Integrator {
+public:
+    // Index of the dominant body; negative picks the most massive body on the next step
+    long centralBody;
+
+    WisdomHolmanIntegrator(long centralBody = -1) : centralBody(centralBody), activeCentral(0) {}
+
+    const char* Name() const override {
+        return "wisdom-holman";
+    }
+
+    IntegratorKind Kind() const override {
+        return IntegratorKind::WisdomHolman;
+    }
+
+    void Reset() override {
+        Integrator::Reset();
+        chooseCentral = true;
+    }
+
+    // The saved accelerations are interaction terms around this central body
+    void SaveState(std::vector<double>& state) const override {
+        state.assign(1, chooseCentral ? -1.0 : static_cast<double>(activeCentral));
+    }
+
+    bool LoadState(const double* state, size_t count, bool accelerationsRestored) override {
+        if (count != 1 || state[0] < 0.0) {
+            return false;
+        }
+        activeCentral = static_cast<size_t>(state[0]);
+        chooseCentral = false;
+        accelerationsValid = accelerationsRestored;
+        return true;
+    }
+
+    void Step(BodySystem& b, GravitySolver& solver, double dt) override {
+        size_t n = b.Size();
+        ++stepsTaken;
+        if (n < 2) {
+            drift(b, dt);
+            return;
+        }
+        if (chooseCentral) {
+            activeCentral = centralBody >= 0 ? static_cast<size_t>(centralBody) : mostMassive(b);
+            chooseCentral = false;
+            accelerationsValid = false;
+        }
+        const size_t c = activeCentral;
+        const double m0 = b.mass[c];
+        const double totalMass = b.TotalMass();
+        const double mu = solver.G * m0;
+
+        // To democratic heliocentric: positions relative to the central body, barycentric velocities
+        glm::dvec3 com = b.CenterOfMass();
+        glm::dvec3 vcm(0.0);
+        for (size_t i = 0; i < n; ++i) {
+            vcm += b.Velocity(i) * b.mass[i];
+        }
+        vcm /= totalMass;
+        glm::dvec3 central = b.Position(c);
+        for (size_t i = 0; i < n; ++i) {
+            b.SetPosition(i, i == c ? glm::dvec3(0.0) : b.Position(i) - central);
+            b.SetVelocity(i, b.Velocity(i) - vcm);
+        }
+
+        interactionKick(b, solver, 0.5 * dt);
+        jump(b, c, m0, 0.5 * dt);
+        for (size_t i = 0; i < n; ++i) {
+            if (i == c) {
+                continue;
+            }
+            glm::dvec3 r = b.Position(i), v = b.Velocity(i);
+            KeplerDrift(r, v, mu, dt);
+            b.SetPosition(i, r);
+            b.SetVelocity(i, v);
+        }
+        jump(b, c, m0, 0.5 * dt);
+        interactionKick(b, solver, 0.5 * dt);
+
+        // Back to inertial coordinates; the barycenter moves uniformly
+        com += vcm * dt;
+        glm::dvec3 weighted(0.0), momentum(0.0);
+        for (size_t i = 0; i < n; ++i) {
+            if (i != c) {
+                weighted += b.Position(i) * b.mass[i];
+                momentum += b.Velocity(i) * b.mass[i];
+            }
+        }
+        central = com - weighted / totalMass;
+        for (size_t i = 0; i < n; ++i) {
+            if (i == c) {
+                b.SetPosition(i, central);
+                b.SetVelocity(i, vcm - momentum / m0);
+            }
+            else {
+                b.SetPosition(i, b.Position(i) + central);
+                b.SetVelocity(i, b.Velocity(i) + vcm);
+            }
+        }
+    }
+
+    // Advances a two-body orbit with universal variables and Lagrange f and g functions, valid for
+    // elliptic, parabolic and hyperbolic motion
+    static void KeplerDrift(glm::dvec3& r, glm::dvec3& v, double mu, double dt) {
+        double r0 = glm::length(r);
+        if (r0 == 0.0 || mu <= 0.0) {
+            r += v * dt;
+            return;
+        }
+        double sqrtMu = std::sqrt(mu);
+        double sigma0 = glm::dot(r, v) / sqrtMu;
+        double alpha = 2.0 / r0 - glm::dot(v, v) / mu;
+
+        double chi = alpha > 0.0 ? sqrtMu * alpha * dt : dt / r0 * sqrtMu;
+        double c2 = 0.5, c3 = 1.0 / 6.0, rNew = r0;
+        for (int iteration = 0; iteration < 50; ++iteration) {
+            double z = alpha * chi * chi;
+            stumpff(z, c2, c3);
+            double chi2 = chi * chi;
+            double f = sigma0 * chi2 * c2 + (1.0 - alpha * r0) * chi2 * chi * c3 + r0 * chi - sqrtMu * dt;
+            rNew = sigma0 * chi * (1.0 - z * c3) + (1.0 - alpha * r0) * chi2 * c2 + r0;
+            double delta = f / rNew;
+            chi -= delta;
+            if (std::fabs(delta) <= 1e-14 * std::max(1.0, std::fabs(chi))) {
+                break;
+            }
+        }
+        double z = alpha * chi * chi;
+        stumpff(z, c2, c3);
+        double chi2 = chi * chi;
+        rNew = sigma0 * chi * (1.0 - z * c3) + (1.0 - alpha * r0) * chi2 * c2 + r0;
+
+        double f = 1.0 - chi2 / r0 * c2;
+        double g = dt - chi2 * chi * c3 / sqrtMu;
+        double fDot = sqrtMu / (rNew * r0) * chi * (z * c3 - 1.0);
+        double gDot = 1.0 - chi2 / rNew * c2;
+        glm::dvec3 r1 = f * r + g * v;
+        glm::dvec3 v1 = fDot * r + gDot * v;
+        r = r1;
+        v = v1;
+    }
+
+private:
+    size_t activeCentral;
+    bool chooseCentral = true;
+
+    static size_t mostMassive(const BodySystem& b) {
+        size_t best = 0;
+        for (size_t i = 1; i < b.Size(); ++i) {
+            if (b.mass[i] > b.mass[best]) {
+                best = i;
+            }
+        }
+        return best;
+    }
+
+    // Stumpff functions c2(z), c3(z); series near zero avoids the cancellation in the closed forms
+    static void stumpff(double z, double& c2, double& c3) {
+        if (std::fabs(z) < 1e-4) {
+            c2 = 0.5 - z / 24.0 + z * z / 720.0;
+            c3 = 1.0 / 6.0 - z / 120.0 + z * z / 5040.0;
+        }
+        else if (z > 0.0) {
+            double s = std::sqrt(z);
+            c2 = (1.0 - std::cos(s)) / z;
+            c3 = (s - std::sin(s)) / (z * s);
+        }
+        else {
+            double s = std::sqrt(-z);
+            c2 = (std::cosh(s) - 1.0) / -z;
+            c3 = (std::sinh(s) - s) / (-z * s);
+        }
+    }
+
+    // Mutual accelerations of the non-central bodies
+    void interactionKick(BodySystem& b, GravitySolver& solver, double h) {
+        if (!accelerationsValid) {
+            double m0 = b.mass[activeCentral];
+            b.mass[activeCentral] = 0.0;
+            computeForces(b, solver);
+            b.mass[activeCentral] = m0;
+        }
+        b.ax[activeCentral] = b.ay[activeCentral] = b.az[activeCentral] = 0.0;
+        kick(b, h);
+    }
+
+    // Central-body momentum term: every heliocentric position moves with the total barycentric momentum
+    void jump(BodySystem& b, size_t c, double m0, double h) {
+        glm::dvec3 momentum(0.0);
+        for (size_t i = 0; i < b.Size(); ++i) {
+            if (i != c) {
+                momentum += b.Velocity(i) * b.mass[i];
+            }
+        }
+        glm::dvec3 shift = momentum * (h / m0);
+        for (size_t i = 0; i < b.Size(); ++i) {
+            if (i != c) {
+                b.SetPosition(i, b.Position(i) + shift);
+            }
+        }
+        accelerationsValid = false;
+    }
+};
+
+// Kick-drift-kick leapfrog with individual power-of-two block timesteps. Each body steps with
+// dt / 2^level, levels are picked from the body's own acceleration timescale |a| / |da/dt|, and a
+// substep only kicks, and only evaluates forces for, the bodies whose step ends there; every body is
+// drifted to the substep time so the active forces always see synchronized positions. A body may move
+// to a coarser level only where the coarser grid lines up, so everyone is in sync again at the end of dt.
+class BlockLeapfrogIntegrator final : public Integrator {
+public:
+    double eta;         // step = eta * |a| / |da/dt|, about eta / (2 pi) of a circular orbit
+    int maxLevel;       // deepest subdivision of dt
+
+    BlockLeapfrogIntegrator(double eta = 0.02, int maxLevel = 30) : eta(eta), maxLevel(std::min(maxLevel, 40)) {}
+
+    const char* Name() const override {
+        return "block-leapfrog";
+    }
+
+    IntegratorKind Kind() const override {
+        return IntegratorKind::BlockLeapfrog;
+    }
+
+    void SaveState(std::vector<double>& state) const override {
+        state.assign(1, lastDt);
+        state.insert(state.end(), level.begin(), level.end());
+    }
+
+    bool LoadState(const double* state, size_t count, bool accelerationsRestored) override {
+        if (count == 0) {
+            return false;
+        }
+        lastDt = state[0];
+        level.assign(state + 1, state + count);
+        stepStart.assign(level.size(), 0);
+        startAcceleration.resize(level.size());
+        accelerationsValid = accelerationsRestored;
+        return true;
+    }
+
+    // Bodies per level after the last step, for stats
+    std::vector<size_t> LevelHistogram() const {
+        std::vector<size_t> histogram;
+        for (size_t i = 0; i < level.size(); ++i) {
+            if (static_cast<size_t>(level[i]) >= histogram.size()) {
+                histogram.resize(level[i] + 1, 0);
+            }
+            ++histogram[level[i]];
+        }
+        return histogram;
+    }
+
+    void Step(BodySystem& bodies, GravitySolver& solver, double dt) override {
+        const size_t n = bodies.Size();
+        if (n == 0 || dt == 0.0) {
+            return;
+        }
+        if (!accelerationsValid || level.size() != n || dt != lastDt) {
+            start(bodies, solver, dt);
+        }
+        const uint64_t end = uint64_t(1) << maxLevel;
+        const double tickLength = dt / static_cast<double>(end);
+        uint64_t tick = 0;
+        std::fill(stepStart.begin(), stepStart.end(), 0);
+        while (tick < end) {
+            // Opening half kicks for bodies starting a step here
+            uint64_t next = end;
+            for (size_t i = 0; i < n; ++i) {
+                if (stepStart[i] == tick) {
+                    double h = 0.5 * tickLength * static_cast<double>(stride(i));
+                    bodies.vx[i] += h * bodies.ax[i];
+                    bodies.vy[i] += h * bodies.ay[i];
+                    bodies.vz[i] += h * bodies.az[i];
+                    startAcceleration[i] = bodies.Acceleration(i);
+                }
+                next = std::min(next, stepStart[i] + stride(i));
+            }
+            drift(bodies, tickLength * static_cast<double>(next - tick));
+            tick = next;
+
+            active.clear();
+            for (size_t i = 0; i < n; ++i) {
+                if (stepStart[i] + stride(i) == tick) {
+                    active.push_back(i);
+                }
+            }
+            solver.ComputeAccelerationsFor(bodies, active);
+            ++forceEvaluations;
+            for (size_t k = 0; k < active.size(); ++k) {
+                const size_t i = active[k];
+                const double length = tickLength * static_cast<double>(stride(i));
+                bodies.vx[i] += 0.5 * length * bodies.ax[i];
+                bodies.vy[i] += 0.5 * length * bodies.ay[i];
+                bodies.vz[i] += 0.5 * length * bodies.az[i];
+                double jerk = glm::length(bodies.Acceleration(i) - startAcceleration[i]) / length;
+                double wanted = jerk > 0.0 ? eta * glm::length(bodies.Acceleration(i)) / jerk : length;
+                int target = levelFor(wanted, dt);
+                // Hysteresis: refine at once, coarsen one level at a time and only with a margin
+                if (target < level[i] - 1) {
+                    target = level[i] - 1;
+                }
+                else if (target < level[i]) {
+                    target = level[i];
+                }
+                level[i] = alignedLevel(target, tick);
+                stepStart[i] = tick;
+            }
+            ++stepsTaken;
+        }
+    }
+
+private:
+    std::vector<int> level;
+    std::vector<uint64_t> stepStart;        // in units of dt / 2^maxLevel
+    std::vector<glm::dvec3> startAcceleration;
+    std::vector<size_t> active;
+    double lastDt = 0.0;
+
+    uint64_t stride(size_t i) const {
+        return uint64_t(1) << (maxLevel - level[i]);
+    }
+
+    int levelFor(double wanted, double dt) const {
+        if (!(wanted > 0.0) || wanted >= dt) {
+            return 0;
+        }
+        int l = static_cast<int>(std::ceil(std::log2(dt / wanted)));
+        return std::min(std::max(l, 0), maxLevel);
+    }
+
+    // Finer levels always fit; coarser ones only where their grid passes through `tick`
+    int alignedLevel(int wanted, uint64_t tick) const {
+        while (wanted < maxLevel && tick % (uint64_t(1) << (maxLevel - wanted)) != 0) {
+            ++wanted;
+        }
+        return wanted;
+    }
+
+    // Fresh forces for everyone. Without a jerk estimate yet, every body starts on the finest level
+    // that |v| / |a| (r / v on a circular orbit) asks for anywhere, and coarsens from its first step on;
+    // a planet's own |v| / |a| knows nothing about the moons tugging at it.
+    void start(BodySystem& bodies, GravitySolver& solver, double dt) {
+        const size_t n = bodies.Size();
+        if (!accelerationsValid) {
+            computeForces(bodies, solver);
+        }
+        if (level.size() != n || dt != lastDt) {
+            int finest = 0;
+            for (size_t i = 0; i < n; ++i) {
+                double a = glm::length(bodies.Acceleration(i));
+                double v = glm::length(bodies.Velocity(i));
+                if (a > 0.0 && v > 0.0) {
+                    finest = std::max(finest, levelFor(eta * v / a, dt));
+                }
+            }
+            level.assign(n, finest);
+        }
+        stepStart.assign(n, 0);
+        startAcceleration.resize(n);
+        lastDt = dt;
+    }
+};
+
+// IAS15: 15th-order implicit Gauss-Radau integrator with adaptive steps (Rein & Spiegel 2015).
+// Within a step the acceleration is a degree-7 polynomial in time whose coefficients are found by
+// predictor-corrector iteration at the seven Radau nodes; the size of the last coefficient measures
+// the truncation error and sets the next step as dt * (epsilon / error)^(1/7). Step(dt) always advances
+// exactly dt, taking as many substeps as the accuracy needs, and the chosen substep carries over to the
+// next call, so quiet phases run at whatever step the caller asks for while encounters are subdivided.
+class IAS15Integrator final : public Integrator {
+public:
+    double epsilon;         // relative error per step that the step size is tuned for
+    double minimumStep;     // substeps never shrink below this, even if the error demands it
+
+    IAS15Integrator(double epsilon = 1e-9, double minimumStep = 0.0)
+        : epsilon(epsilon), minimumStep(minimumStep), nextStep(0.0), lastStep(0.0) {
+        initializeCoefficients();
+    }
+
+    const char* Name() const override {
+        return "ias15";
+    }
+
+    IntegratorKind Kind() const override {
+        return IntegratorKind::IAS15;
+    }
+
+    void Reset() override {
+        Integrator::Reset();
+        lastStep = 0.0;
+        size = 0;
+    }
+
+    // Substep the next call will start with
+    double NextStep() const {
+        return nextStep;
+    }
+
+    // Step history and the last step's polynomial, which seeds the next predictor
+    void SaveState(std::vector<double>& state) const override {
+        state.assign({ nextStep, lastStep, static_cast<double>(size) });
+        state.insert(state.end(), csx.begin(), csx.end());
+        state.insert(state.end(), csv.begin(), csv.end());
+        for (int k = 0; k < 7; ++k) {
+            state.insert(state.end(), previousB[k].begin(), previousB[k].end());
+            state.insert(state.end(), previousE[k].begin(), previousE[k].end());
+        }
+    }
+
+    bool LoadState(const double* state, size_t count, bool accelerationsRestored) override {
+        if (count < 3) {
+            return false;
+        }
+        size_t n = static_cast<size_t>(state[2]);
+        if (count != 3 + 16 * n) {
+            return false;
+        }
+        resize(n);
+        const double* next = state + 3;
+        csx.assign(next, next + n); next += n;
+        csv.assign(next, next + n); next += n;
+        for (int k = 0; k < 7; ++k) {
+            previousB[k].assign(next, next + n); next += n;
+            previousE[k].assign(next, next + n); next += n;
+        }
+        nextStep = state[0];
+        lastStep = state[1];
+        accelerationsValid = accelerationsRestored;
+        return true;
+    }
+
+    void Step(BodySystem& bodies, GravitySolver& solver, double dt) override {
+        if (bodies.Size() == 0 || dt == 0.0) {
+            return;
+        }
+        if (size != 3 * bodies.Size()) {
+            resize(3 * bodies.Size());
+        }
+        if (nextStep == 0.0 || (nextStep > 0.0) != (dt > 0.0)) {
+            nextStep = dt;
+        }
+        double remaining = dt;
+        while (std::fabs(remaining) > 1e-14 * std::fabs(dt)) {
+            double preferred = nextStep;
+            bool clipped = std::fabs(remaining) < std::fabs(preferred);
+            remaining -= substep(bodies, solver, clipped ? remaining : preferred);
+            // A step shortened to land on the end of dt says little about the step the dynamics allow
+            if (clipped && std::fabs(nextStep) < std::fabs(preferred)) {
+                nextStep = std::max(std::fabs(nextStep), std::min(std::fabs(preferred), 4.0 * std::fabs(dt)));
+                nextStep = std::copysign(nextStep, dt);
+            }
+        }
+    }
+
+private:
+    static const int Nodes = 8;     // Gauss-Radau spacings including the start of the step
+    double h[Nodes];
+    double rr[Nodes][Nodes];        // rr[n][j] = h[n] - h[j]
+    double c[7][7];                 // c[k][j]: t^(j+1) coefficient of t (t - h1) ... (t - hk)
+
+    size_t size = 0;
+    double nextStep, lastStep;
+    std::vector<double> x0, v0, a0, csx, csv;
+    std::vector<double> b[7], g[7], e[7], previousB[7], previousE[7];
+
+    void initializeCoefficients() {
+        const double spacings[Nodes] = { 0.0, 0.0562625605369221464656521910318, 0.180240691736892364987579942780,
+            0.352624717113169637373907769648, 0.547153626330555383001448554766, 0.734210177215410531523210605558,
+            0.885320946839095768090359771030, 0.977520613561287501891174488626 };
+        for (int n = 0; n < Nodes; ++n) {
+            h[n] = spacings[n];
+        }
+        for (int n = 0; n < Nodes; ++n) {
+            for (int j = 0; j < Nodes; ++j) {
+                rr[n][j] = h[n] - h[j];
+            }
+        }
+        // Expand the Newton products t (t - h1) ... (t - hk) into powers of t
+        double product[Nodes + 1] = { 0.0, 1.0 };   // product[p]: coefficient of t^p, starting from t
+        for (int k = 0; k < 7; ++k) {
+            if (k > 0) {
+                for (int p = Nodes; p >= 1; --p) {
+                    product[p] = product[p - 1] - h[k] * product[p];
+                }
+                product[0] = 0.0;
+            }
+            for (int j = 0; j < 7; ++j) {
+                c[k][j] = product[j + 1];
+            }
+        }
+    }
+
+    void resize(size_t n) {
+        size = n;
+        x0.assign(n, 0.0); v0.assign(n, 0.0); a0.assign(n, 0.0);
+        csx.assign(n, 0.0); csv.assign(n, 0.0);
+        for (int k = 0; k < 7; ++k) {
+            b[k].assign(n, 0.0); g[k].assign(n, 0.0); e[k].assign(n, 0.0);
+            previousB[k].assign(n, 0.0); previousE[k].assign(n, 0.0);
+        }
+        lastStep = 0.0;
+        accelerationsValid = false;
+    }
+
+    void load(const BodySystem& bodies) {
+        for (size_t i = 0; i < bodies.Size(); ++i) {
+            x0[3 * i] = bodies.x[i]; x0[3 * i + 1] = bodies.y[i]; x0[3 * i + 2] = bodies.z[i];
+            v0[3 * i] = bodies.vx[i]; v0[3 * i + 1] = bodies.vy[i]; v0[3 * i + 2] = bodies.vz[i];
+            a0[3 * i] = bodies.ax[i]; a0[3 * i + 1] = bodies.ay[i]; a0[3 * i + 2] = bodies.az[i];
+        }
+    }
+
+    static double acceleration(const BodySystem& bodies, size_t k) {
+        size_t i = k / 3;
+        int axis = static_cast<int>(k % 3);
+        return axis == 0 ? bodies.ax[i] : axis == 1 ? bodies.ay[i] : bodies.az[i];
+    }
+
+    static void setPosition(BodySystem& bodies, size_t k, double value) {
+        size_t i = k / 3;
+        int axis = static_cast<int>(k % 3);
+        (axis == 0 ? bodies.x[i] : axis == 1 ? bodies.y[i] : bodies.z[i]) = value;
+    }
+
+    static void setVelocity(BodySystem& bodies, size_t k, double value) {
+        size_t i = k / 3;
+        int axis = static_cast<int>(k % 3);
+        (axis == 0 ? bodies.vx[i] : axis == 1 ? bodies.vy[i] : bodies.vz[i]) = value;
+    }
+
+    // Starting guess for b on a step `ratio` times as long as the last accepted one: the last step's
+    // polynomial re-expanded around its end, corrected by how far off the previous guess was
+    void predictCoefficients(double ratio) {
+        if (lastStep == 0.0 || ratio > 20.0) {
+            for (int k = 0; k < 7; ++k) {
+                std::fill(b[k].begin(), b[k].end(), 0.0);
+                std::fill(e[k].begin(), e[k].end(), 0.0);
+            }
+            return;
+        }
+        double q[8];
+        q[0] = 1.0;
+        for (int p = 1; p < 8; ++p) {
+            q[p] = q[p - 1] * ratio;
+        }
+        for (size_t k = 0; k < size; ++k) {
+            double old[7], correction[7];
+            for (int j = 0; j < 7; ++j) {
+                old[j] = previousB[j][k];
+                correction[j] = old[j] - previousE[j][k];
+            }
+            // Coefficient of s^(m+1) in sum_j old_j (1 + ratio s)^(j+1): binomial(j+1, m+1) ratio^(m+1)
+            for (int m = 0; m < 7; ++m) {
+                double sum = 0.0, binomial = 1.0;
+                for (int j = m; j < 7; ++j) {
+                    sum += binomial * old[j];
+                    binomial = binomial * (j + 2) / (j + 1 - m);
+                }
+                e[m][k] = q[m + 1] * sum;
+                b[m][k] = e[m][k] + correction[m];
+            }
+        }
+    }
+
+    // g from b by back substitution through the Newton-to-power basis change
+    void coefficientsToDifferences() {
+        for (size_t k = 0; k < size; ++k) {
+            for (int m = 6; m >= 0; --m) {
+                double value = b[m][k];
+                for (int j = m + 1; j < 7; ++j) {
+                    value -= c[j][m] * g[j][k];
+                }
+                g[m][k] = value;
+            }
+        }
+    }
+
+    // One attempt-and-retry IAS15 step of (at most) dt; returns the time actually advanced
+    double substep(BodySystem& bodies, GravitySolver& solver, double dt) {
+        if (!accelerationsValid) {
+            computeForces(bodies, solver);
+        }
+        load(bodies);
+        predictCoefficients(lastStep != 0.0 ? dt / lastStep : 0.0);
+        coefficientsToDifferences();
+
+        while (true) {
+            iterate(bodies, solver, dt);
+            double maxAcceleration = 0.0, maxB6 = 0.0;
+            for (size_t k = 0; k < size; ++k) {
+                maxAcceleration = std::max(maxAcceleration, std::fabs(acceleration(bodies, k)));
+                maxB6 = std::max(maxB6, std::fabs(b[6][k]));
+            }
+
+            // New step from the size of the highest-order term, growing at most 4x per step
+            const double safety = 0.25;
+            double relative = maxAcceleration > 0.0 ? maxB6 / maxAcceleration : 0.0;
+            double proposed = std::isnormal(relative) ? dt * std::pow(epsilon / relative, 1.0 / 7.0) : dt / safety;
+            if (std::fabs(proposed) < minimumStep) {
+                proposed = std::copysign(minimumStep, dt);
+            }
+            if (std::fabs(proposed / dt) < safety && std::fabs(dt) > minimumStep) {
+                // Too inaccurate: restore the start of the step and retry with the smaller step
+                for (size_t k = 0; k < size; ++k) {
+                    setPosition(bodies, k, x0[k]);
+                    setVelocity(bodies, k, v0[k]);
+                }
+                restoreAccelerations(bodies);
+                ++rejectedSteps;
+                dt = proposed;
+                predictCoefficients(lastStep != 0.0 ? dt / lastStep : 0.0);
+                coefficientsToDifferences();
+                continue;
+            }
+            if (std::fabs(proposed / dt) > 1.0 / safety) {
+                proposed = dt / safety;
+            }
+
+            // Accept: advance to the end of the step with compensated summation
+            for (size_t k = 0; k < size; ++k) {
+                double dx = dt * (v0[k] + dt * (a0[k] / 2.0 + b[0][k] / 6.0 + b[1][k] / 12.0 + b[2][k] / 20.0 +
+                    b[3][k] / 30.0 + b[4][k] / 42.0 + b[5][k] / 56.0 + b[6][k] / 72.0));
+                double dv = dt * (a0[k] + b[0][k] / 2.0 + b[1][k] / 3.0 + b[2][k] / 4.0 + b[3][k] / 5.0 +
+                    b[4][k] / 6.0 + b[5][k] / 7.0 + b[6][k] / 8.0);
+                setPosition(bodies, k, compensatedAdd(x0[k], dx, csx[k]));
+                setVelocity(bodies, k, compensatedAdd(v0[k], dv, csv[k]));
+            }
+            for (int m = 0; m < 7; ++m) {
+                previousB[m] = b[m];
+                previousE[m] = e[m];
+            }
+            lastStep = dt;
+            nextStep = proposed;
+            accelerationsValid = false;
+            ++stepsTaken;
+            return dt;
+        }
+    }
+
+    // Predictor-corrector iterations for b over the step, until the corrections stop shrinking
+    void iterate(BodySystem& bodies, GravitySolver& solver, double dt) {
+        double error = 2.0, lastError = 3.0;
+        for (int iteration = 0; iteration < 12; ++iteration) {
+            if (error < 1e-16 || (iteration > 2 && lastError <= error)) {
+                break;
+            }
+            lastError = error;
+            error = 0.0;
+            double maxAcceleration = 0.0, maxCorrection = 0.0;
+            for (int n = 1; n < Nodes; ++n) {
+                const double t = h[n];
+                for (size_t k = 0; k < size; ++k) {
+                    double x = x0[k] + dt * t * (v0[k] + dt * t * (a0[k] / 2.0 + t * (b[0][k] / 6.0 + t *
+                        (b[1][k] / 12.0 + t * (b[2][k] / 20.0 + t * (b[3][k] / 30.0 + t * (b[4][k] / 42.0 + t *
+                        (b[5][k] / 56.0 + t * b[6][k] / 72.0))))))));
+                    setPosition(bodies, k, x);
+                }
+                computeForces(bodies, solver);
+                for (size_t k = 0; k < size; ++k) {
+                    double at = acceleration(bodies, k);
+                    double gk = at - a0[k];
+                    double before = g[n - 1][k];
+                    // Divided difference through the nodes so far
+                    double value = gk / rr[n][0];
+                    for (int j = 1; j < n; ++j) {
+                        value = (value - g[j - 1][k]) / rr[n][j];
+                    }
+                    g[n - 1][k] = value;
+                    double change = value - before;
+                    for (int j = 0; j < n - 1; ++j) {
+                        b[j][k] += change * c[n - 1][j];
+                    }
+                    b[n - 1][k] += change;
+                    if (n == 7) {
+                        maxCorrection = std::max(maxCorrection, std::fabs(change));
+                        maxAcceleration = std::max(maxAcceleration, std::fabs(at));
+                    }
+                }
+            }
+            error = maxAcceleration > 0.0 ? maxCorrection / maxAcceleration : 0.0;
+        }
+    }
+
+    void restoreAccelerations(BodySystem& bodies) {
+        for (size_t i = 0; i < bodies.Size(); ++i) {
+            bodies.ax[i] = a0[3 * i]; bodies.ay[i] = a0[3 * i + 1]; bodies.az[i] = a0[3 * i + 2];
+        }
+    }
+
+    // Kahan sum: returns base + delta, carrying the rounding error in `compensation`
+    static double compensatedAdd(double base, double delta, double& compensation) {
+        double y = delta - compensation;
+        double t = base + y;
+        compensation = (t - base) - y;
+        return t;
+    }
+};
+
+inline std::unique_ptr<Integrator> MakeIntegrator(IntegratorKind kind) {
+    switch (kind) {
+    case IntegratorKind::Yoshida4:
+        return std::unique_ptr<Integrator>(new Yoshida4Integrator());
+    case IntegratorKind::WisdomHolman:
+        return std::unique_ptr<Integrator>(new WisdomHolmanIntegrator());
+    case IntegratorKind::IAS15:
+        return std::unique_ptr<Integrator>(new IAS15Integrator());
+    case IntegratorKind::BlockLeapfrog:
+        return std::unique_ptr<Integrator>(new BlockLeapfrogIntegrator());
+    default:
+        return std::unique_ptr<Integrator>(new LeapfrogIntegrator());
+    }
+}
+
+inline IntegratorKind DefaultIntegratorKind() {
+    return static_cast<IntegratorKind>(SOLARSYSTEM_DEFAULT_INTEGRATOR);
+}
+
+// Parses "leapfrog", "yoshida4", "wisdom-holman", "ias15" or "block-leapfrog"; unknown names fall back to the compile-time default
+inline IntegratorKind IntegratorKindFromName(const std::string& name) {
+    if (name == "leapfrog") {
+        return IntegratorKind::Leapfrog;
+    }
+    if (name == "yoshida4") {
+        return IntegratorKind::Yoshida4;
+    }
+    if (name == "wisdom-holman" || name == "wh") {
+        return IntegratorKind::WisdomHolman;
+    }
+    if (name == "ias15") {
+        return IntegratorKind::IAS15;
+    }
+    if (name == "block-leapfrog" || name == "block") {
+        return IntegratorKind::BlockLeapfrog;
+    }
+    return DefaultIntegratorKind();
+}
@@ -0,0 +1,279 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker count override; 0 means use every hardware thread
+inline unsigned& workerCountOverride() {
+    static unsigned count = 0;
+    return count;
+}
+
+// Takes effect at the next JobSystem::Instance() call; only change it between parallel sections
+inline void SetWorkerCount(unsigned count) {
+    workerCountOverride() = count;
+}
+
+// Number of threads the simulation splits its work across
+inline unsigned WorkerCount() {
+    if (workerCountOverride() != 0) {
+        return workerCountOverride();
+    }
+    // Queried once: hardware_concurrency reads the affinity mask, and this runs on every ParallelFor
+    static const unsigned count = std::max(std::thread::hardware_concurrency(), 1u);
+    return count;
+}
+
+// Work-stealing thread pool. Every worker owns a deque: it pushes and pops its own jobs at the back
+// (depth first, cache warm) while idle workers steal from the front of other deques (breadth first,
+// large pieces). Threads that are not workers push into an extra shared queue and help run jobs
+// while they wait, so the calling thread is never idle.
+class JobSystem {
+public:
+    typedef std::function<void()> Job;
+
+    explicit JobSystem(unsigned threads = WorkerCount()) : stopping(false), queued(0) {
+        unsigned background = threads > 1 ? threads - 1 : 0;
+        for (unsigned q = 0; q <= background; ++q) {
+            queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (unsigned w = 0; w < background; ++w) {
+            workers.push_back(std::thread(&JobSystem::workerLoop, this, w));
+        }
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t w = 0; w < workers.size(); ++w) {
+            workers[w].join();
+        }
+    }
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // Shared pool with WorkerCount() threads; recreated when the worker count has changed
+    static JobSystem& Instance() {
+        static std::unique_ptr<JobSystem> instance;
+        if (!instance || instance->Threads() != WorkerCount()) {
+            instance.reset();
+            instance.reset(new JobSystem(WorkerCount()));
+        }
+        return *instance;
+    }
+
+    // Threads that execute jobs, counting the thread that waits
+    unsigned Threads() const {
+        return static_cast<unsigned>(workers.size()) + 1;
+    }
+
+    void Push(Job job) {
+        WorkerQueue& queue = *queues[localQueue()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.jobs.push_back(std::move(job));
+        }
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wake.notify_one();
+    }
+
+    // Runs one queued job if any can be found; returns false when every queue was empty
+    bool RunOne() {
+        Job job;
+        if (!take(job)) {
+            return false;
+        }
+        job();
+        return true;
+    }
+
+    // Helps with queued work until `remaining` reaches zero
+    void WaitFor(const std::atomic<size_t>& remaining) {
+        while (remaining.load() > 0) {
+            if (!RunOne()) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Splits [begin, end) into chunks of at least `grain` items (a few per thread, so stealing can
+    // balance uneven work) and calls fn(chunkBegin, chunkEnd) on each. The caller runs the first
+    // chunk and helps with the rest, so nested calls from inside jobs are fine.
+    template <typename Fn>
+    void ParallelFor(size_t begin, size_t end, size_t grain, const Fn& fn) {
+        if (end <= begin) {
+            return;
+        }
+        const size_t count = end - begin;
+        grain = std::max<size_t>(grain, 1);
+        size_t chunks = std::min<size_t>((count + grain - 1) / grain, ChunksPerThread * Threads());
+        if (chunks <= 1 || Threads() == 1) {
+            fn(begin, end);
+            return;
+        }
+        const size_t chunk = (count + chunks - 1) / chunks;
+        chunks = (count + chunk - 1) / chunk;
+
+        std::atomic<size_t> remaining(chunks - 1);
+        for (size_t c = chunks - 1; c > 0; --c) {
+            size_t chunkBegin = begin + c * chunk;
+            size_t chunkEnd = std::min(end, chunkBegin + chunk);
+            Push([&fn, &remaining, chunkBegin, chunkEnd] {
+                fn(chunkBegin, chunkEnd);
+                remaining.fetch_sub(1);
+            });
+        }
+        fn(begin, std::min(end, begin + chunk));
+        WaitFor(remaining);
+    }
+
+private:
+    static const size_t ChunksPerThread = 4;
+
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue> > queues;   // one per background worker, plus a shared one
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool stopping;
+    std::atomic<size_t> queued;
+
+    // Index of the calling thread's worker queue in this pool, or -1 for outside threads
+    static int& currentWorker() {
+        thread_local int index = -1;
+        return index;
+    }
+
+    static JobSystem*& currentPool() {
+        thread_local JobSystem* pool = nullptr;
+        return pool;
+    }
+
+    size_t localQueue() const {
+        if (currentPool() == this && currentWorker() >= 0) {
+            return static_cast<size_t>(currentWorker());
+        }
+        return queues.size() - 1;
+    }
+
+    bool take(Job& job) {
+        size_t own = localQueue();
+        {
+            WorkerQueue& queue = *queues[own];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.jobs.empty()) {
+                job = std::move(queue.jobs.back());
+                queue.jobs.pop_back();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            WorkerQueue& victim = *queues[(own + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.jobs.empty()) {
+                job = std::move(victim.jobs.front());
+                victim.jobs.pop_front();
+                queued.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned index) {
+        currentWorker() = static_cast<int>(index);
+        currentPool() = this;
+        for (;;) {
+            if (RunOne()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wake.wait(lock, [this] { return stopping || queued.load() > 0; });
+            if (stopping) {
+                return;
+            }
+        }
+    }
+};
+
+// Static dependency graph of jobs. Tasks whose dependencies are all finished are pushed to the
+// pool by whichever worker finished the last dependency, so the graph runs without a scheduler.
+class TaskGraph {
+public:
+    typedef size_t TaskId;
+
+    TaskId Add(JobSystem::Job job) {
+        tasks.push_back(Task());
+        tasks.back().job = std::move(job);
+        return tasks.size() - 1;
+    }
+
+    // `after` may only start once `before` has finished
+    void Precede(TaskId before, TaskId after) {
+        tasks[before].successors.push_back(after);
+        ++tasks[after].dependencies;
+    }
+
+    size_t Size() const {
+        return tasks.size();
+    }
+
+    void Run(JobSystem& jobs = JobSystem::Instance()) {
+        if (tasks.empty()) {
+            return;
+        }
+        pending.reset(new std::atomic<size_t>[tasks.size()]);
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            pending[t].store(tasks[t].dependencies);
+        }
+        remaining.store(tasks.size());
+        for (size_t t = 0; t < tasks.size(); ++t) {
+            if (tasks[t].dependencies == 0) {
+                schedule(jobs, t);
+            }
+        }
+        jobs.WaitFor(remaining);
+    }
+
+private:
+    struct Task {
+        JobSystem::Job job;
+        std::vector<TaskId> successors;
+        size_t dependencies = 0;
+    };
+
+    std::vector<Task> tasks;
+    std::unique_ptr<std::atomic<size_t>[]> pending;
+    std::atomic<size_t> remaining;
+
+    void schedule(JobSystem& jobs, TaskId id) {
+        jobs.Push([this, &jobs, id] {
+            tasks[id].job();
+            for (size_t s = 0; s < tasks[id].successors.size(); ++s) {
+                TaskId next = tasks[id].successors[s];
+                if (pending[next].fetch_sub(1) == 1) {
+                    schedule(jobs, next);
+                }
+            }
+            remaining.fetch_sub(1);
+        });
+    }
+};
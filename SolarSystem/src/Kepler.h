@@ -0,0 +1,309 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Parallel.h"
+#include "SimdMath.h"
+
+// Classical elements of a bound orbit. Angles are in radians; the mean anomaly is given at `epoch`.
+struct OrbitalElements {
+    double semiMajorAxis;
+    double eccentricity;
+    double inclination;
+    double ascendingNode;
+    double argumentOfPeriapsis;
+    double meanAnomaly;
+    double epoch = 0.0;
+};
+
+// Size, shape and orientation of an orbit, for filters that reason about the path rather than the motion
+struct OrbitShape {
+    double semiMajorAxis;
+    double eccentricity;
+    double meanMotion;
+    glm::dvec3 periapsis;       // unit vector from the focus toward periapsis
+    glm::dvec3 normal;          // unit angular momentum direction
+
+    double Periapsis() const {
+        return semiMajorAxis * (1.0 - eccentricity);
+    }
+
+    double Apoapsis() const {
+        return semiMajorAxis * (1.0 + eccentricity);
+    }
+
+    // Distance from the focus at true anomaly nu
+    double Radius(double nu) const {
+        return semiMajorAxis * (1.0 - eccentricity * eccentricity) / (1.0 + eccentricity * std::cos(nu));
+    }
+
+    // Fastest speed along the orbit (at periapsis)
+    double MaxSpeed() const {
+        return meanMotion * semiMajorAxis * std::sqrt((1.0 + eccentricity) / (1.0 - eccentricity));
+    }
+};
+
+// Two-body propagation for batches of bodies. Each orbit is reduced to its mean motion, phase and
+// the in-plane axes toward periapsis (scaled by a) and along the motion there (scaled by b), so
+//     r(t) = aP (cos E - e) + bQ sin E,   E - e sin E = n t + phase
+// costs one Kepler solve at any time, independent of how far t is from the epoch. The batch path solves
+// four bodies per AVX register with Halley iterations and a polynomial sincos.
+class KeplerOrbits {
+public:
+    static const size_t Invalid = static_cast<size_t>(-1);
+
+    double mu;      // default gravitational parameter G * M for Add
+
+    KeplerOrbits(double mu = 1.0) : mu(mu) {}
+
+    size_t Size() const {
+        return meanMotion.size();
+    }
+
+    void Clear() {
+        meanMotion.clear(); phase.clear(); eccentricity.clear();
+        px.clear(); py.clear(); pz.clear(); qx.clear(); qy.clear(); qz.clear();
+    }
+
+    void Reserve(size_t n) {
+        meanMotion.reserve(n); phase.reserve(n); eccentricity.reserve(n);
+        px.reserve(n); py.reserve(n); pz.reserve(n); qx.reserve(n); qy.reserve(n); qz.reserve(n);
+    }
+
+    size_t Add(const OrbitalElements& elements) {
+        return Add(elements, mu);
+    }
+
+    size_t Add(const OrbitalElements& elements, double bodyMu) {
+        return Add(elements, bodyMu, glm::dmat3(1.0));
+    }
+
+    // `frame` maps the reference plane of the elements (x, y, with z as the pole) into world axes
+    size_t Add(const OrbitalElements& elements, double bodyMu, const glm::dmat3& frame) {
+        double a = elements.semiMajorAxis, e = elements.eccentricity;
+        if (!(a > 0.0) || !(e >= 0.0 && e < 1.0) || !(bodyMu > 0.0)) {
+            std::cout << "ERROR::KEPLER::UNBOUND_ORBIT a=" << a << " e=" << e << std::endl;
+            return Invalid;
+        }
+        double n = std::sqrt(bodyMu / (a * a * a));
+        double b = a * std::sqrt(1.0 - e * e);
+        double cosNode = std::cos(elements.ascendingNode), sinNode = std::sin(elements.ascendingNode);
+        double cosPeri = std::cos(elements.argumentOfPeriapsis), sinPeri = std::sin(elements.argumentOfPeriapsis);
+        double cosInc = std::cos(elements.inclination), sinInc = std::sin(elements.inclination);
+
+        meanMotion.push_back(n);
+        phase.push_back(elements.meanAnomaly - n * elements.epoch);
+        eccentricity.push_back(e);
+        glm::dvec3 P = frame * glm::dvec3(cosNode * cosPeri - sinNode * sinPeri * cosInc,
+            sinNode * cosPeri + cosNode * sinPeri * cosInc, sinPeri * sinInc) * a;
+        glm::dvec3 Q = frame * glm::dvec3(-cosNode * sinPeri - sinNode * cosPeri * cosInc,
+            -sinNode * sinPeri + cosNode * cosPeri * cosInc, cosPeri * sinInc) * b;
+        px.push_back(P.x); py.push_back(P.y); pz.push_back(P.z);
+        qx.push_back(Q.x); qy.push_back(Q.y); qz.push_back(Q.z);
+        return Size() - 1;
+    }
+
+    // Position and velocity of one orbit at time t, relative to the focus
+    void State(size_t i, double t, glm::dvec3& position, glm::dvec3& velocity) const {
+        double e = eccentricity[i];
+        double E = SolveKepler(reduceAngle(meanMotion[i] * t + phase[i]), e);
+        double cosE = std::cos(E), sinE = std::sin(E);
+        glm::dvec3 aP(px[i], py[i], pz[i]), bQ(qx[i], qy[i], qz[i]);
+        position = aP * (cosE - e) + bQ * sinE;
+        double rate = meanMotion[i] / (1.0 - e * cosE);     // dE/dt
+        velocity = (bQ * cosE - aP * sinE) * rate;
+    }
+
+    glm::dvec3 Position(size_t i, double t) const {
+        glm::dvec3 position, velocity;
+        State(i, t, position, velocity);
+        return position;
+    }
+
+    OrbitShape Shape(size_t i) const {
+        glm::dvec3 aP(px[i], py[i], pz[i]), bQ(qx[i], qy[i], qz[i]);
+        OrbitShape shape;
+        shape.semiMajorAxis = glm::length(aP);
+        shape.eccentricity = eccentricity[i];
+        shape.meanMotion = meanMotion[i];
+        shape.periapsis = aP / shape.semiMajorAxis;
+        shape.normal = glm::normalize(glm::cross(aP, bQ));
+        return shape;
+    }
+
+    // Positions of every orbit at time t (relative to the focus), split across worker threads
+    void Propagate(double t, double* x, double* y, double* z) const {
+        ParallelFor(0, Size(), 16384, [&](size_t begin, size_t end) {
+            propagateRange(t, begin, end, [&](size_t i, double rx, double ry, double rz) {
+                x[i] = rx; y[i] = ry; z[i] = rz;
+            });
+        });
+    }
+
+    // Float positions offset by `origin`, written with `stride` floats between bodies; suited to
+    // filling a mapped vertex buffer directly
+    void Propagate(double t, float* out, size_t stride, const glm::dvec3& origin) const {
+        ParallelFor(0, Size(), 16384, [&](size_t begin, size_t end) {
+            propagateRange(t, begin, end, [&](size_t i, double rx, double ry, double rz) {
+                float* p = out + i * stride;
+                p[0] = static_cast<float>(origin.x + rx);
+                p[1] = static_cast<float>(origin.y + ry);
+                p[2] = static_cast<float>(origin.z + rz);
+            });
+        });
+    }
+
+    void Propagate(double t, std::vector<double>& x, std::vector<double>& y, std::vector<double>& z) const {
+        x.resize(Size()); y.resize(Size()); z.resize(Size());
+        if (Size() > 0) {
+            Propagate(t, &x[0], &y[0], &z[0]);
+        }
+    }
+
+    // Eccentric anomaly for mean anomaly M in [-pi, pi] and 0 <= e < 1
+    static double SolveKepler(double M, double e) {
+        double E = e < 0.8 ? M + e * std::sin(M) * (1.0 + e * std::cos(M)) : M + (M < 0.0 ? -0.85 : 0.85) * e;
+        for (int iteration = 0; iteration < MaxIterations; ++iteration) {
+            double sinE = std::sin(E), cosE = std::cos(E);
+            double step = halleyStep(E, M, e, sinE, cosE);
+            E -= step;
+            if (std::fabs(step) < Tolerance) {
+                break;
+            }
+        }
+        return E;
+    }
+
+    // Elements of the orbit through (position, velocity) around a focus with parameter mu
+    static OrbitalElements ElementsFromState(const glm::dvec3& position, const glm::dvec3& velocity, double mu,
+        double epoch = 0.0) {
+        const double tiny = 1e-12;
+        OrbitalElements elements = OrbitalElements();
+        elements.epoch = epoch;
+        double r = glm::length(position);
+        glm::dvec3 h = glm::cross(position, velocity);
+        glm::dvec3 hHat = glm::normalize(h);
+        glm::dvec3 node(-h.y, h.x, 0.0);
+        glm::dvec3 eVector = ((glm::dot(velocity, velocity) - mu / r) * position - glm::dot(position, velocity) * velocity) / mu;
+
+        elements.eccentricity = glm::length(eVector);
+        elements.semiMajorAxis = 1.0 / (2.0 / r - glm::dot(velocity, velocity) / mu);
+        elements.inclination = std::acos(glm::clamp(hHat.z, -1.0, 1.0));
+
+        // Equatorial orbits measure from +x, circular orbits from the node
+        glm::dvec3 nodeDirection = glm::length(node) > tiny * glm::length(h) ? glm::normalize(node) : glm::dvec3(1.0, 0.0, 0.0);
+        elements.ascendingNode = std::atan2(nodeDirection.y, nodeDirection.x);
+        glm::dvec3 periapsis = nodeDirection;
+        if (elements.eccentricity > tiny) {
+            periapsis = eVector / elements.eccentricity;
+            elements.argumentOfPeriapsis = signedAngle(nodeDirection, periapsis, hHat);
+        }
+        double trueAnomaly = signedAngle(periapsis, position, hHat);
+        double e = elements.eccentricity;
+        double E = 2.0 * std::atan(std::sqrt((1.0 - e) / (1.0 + e)) * std::tan(0.5 * trueAnomaly));
+        elements.meanAnomaly = E - e * std::sin(E);
+        return elements;
+    }
+
+    static const char* InstructionSet() {
+#if defined(__AVX__)
+        return "AVX";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+    static const int MaxIterations = 10;
+    static constexpr double Tolerance = 1e-13;
+    static constexpr double TwoPi = 6.283185307179586476925;
+
+    std::vector<double> meanMotion, phase, eccentricity;
+    std::vector<double> px, py, pz;     // a * periapsis direction
+    std::vector<double> qx, qy, qz;     // b * direction of motion at periapsis
+
+    static double reduceAngle(double M) {
+        return M - TwoPi * std::floor(M / TwoPi + 0.5);
+    }
+
+    static double halleyStep(double E, double M, double e, double sinE, double cosE) {
+        double f = E - e * sinE - M;
+        double f1 = 1.0 - e * cosE;
+        double f2 = e * sinE;
+        return f / (f1 - 0.5 * f * f2 / f1);
+    }
+
+    static double signedAngle(const glm::dvec3& from, const glm::dvec3& to, const glm::dvec3& axis) {
+        return std::atan2(glm::dot(glm::cross(from, to), axis), glm::dot(from, to));
+    }
+
+    // Solves bodies [begin, end) at time t and hands each position to store(i, x, y, z)
+    template <typename Store>
+    void propagateRange(double t, size_t begin, size_t end, Store store) const {
+        size_t i = begin;
+#if defined(__AVX__)
+        const __m256d vt = _mm256_set1_pd(t);
+        const __m256d twoPi = _mm256_set1_pd(TwoPi);
+        const __m256d invTwoPi = _mm256_set1_pd(1.0 / TwoPi);
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d highE = _mm256_set1_pd(0.8);
+        const __m256d danby = _mm256_set1_pd(0.85);
+        const __m256d tolerance = _mm256_set1_pd(Tolerance);
+        const __m256d signBit = _mm256_set1_pd(-0.0);
+        for (; i + 4 <= end; i += 4) {
+            __m256d e = _mm256_loadu_pd(&eccentricity[i]);
+            __m256d M = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&meanMotion[i]), vt), _mm256_loadu_pd(&phase[i]));
+            M = _mm256_sub_pd(M, _mm256_mul_pd(twoPi, _mm256_round_pd(_mm256_mul_pd(M, invTwoPi), _MM_FROUND_TO_NEAREST_INT)));
+
+            // Starter: second-order series for moderate e, Danby's M + 0.85 e sign(M) for high e
+            __m256d sinE, cosE;
+            SinCos4(M, sinE, cosE);
+            __m256d series = _mm256_add_pd(M, _mm256_mul_pd(_mm256_mul_pd(e, sinE), _mm256_add_pd(one, _mm256_mul_pd(e, cosE))));
+            __m256d signM = _mm256_and_pd(M, signBit);
+            __m256d high = _mm256_add_pd(M, _mm256_or_pd(_mm256_mul_pd(danby, e), signM));
+            __m256d E = _mm256_blendv_pd(series, high, _mm256_cmp_pd(e, highE, _CMP_GE_OQ));
+
+            // Halley iterations until every lane has converged. The last step is below the tolerance,
+            // so sin and cos of the final E follow from a first-order update instead of another sincos.
+            for (int iteration = 0; iteration < MaxIterations; ++iteration) {
+                SinCos4(E, sinE, cosE);
+                __m256d f = _mm256_sub_pd(_mm256_sub_pd(E, _mm256_mul_pd(e, sinE)), M);
+                __m256d f1 = _mm256_sub_pd(one, _mm256_mul_pd(e, cosE));
+                __m256d f2 = _mm256_mul_pd(e, sinE);
+                __m256d step = _mm256_div_pd(f, _mm256_sub_pd(f1, _mm256_div_pd(_mm256_mul_pd(_mm256_mul_pd(half, f), f2), f1)));
+                E = _mm256_sub_pd(E, step);
+                __m256d size = _mm256_andnot_pd(signBit, step);
+                if (_mm256_movemask_pd(_mm256_cmp_pd(size, tolerance, _CMP_GE_OQ)) == 0) {
+                    __m256d nextSin = _mm256_sub_pd(sinE, _mm256_mul_pd(cosE, step));
+                    cosE = _mm256_add_pd(cosE, _mm256_mul_pd(sinE, step));
+                    sinE = nextSin;
+                    break;
+                }
+                if (iteration + 1 == MaxIterations) {
+                    SinCos4(E, sinE, cosE);
+                }
+            }
+            __m256d cosTerm = _mm256_sub_pd(cosE, e);
+            double lx[4], ly[4], lz[4];
+            _mm256_storeu_pd(lx, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&px[i]), cosTerm), _mm256_mul_pd(_mm256_loadu_pd(&qx[i]), sinE)));
+            _mm256_storeu_pd(ly, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&py[i]), cosTerm), _mm256_mul_pd(_mm256_loadu_pd(&qy[i]), sinE)));
+            _mm256_storeu_pd(lz, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(&pz[i]), cosTerm), _mm256_mul_pd(_mm256_loadu_pd(&qz[i]), sinE)));
+            for (int k = 0; k < 4; ++k) {
+                store(i + k, lx[k], ly[k], lz[k]);
+            }
+        }
+#endif
+        for (; i < end; ++i) {
+            double e = eccentricity[i];
+            double E = SolveKepler(reduceAngle(meanMotion[i] * t + phase[i]), e);
+            double cosTerm = std::cos(E) - e, sinE = std::sin(E);
+            store(i, px[i] * cosTerm + qx[i] * sinE, py[i] * cosTerm + qy[i] * sinE, pz[i] * cosTerm + qz[i] * sinE);
+        }
+    }
+};
@@ -22,10 +22,15 @@ GLint TextureFromFile(const char* path, string directory);
 
 class Model {
 public:
-    Model(const GLchar* path) {
+    Model(const GLchar* path) : boundingRadius(0.0f) {
         this->loadModel(path);
     }
 
+    // Distance of the farthest vertex from the model origin, for culling
+    float BoundingRadius() const {
+        return this->boundingRadius;
+    }
+
     void Draw(Shader shader) {
         for (GLuint i = 0; i < this->meshes.size(); i++) {
             this->meshes[i].Draw(shader);
@@ -35,6 +40,7 @@ public:
 private:
     vector<Mesh> meshes;
     string directory;
+    float boundingRadius;
     vector<Texture> textures_loaded;
 
     void loadModel(string path) {
@@ -75,6 +81,7 @@ private:
             vector.y = mesh->mVertices[i].y;
             vector.z = mesh->mVertices[i].z;
             vertex.Position = vector;
+            this->boundingRadius = glm::max(this->boundingRadius, glm::length(vector));
 
             vector.x = mesh->mNormals[i].x;
             vector.y = mesh->mNormals[i].y;
@@ -0,0 +1,381 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include "Parallel.h"
+
+// Body state in structure-of-arrays layout, so force kernels stream each component contiguously
+struct BodySystem {
+    std::vector<double> x, y, z;
+    std::vector<double> vx, vy, vz;
+    std::vector<double> ax, ay, az;
+    std::vector<double> mass;
+    std::vector<double> radius;
+
+    size_t Size() const {
+        return mass.size();
+    }
+
+    void Resize(size_t n) {
+        x.resize(n); y.resize(n); z.resize(n);
+        vx.resize(n); vy.resize(n); vz.resize(n);
+        ax.resize(n); ay.resize(n); az.resize(n);
+        mass.resize(n);
+        radius.resize(n);
+    }
+
+    size_t Add(const glm::dvec3& position, const glm::dvec3& velocity, double m, double r = 0.0) {
+        size_t index = Size();
+        Resize(index + 1);
+        SetPosition(index, position);
+        SetVelocity(index, velocity);
+        mass[index] = m;
+        radius[index] = r;
+        return index;
+    }
+
+    glm::dvec3 Position(size_t i) const {
+        return glm::dvec3(x[i], y[i], z[i]);
+    }
+
+    glm::dvec3 Velocity(size_t i) const {
+        return glm::dvec3(vx[i], vy[i], vz[i]);
+    }
+
+    glm::dvec3 Acceleration(size_t i) const {
+        return glm::dvec3(ax[i], ay[i], az[i]);
+    }
+
+    void SetPosition(size_t i, const glm::dvec3& p) {
+        x[i] = p.x; y[i] = p.y; z[i] = p.z;
+    }
+
+    void SetVelocity(size_t i, const glm::dvec3& v) {
+        vx[i] = v.x; vy[i] = v.y; vz[i] = v.z;
+    }
+
+    // Drops every body with keep[i] == 0, preserving order. remap[old] is the new index, or
+    // BodySystem::Removed for dropped bodies.
+    static const size_t Removed = static_cast<size_t>(-1);
+
+    void Compact(const std::vector<char>& keep, std::vector<size_t>& remap) {
+        const size_t n = Size();
+        remap.assign(n, static_cast<size_t>(Removed));
+        size_t out = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (!keep[i]) {
+                continue;
+            }
+            remap[i] = out;
+            x[out] = x[i]; y[out] = y[i]; z[out] = z[i];
+            vx[out] = vx[i]; vy[out] = vy[i]; vz[out] = vz[i];
+            ax[out] = ax[i]; ay[out] = ay[i]; az[out] = az[i];
+            mass[out] = mass[i];
+            radius[out] = radius[i];
+            ++out;
+        }
+        Resize(out);
+    }
+
+    double TotalMass() const {
+        double total = 0.0;
+        for (size_t i = 0; i < Size(); ++i) {
+            total += mass[i];
+        }
+        return total;
+    }
+
+    glm::dvec3 CenterOfMass() const {
+        glm::dvec3 sum(0.0);
+        for (size_t i = 0; i < Size(); ++i) {
+            sum += Position(i) * mass[i];
+        }
+        double total = TotalMass();
+        return total > 0.0 ? sum / total : sum;
+    }
+};
+
+// Force backend interface. Solvers fill ax/ay/az for every body; the renderer and integrators only
+// ever talk to this interface, so backends can be swapped at runtime.
+class GravitySolver {
+public:
+    double G;
+    double softening;
+    unsigned long long interactions;   // pairwise interactions evaluated so far, for throughput stats
+
+    GravitySolver(double G = 1.0, double softening = 0.0) : G(G), softening(softening), interactions(0) {}
+    virtual ~GravitySolver() {}
+
+    virtual const char* Name() const = 0;
+    virtual void ComputeAccelerations(BodySystem& bodies) = 0;
+
+    // Accelerations of the listed bodies only, from all sources; the others keep stale values.
+    // Backends without a cheaper path just compute everything.
+    virtual void ComputeAccelerationsFor(BodySystem& bodies, const std::vector<size_t>& targets) {
+        (void)targets;
+        ComputeAccelerations(bodies);
+    }
+};
+
+enum class KernelPrecision {
+    Double,   // full double precision, used for the planetary scenes
+    Mixed     // float positions relative to the centroid with rsqrt, for large N
+};
+
+// O(N^2) direct summation. Targets are vectorized across SIMD lanes (AVX or SSE2, scalar fallback)
+// and split across worker threads; every source is broadcast against a block of targets.
+class DirectSummationSolver : public GravitySolver {
+public:
+    KernelPrecision precision;
+    size_t grain;
+
+    DirectSummationSolver(double G = 1.0, double softening = 0.0, KernelPrecision precision = KernelPrecision::Double)
+        : GravitySolver(G, softening), precision(precision), grain(64) {}
+
+    const char* Name() const override {
+        return precision == KernelPrecision::Double ? "direct" : "direct-mixed";
+    }
+
+    static const char* InstructionSet() {
+#if defined(__AVX__)
+        return "AVX";
+#elif defined(__SSE2__) || defined(_M_X64)
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+
+    void ComputeAccelerations(BodySystem& bodies) override {
+        size_t n = bodies.Size();
+        if (precision == KernelPrecision::Mixed) {
+            prepareSinglePrecision(bodies);
+            ParallelFor(0, n, grain, [&](size_t begin, size_t end) { accumulateMixed(bodies, begin, end); });
+        }
+        else {
+            ParallelFor(0, n, grain, [&](size_t begin, size_t end) { accumulateDouble(bodies, begin, end); });
+        }
+        interactions += static_cast<unsigned long long>(n) * n;
+    }
+
+    // Subsets come from block timesteps on hierarchical systems, so this always runs in double precision
+    void ComputeAccelerationsFor(BodySystem& bodies, const std::vector<size_t>& targets) override {
+        if (targets.size() == bodies.Size()) {
+            ComputeAccelerations(bodies);
+            return;
+        }
+        ParallelFor(0, targets.size(), grain, [&](size_t begin, size_t end) {
+            accumulateTargets(bodies, targets, begin, end);
+        });
+        interactions += static_cast<unsigned long long>(targets.size()) * bodies.Size();
+    }
+
+private:
+    std::vector<float> fx, fy, fz, fm;
+
+    void accumulateTargets(BodySystem& b, const std::vector<size_t>& targets, size_t begin, size_t end) const {
+        const size_t n = b.Size();
+        const double eps2 = softening * softening;
+        for (size_t t = begin; t < end; ++t) {
+            const size_t i = targets[t];
+            const double xi = b.x[i], yi = b.y[i], zi = b.z[i];
+            double axi = 0.0, ayi = 0.0, azi = 0.0;
+            for (size_t j = 0; j < n; ++j) {
+                double dx = b.x[j] - xi, dy = b.y[j] - yi, dz = b.z[j] - zi;
+                double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                if (r2 > 0.0) {
+                    double inv = 1.0 / std::sqrt(r2);
+                    double s = b.mass[j] * inv * inv * inv;
+                    axi += dx * s; ayi += dy * s; azi += dz * s;
+                }
+            }
+            b.ax[i] = G * axi; b.ay[i] = G * ayi; b.az[i] = G * azi;
+        }
+    }
+
+    void accumulateDouble(BodySystem& b, size_t begin, size_t end) const {
+        const size_t n = b.Size();
+        const double eps2 = softening * softening;
+        const double* x = &b.x[0];
+        const double* y = &b.y[0];
+        const double* z = &b.z[0];
+        const double* m = &b.mass[0];
+        size_t i = begin;
+
+#if defined(__AVX__)
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d vEps2 = _mm256_set1_pd(eps2);
+        const __m256d vG = _mm256_set1_pd(G);
+        for (; i + 4 <= end; i += 4) {
+            __m256d xi = _mm256_loadu_pd(x + i), yi = _mm256_loadu_pd(y + i), zi = _mm256_loadu_pd(z + i);
+            __m256d axi = zero, ayi = zero, azi = zero;
+            for (size_t j = 0; j < n; ++j) {
+                __m256d dx = _mm256_sub_pd(_mm256_set1_pd(x[j]), xi);
+                __m256d dy = _mm256_sub_pd(_mm256_set1_pd(y[j]), yi);
+                __m256d dz = _mm256_sub_pd(_mm256_set1_pd(z[j]), zi);
+                __m256d r2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)),
+                    _mm256_add_pd(_mm256_mul_pd(dz, dz), vEps2));
+                __m256d inv = _mm256_div_pd(one, _mm256_sqrt_pd(r2));
+                __m256d s = _mm256_mul_pd(_mm256_mul_pd(inv, inv), _mm256_mul_pd(inv, _mm256_set1_pd(m[j])));
+                // Self-interaction (r2 == 0 without softening) produces inf, masked to zero here
+                s = _mm256_and_pd(s, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+                axi = _mm256_add_pd(axi, _mm256_mul_pd(dx, s));
+                ayi = _mm256_add_pd(ayi, _mm256_mul_pd(dy, s));
+                azi = _mm256_add_pd(azi, _mm256_mul_pd(dz, s));
+            }
+            _mm256_storeu_pd(&b.ax[i], _mm256_mul_pd(axi, vG));
+            _mm256_storeu_pd(&b.ay[i], _mm256_mul_pd(ayi, vG));
+            _mm256_storeu_pd(&b.az[i], _mm256_mul_pd(azi, vG));
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        const __m128d zero = _mm_setzero_pd();
+        const __m128d one = _mm_set1_pd(1.0);
+        const __m128d vEps2 = _mm_set1_pd(eps2);
+        const __m128d vG = _mm_set1_pd(G);
+        for (; i + 2 <= end; i += 2) {
+            __m128d xi = _mm_loadu_pd(x + i), yi = _mm_loadu_pd(y + i), zi = _mm_loadu_pd(z + i);
+            __m128d axi = zero, ayi = zero, azi = zero;
+            for (size_t j = 0; j < n; ++j) {
+                __m128d dx = _mm_sub_pd(_mm_set1_pd(x[j]), xi);
+                __m128d dy = _mm_sub_pd(_mm_set1_pd(y[j]), yi);
+                __m128d dz = _mm_sub_pd(_mm_set1_pd(z[j]), zi);
+                __m128d r2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)),
+                    _mm_add_pd(_mm_mul_pd(dz, dz), vEps2));
+                __m128d inv = _mm_div_pd(one, _mm_sqrt_pd(r2));
+                __m128d s = _mm_mul_pd(_mm_mul_pd(inv, inv), _mm_mul_pd(inv, _mm_set1_pd(m[j])));
+                s = _mm_and_pd(s, _mm_cmpgt_pd(r2, zero));
+                axi = _mm_add_pd(axi, _mm_mul_pd(dx, s));
+                ayi = _mm_add_pd(ayi, _mm_mul_pd(dy, s));
+                azi = _mm_add_pd(azi, _mm_mul_pd(dz, s));
+            }
+            _mm_storeu_pd(&b.ax[i], _mm_mul_pd(axi, vG));
+            _mm_storeu_pd(&b.ay[i], _mm_mul_pd(ayi, vG));
+            _mm_storeu_pd(&b.az[i], _mm_mul_pd(azi, vG));
+        }
+#endif
+        for (; i < end; ++i) {
+            double axi = 0.0, ayi = 0.0, azi = 0.0;
+            for (size_t j = 0; j < n; ++j) {
+                double dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+                double r2 = dx * dx + dy * dy + dz * dz + eps2;
+                if (r2 > 0.0) {
+                    double inv = 1.0 / std::sqrt(r2);
+                    double s = m[j] * inv * inv * inv;
+                    axi += dx * s; ayi += dy * s; azi += dz * s;
+                }
+            }
+            b.ax[i] = G * axi; b.ay[i] = G * ayi; b.az[i] = G * azi;
+        }
+    }
+
+    // Float copies of the positions relative to the centroid; keeps the float kernel's rounding
+    // error proportional to the size of the system rather than its distance from the origin
+    void prepareSinglePrecision(const BodySystem& b) {
+        size_t n = b.Size();
+        fx.resize(n); fy.resize(n); fz.resize(n); fm.resize(n);
+        glm::dvec3 origin(0.0);
+        for (size_t i = 0; i < n; ++i) {
+            origin += b.Position(i);
+        }
+        if (n > 0) {
+            origin /= static_cast<double>(n);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            fx[i] = static_cast<float>(b.x[i] - origin.x);
+            fy[i] = static_cast<float>(b.y[i] - origin.y);
+            fz[i] = static_cast<float>(b.z[i] - origin.z);
+            fm[i] = static_cast<float>(b.mass[i]);
+        }
+    }
+
+    void accumulateMixed(BodySystem& b, size_t begin, size_t end) const {
+        const size_t n = b.Size();
+        const float eps2 = static_cast<float>(softening * softening);
+        const float* x = n > 0 ? &fx[0] : nullptr;
+        const float* y = n > 0 ? &fy[0] : nullptr;
+        const float* z = n > 0 ? &fz[0] : nullptr;
+        const float* m = n > 0 ? &fm[0] : nullptr;
+        size_t i = begin;
+
+#if defined(__AVX__)
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 threeHalves = _mm256_set1_ps(1.5f);
+        const __m256 vEps2 = _mm256_set1_ps(eps2);
+        for (; i + 8 <= end; i += 8) {
+            __m256 xi = _mm256_loadu_ps(x + i), yi = _mm256_loadu_ps(y + i), zi = _mm256_loadu_ps(z + i);
+            __m256 axi = zero, ayi = zero, azi = zero;
+            for (size_t j = 0; j < n; ++j) {
+                __m256 dx = _mm256_sub_ps(_mm256_set1_ps(x[j]), xi);
+                __m256 dy = _mm256_sub_ps(_mm256_set1_ps(y[j]), yi);
+                __m256 dz = _mm256_sub_ps(_mm256_set1_ps(z[j]), zi);
+                __m256 r2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                    _mm256_add_ps(_mm256_mul_ps(dz, dz), vEps2));
+                // rsqrt estimate refined by one Newton-Raphson step (~22 bits)
+                __m256 inv = _mm256_rsqrt_ps(r2);
+                inv = _mm256_mul_ps(inv, _mm256_sub_ps(threeHalves, _mm256_mul_ps(_mm256_mul_ps(half, r2), _mm256_mul_ps(inv, inv))));
+                __m256 s = _mm256_mul_ps(_mm256_mul_ps(inv, inv), _mm256_mul_ps(inv, _mm256_set1_ps(m[j])));
+                s = _mm256_and_ps(s, _mm256_cmp_ps(r2, zero, _CMP_GT_OQ));
+                axi = _mm256_add_ps(axi, _mm256_mul_ps(dx, s));
+                ayi = _mm256_add_ps(ayi, _mm256_mul_ps(dy, s));
+                azi = _mm256_add_ps(azi, _mm256_mul_ps(dz, s));
+            }
+            float sx[8], sy[8], sz[8];
+            _mm256_storeu_ps(sx, axi); _mm256_storeu_ps(sy, ayi); _mm256_storeu_ps(sz, azi);
+            for (int k = 0; k < 8; ++k) {
+                b.ax[i + k] = G * sx[k]; b.ay[i + k] = G * sy[k]; b.az[i + k] = G * sz[k];
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 threeHalves = _mm_set1_ps(1.5f);
+        const __m128 vEps2 = _mm_set1_ps(eps2);
+        for (; i + 4 <= end; i += 4) {
+            __m128 xi = _mm_loadu_ps(x + i), yi = _mm_loadu_ps(y + i), zi = _mm_loadu_ps(z + i);
+            __m128 axi = zero, ayi = zero, azi = zero;
+            for (size_t j = 0; j < n; ++j) {
+                __m128 dx = _mm_sub_ps(_mm_set1_ps(x[j]), xi);
+                __m128 dy = _mm_sub_ps(_mm_set1_ps(y[j]), yi);
+                __m128 dz = _mm_sub_ps(_mm_set1_ps(z[j]), zi);
+                __m128 r2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                    _mm_add_ps(_mm_mul_ps(dz, dz), vEps2));
+                __m128 inv = _mm_rsqrt_ps(r2);
+                inv = _mm_mul_ps(inv, _mm_sub_ps(threeHalves, _mm_mul_ps(_mm_mul_ps(half, r2), _mm_mul_ps(inv, inv))));
+                __m128 s = _mm_mul_ps(_mm_mul_ps(inv, inv), _mm_mul_ps(inv, _mm_set1_ps(m[j])));
+                s = _mm_and_ps(s, _mm_cmpgt_ps(r2, zero));
+                axi = _mm_add_ps(axi, _mm_mul_ps(dx, s));
+                ayi = _mm_add_ps(ayi, _mm_mul_ps(dy, s));
+                azi = _mm_add_ps(azi, _mm_mul_ps(dz, s));
+            }
+            float sx[4], sy[4], sz[4];
+            _mm_storeu_ps(sx, axi); _mm_storeu_ps(sy, ayi); _mm_storeu_ps(sz, azi);
+            for (int k = 0; k < 4; ++k) {
+                b.ax[i + k] = G * sx[k]; b.ay[i + k] = G * sy[k]; b.az[i + k] = G * sz[k];
+            }
+        }
+#endif
+        for (; i < end; ++i) {
+            float axi = 0.0f, ayi = 0.0f, azi = 0.0f;
+            for (size_t j = 0; j < n; ++j) {
+                float dx = x[j] - x[i], dy = y[j] - y[i], dz = z[j] - z[i];
+                float r2 = dx * dx + dy * dy + dz * dz + eps2;
+                if (r2 > 0.0f) {
+                    float inv = 1.0f / std::sqrt(r2);
+                    float s = m[j] * inv * inv * inv;
+                    axi += dx * s; ayi += dy * s; azi += dz * s;
+                }
+            }
+            b.ax[i] = G * axi; b.ay[i] = G * ayi; b.az[i] = G * azi;
+        }
+    }
+};
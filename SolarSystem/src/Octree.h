@@ -0,0 +1,295 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NBody.h"
+#include "Parallel.h"
+#include "RadixSort.h"
+
+// Octree cell in depth-first order. Children of an internal node start at index + 1 and are chained
+// through `skip`, which points past the node's whole subtree; walking without a stack is just
+// "descend: i + 1, accept or leaf: skip".
+struct OctreeNode {
+    double comX, comY, comZ;            // center of mass
+    double mass;
+    double centerX, centerY, centerZ;   // geometric cell center
+    double halfSize;
+    uint32_t first, count;              // body range in Morton order
+    uint32_t skip;
+    uint32_t level;
+    bool leaf;
+};
+
+// Linearized octree over Morton-sorted bodies. Bodies are copied into Morton order so that leaves and
+// nearby targets are contiguous in memory. Between rebuilds the tree can be refit: topology is kept,
+// positions and moments are refreshed and `drift` records how far bodies moved since the build.
+class Octree {
+public:
+    static const int MaxLevel = 21;     // 21 bits per axis in a 63-bit Morton code
+
+    size_t leafSize;
+    std::vector<OctreeNode> nodes;
+    std::vector<uint32_t> order;        // Morton index -> body index
+    std::vector<double> sx, sy, sz, sm; // positions and masses in Morton order
+    double drift;                       // largest displacement since the last Build
+    double meanLeafHalfSize;
+
+    Octree(size_t leafSize = 16) : leafSize(leafSize), drift(0.0), meanLeafHalfSize(0.0) {}
+
+    size_t BodyCount() const {
+        return order.size();
+    }
+
+    void Build(const BodySystem& b) {
+        const size_t n = b.Size();
+        nodes.clear();
+        drift = 0.0;
+        if (n == 0) {
+            order.clear();
+            return;
+        }
+
+        glm::dvec3 lo, hi;
+        bounds(b, lo, hi);
+        double size = std::max(hi.x - lo.x, std::max(hi.y - lo.y, hi.z - lo.z));
+        size = size > 0.0 ? size * (1.0 + 1e-9) : 1.0;
+        const double scale = static_cast<double>(1u << MaxLevel) / size;
+
+        codes.resize(n);
+        order.resize(n);
+        ParallelFor(0, n, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                codes[i] = MortonCode(static_cast<uint32_t>((b.x[i] - lo.x) * scale),
+                    static_cast<uint32_t>((b.y[i] - lo.y) * scale), static_cast<uint32_t>((b.z[i] - lo.z) * scale));
+                order[i] = static_cast<uint32_t>(i);
+            }
+        });
+        RadixSortPairs(codes, order, 3 * MaxLevel);
+
+        sx.resize(n); sy.resize(n); sz.resize(n); sm.resize(n);
+        builtX.resize(n); builtY.resize(n); builtZ.resize(n);
+        gather(b);
+        builtX = sx; builtY = sy; builtZ = sz;
+
+        double half = 0.5 * size;
+        glm::dvec3 center = lo + glm::dvec3(half);
+        if (n < 4096) {
+            buildNode(0, n, 0, center, half, nodes, false);
+        }
+        else {
+            buildSubtrees(center, half);
+            buildNode(0, n, 0, center, half, nodes, true);
+        }
+
+        double leafSum = 0.0;
+        size_t leaves = 0;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i].leaf) {
+                leafSum += nodes[i].halfSize;
+                ++leaves;
+            }
+        }
+        meanLeafHalfSize = leaves > 0 ? leafSum / leaves : half;
+        computeMoments();
+    }
+
+    // Keeps the topology, refreshes positions/masses and moments; returns the drift since Build
+    double Refit(const BodySystem& b) {
+        gather(b);
+        const size_t n = order.size();
+        const unsigned workers = WorkerCount();
+        std::vector<double> partial(workers + 1, 0.0);
+        size_t chunk = (n + workers - 1) / workers;
+        ParallelFor(0, workers, 1, [&](size_t first, size_t last) {
+            for (size_t w = first; w < last; ++w) {
+                double worst = 0.0;
+                size_t end = std::min(n, (w + 1) * chunk);
+                for (size_t k = w * chunk; k < end; ++k) {
+                    double dx = sx[k] - builtX[k], dy = sy[k] - builtY[k], dz = sz[k] - builtZ[k];
+                    worst = std::max(worst, dx * dx + dy * dy + dz * dz);
+                }
+                partial[w] = worst;
+            }
+        });
+        drift = std::sqrt(*std::max_element(partial.begin(), partial.end()));
+        computeMoments();
+        return drift;
+    }
+
+    // Interleaves the low 21 bits of x, y and z (x in the lowest bit of each triple)
+    static uint64_t MortonCode(uint32_t x, uint32_t y, uint32_t z) {
+        return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+    }
+
+private:
+    std::vector<uint64_t> codes;
+    std::vector<double> builtX, builtY, builtZ;
+    std::vector<std::vector<OctreeNode> > subtrees;
+    static const uint32_t SplitLevel = 2;
+
+    static uint64_t spread(uint32_t v) {
+        uint64_t x = v & 0x1FFFFF;
+        x = (x | x << 32) & 0x1F00000000FFFFULL;
+        x = (x | x << 16) & 0x1F0000FF0000FFULL;
+        x = (x | x << 8) & 0x100F00F00F00F00FULL;
+        x = (x | x << 4) & 0x10C30C30C30C30C3ULL;
+        x = (x | x << 2) & 0x1249249249249249ULL;
+        return x;
+    }
+
+    void bounds(const BodySystem& b, glm::dvec3& lo, glm::dvec3& hi) const {
+        const size_t n = b.Size();
+        const unsigned workers = WorkerCount();
+        std::vector<glm::dvec3> los(workers, glm::dvec3(b.x[0], b.y[0], b.z[0]));
+        std::vector<glm::dvec3> his(los);
+        size_t chunk = (n + workers - 1) / workers;
+        ParallelFor(0, workers, 1, [&](size_t first, size_t last) {
+            for (size_t w = first; w < last; ++w) {
+                size_t end = std::min(n, (w + 1) * chunk);
+                for (size_t i = w * chunk; i < end; ++i) {
+                    glm::dvec3 p(b.x[i], b.y[i], b.z[i]);
+                    los[w] = glm::min(los[w], p);
+                    his[w] = glm::max(his[w], p);
+                }
+            }
+        });
+        lo = los[0];
+        hi = his[0];
+        for (unsigned w = 1; w < workers; ++w) {
+            lo = glm::min(lo, los[w]);
+            hi = glm::max(hi, his[w]);
+        }
+    }
+
+    void gather(const BodySystem& b) {
+        ParallelFor(0, order.size(), 4096, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                uint32_t i = order[k];
+                sx[k] = b.x[i]; sy[k] = b.y[i]; sz[k] = b.z[i]; sm[k] = b.mass[i];
+            }
+        });
+    }
+
+    // Octant (3 bits) of a code at the given depth
+    static uint32_t octant(uint64_t code, uint32_t level) {
+        return static_cast<uint32_t>((code >> (3 * (MaxLevel - 1 - level))) & 7);
+    }
+
+    static glm::dvec3 childCenter(const glm::dvec3& center, double half, uint32_t oct) {
+        double q = 0.5 * half;
+        return center + glm::dvec3((oct & 1) ? q : -q, (oct & 2) ? q : -q, (oct & 4) ? q : -q);
+    }
+
+    // Appends the subtree for [begin, end) in depth-first order. With useSubtrees, nodes at SplitLevel
+    // are spliced in from the subtrees built in parallel instead of being built here.
+    void buildNode(size_t begin, size_t end, uint32_t level, const glm::dvec3& center, double half,
+        std::vector<OctreeNode>& out, bool useSubtrees) {
+        if (useSubtrees && level == SplitLevel) {
+            const std::vector<OctreeNode>& subtree = subtrees[codes[begin] >> (3 * (MaxLevel - SplitLevel))];
+            uint32_t offset = static_cast<uint32_t>(out.size());
+            for (size_t i = 0; i < subtree.size(); ++i) {
+                out.push_back(subtree[i]);
+                out.back().skip += offset;
+            }
+            return;
+        }
+
+        size_t index = out.size();
+        OctreeNode node = OctreeNode();
+        node.centerX = center.x; node.centerY = center.y; node.centerZ = center.z;
+        node.halfSize = half;
+        node.first = static_cast<uint32_t>(begin);
+        node.count = static_cast<uint32_t>(end - begin);
+        node.level = level;
+        node.leaf = (end - begin) <= leafSize || level >= MaxLevel;
+        out.push_back(node);
+
+        if (!out[index].leaf) {
+            size_t childBegin = begin;
+            while (childBegin < end) {
+                uint32_t oct = octant(codes[childBegin], level);
+                // Codes are sorted, so the octant's range ends at the first code with a larger digit
+                size_t lo = childBegin + 1, hi = end;
+                while (lo < hi) {
+                    size_t mid = lo + (hi - lo) / 2;
+                    if (octant(codes[mid], level) == oct) {
+                        lo = mid + 1;
+                    }
+                    else {
+                        hi = mid;
+                    }
+                }
+                size_t childEnd = lo;
+                buildNode(childBegin, childEnd, level + 1, childCenter(center, half, oct), 0.5 * half, out, useSubtrees);
+                childBegin = childEnd;
+            }
+        }
+        out[index].skip = static_cast<uint32_t>(out.size());
+    }
+
+    // Builds every non-empty cell at SplitLevel (64 cells) as an independent subtree in parallel
+    void buildSubtrees(const glm::dvec3& center, double half) {
+        const uint32_t cells = 1u << (3 * SplitLevel);
+        const int shift = 3 * (MaxLevel - SplitLevel);
+        subtrees.assign(cells, std::vector<OctreeNode>());
+        std::vector<size_t> starts(cells + 1);
+        for (uint32_t cell = 0; cell <= cells; ++cell) {
+            starts[cell] = std::lower_bound(codes.begin(), codes.end(), static_cast<uint64_t>(cell) << shift) - codes.begin();
+        }
+        ParallelFor(0, cells, 1, [&](size_t first, size_t last) {
+            for (size_t cell = first; cell < last; ++cell) {
+                if (starts[cell] == starts[cell + 1]) {
+                    continue;
+                }
+                glm::dvec3 c = childCenter(childCenter(center, half, static_cast<uint32_t>(cell >> 3)), 0.5 * half,
+                    static_cast<uint32_t>(cell & 7));
+                buildNode(starts[cell], starts[cell + 1], SplitLevel, c, 0.25 * half, subtrees[cell], false);
+            }
+        });
+    }
+
+    // Leaves sum their bodies in parallel, then internal nodes accumulate children in reverse order
+    void computeMoments() {
+        ParallelFor(0, nodes.size(), 1024, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                OctreeNode& node = nodes[i];
+                if (!node.leaf) {
+                    continue;
+                }
+                double m = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+                for (uint32_t k = node.first; k < node.first + node.count; ++k) {
+                    m += sm[k];
+                    mx += sm[k] * sx[k]; my += sm[k] * sy[k]; mz += sm[k] * sz[k];
+                }
+                setMoments(node, m, mx, my, mz);
+            }
+        });
+        for (size_t i = nodes.size(); i-- > 0;) {
+            OctreeNode& node = nodes[i];
+            if (node.leaf) {
+                continue;
+            }
+            double m = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+            for (size_t c = i + 1; c < node.skip; c = nodes[c].skip) {
+                const OctreeNode& child = nodes[c];
+                m += child.mass;
+                mx += child.mass * child.comX; my += child.mass * child.comY; mz += child.mass * child.comZ;
+            }
+            setMoments(node, m, mx, my, mz);
+        }
+    }
+
+    static void setMoments(OctreeNode& node, double m, double mx, double my, double mz) {
+        node.mass = m;
+        if (m > 0.0) {
+            node.comX = mx / m; node.comY = my / m; node.comZ = mz / m;
+        }
+        else {
+            node.comX = node.centerX; node.comY = node.centerY; node.comZ = node.centerZ;
+        }
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <map>
+#include <tuple>
+#include <vector>
+#include "Shader.h"
+
+// Orbit paths keyed by (semi-major, semi-minor, point count). Each orbit is generated once and
+// appended to a single shared vertex buffer, so all of them can be drawn with one batched call.
+class OrbitPathCache {
+public:
+    typedef std::tuple<float, float, int> OrbitKey;
+
+    OrbitPathCache() : VAO(0), VBO(0), dirty(false) {}
+
+    ~OrbitPathCache() {
+        Release();
+    }
+
+    OrbitPathCache(const OrbitPathCache&) = delete;
+    OrbitPathCache& operator=(const OrbitPathCache&) = delete;
+
+    // Frees the GL objects; call it while the context is current, the destructor then finds nothing left to free
+    void Release() {
+        if (VBO != 0) {
+            glDeleteBuffers(1, &VBO);
+            VBO = 0;
+        }
+        if (VAO != 0) {
+            glDeleteVertexArrays(1, &VAO);
+            VAO = 0;
+        }
+        dirty = !points.empty();
+    }
+
+    // Returns the index of the cached orbit, generating its points only the first time it is seen
+    size_t Request(float semiMajorAxis, float semiMinorAxis, int numPoints) {
+        OrbitKey key(semiMajorAxis, semiMinorAxis, numPoints);
+        std::map<OrbitKey, size_t>::iterator found = orbits.find(key);
+        if (found != orbits.end()) {
+            return found->second;
+        }
+
+        size_t index = firsts.size();
+        firsts.push_back(static_cast<GLint>(points.size()));
+        counts.push_back(static_cast<GLsizei>(numPoints + 1));
+        for (int i = 0; i <= numPoints; ++i) {
+            float angle = 2.0f * glm::pi<float>() * static_cast<float>(i) / static_cast<float>(numPoints);
+            points.push_back(glm::vec3(semiMajorAxis * sin(angle), 0.0f, semiMinorAxis * cos(angle)));
+        }
+        orbits[key] = index;
+        dirty = true;
+        return index;
+    }
+
+    size_t Size() const {
+        return firsts.size();
+    }
+
+    // Draws every cached orbit with a single glMultiDrawArrays call
+    void Draw(Shader& shader, const glm::mat4& model) {
+        if (firsts.empty()) {
+            return;
+        }
+        if (dirty) {
+            upload();
+        }
+        glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
+        glBindVertexArray(VAO);
+        glMultiDrawArrays(GL_LINE_STRIP, &firsts[0], &counts[0], static_cast<GLsizei>(firsts.size()));
+        glBindVertexArray(0);
+    }
+
+private:
+    GLuint VAO, VBO;
+    bool dirty;
+    std::map<OrbitKey, size_t> orbits;
+    std::vector<glm::vec3> points;
+    std::vector<GLint> firsts;
+    std::vector<GLsizei> counts;
+
+    // Re-uploads the shared buffer; only happens when a new orbit was added since the last draw
+    void upload() {
+        if (VAO == 0) {
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+            glBindVertexArray(0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, points.size() * sizeof(glm::vec3), &points[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        dirty = false;
+    }
+};
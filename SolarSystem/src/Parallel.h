@@ -0,0 +1,11 @@
+#pragma once
+#include <cstddef>
+
+#include "JobSystem.h"
+
+// Calls fn(chunkBegin, chunkEnd) over [begin, end) on the shared work-stealing pool. Ranges smaller
+// than `grain` run inline on the calling thread.
+template <typename Fn>
+void ParallelFor(size_t begin, size_t end, size_t grain, Fn fn) {
+    JobSystem::Instance().ParallelFor(begin, end, grain, fn);
+}
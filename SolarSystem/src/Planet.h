@@ -1,10 +1,12 @@
 #pragma once
 #include "Shader.h"
 #include "Camera.h"
+#include "OrbitCache.h"
+#include "Simulation.h"
+#include "Kepler.h"
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <tuple>
 
 class Planet {
 	public:
@@ -12,105 +14,113 @@ class Planet {
 		float massratio = 3;
 		float totalMassRatio = massratio + 1.0f;
         glm::vec3 centerOfMass;
-		float eccentricity = 0.5;
+        // Combined mass of the suns in scene units (G = 1), chosen so the inner orbits keep the old pace
+        double starMass = 171.0;
 		int numPoints = 1000;
 		bool orbitLines = true;
         GLfloat scale = 0.1f;
-        bool move = true;
-        GLfloat speed = 0.1f;
-        std::vector<GLuint> orbitPathVAOs;
+        OrbitPathCache orbitPaths;
         glm::vec3 *lightPos;
+        size_t suns[2] = { 0, 1 };
+        // Frame of the last Kepler fit: the suns' center of mass and its velocity at that time
+        glm::dvec3 keplerCenter = glm::dvec3(0.0), keplerCenterVelocity = glm::dvec3(0.0);
+        double keplerEpoch = 0.0;
 
         Planet(glm::vec3 lightPositions[]) {
             lightPos = lightPositions;
             centerOfMass = (lightPositions[0] * massratio + lightPositions[1]) / totalMassRatio;
+            keplerCenter = glm::dvec3(centerOfMass);
         }
 
-        std::vector<glm::vec3> generateOrbitPathPoints(float semiMajorAxis, float semiMinorAxis) {
-            std::vector<glm::vec3> points;
-            for (int i = 0; i <= numPoints; ++i) {
-                float angle = 2.0f * glm::pi<float>() * static_cast<float>(i) / static_cast<float>(numPoints);
-                float x = semiMajorAxis * sin(angle);
-                float y = semiMinorAxis * cos(angle);
-                points.push_back(glm::vec3(x, 0.0f, y));
-            }
-            return points;
+        // Orbital elements use z as the pole; the scene's orbits lie in the xz plane with y up.
+        // Cyclic axis swap (x, y, z) -> (y, z, x), so prograde orbits keep their sense.
+        static glm::dmat3 sceneFrame() {
+            return glm::dmat3(glm::dvec3(0.0, 0.0, 1.0), glm::dvec3(1.0, 0.0, 0.0), glm::dvec3(0.0, 1.0, 0.0));
         }
 
-        std::tuple<glm::mat4, GLfloat, GLfloat> transformPlanetModel(Shader& shader, GLuint i, float a, float r, float s,
-            float rotationSpeed, glm::vec3 axis = glm::vec3(0.0f, 0.1f, 0.0f)) {
-            glm::mat4 model(1);
-            GLfloat angle, radius, x, y;
-            angle = a * i * speed;
-            radius = r * scale;
-
-            // Calculate the position of the planet in the reference frame of the center of mass using the elliptical orbit equation
-            float semiMinorAxis = radius;
-            float semiMajorAxis = radius * sqrt(1.0f - eccentricity * eccentricity);
-            x = semiMajorAxis * sin(glm::pi<float>() * 2 * angle / 360);
-            y = semiMinorAxis * cos(glm::pi<float>() * 2 * angle / 360);
-            glm::vec3 planetPosRelativeToCenterOfMass = glm::vec3(x, 0.0f, y);
-
-            // Transform the position of the planet back to the global reference frame
-            glm::vec3 planetPos = planetPosRelativeToCenterOfMass + centerOfMass;
-
-            // Use the position of the planet in the global reference frame to update the model matrix
-            model = glm::translate(model, planetPos);
+        // Adds the two suns as a circular binary around their center of mass
+        void addSuns(NBodySimulation &simulation, size_t sunIndices[2]) {
+            double masses[2] = { starMass * massratio / totalMassRatio, starMass / totalMassRatio };
+            double separation = glm::length(glm::dvec3(lightPos[0] - lightPos[1]));
+            double angularSpeed = sqrt(simulation.Solver().G * starMass / (separation * separation * separation));
+            for (int k = 0; k < 2; ++k) {
+                glm::dvec3 offset = glm::dvec3(lightPos[k] - centerOfMass);
+                glm::dvec3 velocity = glm::cross(glm::dvec3(0.0, angularSpeed, 0.0), offset);
+                sunIndices[k] = simulation.AddBody(glm::dvec3(lightPos[k]), velocity, masses[k]);
+                suns[k] = sunIndices[k];
+            }
+        }
 
-            model = glm::scale(model, glm::vec3(s * scale));
-            if (move) {
-                angle = 0.001f * i;
-                model = glm::rotate(model, angle * rotationSpeed, axis);
+        // Replaces `orbits` with a two-body fit of every body around the suns' center of mass. Each sun
+        // orbits the barycenter with mu = G m_other^3 / M^2, each planet with mu = G (M + m).
+        // Fails, leaving no orbits, when a body is unbound: orbit i must always be body i.
+        bool fitKeplerOrbits(NBodySimulation &simulation, KeplerOrbits &orbits) {
+            const BodySystem &b = simulation.bodies;
+            double G = simulation.Solver().G;
+            double m0 = b.mass[suns[0]], m1 = b.mass[suns[1]], total = m0 + m1;
+            keplerCenter = (b.Position(suns[0]) * m0 + b.Position(suns[1]) * m1) / total;
+            keplerCenterVelocity = (b.Velocity(suns[0]) * m0 + b.Velocity(suns[1]) * m1) / total;
+            keplerEpoch = simulation.time;
+
+            orbits.Clear();
+            for (size_t i = 0; i < b.Size(); ++i) {
+                double mu = G * (total + b.mass[i]);
+                if (i == suns[0] || i == suns[1]) {
+                    double other = i == suns[0] ? m1 : m0;
+                    mu = G * other * other * other / (total * total);
+                }
+                OrbitalElements elements = KeplerOrbits::ElementsFromState(b.Position(i) - keplerCenter,
+                    b.Velocity(i) - keplerCenterVelocity, mu, keplerEpoch);
+                if (orbits.Add(elements, mu) == KeplerOrbits::Invalid) {
+                    std::cout << "ERROR::KEPLER::UNBOUND_BODY " << i << std::endl;
+                    orbits.Clear();
+                    return false;
+                }
             }
+            return true;
+        }
 
-            glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-            createOrbitPathVAO(semiMajorAxis, semiMinorAxis);
-            return { model, x, y };
-        };
+        // Barycenter of the Kepler fit at time t
+        glm::dvec3 keplerCenterAt(double t) const {
+            return keplerCenter + keplerCenterVelocity * (t - keplerEpoch);
+        }
 
-        void transformSunModel(Shader &shader, GLuint i, float a, float offset, int lightIndex, float s, float rotationSpeed) {
-            float sunDistance = glm::length(*(lightPos + lightIndex) - centerOfMass);
-            GLfloat angle = a * i * speed;
+        // Writes the Kepler state at time t back into the N-body simulation
+        void applyKeplerOrbits(NBodySimulation &simulation, const KeplerOrbits &orbits, double t) {
+            glm::dvec3 center = keplerCenterAt(t);
+            for (size_t i = 0; i < orbits.Size() && i < simulation.bodies.Size(); ++i) {
+                glm::dvec3 position, velocity;
+                orbits.State(i, t, position, velocity);
+                simulation.bodies.SetPosition(i, center + position);
+                simulation.bodies.SetVelocity(i, keplerCenterVelocity + velocity);
+            }
+            simulation.time = t;
+            simulation.Invalidate();
+        }
 
-            // Calculate new positions for the suns
-            glm::vec3 sunOffset(sunDistance * cos(angle + offset), 0.0f, sunDistance * sin(angle + offset));
-            glm::vec3 sunPosition = centerOfMass + sunOffset;
+        // Adds a planet on a circular orbit of radius r * scale around the suns' center of mass
+        size_t addPlanet(NBodySimulation &simulation, float r, double mass) {
+            double radius = r * scale;
+            double orbitalSpeed = sqrt(simulation.Solver().G * starMass / radius);
+            glm::dvec3 position = glm::dvec3(centerOfMass) + glm::dvec3(0.0, 0.0, radius);
+            orbitPaths.Request(static_cast<float>(radius), static_cast<float>(radius), numPoints);
+            return simulation.AddBody(position, glm::dvec3(orbitalSpeed, 0.0, 0.0), mass);
+        }
 
+        // Places a sun at lightPos[lightIndex], which the renderer keeps relative to the camera
+        void transformSunModel(Shader &shader, float time, int lightIndex, float s, float rotationSpeed) {
             glm::mat4 model(1);
             model = glm::translate(model, *(lightPos + lightIndex));
             model = glm::scale(model, glm::vec3(s * scale));
-            angle = 0.001f * i * speed;
+            GLfloat angle = 0.006f * time;
             model = glm::rotate(model, angle * rotationSpeed, glm::vec3(0.0f, 0.1f, 0.0f));
             glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-            *(lightPos + lightIndex) = sunPosition;
         };
 
-        void createOrbitPathVAO(float semiMajorAxis, float semiMinorAxis) {
-            std::vector<glm::vec3> orbitPathPoints = generateOrbitPathPoints(semiMajorAxis, semiMinorAxis);
-
-            // Create a VAO and VBO for the orbit path points
-            GLuint orbitPathVAO, orbitPathVBO;
-            glGenVertexArrays(1, &orbitPathVAO);
-            glGenBuffers(1, &orbitPathVBO);
-            glBindVertexArray(orbitPathVAO);
-            glBindBuffer(GL_ARRAY_BUFFER, orbitPathVBO);
-            glBufferData(GL_ARRAY_BUFFER, orbitPathPoints.size() * sizeof(glm::vec3), &orbitPathPoints[0], GL_STATIC_DRAW);
-            glEnableVertexAttribArray(0);
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-            glBindVertexArray(0);
-
-            orbitPathVAOs.push_back(orbitPathVAO);
-        };
-
-        void DrawOrbitLines(Shader &shader) {
-            for (size_t i = 0; i < orbitPathVAOs.size(); ++i) {
-                glBindVertexArray(orbitPathVAOs[i]);
-                glm::mat4 orbitPathModel = glm::translate(glm::mat4(1), centerOfMass);
-                glUniformMatrix4fv(glGetUniformLocation(shader.Program, "model"), 1, GL_FALSE, glm::value_ptr(orbitPathModel));
-                if (orbitLines) {
-                    glDrawArrays(GL_LINE_STRIP, 0, numPoints + 1);
-                }
+        // origin: world position the scene is drawn relative to (the camera's)
+        void DrawOrbitLines(Shader &shader, const glm::dvec3 &origin = glm::dvec3(0.0)) {
+            if (orbitLines) {
+                orbitPaths.Draw(shader, glm::translate(glm::mat4(1), glm::vec3(glm::dvec3(centerOfMass) - origin)));
             }
-            glBindVertexArray(0);
         }
 };
@@ -0,0 +1,67 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Parallel.h"
+
+// Stable LSD radix sort of (key, value) pairs, 8 bits per pass. Each pass builds per-chunk digit
+// histograms and scatters in parallel; passes whose digit is identical for every key are skipped.
+inline void RadixSortPairs(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, int keyBits = 64) {
+    const size_t n = keys.size();
+    if (n < 2) {
+        return;
+    }
+    const size_t chunkSize = 1 << 14;
+    const size_t chunks = (n + chunkSize - 1) / chunkSize;
+    std::vector<uint64_t> keysOut(n);
+    std::vector<uint32_t> valuesOut(n);
+    std::vector<size_t> histograms(chunks * 256);
+
+    for (int shift = 0; shift < keyBits; shift += 8) {
+        std::fill(histograms.begin(), histograms.end(), 0);
+        ParallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c) {
+                size_t* histogram = &histograms[c * 256];
+                size_t end = std::min(n, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < end; ++i) {
+                    ++histogram[(keys[i] >> shift) & 0xFF];
+                }
+            }
+        });
+
+        // Exclusive prefix over (digit, chunk) turns counts into scatter offsets
+        size_t total = 0;
+        bool trivial = false;
+        for (size_t digit = 0; digit < 256; ++digit) {
+            size_t digitCount = 0;
+            for (size_t c = 0; c < chunks; ++c) {
+                size_t count = histograms[c * 256 + digit];
+                histograms[c * 256 + digit] = total + digitCount;
+                digitCount += count;
+            }
+            if (digitCount == n) {
+                trivial = true;
+            }
+            total += digitCount;
+        }
+        if (trivial) {
+            continue;
+        }
+
+        ParallelFor(0, chunks, 1, [&](size_t first, size_t last) {
+            for (size_t c = first; c < last; ++c) {
+                size_t* offsets = &histograms[c * 256];
+                size_t end = std::min(n, (c + 1) * chunkSize);
+                for (size_t i = c * chunkSize; i < end; ++i) {
+                    size_t slot = offsets[(keys[i] >> shift) & 0xFF]++;
+                    keysOut[slot] = keys[i];
+                    valuesOut[slot] = values[i];
+                }
+            }
+        });
+        keys.swap(keysOut);
+        values.swap(valuesOut);
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+#include <cmath>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "Model.h"
+#include "SceneGraph.h"
+#include "Parallel.h"
+
+// View frustum as six inward-facing planes (Gribb/Hartmann extraction from a clip matrix)
+struct Frustum {
+    glm::vec4 planes[6];
+
+    static Frustum FromMatrix(const glm::mat4& clip) {
+        Frustum frustum;
+        glm::vec4 rowX(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+        glm::vec4 rowY(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+        glm::vec4 rowZ(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+        glm::vec4 rowW(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+        frustum.planes[0] = rowW + rowX;
+        frustum.planes[1] = rowW - rowX;
+        frustum.planes[2] = rowW + rowY;
+        frustum.planes[3] = rowW - rowY;
+        frustum.planes[4] = rowW + rowZ;
+        frustum.planes[5] = rowW - rowZ;
+        for (int p = 0; p < 6; ++p) {
+            frustum.planes[p] /= glm::length(glm::vec3(frustum.planes[p]));
+        }
+        return frustum;
+    }
+
+    bool IntersectsSphere(const glm::vec3& center, float radius) const {
+        for (int p = 0; p < 6; ++p) {
+            if (glm::dot(glm::vec3(planes[p]), center) + planes[p].w < -radius) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// A model to draw at a scene graph node, and the results of this frame's preparation
+struct DrawItem {
+    SceneGraph::Handle node;
+    Model* model;
+    glm::mat4 transform;
+    bool visible;
+};
+
+// Per-frame draw list. Prepare computes every model matrix and frustum-culls the bounding spheres on
+// the job system; Draw then only uploads matrices and submits the visible items on the GL thread.
+class RenderQueue {
+public:
+    std::vector<DrawItem> items;
+
+    size_t Add(SceneGraph::Handle node, Model& model) {
+        DrawItem item = { node, &model, glm::mat4(1), true };
+        items.push_back(item);
+        return items.size() - 1;
+    }
+
+    // Reads the world transforms of an updated scene graph. Transforms are built relative to `origin`
+    // (the camera), which is subtracted before converting to float, so viewProjection should be the
+    // projection times a rotation-only view.
+    void Prepare(const SceneGraph& scene, const glm::dvec3& origin, const glm::mat4& viewProjection) {
+        Frustum frustum = Frustum::FromMatrix(viewProjection);
+        ParallelFor(0, items.size(), 8, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                DrawItem& item = items[i];
+                item.transform = scene.ModelMatrix(item.node, origin);
+                float radius = item.model->BoundingRadius() * scene.WorldScale(item.node);
+                item.visible = frustum.IntersectsSphere(glm::vec3(item.transform[3]), radius);
+            }
+        });
+    }
+
+    void Draw(Shader& shader) {
+        GLint location = glGetUniformLocation(shader.Program, "model");
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (!items[i].visible) {
+                continue;
+            }
+            glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(items[i].transform));
+            items[i].model->Draw(shader);
+        }
+    }
+
+    size_t Culled() const {
+        size_t culled = 0;
+        for (size_t i = 0; i < items.size(); ++i) {
+            culled += items[i].visible ? 0 : 1;
+        }
+        return culled;
+    }
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <cmath>
+#include <limits>
+
+// Root of f in [a, b], given fa = f(a) and fb = f(b) of opposite signs, to within `tolerance`. Brent's
+// method: inverse quadratic interpolation or secant steps while they converge, bisection otherwise,
+// so it never needs more evaluations than bisection by more than a small factor.
+template <typename Fn>
+double BrentRoot(const Fn& f, double a, double b, double fa, double fb, double tolerance, int maxIterations = 100) {
+    if (fa == 0.0) {
+        return a;
+    }
+    if (fb == 0.0) {
+        return b;
+    }
+    double c = a, fc = fa, d = b - a, e = d;
+    for (int iteration = 0; iteration < maxIterations; ++iteration) {
+        if ((fb > 0.0) == (fc > 0.0)) {
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+        if (std::fabs(fc) < std::fabs(fb)) {
+            a = b; b = c; c = a;
+            fa = fb; fb = fc; fc = fa;
+        }
+        double tol = 2.0 * std::numeric_limits<double>::epsilon() * std::fabs(b) + 0.5 * tolerance;
+        double m = 0.5 * (c - b);
+        if (std::fabs(m) <= tol || fb == 0.0) {
+            return b;
+        }
+        if (std::fabs(e) < tol || std::fabs(fa) <= std::fabs(fb)) {
+            d = e = m;
+        }
+        else {
+            double s = fb / fa, p, q;
+            if (a == c) {
+                p = 2.0 * m * s;
+                q = 1.0 - s;
+            }
+            else {
+                double r = fb / fc;
+                q = fa / fc;
+                p = s * (2.0 * m * q * (q - r) - (b - a) * (r - 1.0));
+                q = (q - 1.0) * (r - 1.0) * (s - 1.0);
+            }
+            if (p > 0.0) {
+                q = -q;
+            }
+            else {
+                p = -p;
+            }
+            if (2.0 * p < std::fmin(3.0 * m * q - std::fabs(tol * q), std::fabs(e * q))) {
+                e = d;
+                d = p / q;
+            }
+            else {
+                d = e = m;
+            }
+        }
+        a = b;
+        fa = fb;
+        b += std::fabs(d) > tol ? d : (m > 0.0 ? tol : -tol);
+        fb = f(b);
+    }
+    return b;
+}
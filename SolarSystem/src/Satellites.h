@@ -0,0 +1,207 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "Sgp4.h"
+#include "Bvh.h"
+
+// Earth satellites from two-line element sets, drawn around the Earth body. Every frame the SGP4 batch
+// propagator writes float positions straight into a mapped per-instance buffer, and one instanced call
+// draws a small box-and-panel mesh at each of them with the asteroid shader.
+class SatelliteSwarm {
+public:
+    Sgp4Orbits orbits;
+    std::vector<std::string> names;
+    bool visible;
+
+    SatelliteSwarm() : visible(false), meshVBO(0), positionVBO(0), shapeVBO(0), VAO(0), vertexCount(0), pickTime(0.0),
+        pickFrame(0.0), pickCenter(0.0), pickStale(true) {}
+
+    ~SatelliteSwarm() {
+        Release();
+    }
+
+    SatelliteSwarm(const SatelliteSwarm&) = delete;
+    SatelliteSwarm& operator=(const SatelliteSwarm&) = delete;
+
+    // Frees the GL objects; call it while the context is current, the destructor then finds nothing left to free
+    void Release() {
+        if (VAO != 0) {
+            glDeleteVertexArrays(1, &VAO);
+            VAO = 0;
+        }
+        GLuint buffers[3] = { meshVBO, positionVBO, shapeVBO };
+        for (int b = 0; b < 3; ++b) {
+            if (buffers[b] != 0) {
+                glDeleteBuffers(1, &buffers[b]);
+            }
+        }
+        meshVBO = positionVBO = shapeVBO = 0;
+    }
+
+    size_t Size() const {
+        return orbits.Size();
+    }
+
+    // Latest element epoch, a natural start date: SGP4 is most accurate near the epochs
+    double LatestEpoch() const {
+        double latest = 0.0;
+        for (size_t i = 0; i < Size(); ++i) {
+            latest = std::max(latest, orbits.Epoch(i));
+        }
+        return latest;
+    }
+
+    // Replaces the swarm; `size` is the drawn size of a satellite in scene units
+    void Load(const std::vector<TwoLineElements>& elements, float size) {
+        orbits.Clear();
+        orbits.Reserve(elements.size());
+        names.clear();
+        names.reserve(elements.size());
+        for (size_t i = 0; i < elements.size(); ++i) {
+            if (orbits.Add(elements[i]) != Sgp4Orbits::Invalid) {
+                names.push_back(elements[i].name);
+            }
+        }
+        upload(size);
+    }
+
+    // Propagates every satellite to Julian date jd; `frame` maps TEME km into the scene and `center`
+    // is Earth's camera-relative position
+    void Update(double jd, const glm::dmat3& frame, const glm::dvec3& center) {
+        if (!visible || Size() == 0) {
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        GLsizeiptr bytes = static_cast<GLsizeiptr>(Size() * 3 * sizeof(float));
+        void* mapped = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped == nullptr) {
+            std::cout << "ERROR::SATELLITES::MAP_FAILED" << std::endl;
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return;
+        }
+        orbits.Propagate(jd, static_cast<float*>(mapped), 3, frame, center);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Pick tree over the satellites, placed like Update. Low orbits lap Earth in a few seconds of a
+    // fast-forwarded scene, so like the belt's tree it is only brought up to date when queried.
+    const SphereBvh& PickTree(double jd, const glm::dmat3& frame, const glm::dvec3& center) {
+        if (pickStale || jd != pickTime || frame != pickFrame || center != pickCenter) {
+            orbits.Propagate(jd, pickTree.Positions(), 3, frame, center);
+            pickTree.Update();
+            pickTime = jd;
+            pickFrame = frame;
+            pickCenter = center;
+            pickStale = false;
+        }
+        return pickTree;
+    }
+
+    // One instanced draw; the shader expects view, projection and the lights
+    void Draw(Shader& shader, float time) {
+        if (!visible || Size() == 0) {
+            return;
+        }
+        glUniform1f(glGetUniformLocation(shader.Program, "time"), time);
+        glUniform3f(glGetUniformLocation(shader.Program, "albedo"), 0.8f, 0.8f, 0.85f);
+        glBindVertexArray(VAO);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, vertexCount, static_cast<GLsizei>(Size()));
+        glBindVertexArray(0);
+    }
+
+private:
+    struct MeshVertex {
+        glm::vec3 position;
+        glm::vec3 normal;
+    };
+
+    GLuint meshVBO, positionVBO, shapeVBO, VAO;
+    GLsizei vertexCount;
+    SphereBvh pickTree;
+    double pickTime;
+    glm::dmat3 pickFrame;
+    glm::dvec3 pickCenter;
+    bool pickStale;
+
+    // Axis-aligned box with flat normals: 12 triangles
+    static void appendBox(std::vector<MeshVertex>& out, const glm::vec3& center, const glm::vec3& half) {
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int side = -1; side <= 1; side += 2) {
+                glm::vec3 normal(0.0f);
+                normal[axis] = static_cast<float>(side);
+                glm::vec3 u(0.0f), v(0.0f);
+                u[(axis + 1) % 3] = half[(axis + 1) % 3];
+                v[(axis + 2) % 3] = half[(axis + 2) % 3];
+                if (side < 0) {
+                    std::swap(u, v);
+                }
+                glm::vec3 face = center + normal * half[axis];
+                glm::vec3 corners[4] = { face - u - v, face + u - v, face + u + v, face - u + v };
+                const int order[6] = { 0, 1, 2, 0, 2, 3 };
+                for (int k = 0; k < 6; ++k) {
+                    MeshVertex vertex = { corners[order[k]], normal };
+                    out.push_back(vertex);
+                }
+            }
+        }
+    }
+
+    void upload(float size) {
+        Release();
+        const size_t count = Size();
+        pickTree.Resize(0);
+        pickTree.Resize(count);
+        pickStale = true;
+        std::fill(pickTree.Radii(), pickTree.Radii() + count, 1.5f * size);    // the panels reach 1.5
+
+        // A bus with a solar panel on each side
+        std::vector<MeshVertex> mesh;
+        appendBox(mesh, glm::vec3(0.0f), glm::vec3(0.35f));
+        appendBox(mesh, glm::vec3(-0.95f, 0.0f, 0.0f), glm::vec3(0.55f, 0.3f, 0.03f));
+        appendBox(mesh, glm::vec3(0.95f, 0.0f, 0.0f), glm::vec3(0.55f, 0.3f, 0.03f));
+        vertexCount = static_cast<GLsizei>(mesh.size());
+        std::vector<glm::vec2> shapes(count);
+        for (size_t i = 0; i < count; ++i) {
+            shapes[i] = glm::vec2(size, static_cast<float>(i % 628) * 0.01f);
+        }
+
+        glGenBuffers(1, &meshVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glBufferData(GL_ARRAY_BUFFER, mesh.size() * sizeof(MeshVertex), &mesh[0], GL_STATIC_DRAW);
+        glGenBuffers(1, &positionVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glBufferData(GL_ARRAY_BUFFER, count * 3 * sizeof(float), nullptr, GL_STREAM_DRAW);
+        glGenBuffers(1, &shapeVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, shapeVBO);
+        glBufferData(GL_ARRAY_BUFFER, count * sizeof(glm::vec2), count > 0 ? &shapes[0] : nullptr, GL_STATIC_DRAW);
+
+        glGenVertexArrays(1, &VAO);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, meshVBO);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+        glVertexAttribDivisor(2, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, shapeVBO);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+        glVertexAttribDivisor(3, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Simulation.h"
+#include "BarnesHut.h"
+#include "FMM.h"
+
+// Plain-text scenario for batch runs. One directive per line, '#' starts a comment:
+//     G <value>                  gravitational constant (default 1)
+//     softening <value>          (default 0)
+//     integrator <name>          leapfrog, yoshida4, wisdom-holman, ias15 or block-leapfrog
+//     solver <name>              direct, barnes-hut or fmm (default direct)
+//     step <dt>                  fixed step; the output interval of the adaptive schemes
+//     end <time>                 time to run to
+//     output <interval>          trajectory frame interval, a multiple of the step (default: every step)
+//     body <name> <x> <y> <z> <vx> <vy> <vz> <mass> [radius]
+// Ensemble runs (solarsim-cli --ensemble) also read:
+//     perturb <body|all> <position|velocity|mass> <gaussian|uniform> <scale>
+//                                per axis for position and velocity (sigma or half width), relative for mass
+//     approach <body> <body> [threshold]     closest-approach statistics of the pair
+//     elements <body> <central>              final orbital element statistics around `central`
+struct ScenarioBody {
+    std::string name;
+    glm::dvec3 position;
+    glm::dvec3 velocity;
+    double mass;
+    double radius;
+};
+
+enum class PerturbedQuantity { Position, Velocity, Mass };
+
+struct ScenarioPerturbation {
+    static const size_t AllBodies = static_cast<size_t>(-1);
+    size_t body;
+    PerturbedQuantity quantity;
+    bool gaussian;
+    double scale;
+};
+
+struct ScenarioApproach {
+    size_t first, second;
+    double threshold;
+};
+
+struct ScenarioElements {
+    size_t body, central;
+};
+
+struct Scenario {
+    double G = 1.0;
+    double softening = 0.0;
+    std::string integrator;     // empty: the build's default
+    std::string solver = "direct";
+    double step = 1.0 / 60.0;
+    double endTime = 0.0;
+    double outputInterval = 0.0;
+    std::vector<ScenarioBody> bodies;
+    std::vector<ScenarioPerturbation> perturbations;
+    std::vector<ScenarioApproach> approaches;
+    std::vector<ScenarioElements> elements;
+
+    bool Load(const std::string& path) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            std::cout << "ERROR::SCENARIO::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+            return false;
+        }
+        // Ensemble directives may name bodies defined further down, so they are resolved at the end
+        std::vector<std::pair<int, std::vector<std::string>>> references;
+        std::string line;
+        for (int number = 1; std::getline(file, line); ++number) {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+            std::istringstream words(line);
+            std::string key;
+            if (!(words >> key)) {
+                continue;
+            }
+            bool ok = true;
+            if (key == "G") {
+                ok = static_cast<bool>(words >> G);
+            }
+            else if (key == "softening") {
+                ok = static_cast<bool>(words >> softening) && softening >= 0.0;
+            }
+            else if (key == "integrator") {
+                ok = static_cast<bool>(words >> integrator) && KnownIntegrator(integrator);
+            }
+            else if (key == "solver") {
+                ok = static_cast<bool>(words >> solver) && (solver == "direct" || solver == "barnes-hut" || solver == "fmm");
+            }
+            else if (key == "step") {
+                ok = static_cast<bool>(words >> step) && step > 0.0;
+            }
+            else if (key == "end") {
+                ok = static_cast<bool>(words >> endTime);
+            }
+            else if (key == "output") {
+                ok = static_cast<bool>(words >> outputInterval) && outputInterval >= 0.0;
+            }
+            else if (key == "body") {
+                ScenarioBody body;
+                body.radius = 0.0;
+                ok = static_cast<bool>(words >> body.name >> body.position.x >> body.position.y >> body.position.z
+                    >> body.velocity.x >> body.velocity.y >> body.velocity.z >> body.mass) && body.mass >= 0.0;
+                if (ok && !(words >> body.radius)) {
+                    body.radius = 0.0;
+                }
+                bodies.push_back(body);
+            }
+            else if (key == "perturb" || key == "approach" || key == "elements") {
+                std::vector<std::string> fields(1, key);
+                std::string field;
+                while (words >> field) {
+                    fields.push_back(field);
+                }
+                references.push_back(std::make_pair(number, fields));
+            }
+            else {
+                ok = false;
+            }
+            if (!ok) {
+                std::cout << "ERROR::SCENARIO::INVALID_LINE " << path << ":" << number << std::endl;
+                return false;
+            }
+        }
+        if (bodies.empty()) {
+            std::cout << "ERROR::SCENARIO::NO_BODIES " << path << std::endl;
+            return false;
+        }
+        for (size_t r = 0; r < references.size(); ++r) {
+            if (!parseEnsembleDirective(references[r].second)) {
+                std::cout << "ERROR::SCENARIO::INVALID_LINE " << path << ":" << references[r].first << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Index of the named body, or -1
+    long BodyIndex(const std::string& name) const {
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            if (bodies[i].name == name) {
+                return static_cast<long>(i);
+            }
+        }
+        return -1;
+    }
+
+    // Sets up the solver, integrator and bodies of a fresh simulation
+    void Build(NBodySimulation& simulation) const {
+        if (solver == "barnes-hut") {
+            simulation.SetSolver(std::unique_ptr<GravitySolver>(new BarnesHutSolver(G, softening)));
+        }
+        else if (solver == "fmm") {
+            simulation.SetSolver(std::unique_ptr<GravitySolver>(new FmmSolver(G, softening)));
+        }
+        else {
+            simulation.SetSolver(std::unique_ptr<GravitySolver>(new DirectSummationSolver(G, softening)));
+        }
+        simulation.SetIntegrator(integrator.empty() ? DefaultIntegratorKind() : IntegratorKindFromName(integrator));
+        for (size_t i = 0; i < bodies.size(); ++i) {
+            simulation.AddBody(bodies[i].position, bodies[i].velocity, bodies[i].mass, bodies[i].radius);
+        }
+    }
+
+    static bool KnownIntegrator(const std::string& name) {
+        for (int k = 0; k < IntegratorKindCount; ++k) {
+            if (name == MakeIntegrator(static_cast<IntegratorKind>(k))->Name()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    bool parseEnsembleDirective(const std::vector<std::string>& fields) {
+        const std::string& key = fields[0];
+        if (key == "perturb" && fields.size() == 5) {
+            ScenarioPerturbation perturbation;
+            long body = fields[1] == "all" ? 0 : BodyIndex(fields[1]);
+            perturbation.body = fields[1] == "all" ? static_cast<size_t>(ScenarioPerturbation::AllBodies) : static_cast<size_t>(body);
+            if (fields[2] == "position") {
+                perturbation.quantity = PerturbedQuantity::Position;
+            }
+            else if (fields[2] == "velocity") {
+                perturbation.quantity = PerturbedQuantity::Velocity;
+            }
+            else if (fields[2] == "mass") {
+                perturbation.quantity = PerturbedQuantity::Mass;
+            }
+            else {
+                return false;
+            }
+            perturbation.gaussian = fields[3] == "gaussian";
+            bool ok = parseNumber(fields[4], perturbation.scale) && perturbation.scale >= 0.0;
+            if (body < 0 || !ok || (!perturbation.gaussian && fields[3] != "uniform")) {
+                return false;
+            }
+            perturbations.push_back(perturbation);
+            return true;
+        }
+        if (key == "approach" && (fields.size() == 3 || fields.size() == 4)) {
+            long first = BodyIndex(fields[1]), second = BodyIndex(fields[2]);
+            ScenarioApproach approach;
+            approach.threshold = 0.0;
+            if (first < 0 || second < 0 || first == second ||
+                (fields.size() == 4 && !parseNumber(fields[3], approach.threshold))) {
+                return false;
+            }
+            approach.first = static_cast<size_t>(first);
+            approach.second = static_cast<size_t>(second);
+            approaches.push_back(approach);
+            return true;
+        }
+        if (key == "elements" && fields.size() == 3) {
+            long body = BodyIndex(fields[1]), central = BodyIndex(fields[2]);
+            if (body < 0 || central < 0 || body == central) {
+                return false;
+            }
+            ScenarioElements tracked = { static_cast<size_t>(body), static_cast<size_t>(central) };
+            elements.push_back(tracked);
+            return true;
+        }
+        return false;
+    }
+
+    static bool parseNumber(const std::string& text, double& value) {
+        std::istringstream stream(text);
+        return static_cast<bool>(stream >> value);
+    }
+};
@@ -0,0 +1,254 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Parallel.h"
+
+// Transform hierarchy for everything attached to a body: a planet's spin and tilt, its moons, rings or
+// spacecraft. Nodes are kept in flat arrays sorted breadth first, so a parent always precedes its
+// children and every depth is a contiguous range that can be updated in parallel. World transforms
+// are only recomputed where the local transform or an ancestor changed since the last Update.
+// Translations stay in double (world units) for the floating origin; rotation and scale are float.
+class SceneGraph {
+public:
+    typedef uint32_t Handle;
+    static const Handle None = 0xffffffffu;
+
+    SceneGraph() : structureDirty(false), animatedTime(std::numeric_limits<double>::quiet_NaN()) {}
+
+    // Handles stay valid when the arrays are re-sorted
+    Handle AddNode(Handle parent = None, const glm::dvec3& translation = glm::dvec3(0.0),
+        const glm::mat4& linear = glm::mat4(1)) {
+        Handle handle = static_cast<Handle>(slotOf.size());
+        uint32_t slot = static_cast<uint32_t>(handleAt.size());
+        slotOf.push_back(slot);
+        handleAt.push_back(handle);
+        parentSlot.push_back(parent == None ? static_cast<uint32_t>(None) : slotOf[parent]);
+        localTranslation.push_back(translation);
+        localLinear.push_back(linear);
+        worldPosition.push_back(translation);
+        worldLinear.push_back(linear);
+        dirty.push_back(1);
+        changed.push_back(0);
+        structureDirty = true;
+        return handle;
+    }
+
+    size_t Size() const {
+        return handleAt.size();
+    }
+
+    // Setters only mark the node dirty when the value actually changes
+    void SetTranslation(Handle node, const glm::dvec3& translation) {
+        uint32_t slot = slotOf[node];
+        if (localTranslation[slot] != translation) {
+            localTranslation[slot] = translation;
+            dirty[slot] = 1;
+        }
+    }
+
+    void SetLinear(Handle node, const glm::mat4& linear) {
+        uint32_t slot = slotOf[node];
+        if (localLinear[slot] != linear) {
+            localLinear[slot] = linear;
+            dirty[slot] = 1;
+        }
+    }
+
+    // Circular orbit around the parent in the plane's xz plane, driven by Animate
+    void SetOrbit(Handle node, double radius, double period, double phase, const glm::dmat3& plane = glm::dmat3(1.0)) {
+        Motion motion = newMotion(node);
+        motion.orbitRadius = radius;
+        motion.orbitRate = period != 0.0 ? 2.0 * 3.14159265358979323846 / period : 0.0;
+        motion.orbitPhase = phase;
+        motion.orbitPlane = plane;
+        motions.push_back(motion);
+    }
+
+    // Linear part base * rotate(rate * time, axis), driven by Animate
+    void SetSpin(Handle node, float rate, const glm::vec3& axis, const glm::mat4& base = glm::mat4(1)) {
+        Motion motion = newMotion(node);
+        motion.spinRate = rate;
+        motion.spinAxis = axis;
+        motion.spinBase = base;
+        motions.push_back(motion);
+    }
+
+    // Moves every orbiting and spinning node to `time`; nothing is touched if time did not change
+    void Animate(double time) {
+        if (time == animatedTime) {
+            return;
+        }
+        animatedTime = time;
+        for (size_t m = 0; m < motions.size(); ++m) {
+            const Motion& motion = motions[m];
+            if (motion.orbitRadius > 0.0) {
+                double angle = motion.orbitPhase + motion.orbitRate * time;
+                SetTranslation(motion.node, motion.orbitPlane *
+                    glm::dvec3(motion.orbitRadius * std::cos(angle), 0.0, motion.orbitRadius * std::sin(angle)));
+            }
+            if (motion.spinRate != 0.0f) {
+                SetLinear(motion.node, glm::rotate(motion.spinBase, static_cast<float>(motion.spinRate * time), motion.spinAxis));
+            }
+        }
+    }
+
+    // Recomputes the world transforms of dirty nodes and their descendants, one depth at a time;
+    // returns how many were recomputed
+    size_t Update() {
+        if (structureDirty) {
+            sortBreadthFirst();
+        }
+        for (size_t level = 0; level + 1 < levelStart.size(); ++level) {
+            ParallelFor(levelStart[level], levelStart[level + 1], 256, [&](size_t begin, size_t end) {
+                for (size_t slot = begin; slot < end; ++slot) {
+                    uint32_t parent = parentSlot[slot];
+                    bool update = dirty[slot] || (parent != None && changed[parent]);
+                    changed[slot] = update ? 1 : 0;
+                    dirty[slot] = 0;
+                    if (!update) {
+                        continue;
+                    }
+                    if (parent == None) {
+                        worldPosition[slot] = localTranslation[slot];
+                        worldLinear[slot] = localLinear[slot];
+                    }
+                    else {
+                        glm::dmat3 parentLinear(glm::mat3(worldLinear[parent]));
+                        worldPosition[slot] = worldPosition[parent] + parentLinear * localTranslation[slot];
+                        worldLinear[slot] = worldLinear[parent] * localLinear[slot];
+                    }
+                }
+            });
+        }
+        size_t updated = 0;
+        for (size_t slot = 0; slot < changed.size(); ++slot) {
+            updated += changed[slot];
+        }
+        return updated;
+    }
+
+    glm::dvec3 WorldPosition(Handle node) const {
+        return worldPosition[slotOf[node]];
+    }
+
+    glm::mat4 WorldLinear(Handle node) const {
+        return worldLinear[slotOf[node]];
+    }
+
+    // Model matrix relative to `origin` (the camera), subtracted in double before converting to float
+    glm::mat4 ModelMatrix(Handle node, const glm::dvec3& origin) const {
+        uint32_t slot = slotOf[node];
+        glm::mat4 model = worldLinear[slot];
+        model[3] = glm::vec4(glm::vec3(worldPosition[slot] - origin), 1.0f);
+        return model;
+    }
+
+    // Largest axis scale of the world transform, for bounding spheres
+    float WorldScale(Handle node) const {
+        const glm::mat4& linear = worldLinear[slotOf[node]];
+        return std::max(glm::length(glm::vec3(linear[0])), std::max(glm::length(glm::vec3(linear[1])),
+            glm::length(glm::vec3(linear[2]))));
+    }
+
+    // Number of depths, root level included
+    size_t Depth() const {
+        return levelStart.empty() ? 0 : levelStart.size() - 1;
+    }
+
+private:
+    struct Motion {
+        Handle node;
+        double orbitRadius, orbitRate, orbitPhase;
+        glm::dmat3 orbitPlane;
+        float spinRate;
+        glm::vec3 spinAxis;
+        glm::mat4 spinBase;
+    };
+
+    std::vector<uint32_t> slotOf;   // by handle
+    // By slot, in breadth-first order once sorted
+    std::vector<Handle> handleAt;
+    std::vector<uint32_t> parentSlot;
+    std::vector<glm::dvec3> localTranslation, worldPosition;
+    std::vector<glm::mat4> localLinear, worldLinear;
+    std::vector<char> dirty, changed;
+    std::vector<size_t> levelStart;     // first slot of each depth, plus the end
+    bool structureDirty;
+    std::vector<Motion> motions;
+    double animatedTime;
+
+    Motion newMotion(Handle node) {
+        Motion motion;
+        motion.node = node;
+        motion.orbitRadius = motion.orbitRate = motion.orbitPhase = 0.0;
+        motion.orbitPlane = glm::dmat3(1.0);
+        motion.spinRate = 0.0f;
+        motion.spinAxis = glm::vec3(0.0f, 1.0f, 0.0f);
+        motion.spinBase = glm::mat4(1);
+        animatedTime = std::numeric_limits<double>::quiet_NaN();
+        return motion;
+    }
+
+    // Re-sorts every per-node array breadth first and rebuilds the depth ranges; all nodes become dirty
+    void sortBreadthFirst() {
+        const size_t n = handleAt.size();
+        std::vector<std::vector<uint32_t>> children(n);
+        std::vector<uint32_t> order;
+        order.reserve(n);
+        for (uint32_t slot = 0; slot < n; ++slot) {
+            if (parentSlot[slot] == None) {
+                order.push_back(slot);
+            }
+            else {
+                children[parentSlot[slot]].push_back(slot);
+            }
+        }
+        levelStart.assign(1, 0);
+        for (size_t begin = 0; begin < order.size();) {
+            size_t end = order.size();
+            levelStart.push_back(end);
+            for (size_t k = begin; k < end; ++k) {
+                order.insert(order.end(), children[order[k]].begin(), children[order[k]].end());
+            }
+            begin = end;
+        }
+
+        std::vector<uint32_t> newSlot(n);
+        for (uint32_t k = 0; k < n; ++k) {
+            newSlot[order[k]] = k;
+        }
+        permute(handleAt, order);
+        permute(localTranslation, order);
+        permute(worldPosition, order);
+        permute(localLinear, order);
+        permute(worldLinear, order);
+        std::vector<uint32_t> parents(n);
+        for (uint32_t k = 0; k < n; ++k) {
+            uint32_t parent = parentSlot[order[k]];
+            parents[k] = parent == None ? static_cast<uint32_t>(None) : newSlot[parent];
+        }
+        parentSlot.swap(parents);
+        for (uint32_t k = 0; k < n; ++k) {
+            slotOf[handleAt[k]] = k;
+        }
+        dirty.assign(n, 1);
+        changed.assign(n, 0);
+        structureDirty = false;
+    }
+
+    template <typename T>
+    static void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+        std::vector<T> sorted(values.size());
+        for (size_t k = 0; k < order.size(); ++k) {
+            sorted[k] = values[order[k]];
+        }
+        values.swap(sorted);
+    }
+};
@@ -0,0 +1,640 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Parallel.h"
+#include "SimdMath.h"
+
+// Mean elements of one satellite as published in a two-line element set. Angles are in radians, the
+// mean motion in radians per minute (Kozai mean motion, as in the TLE) and the epoch a Julian date (UTC).
+struct TwoLineElements {
+    std::string name;
+    uint32_t catalogNumber = 0;
+    double epoch = 0.0;
+    double bstar = 0.0;                 // drag term, 1 / Earth radii
+    double inclination = 0.0;
+    double ascendingNode = 0.0;
+    double eccentricity = 0.0;
+    double argumentOfPerigee = 0.0;
+    double meanAnomaly = 0.0;
+    double meanMotion = 0.0;
+};
+
+// Reads TLE and 3LE files (an optional name line before each pair of element lines, as CelesTrak and
+// Space-Track publish them). Element lines with a wrong checksum or unreadable fields are skipped and
+// counted.
+class TleReader {
+public:
+    static bool Load(const std::string& path, std::vector<TwoLineElements>& out, size_t* rejected = nullptr) {
+        std::ifstream file(path.c_str());
+        if (!file) {
+            std::cout << "ERROR::TLE::FILE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        out.clear();
+        size_t bad = 0;
+        std::string line, name, first;
+        while (std::getline(file, line)) {
+            while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) {
+                line.pop_back();
+            }
+            if (line.size() >= 2 && line[0] == '1' && line[1] == ' ') {
+                first = line;
+            }
+            else if (line.size() >= 2 && line[0] == '2' && line[1] == ' ' && !first.empty()) {
+                TwoLineElements elements;
+                if (Parse(first, line, elements)) {
+                    elements.name = name.empty() ? std::to_string(elements.catalogNumber) : name;
+                    out.push_back(elements);
+                }
+                else {
+                    ++bad;
+                }
+                first.clear();
+                name.clear();
+            }
+            else if (!line.empty()) {
+                // A name line; 3LE files prefix it with "0 "
+                name = line.compare(0, 2, "0 ") == 0 ? line.substr(2) : line;
+                first.clear();
+            }
+        }
+        if (rejected != nullptr) {
+            *rejected = bad;
+        }
+        return true;
+    }
+
+    static bool Parse(const std::string& line1, const std::string& line2, TwoLineElements& out) {
+        if (line1.size() < 64 || line2.size() < 63 || !checksumValid(line1) || !checksumValid(line2)) {
+            return false;
+        }
+        const double degrees = 3.14159265358979323846 / 180.0;
+        bool ok = true;
+        out.catalogNumber = catalogNumber(line1.substr(2, 5), ok);
+        int year = static_cast<int>(number(line1, 18, 2, ok));
+        double day = number(line1, 20, 12, ok);
+        out.bstar = impliedDecimal(line1.substr(53, 8), ok);
+        out.inclination = number(line2, 8, 8, ok) * degrees;
+        out.ascendingNode = number(line2, 17, 8, ok) * degrees;
+        out.eccentricity = number("." + line2.substr(26, 7), 0, 8, ok);
+        out.argumentOfPerigee = number(line2, 34, 8, ok) * degrees;
+        out.meanAnomaly = number(line2, 43, 8, ok) * degrees;
+        out.meanMotion = number(line2, 52, 11, ok) * 2.0 * 3.14159265358979323846 / 1440.0;
+        // Two-digit years 57-99 are 1957-1999
+        year += year < 57 ? 2000 : 1900;
+        out.epoch = 367.0 * year - std::floor(7.0 * year / 4.0) + 30.0 + 1721013.5 + day;
+        return ok && out.meanMotion > 0.0;
+    }
+
+private:
+    // The last digit is the sum of the digits, counting '-' as 1, modulo 10
+    static bool checksumValid(const std::string& line) {
+        if (line.size() < 69 || line[68] < '0' || line[68] > '9') {
+            return true;
+        }
+        int sum = 0;
+        for (size_t c = 0; c < 68; ++c) {
+            sum += line[c] >= '0' && line[c] <= '9' ? line[c] - '0' : line[c] == '-' ? 1 : 0;
+        }
+        return sum % 10 == line[68] - '0';
+    }
+
+    static double number(const std::string& line, size_t start, size_t length, bool& ok) {
+        std::string field = line.substr(start, length);
+        char* end = nullptr;
+        double value = std::strtod(field.c_str(), &end);
+        while (end != nullptr && *end == ' ') {
+            ++end;
+        }
+        if (end == field.c_str() || (end != nullptr && *end != '\0')) {
+            ok = false;
+        }
+        return value;
+    }
+
+    // " 28098-4" is 0.28098e-4
+    static double impliedDecimal(const std::string& field, bool& ok) {
+        std::string mantissa = field.substr(0, 6), exponent = field.substr(6, 2);
+        size_t digits = mantissa.find_first_of("0123456789");
+        if (digits == std::string::npos) {
+            return 0.0;
+        }
+        bool negative = mantissa.find('-') != std::string::npos;
+        double value = number("." + mantissa.substr(digits), 0, 7 - digits, ok);
+        return (negative ? -value : value) * std::pow(10.0, number(exponent, 0, 2, ok));
+    }
+
+    // Five digits, or Alpha-5: a letter (I and O skipped) for the ten-thousands from 10 up
+    static uint32_t catalogNumber(const std::string& field, bool& ok) {
+        char lead = field[0];
+        if (lead >= 'A' && lead <= 'Z') {
+            int value = lead - 'A' + 10 - (lead > 'I' ? 1 : 0) - (lead > 'O' ? 1 : 0);
+            return static_cast<uint32_t>(value * 10000 + number(field, 1, 4, ok));
+        }
+        return static_cast<uint32_t>(number(field, 0, 5, ok));
+    }
+};
+
+// `count` element sets at `epoch` shaped like today's catalog: broadband shells of several thousand
+// satellites at 550 km, polar shells at 1200 km, sun-synchronous orbits, navigation satellites in
+// medium orbits and a geostationary ring
+inline std::vector<TwoLineElements> GenerateConstellation(size_t count, double epoch, unsigned seed = 11) {
+    const double pi = 3.14159265358979323846, degrees = pi / 180.0;
+    const double earthRadius = 6378.135, mu = 398600.8;
+    std::mt19937_64 rng(seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::vector<TwoLineElements> out(count);
+    for (size_t i = 0; i < count; ++i) {
+        TwoLineElements& elements = out[i];
+        double pick = unit(rng), altitude, eccentricity = 0.0001 + 0.0015 * unit(rng);
+        elements.bstar = 1e-5 + 2e-4 * unit(rng);
+        if (pick < 0.55) {
+            altitude = 550.0;
+            elements.inclination = 53.0 * degrees;
+            elements.ascendingNode = 2.0 * pi * (i % 72) / 72.0;
+        }
+        else if (pick < 0.7) {
+            altitude = 1200.0;
+            elements.inclination = 87.9 * degrees;
+            elements.ascendingNode = 2.0 * pi * (i % 18) / 18.0;
+        }
+        else if (pick < 0.85) {
+            altitude = 500.0 + 300.0 * unit(rng);
+            elements.inclination = (97.4 + 1.2 * unit(rng)) * degrees;
+            elements.ascendingNode = 2.0 * pi * unit(rng);
+        }
+        else if (pick < 0.93) {
+            altitude = 20200.0;
+            eccentricity = 0.01 * unit(rng);
+            elements.inclination = 55.0 * degrees;
+            elements.ascendingNode = 2.0 * pi * (i % 6) / 6.0;
+            elements.bstar = 0.0;
+        }
+        else {
+            altitude = 35786.0;
+            eccentricity = 0.0003 * unit(rng);
+            elements.inclination = 0.1 * degrees * unit(rng);
+            elements.ascendingNode = 2.0 * pi * unit(rng);
+            elements.bstar = 0.0;
+        }
+        double a = earthRadius + altitude;
+        elements.name = "SYN-" + std::to_string(i + 1);
+        elements.catalogNumber = static_cast<uint32_t>(90000 + i);
+        elements.epoch = epoch;
+        elements.eccentricity = eccentricity;
+        elements.argumentOfPerigee = 2.0 * pi * unit(rng);
+        elements.meanAnomaly = 2.0 * pi * unit(rng);
+        elements.meanMotion = std::sqrt(mu / (a * a * a)) * 60.0;
+    }
+    return out;
+}
+
+// SGP4 propagation of satellites around Earth (Hoots and Roehrich, in the revised form of Vallado et
+// al. 2006, with WGS-72 constants), giving positions in the TEME frame in km. The per-satellite
+// initialization is done once in Add and stored as columns, so a batch at one date is a fixed
+// sequence of arithmetic over lanes of four satellites; the simplified drag model of low-perigee orbits
+// is the full model with its higher-order coefficients set to zero, so lanes never branch apart.
+// Deep-space orbits (periods of 225 minutes and more) run the same simplified model without SDP4's
+// lunar-solar and resonance terms, which move them by kilometres over days, and are flagged.
+class Sgp4Orbits {
+public:
+    static const size_t Invalid = static_cast<size_t>(-1);
+    static constexpr double EarthRadius = 6378.135;     // km
+    static constexpr double Mu = 398600.8;              // km^3 / s^2
+
+    size_t Size() const {
+        return epoch.size();
+    }
+
+    size_t DeepSpaceCount() const {
+        return deepSpaceCount;
+    }
+
+    bool DeepSpace(size_t i) const {
+        return deepSpace[i] != 0;
+    }
+
+    double Epoch(size_t i) const {
+        return epoch[i];
+    }
+
+    void Clear() {
+        std::vector<std::vector<double>*> all = columns();
+        for (size_t c = 0; c < all.size(); ++c) {
+            all[c]->clear();
+        }
+        deepSpace.clear();
+        deepSpaceCount = 0;
+    }
+
+    void Reserve(size_t n) {
+        std::vector<std::vector<double>*> all = columns();
+        for (size_t c = 0; c < all.size(); ++c) {
+            all[c]->reserve(n);
+        }
+        deepSpace.reserve(n);
+    }
+
+    size_t Add(const TwoLineElements& elements) {
+        const double e = elements.eccentricity, n = elements.meanMotion;
+        if (!(e >= 0.0 && e < 1.0) || !(n > 0.0)) {
+            std::cout << "ERROR::SGP4::INVALID_ELEMENTS " << elements.name << " e=" << e << " n=" << n << std::endl;
+            return Invalid;
+        }
+        const double twoThirds = 2.0 / 3.0;
+        const double cosio = std::cos(elements.inclination), sinio = std::sin(elements.inclination);
+        const double cosio2 = cosio * cosio;
+        const double omeosq = 1.0 - e * e, rteosq = std::sqrt(omeosq);
+
+        // Brouwer mean motion and semi-major axis from the Kozai mean motion of the TLE
+        double ak = std::pow(Xke / n, twoThirds);
+        double d1 = 0.75 * J2 * (3.0 * cosio2 - 1.0) / (rteosq * omeosq);
+        double del = d1 / (ak * ak);
+        double adel = ak * (1.0 - del * del - del * (1.0 / 3.0 + 134.0 * del * del / 81.0));
+        del = d1 / (adel * adel);
+        const double no = n / (1.0 + del);
+        const double ao = std::pow(Xke / no, twoThirds);
+        const double po = ao * omeosq, posq = po * po;
+        const double rp = ao * (1.0 - e);
+        const double con42 = 1.0 - 5.0 * cosio2, con41 = 3.0 * cosio2 - 1.0;
+
+        // Atmospheric density parameters, lowered for perigees under 156 km
+        bool simple = rp < 220.0 / EarthRadius + 1.0;
+        double sfour = 78.0 / EarthRadius + 1.0;
+        double qzms24 = std::pow((120.0 - 78.0) / EarthRadius, 4.0);
+        double perigee = (rp - 1.0) * EarthRadius;
+        if (perigee < 156.0) {
+            sfour = perigee < 98.0 ? 20.0 : perigee - 78.0;
+            qzms24 = std::pow((120.0 - sfour) / EarthRadius, 4.0);
+            sfour = sfour / EarthRadius + 1.0;
+        }
+        const double pinvsq = 1.0 / posq;
+        const double tsi = 1.0 / (ao - sfour);
+        const double eta = ao * e * tsi, etasq = eta * eta, eeta = e * eta;
+        const double psisq = std::fabs(1.0 - etasq);
+        const double coef = qzms24 * std::pow(tsi, 4.0);
+        const double coef1 = coef / std::pow(psisq, 3.5);
+        const double cc2 = coef1 * no * (ao * (1.0 + 1.5 * etasq + eeta * (4.0 + etasq)) +
+            0.375 * J2 * tsi / psisq * con41 * (8.0 + 3.0 * etasq * (8.0 + etasq)));
+        const double bstar = elements.bstar;
+        const double c1 = bstar * cc2;
+        const double cc3 = e > 1e-4 ? -2.0 * coef * tsi * J3oJ2 * no * sinio / e : 0.0;
+        const double x1mth2 = 1.0 - cosio2;
+        const double c4 = 2.0 * no * coef1 * ao * omeosq * (eta * (2.0 + 0.5 * etasq) + e * (0.5 + 2.0 * etasq) -
+            J2 * tsi / (ao * psisq) * (-3.0 * con41 * (1.0 - 2.0 * eeta + etasq * (1.5 - 0.5 * eeta)) +
+            0.75 * x1mth2 * (2.0 * etasq - eeta * (1.0 + etasq)) * std::cos(2.0 * elements.argumentOfPerigee)));
+        const double c5 = 2.0 * coef1 * ao * omeosq * (1.0 + 2.75 * (etasq + eeta) + eeta * etasq);
+        const double cosio4 = cosio2 * cosio2;
+        const double temp1 = 1.5 * J2 * pinvsq * no;
+        const double temp2 = 0.5 * temp1 * J2 * pinvsq;
+        const double temp3 = -0.46875 * J4 * pinvsq * pinvsq * no;
+        const double xhdot1 = -temp1 * cosio;
+
+        // Deep-space orbits always use the simplified drag model
+        const bool deep = 2.0 * 3.14159265358979323846 / no >= 225.0;
+        simple = simple || deep;
+
+        epoch.push_back(elements.epoch);
+        meanMotion.push_back(no);
+        eccentricity.push_back(e);
+        inclination.push_back(elements.inclination);
+        node.push_back(elements.ascendingNode);
+        argument.push_back(elements.argumentOfPerigee);
+        anomaly.push_back(elements.meanAnomaly);
+        drag.push_back(bstar);
+        axis.push_back(ao);
+        cc1.push_back(c1);
+        cc4.push_back(c4);
+        cc5.push_back(simple ? 0.0 : c5);
+        etaColumn.push_back(eta);
+        mdot.push_back(no + 0.5 * temp1 * rteosq * con41 + 0.0625 * temp2 * rteosq * (13.0 - 78.0 * cosio2 + 137.0 * cosio4));
+        argpdot.push_back(-0.5 * temp1 * con42 + 0.0625 * temp2 * (7.0 - 114.0 * cosio2 + 395.0 * cosio4) +
+            temp3 * (3.0 - 36.0 * cosio2 + 49.0 * cosio4));
+        nodedot.push_back(xhdot1 + (0.5 * temp2 * (4.0 - 19.0 * cosio2) + 2.0 * temp3 * (3.0 - 7.0 * cosio2)) * cosio);
+        nodecf.push_back(3.5 * omeosq * xhdot1 * c1);
+        t2cof.push_back(1.5 * c1);
+        omgcof.push_back(simple ? 0.0 : bstar * cc3 * std::cos(elements.argumentOfPerigee));
+        xmcof.push_back(simple || e <= 1e-4 ? 0.0 : -twoThirds * coef * bstar / eeta);
+        delmo.push_back(std::pow(1.0 + eta * std::cos(elements.meanAnomaly), 3.0));
+        sinmao.push_back(std::sin(elements.meanAnomaly));
+        double cosPlusOne = std::fabs(cosio + 1.0) > 1.5e-12 ? 1.0 + cosio : 1.5e-12;
+        xlcof.push_back(-0.25 * J3oJ2 * sinio * (3.0 + 5.0 * cosio) / cosPlusOne);
+        aycof.push_back(-0.5 * J3oJ2 * sinio);
+        con41Column.push_back(con41);
+        x1mth2Column.push_back(x1mth2);
+        x7thm1.push_back(7.0 * cosio2 - 1.0);
+        cosInclination.push_back(cosio);
+        sinInclination.push_back(sinio);
+        double d2 = 0.0, d3 = 0.0, d4 = 0.0, t3 = 0.0, t4 = 0.0, t5 = 0.0;
+        if (!simple) {
+            double c1sq = c1 * c1;
+            d2 = 4.0 * ao * tsi * c1sq;
+            double temp = d2 * tsi * c1 / 3.0;
+            d3 = (17.0 * ao + sfour) * temp;
+            d4 = 0.5 * temp * ao * tsi * (221.0 * ao + 31.0 * sfour) * c1;
+            t3 = d2 + 2.0 * c1sq;
+            t4 = 0.25 * (3.0 * d3 + c1 * (12.0 * d2 + 10.0 * c1sq));
+            t5 = 0.2 * (3.0 * d4 + 12.0 * c1 * d3 + 6.0 * d2 * d2 + 15.0 * c1sq * (2.0 * d2 + c1sq));
+        }
+        d2Column.push_back(d2);
+        d3Column.push_back(d3);
+        d4Column.push_back(d4);
+        t3cof.push_back(t3);
+        t4cof.push_back(t4);
+        t5cof.push_back(t5);
+        deepSpace.push_back(deep ? 1 : 0);
+        deepSpaceCount += deep ? 1 : 0;
+        return Size() - 1;
+    }
+
+    // Position and velocity (km, km/s, TEME) of one satellite at Julian date jd. False when the orbit has
+    // decayed or the model broke down; the state is then zero.
+    bool State(size_t i, double jd, glm::dvec3& position, glm::dvec3& velocity) const {
+        const double t = (jd - epoch[i]) * 1440.0;
+        const double xmdf = anomaly[i] + mdot[i] * t;
+        const double argpdm = argument[i] + argpdot[i] * t;
+        const double t2 = t * t, t3 = t2 * t, t4 = t3 * t;
+        double nodem = node[i] + nodedot[i] * t + nodecf[i] * t2;
+        double delm = xmcof[i] * (std::pow(1.0 + etaColumn[i] * std::cos(xmdf), 3.0) - delmo[i]);
+        double temp = omgcof[i] * t + delm;
+        double mm = xmdf + temp;
+        double argpm = argpdm - temp;
+        double tempa = 1.0 - cc1[i] * t - d2Column[i] * t2 - d3Column[i] * t3 - d4Column[i] * t4;
+        double tempe = drag[i] * cc4[i] * t + drag[i] * cc5[i] * (std::sin(mm) - sinmao[i]);
+        double templ = t2cof[i] * t2 + t3cof[i] * t3 + t4 * (t4cof[i] + t * t5cof[i]);
+
+        position = velocity = glm::dvec3(0.0);
+        const double am = axis[i] * tempa * tempa;
+        const double nm = Xke / std::pow(am, 1.5);
+        double em = eccentricity[i] - tempe;
+        if (em >= 1.0 || em < -0.001) {
+            return false;
+        }
+        em = std::max(em, 1e-6);
+        mm += meanMotion[i] * templ;
+        const double twoPi = 2.0 * 3.14159265358979323846;
+        double xlm = std::fmod(mm + argpm + nodem, twoPi);
+        nodem = std::fmod(nodem, twoPi);
+        argpm = std::fmod(argpm, twoPi);
+        mm = std::fmod(xlm - argpm - nodem, twoPi);
+
+        // Long-period periodics, then Kepler's equation for E + omega
+        const double axnl = em * std::cos(argpm);
+        temp = 1.0 / (am * (1.0 - em * em));
+        const double aynl = em * std::sin(argpm) + temp * aycof[i];
+        const double xl = mm + argpm + nodem + temp * xlcof[i] * axnl;
+        const double u = std::fmod(xl - nodem, twoPi);
+        double eo1 = u, sineo1 = 0.0, coseo1 = 1.0, step = 1.0;
+        for (int iteration = 0; iteration < MaxIterations && std::fabs(step) >= Tolerance; ++iteration) {
+            sineo1 = std::sin(eo1);
+            coseo1 = std::cos(eo1);
+            step = (u - aynl * coseo1 + axnl * sineo1 - eo1) / (1.0 - coseo1 * axnl - sineo1 * aynl);
+            step = std::max(-0.95, std::min(0.95, step));
+            eo1 += step;
+        }
+
+        // Short-period periodics
+        const double ecose = axnl * coseo1 + aynl * sineo1;
+        const double esine = axnl * sineo1 - aynl * coseo1;
+        const double el2 = axnl * axnl + aynl * aynl;
+        const double pl = am * (1.0 - el2);
+        if (pl < 0.0) {
+            return false;
+        }
+        const double rl = am * (1.0 - ecose);
+        const double rdotl = std::sqrt(am) * esine / rl;
+        const double rvdotl = std::sqrt(pl) / rl;
+        const double betal = std::sqrt(1.0 - el2);
+        temp = esine / (1.0 + betal);
+        const double sinu = am / rl * (sineo1 - aynl - axnl * temp);
+        const double cosu = am / rl * (coseo1 - axnl + aynl * temp);
+        double su = std::atan2(sinu, cosu);
+        const double sin2u = (cosu + cosu) * sinu;
+        const double cos2u = 1.0 - 2.0 * sinu * sinu;
+        temp = 1.0 / pl;
+        const double temp1 = 0.5 * J2 * temp;
+        const double temp2 = temp1 * temp;
+        const double mrt = rl * (1.0 - 1.5 * temp2 * betal * con41Column[i]) + 0.5 * temp1 * x1mth2Column[i] * cos2u;
+        su -= 0.25 * temp2 * x7thm1[i] * sin2u;
+        const double xnode = nodem + 1.5 * temp2 * cosInclination[i] * sin2u;
+        const double xinc = inclination[i] + 1.5 * temp2 * cosInclination[i] * sinInclination[i] * cos2u;
+        const double mvt = rdotl - nm * temp1 * x1mth2Column[i] * sin2u / Xke;
+        const double rvdot = rvdotl + nm * temp1 * (x1mth2Column[i] * cos2u + 1.5 * con41Column[i]) / Xke;
+        if (mrt < 1.0) {
+            return false;
+        }
+
+        const double sinsu = std::sin(su), cossu = std::cos(su);
+        const double snod = std::sin(xnode), cnod = std::cos(xnode);
+        const double sini = std::sin(xinc), cosi = std::cos(xinc);
+        const double xmx = -snod * cosi, xmy = cnod * cosi;
+        glm::dvec3 along(xmx * sinsu + cnod * cossu, xmy * sinsu + snod * cossu, sini * sinsu);
+        glm::dvec3 across(xmx * cossu - cnod * sinsu, xmy * cossu - snod * sinsu, sini * cossu);
+        position = mrt * along * EarthRadius;
+        velocity = (mvt * along + rvdot * across) * (EarthRadius * Xke / 60.0);
+        return true;
+    }
+
+    glm::dvec3 Position(size_t i, double jd) const {
+        glm::dvec3 position, velocity;
+        State(i, jd, position, velocity);
+        return position;
+    }
+
+    // Positions (km, TEME) of every satellite at Julian date jd, split across worker threads. Decayed
+    // satellites are put at Earth's center.
+    void Propagate(double jd, double* x, double* y, double* z) const {
+        ParallelFor(0, Size(), 8192, [&](size_t begin, size_t end) {
+            propagateRange(jd, begin, end, [&](size_t i, double rx, double ry, double rz) {
+                x[i] = rx; y[i] = ry; z[i] = rz;
+            });
+        });
+    }
+
+    // Float positions mapped by `frame` (which also scales km to the output's units) and offset by
+    // `origin`, written with `stride` floats between satellites; suited to filling a mapped vertex buffer
+    void Propagate(double jd, float* out, size_t stride, const glm::dmat3& frame, const glm::dvec3& origin) const {
+        ParallelFor(0, Size(), 8192, [&](size_t begin, size_t end) {
+            propagateRange(jd, begin, end, [&](size_t i, double rx, double ry, double rz) {
+                glm::dvec3 p = origin + frame * glm::dvec3(rx, ry, rz);
+                float* o = out + i * stride;
+                o[0] = static_cast<float>(p.x);
+                o[1] = static_cast<float>(p.y);
+                o[2] = static_cast<float>(p.z);
+            });
+        });
+    }
+
+    void Propagate(double jd, std::vector<double>& x, std::vector<double>& y, std::vector<double>& z) const {
+        x.resize(Size()); y.resize(Size()); z.resize(Size());
+        if (Size() > 0) {
+            Propagate(jd, &x[0], &y[0], &z[0]);
+        }
+    }
+
+    static const char* InstructionSet() {
+#if defined(__AVX__)
+        return "AVX";
+#else
+        return "scalar";
+#endif
+    }
+
+private:
+    // WGS-72
+    static constexpr double J2 = 0.001082616;
+    static constexpr double J3oJ2 = -0.00000253881 / 0.001082616;
+    static constexpr double J4 = -0.00000165597;
+    static constexpr double Xke = 0.0743669161331734;   // 60 / sqrt(EarthRadius^3 / Mu), per minute
+    static const int MaxIterations = 10;
+    static constexpr double Tolerance = 1e-12;
+
+    std::vector<double> epoch, meanMotion, eccentricity, inclination, node, argument, anomaly, drag, axis;
+    std::vector<double> cc1, cc4, cc5, etaColumn, mdot, argpdot, nodedot, nodecf, t2cof, omgcof, xmcof, delmo, sinmao;
+    std::vector<double> xlcof, aycof, con41Column, x1mth2Column, x7thm1, cosInclination, sinInclination;
+    std::vector<double> d2Column, d3Column, d4Column, t3cof, t4cof, t5cof;
+    std::vector<uint8_t> deepSpace;
+    size_t deepSpaceCount = 0;
+
+    std::vector<std::vector<double>*> columns() {
+        std::vector<double>* all[] = { &epoch, &meanMotion, &eccentricity, &inclination, &node, &argument,
+            &anomaly, &drag, &axis, &cc1, &cc4, &cc5, &etaColumn, &mdot, &argpdot, &nodedot, &nodecf, &t2cof, &omgcof,
+            &xmcof, &delmo, &sinmao, &xlcof, &aycof, &con41Column, &x1mth2Column, &x7thm1, &cosInclination,
+            &sinInclination, &d2Column, &d3Column, &d4Column, &t3cof, &t4cof, &t5cof };
+        return std::vector<std::vector<double>*>(all, all + sizeof(all) / sizeof(all[0]));
+    }
+
+    // Propagates satellites [begin, end) to jd and hands each position to store(i, x, y, z)
+    template <typename Store>
+    void propagateRange(double jd, size_t begin, size_t end, Store store) const {
+        size_t i = begin;
+#if defined(__AVX__)
+        const __m256d vjd = _mm256_set1_pd(jd);
+        const __m256d minutes = _mm256_set1_pd(1440.0);
+        const __m256d one = _mm256_set1_pd(1.0);
+        const __m256d zero = _mm256_setzero_pd();
+        const __m256d twoPi = _mm256_set1_pd(6.283185307179586476925);
+        const __m256d invTwoPi = _mm256_set1_pd(1.0 / 6.283185307179586476925);
+        const __m256d signBit = _mm256_set1_pd(-0.0);
+        const __m256d j2Half = _mm256_set1_pd(0.5 * J2);
+        const __m256d limit = _mm256_set1_pd(0.95);
+        auto load = [&](const std::vector<double>& column) { return _mm256_loadu_pd(&column[i]); };
+        auto mul = [](__m256d a, __m256d b) { return _mm256_mul_pd(a, b); };
+        auto add = [](__m256d a, __m256d b) { return _mm256_add_pd(a, b); };
+        auto sub = [](__m256d a, __m256d b) { return _mm256_sub_pd(a, b); };
+        auto reduce = [&](__m256d x) {
+            return sub(x, mul(twoPi, _mm256_round_pd(mul(x, invTwoPi), _MM_FROUND_TO_NEAREST_INT)));
+        };
+        for (; i + 4 <= end; i += 4) {
+            // Secular gravity and drag
+            __m256d t = mul(sub(vjd, load(epoch)), minutes);
+            __m256d t2 = mul(t, t), t3 = mul(t2, t), t4 = mul(t3, t);
+            __m256d xmdf = reduce(add(load(anomaly), mul(load(mdot), t)));
+            __m256d argpdm = add(load(argument), mul(load(argpdot), t));
+            __m256d nodem = reduce(add(add(load(node), mul(load(nodedot), t)), mul(load(nodecf), t2)));
+            __m256d sinM, cosM;
+            SinCos4(xmdf, sinM, cosM);
+            __m256d delmtemp = add(one, mul(load(etaColumn), cosM));
+            __m256d delm = mul(load(xmcof), sub(mul(mul(delmtemp, delmtemp), delmtemp), load(delmo)));
+            __m256d temp = add(mul(load(omgcof), t), delm);
+            __m256d mm = add(xmdf, temp);
+            __m256d argpm = reduce(sub(argpdm, temp));
+            __m256d tempa = sub(sub(sub(sub(one, mul(load(cc1), t)), mul(load(d2Column), t2)), mul(load(d3Column), t3)),
+                mul(load(d4Column), t4));
+            SinCos4(mm, sinM, cosM);
+            __m256d bstar = load(drag);
+            __m256d tempe = add(mul(mul(bstar, load(cc4)), t), mul(mul(bstar, load(cc5)), sub(sinM, load(sinmao))));
+            __m256d templ = add(add(mul(load(t2cof), t2), mul(load(t3cof), t3)), mul(t4, add(load(t4cof), mul(t, load(t5cof)))));
+
+            __m256d tempa2 = mul(tempa, tempa);
+            __m256d am = mul(load(axis), tempa2);
+            __m256d em = sub(load(eccentricity), tempe);
+            __m256d failed = _mm256_or_pd(_mm256_cmp_pd(em, one, _CMP_GE_OQ),
+                _mm256_cmp_pd(em, _mm256_set1_pd(-0.001), _CMP_LT_OQ));
+            em = _mm256_max_pd(em, _mm256_set1_pd(1e-6));
+            mm = add(mm, mul(load(meanMotion), templ));
+
+            // Long-period periodics, then Kepler's equation for E + omega
+            __m256d sinArg, cosArg;
+            SinCos4(argpm, sinArg, cosArg);
+            __m256d axnl = mul(em, cosArg);
+            temp = _mm256_div_pd(one, mul(am, sub(one, mul(em, em))));
+            __m256d aynl = add(mul(em, sinArg), mul(temp, load(aycof)));
+            __m256d u = reduce(add(add(mm, argpm), mul(mul(temp, load(xlcof)), axnl)));
+            __m256d eo1 = u, sineo1, coseo1;
+            for (int iteration = 0; iteration < MaxIterations; ++iteration) {
+                SinCos4(eo1, sineo1, coseo1);
+                __m256d step = _mm256_div_pd(sub(add(sub(u, mul(aynl, coseo1)), mul(axnl, sineo1)), eo1),
+                    sub(sub(one, mul(coseo1, axnl)), mul(sineo1, aynl)));
+                step = _mm256_max_pd(_mm256_min_pd(step, limit), _mm256_sub_pd(zero, limit));
+                eo1 = add(eo1, step);
+                __m256d size = _mm256_andnot_pd(signBit, step);
+                if (_mm256_movemask_pd(_mm256_cmp_pd(size, _mm256_set1_pd(Tolerance), _CMP_GE_OQ)) == 0) {
+                    break;
+                }
+            }
+            // As in the reference code, sin and cos are those of the iterate before the last (tiny) step
+            __m256d ecose = add(mul(axnl, coseo1), mul(aynl, sineo1));
+            __m256d esine = sub(mul(axnl, sineo1), mul(aynl, coseo1));
+            __m256d el2 = add(mul(axnl, axnl), mul(aynl, aynl));
+            __m256d pl = mul(am, sub(one, el2));
+            failed = _mm256_or_pd(failed, _mm256_cmp_pd(pl, zero, _CMP_LT_OQ));
+            __m256d rl = mul(am, sub(one, ecose));
+            __m256d betal = _mm256_sqrt_pd(_mm256_max_pd(sub(one, el2), zero));
+            temp = _mm256_div_pd(esine, add(one, betal));
+            __m256d amOverRl = _mm256_div_pd(am, rl);
+            __m256d sinu = mul(amOverRl, sub(sub(sineo1, aynl), mul(axnl, temp)));
+            __m256d cosu = mul(amOverRl, add(sub(coseo1, axnl), mul(aynl, temp)));
+            __m256d sin2u = mul(add(cosu, cosu), sinu);
+            __m256d cos2u = sub(one, mul(add(sinu, sinu), sinu));
+
+            // Short-period periodics; the argument of latitude is corrected by angle addition
+            temp = _mm256_div_pd(one, pl);
+            __m256d temp1 = mul(j2Half, temp);
+            __m256d temp2 = mul(temp1, temp);
+            __m256d mrt = add(mul(rl, sub(one, mul(mul(mul(_mm256_set1_pd(1.5), temp2), betal), load(con41Column)))),
+                mul(mul(_mm256_set1_pd(0.5), temp1), mul(load(x1mth2Column), cos2u)));
+            failed = _mm256_or_pd(failed, _mm256_cmp_pd(mrt, one, _CMP_LT_OQ));
+            __m256d delta = mul(mul(_mm256_set1_pd(-0.25), temp2), mul(load(x7thm1), sin2u));
+            __m256d cosio = load(cosInclination);
+            __m256d xnode = add(nodem, mul(mul(_mm256_set1_pd(1.5), temp2), mul(cosio, sin2u)));
+            __m256d xinc = add(load(inclination), mul(mul(_mm256_set1_pd(1.5), temp2),
+                mul(mul(cosio, load(sinInclination)), cos2u)));
+            __m256d norm = _mm256_div_pd(one, _mm256_sqrt_pd(add(mul(sinu, sinu), mul(cosu, cosu))));
+            sinu = mul(sinu, norm);
+            cosu = mul(cosu, norm);
+            __m256d sinDelta, cosDelta, snod, cnod, sini, cosi;
+            SinCos4(delta, sinDelta, cosDelta);
+            SinCos4(xnode, snod, cnod);
+            SinCos4(xinc, sini, cosi);
+            __m256d sinsu = add(mul(sinu, cosDelta), mul(cosu, sinDelta));
+            __m256d cossu = sub(mul(cosu, cosDelta), mul(sinu, sinDelta));
+            __m256d xmx = mul(_mm256_xor_pd(snod, signBit), cosi), xmy = mul(cnod, cosi);
+            __m256d scale = _mm256_andnot_pd(failed, mul(mrt, _mm256_set1_pd(EarthRadius)));
+            double lx[4], ly[4], lz[4];
+            _mm256_storeu_pd(lx, mul(scale, add(mul(xmx, sinsu), mul(cnod, cossu))));
+            _mm256_storeu_pd(ly, mul(scale, add(mul(xmy, sinsu), mul(snod, cossu))));
+            _mm256_storeu_pd(lz, mul(scale, mul(sini, sinsu)));
+            for (int k = 0; k < 4; ++k) {
+                store(i + k, lx[k], ly[k], lz[k]);
+            }
+        }
+#endif
+        for (; i < end; ++i) {
+            glm::dvec3 position, velocity;
+            State(i, jd, position, velocity);
+            store(i, position.x, position.y, position.z);
+        }
+    }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#if defined(__AVX__)
+#include <immintrin.h>
+
+// sin and cos of four doubles: reduction by pi/2 in three parts (Cody-Waite), then the Cephes
+// minimax polynomials on [-pi/4, pi/4]. Accurate to a few ulp for |x| up to ~1e5.
+inline void SinCos4(__m256d x, __m256d& s, __m256d& c) {
+    const __m256d twoOverPi = _mm256_set1_pd(0.636619772367581343076);
+    __m256d q = _mm256_round_pd(_mm256_mul_pd(x, twoOverPi), _MM_FROUND_TO_NEAREST_INT);
+    __m256d r = _mm256_sub_pd(x, _mm256_mul_pd(q, _mm256_set1_pd(1.57079625129699707031)));
+    r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(7.54978941586159635335e-8)));
+    r = _mm256_sub_pd(r, _mm256_mul_pd(q, _mm256_set1_pd(5.39030285815811905290e-15)));
+    __m256d r2 = _mm256_mul_pd(r, r);
+
+    __m256d ps = _mm256_set1_pd(1.58962301576546568060e-10);
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(-2.50507477628578072866e-8));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(2.75573136213857245213e-6));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(-1.98412698295895385996e-4));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(8.33333333332211858878e-3));
+    ps = _mm256_add_pd(_mm256_mul_pd(ps, r2), _mm256_set1_pd(-1.66666666666666307295e-1));
+    __m256d sinR = _mm256_add_pd(r, _mm256_mul_pd(_mm256_mul_pd(r, r2), ps));
+
+    __m256d pc = _mm256_set1_pd(-1.13585365213876817300e-11);
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(2.08757008419747316778e-9));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(-2.75573141792967388112e-7));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(2.48015872888517045348e-5));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(-1.38888888888730564116e-3));
+    pc = _mm256_add_pd(_mm256_mul_pd(pc, r2), _mm256_set1_pd(4.16666666666665929218e-2));
+    __m256d cosR = _mm256_add_pd(_mm256_sub_pd(_mm256_set1_pd(1.0), _mm256_mul_pd(_mm256_set1_pd(0.5), r2)),
+        _mm256_mul_pd(_mm256_mul_pd(r2, r2), pc));
+
+    // Quadrant q mod 4: odd quadrants swap sin and cos, then signs follow the unit circle
+    __m256d quadrant = _mm256_sub_pd(q, _mm256_mul_pd(_mm256_set1_pd(4.0), _mm256_floor_pd(_mm256_mul_pd(q, _mm256_set1_pd(0.25)))));
+    __m256d odd = _mm256_or_pd(_mm256_cmp_pd(quadrant, _mm256_set1_pd(1.0), _CMP_EQ_OQ),
+        _mm256_cmp_pd(quadrant, _mm256_set1_pd(3.0), _CMP_EQ_OQ));
+    __m256d sinNegative = _mm256_cmp_pd(quadrant, _mm256_set1_pd(2.0), _CMP_GE_OQ);
+    __m256d cosNegative = _mm256_or_pd(_mm256_cmp_pd(quadrant, _mm256_set1_pd(1.0), _CMP_EQ_OQ),
+        _mm256_cmp_pd(quadrant, _mm256_set1_pd(2.0), _CMP_EQ_OQ));
+    const __m256d signBit = _mm256_set1_pd(-0.0);
+    s = _mm256_xor_pd(_mm256_blendv_pd(sinR, cosR, odd), _mm256_and_pd(sinNegative, signBit));
+    c = _mm256_xor_pd(_mm256_blendv_pd(cosR, sinR, odd), _mm256_and_pd(cosNegative, signBit));
+}
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "NBody.h"
+#include "Integrators.h"
+#include "Collisions.h"
+#include "Conservation.h"
+
+// One close encounter or collision found after a step
+struct EncounterRecord {
+    double time;            // simulation time of closest approach
+    size_t first, second;   // body indices before any merge in that step
+    double distance;
+    bool merged;
+};
+
+// Owns the body state, a force backend and an integrator, all swappable at runtime.
+// The renderer reads interpolated positions between the previous and current step.
+class NBodySimulation {
+public:
+    BodySystem bodies;
+    double time;
+
+    // Encounter detection after every step (off by default). With mergeOnOverlap, overlapping bodies
+    // are merged and later bodies shift down; LastRemap() maps the old indices of that step.
+    bool detectEncounters;
+    bool mergeOnOverlap;
+    CollisionDetector collisions;
+    std::vector<EncounterRecord> encounterLog;
+    size_t encounterLogLimit;   // the log never grows past this; at least its oldest half is dropped when it would
+    size_t encountersDropped;   // records dropped so far, so encounterLog[e] is record e + encountersDropped
+    // Energy and momentum drift every `conservation.cadence` steps (off by default)
+    ConservationMonitor conservation;
+
+    NBodySimulation(std::unique_ptr<GravitySolver> solver = std::unique_ptr<GravitySolver>(new DirectSummationSolver()),
+        std::unique_ptr<Integrator> integrator = MakeIntegrator(DefaultIntegratorKind()))
+        : time(0.0), detectEncounters(false), mergeOnOverlap(false), encounterLogLimit(100000),
+          encountersDropped(0),
+          solver(std::move(solver)), integrator(std::move(integrator)) {}
+
+    GravitySolver& Solver() {
+        return *solver;
+    }
+
+    void SetSolver(std::unique_ptr<GravitySolver> newSolver) {
+        solver = std::move(newSolver);
+        integrator->Reset();
+    }
+
+    Integrator& CurrentIntegrator() {
+        return *integrator;
+    }
+
+    void SetIntegrator(std::unique_ptr<Integrator> newIntegrator) {
+        integrator = std::move(newIntegrator);
+        integrator->Reset();
+    }
+
+    void SetIntegrator(IntegratorKind kind) {
+        SetIntegrator(MakeIntegrator(kind));
+    }
+
+    size_t AddBody(const glm::dvec3& position, const glm::dvec3& velocity, double mass, double radius = 0.0) {
+        integrator->Reset();
+        conservation.Rebase();
+        size_t index = bodies.Add(position, velocity, mass, radius);
+        previousX.push_back(position.x);
+        previousY.push_back(position.y);
+        previousZ.push_back(position.z);
+        return index;
+    }
+
+    // Call after editing body state directly so the next step recomputes forces and rendering
+    // does not blend from the old positions
+    void Invalidate() {
+        integrator->Reset();
+        conservation.Rebase();
+        previousX = bodies.x;
+        previousY = bodies.y;
+        previousZ = bodies.z;
+    }
+
+    void Step(double dt) {
+        if (bodies.Size() == 0) {
+            time += dt;
+            return;
+        }
+        previousX = bodies.x;
+        previousY = bodies.y;
+        previousZ = bodies.z;
+        integrator->Step(bodies, *solver, dt);
+        time += dt;
+        if (detectEncounters) {
+            handleEncounters(dt);
+        }
+        conservation.AfterStep(bodies, *solver, time);
+    }
+
+    const std::vector<size_t>& LastRemap() const {
+        return remap;
+    }
+
+    // Positions at the start of the last step (axis 0, 1, 2), which rendering blends from
+    const std::vector<double>& PreviousPositions(int axis) const {
+        return axis == 0 ? previousX : axis == 1 ? previousY : previousZ;
+    }
+
+    std::vector<double>& PreviousPositions(int axis) {
+        return axis == 0 ? previousX : axis == 1 ? previousY : previousZ;
+    }
+
+    // Position blended between the last two steps
+    glm::dvec3 WorldPosition(size_t i, double alpha) const {
+        glm::dvec3 previous(previousX[i], previousY[i], previousZ[i]);
+        return previous + (bodies.Position(i) - previous) * alpha;
+    }
+
+    // The same in render (float) precision; prefer WorldPosition minus a camera origin for drawing
+    glm::vec3 RenderPosition(size_t i, double alpha) const {
+        return glm::vec3(WorldPosition(i, alpha));
+    }
+
+private:
+    std::unique_ptr<GravitySolver> solver;
+    std::unique_ptr<Integrator> integrator;
+    std::vector<double> previousX, previousY, previousZ;
+    std::vector<size_t> remap;
+
+    void handleEncounters(double dt) {
+        const std::vector<Encounter>& found = collisions.Detect(bodies, dt);
+        if (found.empty()) {
+            return;
+        }
+        size_t removed = 0;
+        if (mergeOnOverlap) {
+            removed = MergeOverlaps(bodies, found, remap);
+        }
+        // At least the oldest half goes, so erasing stays rare; a step finding more than the limit keeps its newest
+        const size_t kept = std::min(found.size(), encounterLogLimit);
+        if (encounterLog.size() + kept > encounterLogLimit) {
+            size_t drop = std::max(encounterLog.size() / 2, encounterLog.size() + kept - encounterLogLimit);
+            encounterLog.erase(encounterLog.begin(), encounterLog.begin() + drop);
+            encountersDropped += drop;
+        }
+        encountersDropped += found.size() - kept;
+        for (size_t e = found.size() - kept; e < found.size(); ++e) {
+            EncounterRecord record = { time + found[e].time, found[e].first, found[e].second, found[e].distance,
+                mergeOnOverlap && found[e].overlap };
+            encounterLog.push_back(record);
+        }
+        if (removed > 0) {
+            Invalidate();
+        }
+    }
+};
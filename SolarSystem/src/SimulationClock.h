@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+
+// Fixed-timestep simulation clock. Real frame time is fed into an accumulator which is drained in
+// fixed simulation steps, so the physics no longer depends on how fast frames are rendered.
+// Rendering samples the state between the last two steps using the leftover fraction (alpha).
+class SimulationClock {
+public:
+    double fixedStep;       // simulated seconds per step
+    double timeScale;       // simulated seconds per real second
+    int maxStepsPerFrame;   // caps catch-up work after a long stall
+    bool paused;
+
+    SimulationClock(double fixedStep = 1.0 / 60.0, double timeScale = 1.0)
+        : fixedStep(fixedStep), timeScale(timeScale), maxStepsPerFrame(240), paused(false),
+          time(0.0), previousTime(0.0), accumulator(0.0), steps(0) {}
+
+    // Adds a frame's worth of real time to the accumulator
+    void Advance(double realDelta) {
+        if (paused || realDelta <= 0.0) {
+            return;
+        }
+        accumulator += realDelta * timeScale;
+
+        // Drop time we could never catch up on instead of spiralling into ever longer frames
+        double maxBacklog = fixedStep * maxStepsPerFrame;
+        if (accumulator > maxBacklog) {
+            accumulator = maxBacklog;
+        }
+    }
+
+    // Consumes one fixed step if enough time has accumulated; call in a loop until it returns false
+    bool ConsumeStep() {
+        if (accumulator < fixedStep) {
+            return false;
+        }
+        accumulator -= fixedStep;
+        previousTime = time;
+        time += fixedStep;
+        ++steps;
+        return true;
+    }
+
+    // Fraction of a step left in the accumulator, used to blend the last two simulation states
+    double Alpha() const {
+        return std::min(accumulator / fixedStep, 1.0);
+    }
+
+    // Simulation time the current frame should be rendered at
+    double RenderTime() const {
+        return previousTime + (time - previousTime) * Alpha();
+    }
+
+    void IncreaseTimeScale(double amount) {
+        timeScale += amount;
+    }
+
+    void DecreaseTimeScale(double amount, double minimum = 0.01) {
+        timeScale = std::max(timeScale - amount, minimum);
+    }
+
+    // Jumps to an absolute simulation time, discarding any partially accumulated step
+    void Seek(double newTime) {
+        time = newTime;
+        previousTime = newTime;
+        accumulator = 0.0;
+    }
+
+    // Restores a saved clock: time and step count, with an empty accumulator
+    void Restore(double newTime, unsigned long long newSteps) {
+        Seek(newTime);
+        steps = newSteps;
+    }
+
+    double Time() const {
+        return time;
+    }
+
+    double StepDelta() const {
+        return time - previousTime;
+    }
+
+    unsigned long long Steps() const {
+        return steps;
+    }
+
+private:
+    double time;
+    double previousTime;
+    double accumulator;
+    unsigned long long steps;
+};
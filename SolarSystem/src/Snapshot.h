@@ -0,0 +1,410 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BarnesHut.h"
+#include "FMM.h"
+#include "MappedFile.h"
+#include "Parallel.h"
+#include "Simulation.h"
+#include "SimulationClock.h"
+
+// On-disk layout (little endian):
+//     SnapshotHeader | sections, each starting on a 64-byte boundary
+// Every section is a raw array (one double per body for the body state), found through the header's
+// section table, so a reader maps the file and points straight at the arrays. Readers reject other
+// versions; sections they do not know are skipped, so new data can be added without a version bump.
+enum class SnapshotSection : uint32_t {
+    PositionX = 1, PositionY, PositionZ,
+    VelocityX, VelocityY, VelocityZ,
+    AccelerationX, AccelerationY, AccelerationZ,
+    Mass, Radius,
+    PreviousX, PreviousY, PreviousZ,    // start of the last step, for render interpolation
+    IntegratorState                     // Integrator::SaveState doubles
+};
+
+struct SnapshotSectionEntry {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+// Caller-defined position of a random stream (seed and number of draws), so stochastic runs resume
+struct SnapshotRandomState {
+    uint64_t seed;
+    uint64_t draws;
+};
+
+struct SnapshotHeader {
+    static const uint32_t MaxSections = 24;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint64_t bodyCount;
+    double time;
+    double clockTime;
+    uint64_t clockSteps;
+    double fixedStep;
+    double timeScale;
+    double G;
+    double softening;
+    int32_t integratorKind;
+    uint32_t accelerationsValid;
+    uint64_t forceEvaluations;
+    uint64_t stepsTaken;
+    uint64_t rejectedSteps;
+    SnapshotRandomState random;
+    char solver[16];
+    uint32_t sectionCount;
+    uint32_t reserved;
+    SnapshotSectionEntry sections[MaxSections];
+};
+
+const uint32_t SnapshotVersion = 1;
+const char SnapshotMagic[8] = { 'S', 'S', 'S', 'N', 'A', 'P', 0, 0 };
+
+// Writes snapshots without holding up the simulation: Capture copies the state into a file image in
+// parallel chunks and a background thread writes it to `path`.tmp, then renames it over `path`, so a
+// crash mid-write never leaves a torn snapshot behind. Reserve sizes the image ahead of the first
+// capture, so captures only cost the copy and not the page faults of a fresh buffer.
+class SnapshotWriter {
+public:
+    SnapshotWriter() : imageBytes(0), imageCapacity(0), writing(false), succeeded(true) {}
+
+    ~SnapshotWriter() {
+        Wait();
+    }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    // Returns false (and writes nothing) while the previous snapshot is still being written
+    bool Capture(NBodySimulation& simulation, const SimulationClock& clock, const std::string& path,
+        const SnapshotRandomState& random = SnapshotRandomState()) {
+        if (Busy()) {
+            std::cout << "ERROR::SNAPSHOT::WRITE_IN_PROGRESS " << path << std::endl;
+            return false;
+        }
+        Wait();
+        buildImage(simulation, clock, random);
+        target = path;
+        writing = true;
+        worker = std::thread([this]() {
+            succeeded = writeImage();
+            writing = false;
+        });
+        return true;
+    }
+
+    // Builds an image of `simulation` without writing it, so later captures of a run of about the same
+    // size reuse its pages; does nothing while a snapshot is being written
+    void Reserve(NBodySimulation& simulation, const SimulationClock& clock) {
+        if (Busy()) {
+            return;
+        }
+        Wait();
+        buildImage(simulation, clock, SnapshotRandomState());
+    }
+
+    bool Busy() const {
+        return writing;
+    }
+
+    // Blocks until the current write is done; returns whether the last snapshot was written
+    bool Wait() {
+        if (worker.joinable()) {
+            worker.join();
+        }
+        return succeeded;
+    }
+
+    // Size of the last captured image
+    size_t Bytes() const {
+        return imageBytes;
+    }
+
+private:
+    std::unique_ptr<char[]> image;
+    size_t imageBytes, imageCapacity;
+    std::string target;
+    std::thread worker;
+    std::atomic<bool> writing;
+    std::atomic<bool> succeeded;
+    std::vector<double> integratorState;
+
+    static size_t align(size_t offset) {
+        return (offset + 63) & ~static_cast<size_t>(63);
+    }
+
+    void buildImage(NBodySimulation& simulation, const SimulationClock& clock, const SnapshotRandomState& random) {
+        const BodySystem& b = simulation.bodies;
+        const size_t n = b.Size();
+        const Integrator& integrator = simulation.CurrentIntegrator();
+        integrator.SaveState(integratorState);
+
+        struct Array {
+            SnapshotSection id;
+            const double* data;
+            size_t count;
+        };
+        const Array arrays[] = {
+            { SnapshotSection::PositionX, b.x.data(), n }, { SnapshotSection::PositionY, b.y.data(), n },
+            { SnapshotSection::PositionZ, b.z.data(), n }, { SnapshotSection::VelocityX, b.vx.data(), n },
+            { SnapshotSection::VelocityY, b.vy.data(), n }, { SnapshotSection::VelocityZ, b.vz.data(), n },
+            { SnapshotSection::AccelerationX, b.ax.data(), n }, { SnapshotSection::AccelerationY, b.ay.data(), n },
+            { SnapshotSection::AccelerationZ, b.az.data(), n }, { SnapshotSection::Mass, b.mass.data(), n },
+            { SnapshotSection::Radius, b.radius.data(), n },
+            { SnapshotSection::PreviousX, simulation.PreviousPositions(0).data(), n },
+            { SnapshotSection::PreviousY, simulation.PreviousPositions(1).data(), n },
+            { SnapshotSection::PreviousZ, simulation.PreviousPositions(2).data(), n },
+            { SnapshotSection::IntegratorState, integratorState.data(), integratorState.size() }
+        };
+        const size_t sectionCount = sizeof(arrays) / sizeof(arrays[0]);
+
+        SnapshotHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+        header.version = SnapshotVersion;
+        header.headerBytes = sizeof(SnapshotHeader);
+        header.bodyCount = n;
+        header.time = simulation.time;
+        header.clockTime = clock.Time();
+        header.clockSteps = clock.Steps();
+        header.fixedStep = clock.fixedStep;
+        header.timeScale = clock.timeScale;
+        header.G = simulation.Solver().G;
+        header.softening = simulation.Solver().softening;
+        header.integratorKind = static_cast<int32_t>(integrator.Kind());
+        header.accelerationsValid = integrator.AccelerationsValid() ? 1 : 0;
+        header.forceEvaluations = integrator.ForceEvaluations();
+        header.stepsTaken = integrator.StepsTaken();
+        header.rejectedSteps = integrator.RejectedSteps();
+        header.random = random;
+        std::strncpy(header.solver, simulation.Solver().Name(), sizeof(header.solver) - 1);
+        header.sectionCount = static_cast<uint32_t>(sectionCount);
+
+        size_t offset = align(sizeof(SnapshotHeader));
+        for (size_t s = 0; s < sectionCount; ++s) {
+            SnapshotSectionEntry& entry = header.sections[s];
+            entry.id = static_cast<uint32_t>(arrays[s].id);
+            entry.offset = offset;
+            entry.bytes = arrays[s].count * sizeof(double);
+            offset = align(offset + entry.bytes);
+        }
+
+        // The buffer is left uninitialized and only grows, so its pages are first touched by the parallel
+        // copy below, and repeated snapshots of the same run reuse them
+        if (offset > imageCapacity) {
+            imageCapacity = offset + offset / 16;
+            image.reset(new char[imageCapacity]);
+        }
+        imageBytes = offset;
+        char* out = image.get();
+        std::memcpy(out, &header, sizeof(header));
+        std::memset(out + sizeof(header), 0, header.sections[0].offset - sizeof(header));
+
+        // Sections are copied in chunks of about a megabyte; the alignment padding after each is zeroed
+        struct Chunk {
+            size_t section, begin, end;
+        };
+        const size_t chunkBytes = size_t(1) << 20;
+        std::vector<Chunk> chunks;
+        for (size_t s = 0; s < sectionCount; ++s) {
+            const size_t bytes = static_cast<size_t>(header.sections[s].bytes);
+            for (size_t begin = 0; begin < bytes; begin += chunkBytes) {
+                Chunk chunk = { s, begin, std::min(bytes, begin + chunkBytes) };
+                chunks.push_back(chunk);
+            }
+            const size_t end = static_cast<size_t>(header.sections[s].offset) + bytes;
+            std::memset(out + end, 0, (s + 1 < sectionCount ? header.sections[s + 1].offset : offset) - end);
+        }
+        ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                const Chunk& chunk = chunks[c];
+                std::memcpy(out + header.sections[chunk.section].offset + chunk.begin,
+                    reinterpret_cast<const char*>(arrays[chunk.section].data) + chunk.begin, chunk.end - chunk.begin);
+            }
+        });
+    }
+
+    bool writeImage() {
+        std::string temporary = target + ".tmp";
+        {
+            std::ofstream out(temporary.c_str(), std::ios::binary | std::ios::trunc);
+            if (!out) {
+                std::cout << "ERROR::SNAPSHOT::FILE_NOT_WRITTEN " << target << std::endl;
+                return false;
+            }
+            out.write(image.get(), static_cast<std::streamsize>(imageBytes));
+            if (!out) {
+                std::cout << "ERROR::SNAPSHOT::FILE_NOT_WRITTEN " << target << std::endl;
+                return false;
+            }
+        }
+#ifdef _WIN32
+        std::remove(target.c_str());
+#endif
+        if (std::rename(temporary.c_str(), target.c_str()) != 0) {
+            std::cout << "ERROR::SNAPSHOT::FILE_NOT_WRITTEN " << target << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
+
+// Memory-mapped snapshot. Open only validates the header and section table; Array hands out pointers
+// into the mapping, and Restore copies them into a simulation, so resuming costs the page faults of
+// reading the arrays once and nothing else.
+class SnapshotReader {
+public:
+    SnapshotReader() : header(nullptr) {}
+
+    bool Open(const std::string& path) {
+        Close();
+        if (!file.Open(path)) {
+            std::cout << "ERROR::SNAPSHOT::FILE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        if (!validate()) {
+            std::cout << "ERROR::SNAPSHOT::INVALID_FILE " << path << std::endl;
+            Close();
+            return false;
+        }
+        header = reinterpret_cast<const SnapshotHeader*>(file.Data());
+        return true;
+    }
+
+    void Close() {
+        file.Close();
+        header = nullptr;
+    }
+
+    bool IsOpen() const {
+        return header != nullptr;
+    }
+
+    const SnapshotHeader& Header() const {
+        return *header;
+    }
+
+    // Pointer to a section in the mapping and its length in doubles, or nullptr if it is missing
+    const double* Array(SnapshotSection id, size_t& count) const {
+        for (uint32_t s = 0; s < header->sectionCount; ++s) {
+            if (header->sections[s].id == static_cast<uint32_t>(id)) {
+                count = static_cast<size_t>(header->sections[s].bytes / sizeof(double));
+                return reinterpret_cast<const double*>(file.Data() + header->sections[s].offset);
+            }
+        }
+        count = 0;
+        return nullptr;
+    }
+
+    // Replaces the simulation's bodies, force backend, integrator and time, and the clock's time. A backend
+    // other than the current one is rebuilt from its name with default parameters, as Scenario::Build does.
+    bool Restore(NBodySimulation& simulation, SimulationClock& clock) const {
+        if (!IsOpen()) {
+            return false;
+        }
+        const size_t n = static_cast<size_t>(header->bodyCount);
+        BodySystem& b = simulation.bodies;
+        std::vector<double>* targets[] = { &b.x, &b.y, &b.z, &b.vx, &b.vy, &b.vz, &b.ax, &b.ay, &b.az, &b.mass, &b.radius,
+            &simulation.PreviousPositions(0), &simulation.PreviousPositions(1), &simulation.PreviousPositions(2) };
+        const SnapshotSection ids[] = { SnapshotSection::PositionX, SnapshotSection::PositionY, SnapshotSection::PositionZ,
+            SnapshotSection::VelocityX, SnapshotSection::VelocityY, SnapshotSection::VelocityZ,
+            SnapshotSection::AccelerationX, SnapshotSection::AccelerationY, SnapshotSection::AccelerationZ,
+            SnapshotSection::Mass, SnapshotSection::Radius,
+            SnapshotSection::PreviousX, SnapshotSection::PreviousY, SnapshotSection::PreviousZ };
+        for (size_t a = 0; a < sizeof(ids) / sizeof(ids[0]); ++a) {
+            size_t count;
+            if (Array(ids[a], count) == nullptr || count != n) {
+                std::cout << "ERROR::SNAPSHOT::MISSING_SECTION " << static_cast<uint32_t>(ids[a]) << std::endl;
+                return false;
+            }
+        }
+
+        if (header->integratorKind < 0 || header->integratorKind >= IntegratorKindCount) {
+            std::cout << "ERROR::SNAPSHOT::UNKNOWN_INTEGRATOR " << header->integratorKind << std::endl;
+            return false;
+        }
+        const std::string solver(header->solver, std::find(header->solver, header->solver + sizeof(header->solver), '\0'));
+        if (solver != "direct" && solver != "barnes-hut" && solver != "fmm") {
+            std::cout << "ERROR::SNAPSHOT::UNKNOWN_SOLVER " << solver << std::endl;
+            return false;
+        }
+
+        if (solver != simulation.Solver().Name()) {
+            if (solver == "barnes-hut") {
+                simulation.SetSolver(std::unique_ptr<GravitySolver>(new BarnesHutSolver(header->G, header->softening)));
+            }
+            else if (solver == "fmm") {
+                simulation.SetSolver(std::unique_ptr<GravitySolver>(new FmmSolver(header->G, header->softening)));
+            }
+            else {
+                simulation.SetSolver(std::unique_ptr<GravitySolver>(new DirectSummationSolver(header->G, header->softening)));
+            }
+        }
+        simulation.SetIntegrator(static_cast<IntegratorKind>(header->integratorKind));
+        for (size_t a = 0; a < sizeof(ids) / sizeof(ids[0]); ++a) {
+            size_t count;
+            const double* data = Array(ids[a], count);
+            targets[a]->assign(data, data + count);
+        }
+        simulation.time = header->time;
+        simulation.Solver().G = header->G;
+        simulation.Solver().softening = header->softening;
+
+        Integrator& integrator = simulation.CurrentIntegrator();
+        integrator.RestoreCounters(header->forceEvaluations, header->stepsTaken, header->rejectedSteps);
+        size_t stateCount;
+        const double* state = Array(SnapshotSection::IntegratorState, stateCount);
+        if (!integrator.LoadState(state, stateCount, header->accelerationsValid != 0)) {
+            integrator.Reset();
+        }
+        clock.fixedStep = header->fixedStep;
+        clock.timeScale = header->timeScale;
+        clock.Restore(header->clockTime, header->clockSteps);
+        simulation.conservation.Rebase();
+        return true;
+    }
+
+private:
+    MappedFile file;
+    const SnapshotHeader* header;
+
+    bool validate() const {
+        if (file.Size() < sizeof(SnapshotHeader)) {
+            return false;
+        }
+        const SnapshotHeader* h = reinterpret_cast<const SnapshotHeader*>(file.Data());
+        if (std::memcmp(h->magic, SnapshotMagic, sizeof(h->magic)) != 0) {
+            return false;
+        }
+        if (h->version != SnapshotVersion) {
+            std::cout << "ERROR::SNAPSHOT::UNSUPPORTED_VERSION " << h->version << std::endl;
+            return false;
+        }
+        if (h->headerBytes != sizeof(SnapshotHeader) || h->sectionCount > SnapshotHeader::MaxSections) {
+            return false;
+        }
+        for (uint32_t s = 0; s < h->sectionCount; ++s) {
+            const SnapshotSectionEntry& entry = h->sections[s];
+            if (entry.offset % sizeof(double) != 0 || entry.bytes % sizeof(double) != 0 ||
+                entry.offset > file.Size() || entry.bytes > file.Size() - entry.offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
@@ -0,0 +1,477 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "MappedFile.h"
+#include "NBody.h"
+
+// On-disk layout (little endian):
+//     TrajectoryHeader | blocks | TrajectoryIndexEntry[blockCount] | TrajectoryFooter
+// Positions are quantized to integers of `quantum` (twice the tolerance, so rounding stays within it).
+// A block holds `framesPerBlock` consecutive frames, body by body: the first frame as absolute values,
+// then the residual of a constant-velocity prediction (second difference), all as zigzag varints.
+// Smooth orbits leave residuals of a few quanta, so most values take one or two bytes. Every block
+// starts from absolute values, so any block decodes on its own; the index at the end maps frames to
+// blocks, and if it is missing (recording cut short) the blocks are found by walking their headers.
+struct TrajectoryHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t bodyCount;
+    uint32_t framesPerBlock;
+    uint32_t reserved;
+    double startTime;
+    double frameInterval;
+    double quantum;
+};
+
+struct TrajectoryBlockHeader {
+    uint32_t magic;
+    uint32_t frameCount;
+    uint64_t firstFrame;
+    uint64_t bytes;         // payload after this header
+};
+
+struct TrajectoryIndexEntry {
+    uint64_t offset;
+    uint64_t firstFrame;
+};
+
+struct TrajectoryFooter {
+    uint64_t indexOffset;
+    uint64_t blockCount;
+    uint64_t frameCount;
+    char magic[8];
+};
+
+const uint32_t TrajectoryVersion = 1;
+const char TrajectoryMagic[8] = { 'S', 'S', 'T', 'R', 'A', 'J', 0, 0 };
+const char TrajectoryIndexMagic[8] = { 'S', 'S', 'T', 'R', 'I', 'D', 'X', 0 };
+const uint32_t TrajectoryBlockMagic = 0x4b4c4254u;     // "TBLK"
+
+// Zigzag LEB128 varints for the signed residuals
+struct TrajectoryCoding {
+    static void Put(std::vector<unsigned char>& out, int64_t value) {
+        uint64_t bits = (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+        while (bits >= 0x80) {
+            out.push_back(static_cast<unsigned char>(bits | 0x80));
+            bits >>= 7;
+        }
+        out.push_back(static_cast<unsigned char>(bits));
+    }
+
+    // Returns false on a truncated or overlong value
+    static bool Get(const unsigned char*& in, const unsigned char* end, int64_t& value) {
+        uint64_t bits = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (in == end) {
+                return false;
+            }
+            unsigned char byte = *in++;
+            bits |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                value = static_cast<int64_t>(bits >> 1) ^ -static_cast<int64_t>(bits & 1);
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+// Streams body positions to disk, one frame every `frameInterval` of simulation time
+class TrajectoryRecorder {
+public:
+    TrajectoryRecorder() : bodyCount(0), framesPerBlock(0), quantum(1.0), frames(0), pendingFrames(0), bytes(0) {}
+
+    ~TrajectoryRecorder() {
+        Close();
+    }
+
+    bool Open(const std::string& path, size_t bodies, double startTime, double frameInterval, double tolerance,
+        unsigned blockFrames = 64) {
+        Close();
+        if (bodies == 0 || frameInterval <= 0.0 || tolerance <= 0.0 || blockFrames < 2) {
+            std::cout << "ERROR::TRAJECTORY::INVALID_SETTINGS" << std::endl;
+            return false;
+        }
+        out.open(path.c_str(), std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cout << "ERROR::TRAJECTORY::FILE_NOT_WRITTEN " << path << std::endl;
+            return false;
+        }
+        TrajectoryHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, TrajectoryMagic, sizeof(header.magic));
+        header.version = TrajectoryVersion;
+        header.bodyCount = static_cast<uint32_t>(bodies);
+        header.framesPerBlock = blockFrames;
+        header.startTime = startTime;
+        header.frameInterval = frameInterval;
+        header.quantum = 2.0 * tolerance;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        bodyCount = bodies;
+        framesPerBlock = blockFrames;
+        quantum = header.quantum;
+        frames = 0;
+        pendingFrames = 0;
+        bytes = sizeof(header);
+        pending.assign(static_cast<size_t>(blockFrames) * bodies * 3, 0);
+        index.clear();
+        return true;
+    }
+
+    bool IsOpen() const {
+        return out.is_open();
+    }
+
+    // Appends the current positions as the next frame; the body count must not change while recording
+    bool Record(const BodySystem& bodies) {
+        if (!IsOpen() || bodies.Size() != bodyCount) {
+            return false;
+        }
+        // Frame-major while collecting; encoded body by body when the block is full
+        int64_t* frame = &pending[pendingFrames * bodyCount * 3];
+        const double limit = 4.0e18;
+        for (size_t i = 0; i < bodyCount; ++i) {
+            const double values[3] = { bodies.x[i], bodies.y[i], bodies.z[i] };
+            for (int c = 0; c < 3; ++c) {
+                double q = std::max(-limit, std::min(limit, std::round(values[c] / quantum)));
+                frame[i * 3 + c] = static_cast<int64_t>(q);
+            }
+        }
+        ++frames;
+        if (++pendingFrames == framesPerBlock) {
+            return flushBlock();
+        }
+        return true;
+    }
+
+    // Writes the last partial block, the index and the footer
+    bool Close() {
+        if (!IsOpen()) {
+            return true;
+        }
+        bool ok = flushBlock();
+        uint64_t indexOffset = bytes;
+        if (!index.empty()) {
+            out.write(reinterpret_cast<const char*>(&index[0]), index.size() * sizeof(TrajectoryIndexEntry));
+        }
+        TrajectoryFooter footer;
+        footer.indexOffset = indexOffset;
+        footer.blockCount = index.size();
+        footer.frameCount = frames;
+        std::memcpy(footer.magic, TrajectoryIndexMagic, sizeof(footer.magic));
+        out.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+        bytes += index.size() * sizeof(TrajectoryIndexEntry) + sizeof(footer);
+        ok = ok && static_cast<bool>(out);
+        out.close();
+        if (!ok) {
+            std::cout << "ERROR::TRAJECTORY::FILE_NOT_WRITTEN" << std::endl;
+        }
+        return ok;
+    }
+
+    uint64_t Frames() const {
+        return frames;
+    }
+
+    // Bytes written so far, header included
+    uint64_t Bytes() const {
+        return bytes;
+    }
+
+private:
+    std::ofstream out;
+    size_t bodyCount;
+    unsigned framesPerBlock;
+    double quantum;
+    uint64_t frames;
+    unsigned pendingFrames;
+    uint64_t bytes;
+    std::vector<int64_t> pending;
+    std::vector<unsigned char> encoded;
+    std::vector<TrajectoryIndexEntry> index;
+
+    bool flushBlock() {
+        if (pendingFrames == 0) {
+            return true;
+        }
+        encoded.clear();
+        for (size_t i = 0; i < bodyCount; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                int64_t previous = 0, beforePrevious = 0;
+                for (unsigned f = 0; f < pendingFrames; ++f) {
+                    int64_t value = pending[(f * bodyCount + i) * 3 + c];
+                    int64_t prediction = f == 0 ? 0 : f == 1 ? previous : 2 * previous - beforePrevious;
+                    TrajectoryCoding::Put(encoded, value - prediction);
+                    beforePrevious = previous;
+                    previous = value;
+                }
+            }
+        }
+        TrajectoryBlockHeader block;
+        block.magic = TrajectoryBlockMagic;
+        block.frameCount = pendingFrames;
+        block.firstFrame = frames - pendingFrames;
+        block.bytes = encoded.size();
+        TrajectoryIndexEntry entry = { bytes, block.firstFrame };
+        index.push_back(entry);
+        out.write(reinterpret_cast<const char*>(&block), sizeof(block));
+        out.write(reinterpret_cast<const char*>(encoded.data()), static_cast<std::streamsize>(encoded.size()));
+        bytes += sizeof(block) + encoded.size();
+        pendingFrames = 0;
+        return static_cast<bool>(out);
+    }
+};
+
+// Random-access playback from a memory-mapped recording. A lookup decodes only the block holding the
+// requested frames; the two most recently used blocks stay decoded, so playing forward or backward,
+// at any speed, decodes each block about once per pass.
+class TrajectoryPlayer {
+public:
+    TrajectoryPlayer() : header(nullptr), frameCount(0), blocksDecoded(0), useCounter(0), reportedCorrupt(-1) {}
+
+    bool Open(const std::string& path) {
+        Close();
+        if (!file.Open(path)) {
+            std::cout << "ERROR::TRAJECTORY::FILE_NOT_FOUND " << path << std::endl;
+            return false;
+        }
+        if (!readIndex()) {
+            std::cout << "ERROR::TRAJECTORY::INVALID_FILE " << path << std::endl;
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close() {
+        file.Close();
+        header = nullptr;
+        index.clear();
+        frameCount = 0;
+        reportedCorrupt = -1;
+        for (int c = 0; c < 2; ++c) {
+            cache[c].block = -1;
+        }
+    }
+
+    bool IsOpen() const {
+        return header != nullptr;
+    }
+
+    size_t BodyCount() const {
+        return header->bodyCount;
+    }
+
+    uint64_t Frames() const {
+        return frameCount;
+    }
+
+    double StartTime() const {
+        return header->startTime;
+    }
+
+    double EndTime() const {
+        return header->startTime + header->frameInterval * static_cast<double>(frameCount > 0 ? frameCount - 1 : 0);
+    }
+
+    // Largest position error of the quantization
+    double Tolerance() const {
+        return 0.5 * header->quantum;
+    }
+
+    unsigned long long BlocksDecoded() const {
+        return blocksDecoded;
+    }
+
+    // Recorded position of `body` at frame `frame`
+    glm::dvec3 FramePosition(size_t body, uint64_t frame) {
+        frame = std::min<uint64_t>(frame, frameCount - 1);
+        const DecodedBlock& block = decoded(blockOf(frame));
+        const double* p = &block.positions[((frame - block.firstFrame) * header->bodyCount + body) * 3];
+        return glm::dvec3(p[0], p[1], p[2]);
+    }
+
+    // Position at time t, linear between the neighbouring frames and clamped to the recording
+    glm::dvec3 Position(size_t body, double t) {
+        double f = (t - header->startTime) / header->frameInterval;
+        f = std::max(0.0, std::min(f, static_cast<double>(frameCount - 1)));
+        uint64_t frame = static_cast<uint64_t>(f);
+        double alpha = f - static_cast<double>(frame);
+        glm::dvec3 a = FramePosition(body, frame);
+        if (alpha == 0.0 || frame + 1 >= frameCount) {
+            return a;
+        }
+        return a + (FramePosition(body, frame + 1) - a) * alpha;
+    }
+
+private:
+    struct DecodedBlock {
+        long block = -1;
+        uint64_t firstFrame = 0;
+        unsigned long long lastUse = 0;
+        std::vector<double> positions;      // frame-major, three per body
+    };
+
+    MappedFile file;
+    const TrajectoryHeader* header;
+    std::vector<TrajectoryIndexEntry> index;
+    uint64_t frameCount;
+    DecodedBlock cache[2];
+    unsigned long long blocksDecoded;
+    unsigned long long useCounter;
+    long reportedCorrupt;       // last block reported as corrupt, so a bad block is not reported every frame
+    std::vector<int64_t> residuals;
+
+    const TrajectoryBlockHeader* blockHeader(size_t b) const {
+        return reinterpret_cast<const TrajectoryBlockHeader*>(file.Data() + index[b].offset);
+    }
+
+    bool validBlockAt(uint64_t offset, uint64_t limit) const {
+        if (offset > limit || limit - offset < sizeof(TrajectoryBlockHeader)) {
+            return false;
+        }
+        TrajectoryBlockHeader block;
+        std::memcpy(&block, file.Data() + offset, sizeof(block));
+        return block.magic == TrajectoryBlockMagic && block.frameCount > 0 &&
+            block.frameCount <= header->framesPerBlock && block.bytes <= limit - offset - sizeof(block);
+    }
+
+    bool readIndex() {
+        if (file.Size() < sizeof(TrajectoryHeader)) {
+            return false;
+        }
+        header = reinterpret_cast<const TrajectoryHeader*>(file.Data());
+        if (std::memcmp(header->magic, TrajectoryMagic, sizeof(header->magic)) != 0 ||
+            header->version != TrajectoryVersion || header->bodyCount == 0 || header->framesPerBlock == 0 ||
+            !(header->frameInterval > 0.0) || !(header->quantum > 0.0)) {
+            header = nullptr;
+            return false;
+        }
+
+        // The footer's index, if the recording was closed properly
+        uint64_t dataEnd = file.Size();
+        if (file.Size() >= sizeof(TrajectoryHeader) + sizeof(TrajectoryFooter)) {
+            TrajectoryFooter footer;
+            std::memcpy(&footer, file.Data() + file.Size() - sizeof(footer), sizeof(footer));
+            uint64_t indexBytes = footer.blockCount * sizeof(TrajectoryIndexEntry);
+            if (std::memcmp(footer.magic, TrajectoryIndexMagic, sizeof(footer.magic)) == 0 &&
+                footer.indexOffset + indexBytes + sizeof(footer) == file.Size()) {
+                index.resize(static_cast<size_t>(footer.blockCount));
+                if (!index.empty()) {
+                    std::memcpy(&index[0], file.Data() + footer.indexOffset, indexBytes);
+                }
+                dataEnd = footer.indexOffset;
+                // Every entry must point at a valid block that starts where the previous one ended, and the
+                // blocks must cover exactly the footer's frames, so any frame falls inside its block
+                uint64_t covered = 0;
+                for (size_t b = 0; b < index.size(); ++b) {
+                    if (!validBlockAt(index[b].offset, dataEnd) || index[b].firstFrame != covered ||
+                        blockHeader(b)->firstFrame != covered) {
+                        header = nullptr;
+                        return false;
+                    }
+                    covered += blockHeader(b)->frameCount;
+                }
+                if (covered != footer.frameCount) {
+                    header = nullptr;
+                    return false;
+                }
+                frameCount = covered;
+                return frameCount > 0;
+            }
+        }
+
+        // No footer: walk the block headers and keep every complete block that continues the frames
+        uint64_t offset = sizeof(TrajectoryHeader);
+        while (validBlockAt(offset, dataEnd)) {
+            TrajectoryBlockHeader block;
+            std::memcpy(&block, file.Data() + offset, sizeof(block));
+            if (block.firstFrame != frameCount) {
+                break;
+            }
+            TrajectoryIndexEntry entry = { offset, block.firstFrame };
+            index.push_back(entry);
+            frameCount = block.firstFrame + block.frameCount;
+            offset += sizeof(block) + block.bytes;
+        }
+        return frameCount > 0;
+    }
+
+    size_t blockOf(uint64_t frame) const {
+        size_t low = 0, high = index.size();
+        while (high - low > 1) {
+            size_t middle = (low + high) / 2;
+            if (index[middle].firstFrame <= frame) {
+                low = middle;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return low;
+    }
+
+    const DecodedBlock& decoded(size_t b) {
+        ++useCounter;
+        for (int c = 0; c < 2; ++c) {
+            if (cache[c].block == static_cast<long>(b)) {
+                cache[c].lastUse = useCounter;
+                return cache[c];
+            }
+        }
+        DecodedBlock& slot = cache[0].lastUse <= cache[1].lastUse ? cache[0] : cache[1];
+        if (!decode(b, slot)) {
+            // The zero-filled positions are still read, but the half-decoded block is not kept
+            slot.block = -1;
+            slot.lastUse = 0;
+            return slot;
+        }
+        slot.lastUse = useCounter;
+        return slot;
+    }
+
+    bool decode(size_t b, DecodedBlock& slot) {
+        const TrajectoryBlockHeader* block = blockHeader(b);
+        const size_t bodies = header->bodyCount;
+        const unsigned frames = block->frameCount;
+        const unsigned char* in = reinterpret_cast<const unsigned char*>(block + 1);
+        const unsigned char* end = in + block->bytes;
+        slot.block = static_cast<long>(b);
+        slot.firstFrame = block->firstFrame;
+        slot.positions.assign(static_cast<size_t>(frames) * bodies * 3, 0.0);
+        for (size_t i = 0; i < bodies; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                int64_t previous = 0, beforePrevious = 0;
+                for (unsigned f = 0; f < frames; ++f) {
+                    int64_t residual = 0;
+                    if (!TrajectoryCoding::Get(in, end, residual)) {
+                        if (reportedCorrupt != static_cast<long>(b)) {
+                            std::cout << "ERROR::TRAJECTORY::CORRUPT_BLOCK " << b << std::endl;
+                            reportedCorrupt = static_cast<long>(b);
+                        }
+                        std::fill(slot.positions.begin(), slot.positions.end(), 0.0);
+                        return false;
+                    }
+                    int64_t prediction = f == 0 ? 0 : f == 1 ? previous : 2 * previous - beforePrevious;
+                    int64_t value = prediction + residual;
+                    slot.positions[(static_cast<size_t>(f) * bodies + i) * 3 + c] = static_cast<double>(value) * header->quantum;
+                    beforePrevious = previous;
+                    previous = value;
+                }
+            }
+        }
+        ++blocksDecoded;
+        return true;
+    }
+};
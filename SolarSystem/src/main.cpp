@@ -16,30 +16,96 @@
 #include <stdio.h>
 #include "Texture.h"
 #include "Skybox.h"
+#include "SimulationClock.h"
+#include "Simulation.h"
+#include "BarnesHut.h"
+#include "FMM.h"
+#include "Kepler.h"
+#include "Ephemeris.h"
+#include "Snapshot.h"
+#include "Trajectory.h"
+#include "AsteroidBelt.h"
+#include "Satellites.h"
+#include "Bvh.h"
+#include "Eclipses.h"
+#include "FrameProfiler.h"
+#include "SceneGraph.h"
+#include "RenderQueue.h"
 using namespace std;
 
 int SCREEN_WIDTH = 1000;
 int SCREEN_HEIGHT = 750;
 
-// Light attributes
+// Light attributes; while drawing they hold the suns' positions relative to the camera
 glm::vec3 lightPositions[] =
 {
     glm::vec3(0.0f, 0.0f, 0.0f),
-    glm::vec3(0.0f, 0.0f, -20.0f)
+    glm::vec3(0.0f, 0.0f, -6.0f)
 };
 
 // Function prototypes
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void MouseCallback(GLFWwindow* window, double xPos, double yPos);
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int mode);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
-void DoMovement(Planet& planetHelper);
+void DoMovement(Planet& planetHelper, SimulationClock& clock, NBodySimulation& simulation, KeplerOrbits& keplerOrbits,
+    Ephemeris& ephemeris);
+double CatalogAxisToScene(double au);
 
 // Camera
 Camera camera(glm::vec3(-20.0f, 10.0f, 10.0f));
 bool keys[1024];
+// Keys pressed since the last DoMovement: state changes act once per press, not every frame a key is held
+bool keysPressed[1024];
 GLfloat lastX = (float)SCREEN_WIDTH / 2.0, lastY = (float)SCREEN_HEIGHT / 2.0;
 bool firstMouse = true;
 string cameraType = "";
+// Kepler mode places bodies on two-body orbits at the clock time, so the clock can seek instantly
+bool keplerMode = false;
+double seekStep = 10.0;
+// Ephemeris mode replays precomputed Chebyshev fits of the n-body run from a mapped file
+bool ephemerisMode = false;
+EphemerisSettings ephemerisSettings;
+const char* ephemerisPath = "solarsystem.eph";
+// Checkpoints of the n-body run, written in the background and restored from a mapped file
+SnapshotWriter snapshotWriter;
+const char* snapshotPath = "solarsystem.snap";
+// Trajectory recording of the n-body run (one frame per step) and playback from the mapped file
+TrajectoryRecorder trajectoryRecorder;
+TrajectoryPlayer trajectoryPlayer;
+const char* trajectoryPath = "solarsystem.traj";
+double trajectoryTolerance = 1e-5;
+bool playbackMode = false;
+double playbackTime = 0.0;
+double playbackDirection = 1.0;
+// Energy and momentum drift of the n-body run, sampled once a second of simulation steps
+const char* conservationPath = "solarsystem-conservation.csv";
+unsigned conservationCadence = 60;
+size_t reportedConservation = 0;
+// Asteroid belt between Mars and Jupiter, read from an MPC catalog when there is one, else generated on first use
+bool beltVisible = false;
+size_t beltCount = 1000000;
+const char* catalogPath = "MPCORB.DAT";
+// Earth satellites from a TLE file when there is one, else a generated constellation. Their clock starts at
+// the latest element epoch and runs at the scene's year of about 75 time units.
+bool satellitesVisible = false;
+size_t satelliteCount = 50000;
+const char* satellitePath = "satellites.tle";
+const double satelliteDaysPerUnit = 365.25 / 75.0;
+// Eclipses and transits of the suns seen from the planets, tabulated for the next century of a Kepler fit
+bool eclipsesRequested = false;
+double eclipseYears = 100.0;
+const char* eclipsePath = "solarsystem-eclipses.csv";
+// Selection: a left click picks the body, asteroid or satellite under the crosshair, 3 follows it and H
+// lists its nearest neighbours. Each kind has a pick tree over camera-relative positions; the bodies' is
+// refit every frame, the belt's and the satellites' when they are queried.
+enum class SelectionKind { None, Body, Asteroid, Satellite };
+SelectionKind selectionKind = SelectionKind::None;
+size_t selectionIndex = 0;
+bool pickRequested = false;
+bool neighboursRequested = false;
+const float pickSlope = 0.01f;      // rays count as hitting anything within about half a degree
+FrameProfiler profiler;
 
 // Time
 GLfloat deltaTime = 0.0f;
@@ -68,6 +134,7 @@ int main()
     glfwGetFramebufferSize(window, &SCREEN_WIDTH, &SCREEN_HEIGHT);
     glfwSetKeyCallback(window, KeyCallback);
     glfwSetCursorPosCallback(window, MouseCallback);
+    glfwSetMouseButtonCallback(window, MouseButtonCallback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     glewExperimental = GL_TRUE;
     if (GLEW_OK != glewInit())
@@ -84,6 +151,7 @@ int main()
     Shader lampShader("../resources/shaders/lamp.vs", "../resources/shaders/lamp.frag");
     Shader lineShader("../resources/shaders/line.vs", "../resources/shaders/line.frag");
     Shader skyboxShader("../resources/shaders/skybox.vs", "../resources/shaders/skybox.frag");
+    Shader asteroidShader("../resources/shaders/asteroid.vs", "../resources/shaders/asteroid.frag");
 
     // Load models    
     Model earthModel("../resources/models/earth/Earth.obj");
@@ -101,14 +169,103 @@ int main()
     Planet planetHelper(lightPositions);
     glm::vec3 centerOfMass = planetHelper.centerOfMass;
 
+    // Bodies are integrated by the N-body engine (G = 1, suns totalling 171). Planet masses are the real
+    // planet/sun ratios scaled down by 1000 so the compressed spacing of the scene stays stable.
+    NBodySimulation simulation;
+    size_t suns[2];
+    planetHelper.addSuns(simulation, suns);
+    size_t mercury = planetHelper.addPlanet(simulation, 250.0f, 2.8e-8);
+    size_t venus = planetHelper.addPlanet(simulation, 270.0f, 4.2e-7);
+    size_t earth = planetHelper.addPlanet(simulation, 290.0f, 5.1e-7);
+    size_t mars = planetHelper.addPlanet(simulation, 310.0f, 5.5e-8);
+    size_t jupiter = planetHelper.addPlanet(simulation, 360.0f, 1.63e-4);
+    size_t saturn = planetHelper.addPlanet(simulation, 430.0f, 4.9e-5);
+    size_t uranus = planetHelper.addPlanet(simulation, 480.0f, 7.5e-6);
+    size_t neptune = planetHelper.addPlanet(simulation, 530.0f, 8.8e-6);
+    std::vector<std::string> bodyNames(simulation.bodies.Size());
+    const size_t namedBodies[10] = { suns[0], suns[1], mercury, venus, earth, mars, jupiter, saturn, uranus, neptune };
+    const char* names[10] = { "Sun", "Red sun", "Mercury", "Venus", "Earth", "Mars", "Jupiter", "Saturn", "Uranus", "Neptune" };
+    // Drawn radii: node size * scale * mesh radius (2.49 for the sphere meshes, 483 to 492 for Saturn with its
+    // rings, Uranus and Neptune)
+    const double drawnRadii[10] = { 4.984, 1.744, 0.0748, 0.1246, 0.1246, 0.0748, 0.997, 1.547, 1.477, 1.470 };
+    std::vector<double> bodyRadii(simulation.bodies.Size(), 0.0);
+    for (size_t b = 0; b < 10; ++b) {
+        bodyNames[namedBodies[b]] = names[b];
+        bodyRadii[namedBodies[b]] = drawnRadii[b];
+    }
+
     //Skybox
     Skybox skybox;
     unsigned int cubemapTexture = TextureLoading::LoadCubemap(skybox.faces);
 
     // Perspective Projection
-    glm::mat4 projection = glm::perspective(camera.GetZoom(), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
-
-    GLuint i = 0;
+    // Everything is drawn relative to the camera, so the range is only limited by depth precision
+    glm::mat4 projection = glm::perspective(camera.GetZoom(), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.01f, 10000.0f);
+
+    // Simulation time advances in fixed steps, independent of the frame rate
+    SimulationClock clock;
+    KeplerOrbits keplerOrbits;
+    std::vector<double> keplerX, keplerY, keplerZ;
+    Ephemeris ephemeris;
+    size_t reportedEncounters = 0;
+    simulation.collisions.encounterDistance = 2.0;
+    AsteroidBelt asteroidBelt;
+    SatelliteSwarm satellites;
+    double satelliteEpoch = 0.0;
+    SphereBvh bodyTree;
+
+    // Scene graph: every planet is a frame node that follows its body, with the spinning mesh and any
+    // moons as children. The draw list reads the graph's world transforms and is culled on the job system.
+    SceneGraph scene;
+    RenderQueue planetQueue;
+    std::vector<std::pair<size_t, SceneGraph::Handle>> bodyNodes;
+    auto addPlanetNode = [&](size_t body, Model &model, float size, float rotationSpeed,
+        glm::vec3 axis = glm::vec3(0.0f, 0.1f, 0.0f), const glm::mat4 &tilt = glm::mat4(1)) {
+        SceneGraph::Handle frame = scene.AddNode();
+        bodyNodes.push_back(std::make_pair(body, frame));
+        SceneGraph::Handle mesh = scene.AddNode(frame);
+        scene.SetSpin(mesh, 0.06f * rotationSpeed, axis, glm::scale(glm::mat4(1), glm::vec3(size * planetHelper.scale)));
+        // A fixed tilt is a static child of the spinning node
+        planetQueue.Add(tilt == glm::mat4(1) ? mesh : scene.AddNode(mesh, glm::dvec3(0.0), tilt), model);
+        return frame;
+    };
+    addPlanetNode(mercury, mercuryModel, 0.3f, 40.0f);
+    addPlanetNode(venus, venusModel, 0.5f, 40.0f);
+    SceneGraph::Handle earthNode = addPlanetNode(earth, earthModel, 0.5f, 40.0f);
+    addPlanetNode(mars, marsModel, 0.3f, 40.0f);
+    SceneGraph::Handle jupiterNode = addPlanetNode(jupiter, jupiterModel, 4.0f, 30.0f);
+    glm::mat4 saturnTilt = glm::rotate(glm::mat4(1), 61.0f, glm::vec3(0.0f, 0.1f, 0.0f));
+    saturnTilt = glm::rotate(saturnTilt, 90.0f, glm::vec3(0.1f, 0.0f, 0.0f));
+    SceneGraph::Handle saturnNode = addPlanetNode(saturn, saturnModel, 0.032f, 20.0f, glm::vec3(0.0f, 0.5f, -0.35f), saturnTilt);
+    addPlanetNode(uranus, uranusModel, 0.03f, 10.0f);
+    addPlanetNode(neptune, neptuneModel, 0.03f, 10.0f);
+
+    // Moons are kinematic circular orbits around their planet's frame; distance in scene units,
+    // period in simulation time (Earth's year is about 75)
+    struct MoonSpec {
+        SceneGraph::Handle planet;
+        double distance;
+        double period;
+        float size;
+    };
+    const MoonSpec moons[] = {
+        { earthNode, 1.2, 5.6, 0.14f },         // Moon
+        { jupiterNode, 2.4, 0.36, 0.15f },      // Io
+        { jupiterNode, 3.0, 0.73, 0.13f },      // Europa
+        { jupiterNode, 3.8, 1.47, 0.22f },      // Ganymede
+        { jupiterNode, 5.0, 3.43, 0.2f },       // Callisto
+        { saturnNode, 2.2, 0.93, 0.08f },       // Rhea
+        { saturnNode, 3.4, 3.27, 0.21f },       // Titan
+        { saturnNode, 4.4, 16.2, 0.08f }        // Iapetus
+    };
+    for (size_t m = 0; m < sizeof(moons) / sizeof(moons[0]); ++m) {
+        SceneGraph::Handle orbit = scene.AddNode(moons[m].planet);
+        scene.SetOrbit(orbit, moons[m].distance, moons[m].period, 2.4 * m);
+        SceneGraph::Handle mesh = scene.AddNode(orbit, glm::dvec3(0.0),
+            glm::scale(glm::mat4(1), glm::vec3(moons[m].size * planetHelper.scale)));
+        planetQueue.Add(mesh, mercuryModel);
+    }
+    snapshotWriter.Reserve(simulation, clock);
 
     // Main loop
     while (!glfwWindowShouldClose(window))
@@ -117,25 +274,246 @@ int main()
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
-        if (planetHelper.move) {
-            i++;
-        }       
+        profiler.Begin("input");
         glfwPollEvents();
-        DoMovement(planetHelper);
+        DoMovement(planetHelper, clock, simulation, keplerOrbits, ephemeris);
+
+        profiler.Begin("physics");
+        clock.Advance(deltaTime);
+        while (clock.ConsumeStep()) {
+            if (!keplerMode && !ephemerisMode && !playbackMode) {
+                simulation.Step(clock.fixedStep);
+                trajectoryRecorder.Record(simulation.bodies);
+            }
+        }
+        // Playback runs its own time so it can go backward; the scale and pause of the clock still apply
+        if (playbackMode && !clock.paused) {
+            playbackTime += playbackDirection * deltaTime * clock.timeScale;
+            playbackTime = std::max(trajectoryPlayer.StartTime(), std::min(playbackTime, trajectoryPlayer.EndTime()));
+        }
+        // Report encounters logged by the steps above; merging stays off since the scene keeps body indices.
+        // Counts are of every record ever logged, since the log drops its oldest records when it is full.
+        const size_t dropped = simulation.encountersDropped, logged = dropped + simulation.encounterLog.size();
+        if (reportedEncounters < dropped) {
+            std::cout << "ENCOUNTER : " << dropped - reportedEncounters << " dropped from the full log unreported"
+                << std::endl;
+            reportedEncounters = dropped;
+        }
+        for (size_t e = reportedEncounters; e < logged; ++e) {
+            const EncounterRecord& record = simulation.encounterLog[e - dropped];
+            std::cout << "ENCOUNTER : t " << record.time << ", bodies " << record.first << " and " << record.second
+                << ", distance " << record.distance << std::endl;
+        }
+        reportedEncounters = logged;
+        if (simulation.conservation.cadence > 0 && simulation.conservation.Samples() >= reportedConservation + 10) {
+            ConservationDrift drift = simulation.conservation.Drift();
+            std::cout << "CONSERVATION : t " << simulation.conservation.Latest().time << ", |dE/E| " << drift.energy
+                << ", |dP|/P " << drift.momentum << ", |dL|/L " << drift.angularMomentum << " (worst |dE/E| "
+                << simulation.conservation.WorstDrift().energy << ")" << std::endl;
+            reportedConservation = simulation.conservation.Samples();
+        }
+        double renderTime = playbackMode ? playbackTime : clock.RenderTime();
+        float simTime = static_cast<float>(renderTime);
+        double alpha = clock.Alpha();
+        glm::dvec3 keplerCenter = planetHelper.keplerCenterAt(renderTime);
+        if (keplerMode) {
+            keplerOrbits.Propagate(renderTime, keplerX, keplerY, keplerZ);
+        }
+        // World positions stay in double; the camera is the floating origin everything is drawn from
+        auto bodyPosition = [&](size_t i) {
+            if (keplerMode) {
+                return keplerCenter + glm::dvec3(keplerX[i], keplerY[i], keplerZ[i]);
+            }
+            if (ephemerisMode) {
+                return ephemeris.Position(i, renderTime);
+            }
+            if (playbackMode) {
+                return trajectoryPlayer.Position(i, renderTime);
+            }
+            return simulation.WorldPosition(i, alpha);
+        };
+        glm::dvec3 origin = camera.GetWorldPosition();
+        lightPositions[0] = glm::vec3(bodyPosition(suns[0]) - origin);
+        lightPositions[1] = glm::vec3(bodyPosition(suns[1]) - origin);
+
+        profiler.Begin("belt update");
+        asteroidBelt.visible = beltVisible;
+        if (beltVisible && asteroidBelt.Size() == 0) {
+            double beltMu = simulation.Solver().G * planetHelper.starMass;
+            OrbitCatalog catalog;
+            CatalogStats catalogStats;
+            std::ifstream probe(catalogPath);
+            if (probe && CatalogLoader::Load(catalogPath, catalog, &catalogStats)) {
+                asteroidBelt.Load(catalog, beltMu, CatalogAxisToScene, Planet::sceneFrame(), beltCount);
+                std::cout << "Loaded " << asteroidBelt.Size() << " of " << catalogStats.records << " catalog orbits in "
+                    << catalogStats.seconds << " s" << (catalogStats.fromSidecar ? " from the cache" : "") << std::endl;
+            }
+            else {
+                asteroidBelt.Generate(beltCount, beltMu, 32.0, 35.0, Planet::sceneFrame());
+            }
+        }
+        asteroidBelt.Update(renderTime, keplerCenter - origin);
+
+        // Satellites in TEME km around Earth, scaled so Earth's radius is the model's (Earth.obj is 2.49 across)
+        profiler.Begin("satellites update");
+        satellites.visible = satellitesVisible;
+        if (satellitesVisible && satellites.Size() == 0) {
+            std::vector<TwoLineElements> elements;
+            size_t rejected = 0;
+            std::ifstream probe(satellitePath);
+            if (!(probe && TleReader::Load(satellitePath, elements, &rejected) && !elements.empty())) {
+                elements = GenerateConstellation(satelliteCount, 2460600.5);
+            }
+            satellites.Load(elements, 0.002f);
+            satelliteEpoch = satellites.LatestEpoch();
+            std::cout << "Loaded " << satellites.Size() << " satellites (" << satellites.orbits.DeepSpaceCount()
+                << " deep-space, " << rejected << " element sets rejected)" << std::endl;
+        }
+        const double satelliteDate = satelliteEpoch + renderTime * satelliteDaysPerUnit;
+        const glm::dmat3 satelliteFrame = Planet::sceneFrame() * (0.5 * planetHelper.scale * 2.49 / Sgp4Orbits::EarthRadius);
+        const glm::dvec3 earthCenter = bodyPosition(earth) - origin;
+        satellites.Update(satelliteDate, satelliteFrame, earthCenter);
+
+        profiler.Begin("picking");
+        bodyTree.Resize(simulation.bodies.Size());
+        for (size_t i = 0; i < bodyTree.Size(); ++i) {
+            glm::vec3 position(bodyPosition(i) - origin);
+            std::copy(&position.x, &position.x + 3, bodyTree.Positions() + 3 * i);
+            bodyTree.Radii()[i] = i == suns[0] || i == suns[1] ? 1.5f : 0.5f;
+        }
+        bodyTree.Update();
+        auto bodyName = [&](size_t i) {
+            return i < bodyNames.size() && !bodyNames[i].empty() ? bodyNames[i] : "body " + std::to_string(i);
+        };
+        auto selectionName = [&]() {
+            return selectionKind == SelectionKind::Body ? bodyName(selectionIndex) :
+                selectionKind == SelectionKind::Satellite ? satellites.names[selectionIndex] :
+                "asteroid " + std::to_string(selectionIndex);
+        };
+        if (selectionKind == SelectionKind::Asteroid && (!asteroidBelt.visible || selectionIndex >= asteroidBelt.Size())) {
+            selectionKind = SelectionKind::None;
+        }
+        if (selectionKind == SelectionKind::Satellite && (!satellites.visible || selectionIndex >= satellites.Size())) {
+            selectionKind = SelectionKind::None;
+        }
+        if (pickRequested) {
+            pickRequested = false;
+            BvhHit bodyHit, asteroidHit, satelliteHit;
+            bool body = bodyTree.Raycast(glm::vec3(0.0f), camera.GetFront(), pickSlope, bodyHit);
+            bool asteroid = asteroidBelt.visible && asteroidBelt.PickTree(renderTime, keplerCenter - origin).Raycast(
+                glm::vec3(0.0f), camera.GetFront(), pickSlope, asteroidHit);
+            bool satellite = satellites.visible && satellites.PickTree(satelliteDate, satelliteFrame, earthCenter).Raycast(
+                glm::vec3(0.0f), camera.GetFront(), pickSlope, satelliteHit);
+            if (satellite && (!body || satelliteHit.distance < bodyHit.distance) &&
+                (!asteroid || satelliteHit.distance < asteroidHit.distance)) {
+                selectionKind = SelectionKind::Satellite;
+                selectionIndex = satelliteHit.index;
+            }
+            else if (asteroid && (!body || asteroidHit.distance < bodyHit.distance)) {
+                selectionKind = SelectionKind::Asteroid;
+                selectionIndex = asteroidHit.index;
+            }
+            else if (body) {
+                selectionKind = SelectionKind::Body;
+                selectionIndex = bodyHit.index;
+            }
+            else {
+                selectionKind = SelectionKind::None;
+            }
+            std::cout << "SELECTED : " << (selectionKind == SelectionKind::None ? "nothing" : selectionName()) << std::endl;
+        }
+        // Camera-relative position of the selection (the camera itself when nothing is selected)
+        glm::vec3 selectionPosition = selectionKind == SelectionKind::Body ? bodyTree.Position(selectionIndex) :
+            selectionKind == SelectionKind::Asteroid ?
+            glm::vec3(keplerCenter - origin + asteroidBelt.orbits.Position(selectionIndex, renderTime)) :
+            selectionKind == SelectionKind::Satellite ?
+            glm::vec3(earthCenter + satelliteFrame * satellites.orbits.Position(selectionIndex, satelliteDate)) : glm::vec3(0.0f);
+        if (neighboursRequested) {
+            neighboursRequested = false;
+            std::vector<BvhHit> nearest;
+            std::cout << "NEAREST to " << (selectionKind == SelectionKind::None ? "the camera" : selectionName()) << " :";
+            bodyTree.Nearest(selectionPosition, 4, nearest);
+            for (size_t k = 0; k < nearest.size(); ++k) {
+                if (selectionKind != SelectionKind::Body || nearest[k].index != selectionIndex) {
+                    std::cout << " " << bodyName(nearest[k].index) << " " << nearest[k].distance << ",";
+                }
+            }
+            if (asteroidBelt.visible) {
+                asteroidBelt.PickTree(renderTime, keplerCenter - origin).Nearest(selectionPosition, 6, nearest);
+                for (size_t k = 0; k < nearest.size(); ++k) {
+                    if (selectionKind != SelectionKind::Asteroid || nearest[k].index != selectionIndex) {
+                        std::cout << " asteroid " << nearest[k].index << " " << nearest[k].distance << ",";
+                    }
+                }
+            }
+            if (satellites.visible) {
+                satellites.PickTree(satelliteDate, satelliteFrame, earthCenter).Nearest(selectionPosition, 6, nearest);
+                for (size_t k = 0; k < nearest.size(); ++k) {
+                    if (selectionKind != SelectionKind::Satellite || nearest[k].index != selectionIndex) {
+                        std::cout << " " << satellites.names[nearest[k].index] << " " << nearest[k].distance << ",";
+                    }
+                }
+            }
+            std::cout << std::endl;
+        }
+        if (eclipsesRequested) {
+            eclipsesRequested = false;
+            if (ephemerisMode || playbackMode) {
+                std::cout << "Leave ephemeris mode (E) or playback (T) first" << std::endl;
+            }
+            else {
+                KeplerOrbits fitted;
+                if (!keplerMode) {
+                    simulation.time = clock.Time();
+                }
+                if (keplerMode || planetHelper.fitKeplerOrbits(simulation, fitted)) {
+                    const KeplerOrbits& orbits = keplerMode ? keplerOrbits : fitted;
+                    auto state = [&](size_t i, double t, glm::dvec3& position, glm::dvec3& velocity) {
+                        orbits.State(i, t, position, velocity);
+                    };
+                    EclipseSettings settings;
+                    settings.start = clock.Time();
+                    settings.end = settings.start + eclipseYears * 75.0;
+                    EclipseStats stats;
+                    std::vector<uint32_t> sources = { static_cast<uint32_t>(suns[0]), static_cast<uint32_t>(suns[1]) };
+                    std::vector<EclipseEvent> events = EclipseSearch::Search(state,
+                        EclipseSearch::Bodies(orbits, bodyRadii), sources, settings, &stats);
+                    std::ofstream table(eclipsePath, std::ios::trunc);
+                    table << "start,maximum,end,occulter,source,observer,kind,central,magnitude\n";
+                    for (size_t e = 0; e < events.size(); ++e) {
+                        const EclipseEvent& event = events[e];
+                        table << event.start << "," << event.maximum << "," << event.end << ","
+                            << bodyName(event.occulter) << "," << bodyName(event.source) << "," << bodyName(event.observer) << ","
+                            << (event.kind == EclipseKind::Eclipse ? "eclipse" : "transit") << "," << event.central << ","
+                            << event.magnitude << "\n";
+                    }
+                    std::cout << "ECLIPSES : " << events.size() << " in the next " << eclipseYears << " years, "
+                        << stats.seconds << " s, to " << eclipsePath << std::endl;
+                    if (!table) {
+                        std::cout << "ERROR::ECLIPSES::WRITE_FAILED " << eclipsePath << std::endl;
+                    }
+                }
+            }
+        }
+
+        profiler.Begin("planets");
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         glm::mat4 view(1);
-        view = camera.GetViewMatrix();
-        std::tuple<glm::mat4, GLfloat, GLfloat> modelAndCoordinates;        
-        glm::mat4 model(1);        
+        view = camera.GetRotationMatrix();
+        for (size_t b = 0; b < bodyNodes.size(); ++b) {
+            scene.SetTranslation(bodyNodes[b].second, bodyPosition(bodyNodes[b].first));
+        }
+        scene.Animate(renderTime);
+        scene.Update();
+        planetQueue.Prepare(scene, origin, projection * view);
 
         //PLANETS
 
-        GLfloat angle, radius, x, y;
         modelShader.Use();
         GLint viewPosLoc = glGetUniformLocation(modelShader.Program, "viewPos");
-        glUniform3f(viewPosLoc, camera.GetPosition().x, camera.GetPosition().y, camera.GetPosition().z);        
+        glUniform3f(viewPosLoc, 0.0f, 0.0f, 0.0f);        
 
         // Set lights properties
 
@@ -160,58 +538,49 @@ int main()
         glUniformMatrix4fv(glGetUniformLocation(modelShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
         glUniformMatrix4fv(glGetUniformLocation(modelShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
 
-        // Mercury
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 1.0f, 250.0f, 0.3f, 40.0f);
-        mercuryModel.Draw(modelShader);
+        planetQueue.Draw(modelShader);
 
-        // Venus
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.9f, 270.0f, 0.5f, 40.0f);
-        venusModel.Draw(modelShader);
-
-        // Earth
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.8f, 290.0f, 0.5f, 40.0f);
-        earthModel.Draw(modelShader);
-
-        if (cameraType == "Earth") {
-            glm::vec3 cameraPosition = (glm::vec3(get<1>(modelAndCoordinates), 0.2f, get<2>(modelAndCoordinates)) + centerOfMass);
+        if (cameraType == "Follow") {
+            glm::dvec3 followed = selectionKind == SelectionKind::None ? bodyPosition(earth) :
+                origin + glm::dvec3(selectionPosition);
+            glm::dvec3 cameraPosition = followed + glm::dvec3(0.0, 0.2, 0.0);
             camera.SetPosition(cameraPosition);
 
             // Calculate the direction vector pointing towards the center of mass
-            glm::vec3 direction = glm::normalize(centerOfMass - cameraPosition);
+            glm::vec3 direction = glm::vec3(glm::normalize(glm::dvec3(centerOfMass) - cameraPosition));
             float newYaw = glm::degrees(atan2(direction.z, direction.x));
             float newPitch = glm::degrees(asin(direction.y));
             camera.SetOrientation(newYaw, newPitch);
         }
 
-        // Mars
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.7f, 310.0f, 0.3f, 40.0f);
-        marsModel.Draw(modelShader);
-
-        // Jupiter
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.6f, 360.0f, 4.0f, 30.0f);
-        jupiterModel.Draw(modelShader);
-
-        // Saturn  
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.5f, 430.0f, 0.032f, 20.0f, glm::vec3(0.0f, 0.5f, -0.35f));
-        model = get<0>(modelAndCoordinates);
-        model = glm::rotate(model, 61.0f, glm::vec3(0.0f, 0.1f, 0.0f));
-        model = glm::rotate(model, 90.0f, glm::vec3(0.1f, 0.0f, 0.0f));
-        glUniformMatrix4fv(glGetUniformLocation(modelShader.Program, "model"), 1, GL_FALSE, glm::value_ptr(model));
-        saturnModel.Draw(modelShader);
-
-        // Uranus
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.4f, 480.0f, 0.03f, 10.0f);
-        uranusModel.Draw(modelShader);
-
-        // Neptune
-        modelAndCoordinates = planetHelper.transformPlanetModel(modelShader, i, 0.3f, 530.0f, 0.03f, 10.0f);
-        neptuneModel.Draw(modelShader);
+        // Asteroids
+        profiler.Begin("belt draw");
+        if (asteroidBelt.visible) {
+            asteroidShader.Use();
+            glUniformMatrix4fv(glGetUniformLocation(asteroidShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(glGetUniformLocation(asteroidShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            glUniform3fv(glGetUniformLocation(asteroidShader.Program, "lightPositions"), 2, glm::value_ptr(lightPositions[0]));
+            glm::vec3 lightColors[2] = { glm::vec3(1.5f, 1.4f, 1.2f), glm::vec3(0.6f, 0.1f, 0.1f) };
+            glUniform3fv(glGetUniformLocation(asteroidShader.Program, "lightColors"), 2, glm::value_ptr(lightColors[0]));
+            asteroidBelt.Draw(asteroidShader, simTime);
+        }
+        profiler.Begin("satellites draw");
+        if (satellites.visible) {
+            asteroidShader.Use();
+            glUniformMatrix4fv(glGetUniformLocation(asteroidShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+            glUniformMatrix4fv(glGetUniformLocation(asteroidShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+            glUniform3fv(glGetUniformLocation(asteroidShader.Program, "lightPositions"), 2, glm::value_ptr(lightPositions[0]));
+            glm::vec3 lightColors[2] = { glm::vec3(1.5f, 1.4f, 1.2f), glm::vec3(0.6f, 0.1f, 0.1f) };
+            glUniform3fv(glGetUniformLocation(asteroidShader.Program, "lightColors"), 2, glm::value_ptr(lightColors[0]));
+            satellites.Draw(asteroidShader, simTime);
+        }
 
         //Orbit Lines
+        profiler.Begin("suns and lines");
         lineShader.Use();
         glUniformMatrix4fv(glGetUniformLocation(lineShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
         glUniformMatrix4fv(glGetUniformLocation(lineShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        planetHelper.DrawOrbitLines(lineShader);
+        planetHelper.DrawOrbitLines(lineShader, origin);
 
         // SUNS
         lampShader.Use();
@@ -219,31 +588,40 @@ int main()
         glUniformMatrix4fv(glGetUniformLocation(lampShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
 
         //Sun 1        
-        planetHelper.transformSunModel(lampShader, i, 0.01f, 0.0f, 0, 20.0f, 20.0f);
+        planetHelper.transformSunModel(lampShader, simTime, 0, 20.0f, 20.0f);
         sunModel1.Draw(lampShader);
 
         //Sun 2        
-        planetHelper.transformSunModel(lampShader, i, 0.01f, glm::pi<float>(), 1, 7.0f, 30.0f);
+        planetHelper.transformSunModel(lampShader, simTime, 1, 7.0f, 30.0f);
         sunModel2.Draw(lampShader);
 
         //over the sun
         if (cameraType == "Up") {
-            camera.SetPosition(glm::vec3(-3.0f, 85.0f, -5.0f));
+            camera.SetPosition(glm::dvec3(-3.0, 85.0, -5.0));
             camera.SetOrientation(0.0f, -88.0f);
         }    
 
         // Draw skybox
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix()));  // remove translation component
+        profiler.Begin("skybox");
+        view = camera.GetRotationMatrix();
         skybox.DrawSkybox(skyboxShader, cubemapTexture, view, projection);
-        
+
+        // Swap waits for the GPU, so its share is roughly the GPU time not hidden behind the CPU
+        profiler.Begin("swap");
         glfwSwapBuffers(window);
+        profiler.EndFrame();
         
     }
+    // GL objects go while the context still exists; the owners themselves outlive glfwTerminate
+    planetHelper.orbitPaths.Release();
+    asteroidBelt.Release();
+    satellites.Release();
     glfwTerminate();
     return 0;
 };
 
-void DoMovement(Planet &planetHelper) {
+void DoMovement(Planet &planetHelper, SimulationClock &clock, NBodySimulation &simulation, KeplerOrbits &keplerOrbits,
+    Ephemeris &ephemeris) {
 
     if (keys[GLFW_KEY_W]) {
         camera.ProcessKeyboard(FORWARD, deltaTime);
@@ -283,27 +661,218 @@ void DoMovement(Planet &planetHelper) {
         cameraType = "";
     }
     else if (keys[GLFW_KEY_3]) {
-        cameraType = "Earth";
+        cameraType = "Follow";
+    }
+    else if (keysPressed[GLFW_KEY_H]) {
+        neighboursRequested = true;
+    }
+    else if (keysPressed[GLFW_KEY_J]) {
+        eclipsesRequested = true;
     }
     else if (keys[GLFW_KEY_M]) {
-        planetHelper.speed += 0.01f;
-        std::cout << "SPEED : " << planetHelper.speed << std::endl;
+        clock.IncreaseTimeScale(0.1);
+        std::cout << "SPEED : " << clock.timeScale << std::endl;
     }
     else if (keys[GLFW_KEY_N]) {
-        planetHelper.speed -= 0.01f;
-        if (planetHelper.speed <= 0.0001f) {
-            planetHelper.speed = 0.001f;
-        }
-        std::cout << "SPEED : " << planetHelper.speed << std::endl;
+        clock.DecreaseTimeScale(0.1);
+        std::cout << "SPEED : " << clock.timeScale << std::endl;
     }
     else if (keys[GLFW_KEY_P]) {
-        planetHelper.move = !planetHelper.move;
+        clock.paused = !clock.paused;
         std::cout << "Pause/Unpaused movement" << std::endl;
     }
     else if (keys[GLFW_KEY_O]) {
         planetHelper.orbitLines = !planetHelper.orbitLines;
         std::cout << "Show/UnShow OrbitLines" << std::endl;
     }
+    else if (keysPressed[GLFW_KEY_I]) {
+        int next = (static_cast<int>(simulation.CurrentIntegrator().Kind()) + 1) % IntegratorKindCount;
+        simulation.SetIntegrator(static_cast<IntegratorKind>(next));
+        std::cout << "INTEGRATOR : " << simulation.CurrentIntegrator().Name() << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_B]) {
+        GravitySolver& current = simulation.Solver();
+        std::string name = current.Name();
+        if (name == "barnes-hut") {
+            simulation.SetSolver(std::unique_ptr<GravitySolver>(new FmmSolver(current.G, current.softening)));
+        }
+        else if (name == "fmm") {
+            simulation.SetSolver(std::unique_ptr<GravitySolver>(new DirectSummationSolver(current.G, current.softening)));
+        }
+        else {
+            simulation.SetSolver(std::unique_ptr<GravitySolver>(new BarnesHutSolver(current.G, current.softening)));
+        }
+        std::cout << "FORCES : " << simulation.Solver().Name() << std::endl;
+    }
+    else if ((keysPressed[GLFW_KEY_K] || keysPressed[GLFW_KEY_E] || keysPressed[GLFW_KEY_F9]) &&
+        (trajectoryRecorder.IsOpen() || playbackMode)) {
+        std::cout << "Stop trajectory recording (R) or playback (T) first" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_K] && ephemerisMode) {
+        std::cout << "Leave ephemeris mode (E) first" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_K]) {
+        // Entering fits two-body orbits to the current state; leaving hands the Kepler state back
+        // (an unbound body has no orbit, so then the fit fails and the run stays n-body)
+        if (keplerMode) {
+            planetHelper.applyKeplerOrbits(simulation, keplerOrbits, clock.Time());
+            keplerMode = false;
+        }
+        else {
+            simulation.time = clock.Time();
+            keplerMode = planetHelper.fitKeplerOrbits(simulation, keplerOrbits);
+        }
+        std::cout << "MOTION : " << (keplerMode ? "kepler" : "n-body") << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_E]) {
+        // Entering integrates the span once and writes the fit; leaving resumes the n-body run from it
+        if (keplerMode) {
+            std::cout << "Leave Kepler mode (K) first" << std::endl;
+        }
+        else if (ephemerisMode) {
+            for (size_t i = 0; i < simulation.bodies.Size(); ++i) {
+                glm::dvec3 position, velocity;
+                ephemeris.State(i, clock.Time(), position, velocity);
+                simulation.bodies.SetPosition(i, position);
+                simulation.bodies.SetVelocity(i, velocity);
+            }
+            simulation.time = clock.Time();
+            simulation.Invalidate();
+            ephemeris.Close();
+            ephemerisMode = false;
+            std::cout << "MOTION : n-body" << std::endl;
+        }
+        else {
+            simulation.time = clock.Time();
+            EphemerisStats stats;
+            if (EphemerisBuilder::Build(simulation, clock.fixedStep, ephemerisSettings, ephemerisPath, &stats) &&
+                ephemeris.Open(ephemerisPath)) {
+                ephemerisMode = true;
+                std::cout << "MOTION : ephemeris, t " << ephemeris.StartTime() << " to " << ephemeris.EndTime() << ", "
+                    << stats.bytes / 1024 << " KB, max error " << stats.maxError << std::endl;
+            }
+        }
+    }
+    else if (keysPressed[GLFW_KEY_C]) {
+        simulation.detectEncounters = !simulation.detectEncounters;
+        std::cout << "Encounter detection " << (simulation.detectEncounters ? "on" : "off") << " (closer than "
+            << simulation.collisions.encounterDistance << ")" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_L]) {
+        beltVisible = !beltVisible;
+        std::cout << "Show/UnShow asteroid belt (" << beltCount << " asteroids)" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_U]) {
+        satellitesVisible = !satellitesVisible;
+        std::cout << "Show/UnShow Earth satellites" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_G]) {
+        ConservationMonitor& conservation = simulation.conservation;
+        if (conservation.cadence > 0) {
+            conservation.cadence = 0;
+            conservation.CloseSeries();
+            std::cout << "Conservation diagnostics off (" << conservation.Samples() << " samples, "
+                << 1e3 * conservation.Seconds() << " ms)" << std::endl;
+        }
+        else if (conservation.OpenSeries(conservationPath)) {
+            conservation.cadence = conservationCadence;
+            conservation.Rebase();
+            reportedConservation = conservation.Samples();
+            std::cout << "Conservation diagnostics every " << conservationCadence << " steps to " << conservationPath
+                << std::endl;
+        }
+    }
+    else if (keysPressed[GLFW_KEY_F]) {
+        profiler.enabled = !profiler.enabled;
+        std::cout << "Frame cost report " << (profiler.enabled ? "on" : "off") << std::endl;
+    }
+    else if ((keysPressed[GLFW_KEY_F5] || keysPressed[GLFW_KEY_F9]) && (keplerMode || ephemerisMode)) {
+        std::cout << "Snapshots need n-body mode" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_F5]) {
+        if (snapshotWriter.Capture(simulation, clock, snapshotPath)) {
+            std::cout << "SNAPSHOT : t " << clock.Time() << ", " << snapshotWriter.Bytes() / 1024 << " KB to "
+                << snapshotPath << std::endl;
+        }
+    }
+    else if (keysPressed[GLFW_KEY_F9]) {
+        SnapshotReader reader;
+        if (reader.Open(snapshotPath)) {
+            // The scene refers to bodies by index, so only snapshots of the same scene fit
+            if (reader.Header().bodyCount != simulation.bodies.Size()) {
+                std::cout << "ERROR::SNAPSHOT::BODY_COUNT_MISMATCH " << reader.Header().bodyCount << std::endl;
+            }
+            else if (reader.Restore(simulation, clock)) {
+                std::cout << "SNAPSHOT : restored t " << clock.Time() << ", integrator "
+                    << simulation.CurrentIntegrator().Name() << std::endl;
+            }
+        }
+    }
+    else if ((keysPressed[GLFW_KEY_R] || keysPressed[GLFW_KEY_T]) && (keplerMode || ephemerisMode)) {
+        std::cout << "Trajectories need n-body mode" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_R] && playbackMode) {
+        std::cout << "Leave playback (T) first" << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_R]) {
+        // Records the current state, then one frame after every fixed step
+        if (trajectoryRecorder.IsOpen()) {
+            unsigned long long frames = trajectoryRecorder.Frames();
+            trajectoryRecorder.Close();
+            std::cout << "TRAJECTORY : " << frames << " frames, " << trajectoryRecorder.Bytes() / 1024 << " KB to "
+                << trajectoryPath << std::endl;
+        }
+        else if (trajectoryRecorder.Open(trajectoryPath, simulation.bodies.Size(), clock.Time(), clock.fixedStep,
+            trajectoryTolerance)) {
+            trajectoryRecorder.Record(simulation.bodies);
+            std::cout << "TRAJECTORY : recording to " << trajectoryPath << std::endl;
+        }
+    }
+    else if (keysPressed[GLFW_KEY_T]) {
+        // Playback leaves the n-body state alone, so leaving it resumes the live run
+        if (playbackMode) {
+            trajectoryPlayer.Close();
+            playbackMode = false;
+            std::cout << "MOTION : n-body" << std::endl;
+        }
+        else {
+            if (trajectoryRecorder.IsOpen()) {
+                trajectoryRecorder.Close();
+            }
+            if (trajectoryPlayer.Open(trajectoryPath)) {
+                if (trajectoryPlayer.BodyCount() != simulation.bodies.Size()) {
+                    std::cout << "ERROR::TRAJECTORY::BODY_COUNT_MISMATCH" << std::endl;
+                    trajectoryPlayer.Close();
+                }
+                else {
+                    playbackMode = true;
+                    playbackTime = trajectoryPlayer.StartTime();
+                    playbackDirection = 1.0;
+                    std::cout << "MOTION : playback, t " << trajectoryPlayer.StartTime() << " to "
+                        << trajectoryPlayer.EndTime() << std::endl;
+                }
+            }
+        }
+    }
+    else if (keysPressed[GLFW_KEY_V] && playbackMode) {
+        playbackDirection = -playbackDirection;
+        std::cout << "PLAYBACK : " << (playbackDirection > 0.0 ? "forward" : "reverse") << std::endl;
+    }
+    else if ((keysPressed[GLFW_KEY_LEFT_BRACKET] || keysPressed[GLFW_KEY_RIGHT_BRACKET]) && playbackMode) {
+        playbackTime += keysPressed[GLFW_KEY_RIGHT_BRACKET] ? seekStep : -seekStep;
+        playbackTime = std::max(trajectoryPlayer.StartTime(), std::min(playbackTime, trajectoryPlayer.EndTime()));
+        std::cout << "TIME : " << playbackTime << std::endl;
+    }
+    else if (keysPressed[GLFW_KEY_LEFT_BRACKET] || keysPressed[GLFW_KEY_RIGHT_BRACKET]) {
+        if (keplerMode || ephemerisMode) {
+            clock.Seek(clock.Time() + (keysPressed[GLFW_KEY_RIGHT_BRACKET] ? seekStep : -seekStep));
+            std::cout << "TIME : " << clock.Time() << std::endl;
+        }
+        else {
+            std::cout << "Seeking needs Kepler (K), ephemeris (E) or playback (T) mode" << std::endl;
+        }
+    }
+    std::fill(keysPressed, keysPressed + 1024, false);
 }
 
 void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
@@ -314,6 +883,7 @@ void KeyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
     if (key >= 0 && key < 1024) {
         if (action == GLFW_PRESS) {
             keys[key] = true;
+            keysPressed[key] = true;
         }
         else if (action == GLFW_RELEASE) {
             keys[key] = false;
@@ -337,6 +907,25 @@ void MouseCallback(GLFWwindow* window, double xPos, double yPos) {
     camera.ProcessMouseMovement(xOffset, yOffset);
 }
 
+// The cursor is captured for mouse look, so a click picks along the view direction (the crosshair)
+void MouseButtonCallback(GLFWwindow* window, int button, int action, int mode) {
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+        pickRequested = true;
+    }
+}
+
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
-}
\ No newline at end of file
+}
+// The scene's orbits are not to scale, so catalog distances are placed between the planets they lie
+// between: piecewise linear in log(a) through the planets' real and scene semi-major axes
+double CatalogAxisToScene(double au) {
+    const double planetAU[8] = { 0.387, 0.723, 1.0, 1.524, 5.203, 9.537, 19.19, 30.07 };
+    const double planetScene[8] = { 25.0, 27.0, 29.0, 31.0, 36.0, 43.0, 48.0, 53.0 };
+    int k = 0;
+    while (k < 6 && au > planetAU[k + 1]) {
+        ++k;
+    }
+    double f = std::log(au / planetAU[k]) / std::log(planetAU[k + 1] / planetAU[k]);
+    return std::max(1.0, planetScene[k] + f * (planetScene[k + 1] - planetScene[k]));
+}